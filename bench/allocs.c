@@ -0,0 +1,255 @@
+/*
+ * allocs.c — Steady-state heap allocation counter (LD_PRELOAD)
+ *
+ *     LD_PRELOAD=build/wlvideo-allocs.so wlvideo --benchmark video.mkv
+ *
+ * Interposes the glibc allocator entry points and avcodec_receive_frame().
+ * Every decoded frame is one tick; after WLVIDEO_ALLOC_WARMUP frames
+ * (default 120) each malloc, calloc, realloc and aligned allocation is
+ * counted and attributed to its call stack. At exit the allocations per
+ * frame are printed with the worst call sites and their backtraces, and
+ * the exit status becomes 3 if they exceed WLVIDEO_ALLOC_MAX (default 8).
+ *
+ * Counting pauses at end of stream and resumes on the next frame, so the
+ * seek of a looping run and the teardown after the last frame are not
+ * charged to the steady state. Per-frame work on other threads (FFmpeg
+ * frame threads, render threads) is included.
+ *
+ * glibc only: the real allocator is reached through __libc_malloc and
+ * friends, so nothing here allocates through the hooks themselves.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SITE_DEPTH  16
+#define MAX_SITES   4096
+#define SKIP_FRAMES 2       /* record() and the hook itself */
+#define DEFAULT_WARMUP 120
+#define DEFAULT_MAX    8.0
+#define DEFAULT_TOP    10
+
+/* FFERRTAG('E','O','F',' ') */
+#define AVERROR_EOF (-(int)('E' | ('O' << 8) | ('F' << 16) | ((unsigned)' ' << 24)))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+/* ================================
+ * Section: Call sites
+ * ================================ */
+
+typedef struct {
+    uint64_t hash;
+    int depth;
+    void *pc[SITE_DEPTH];
+    uint64_t count;
+    uint64_t bytes;
+} Site;
+
+static Site sites[MAX_SITES];
+static int site_lock;
+static uint64_t sites_dropped;
+
+static bool armed;
+static uint64_t frames, frames_counted;
+static uint64_t allocs, alloc_bytes;
+static uint64_t warmup = DEFAULT_WARMUP;
+static double max_per_frame = DEFAULT_MAX;
+static int top = DEFAULT_TOP;
+
+static __thread bool in_record;
+
+static void lock(void) {
+    while (__atomic_exchange_n(&site_lock, 1, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void unlock(void) {
+    __atomic_store_n(&site_lock, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t hash_stack(void **pc, int n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < n; i++) {
+        h ^= (uintptr_t)pc[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+static void record(size_t size) {
+    if (!__atomic_load_n(&armed, __ATOMIC_RELAXED) || in_record)
+        return;
+    in_record = true;
+
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+
+    void *pc[SITE_DEPTH + SKIP_FRAMES];
+    int n = backtrace(pc, SITE_DEPTH + SKIP_FRAMES) - SKIP_FRAMES;
+    if (n > 0) {
+        uint64_t h = hash_stack(pc + SKIP_FRAMES, n);
+        lock();
+        size_t i = h % MAX_SITES, probes = 0;
+        while (sites[i].hash && sites[i].hash != h && probes++ < MAX_SITES)
+            i = (i + 1) % MAX_SITES;
+        if (probes >= MAX_SITES) {
+            sites_dropped++;
+        } else {
+            Site *s = &sites[i];
+            if (!s->hash) {
+                s->hash = h;
+                s->depth = n;
+                memcpy(s->pc, pc + SKIP_FRAMES, n * sizeof(void *));
+            }
+            s->count++;
+            s->bytes += size;
+        }
+        unlock();
+    }
+    in_record = false;
+}
+
+/* ================================
+ * Section: Hooks
+ * ================================ */
+
+void *malloc(size_t size) {
+    record(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    record(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *reallocarray(void *ptr, size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, n * size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+void *memalign(size_t align, size_t size) {
+    record(size);
+    return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+    if (align < sizeof(void *) || (align & (align - 1)))
+        return EINVAL;
+    void *p = memalign(align, size);
+    if (!p && size) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void *valloc(size_t size) {
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+/* One tick per decoded frame; end of stream pauses counting */
+int avcodec_receive_frame(void *avctx, void *frame) {
+    static int (*real)(void *, void *);
+    if (!real) real = (int (*)(void *, void *))dlsym(RTLD_NEXT, "avcodec_receive_frame");
+    if (!real) abort();
+
+    int ret = real(avctx, frame);
+    if (ret == 0) {
+        uint64_t n = __atomic_add_fetch(&frames, 1, __ATOMIC_RELAXED);
+        if (n > warmup) {
+            __atomic_add_fetch(&frames_counted, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&armed, true, __ATOMIC_RELAXED);
+        }
+    } else if (ret == AVERROR_EOF) {
+        __atomic_store_n(&armed, false, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+/* ================================
+ * Section: Report
+ * ================================ */
+
+__attribute__((constructor))
+static void allocs_init(void) {
+    const char *s;
+    if ((s = getenv("WLVIDEO_ALLOC_WARMUP"))) warmup = strtoull(s, NULL, 10);
+    if ((s = getenv("WLVIDEO_ALLOC_MAX"))) max_per_frame = strtod(s, NULL);
+    if ((s = getenv("WLVIDEO_ALLOC_TOP"))) top = atoi(s);
+
+    /* The first backtrace() loads the unwinder, which allocates */
+    void *pc[1];
+    backtrace(pc, 1);
+}
+
+__attribute__((destructor))
+static void allocs_report(void) {
+    __atomic_store_n(&armed, false, __ATOMIC_RELAXED);
+    in_record = true;
+
+    if (frames_counted == 0) {
+        fprintf(stderr, "[allocs] only %lu frames, none past the %lu frame warm-up\n",
+                (unsigned long)frames, (unsigned long)warmup);
+        return;
+    }
+
+    double per_frame = (double)allocs / frames_counted;
+    fprintf(stderr, "[allocs] %lu frames after %lu warm-up: %lu allocations (%.2f/frame), "
+                    "%.1f KiB/frame\n",
+            (unsigned long)frames_counted, (unsigned long)warmup, (unsigned long)allocs,
+            per_frame, alloc_bytes / 1024.0 / frames_counted);
+    if (sites_dropped)
+        fprintf(stderr, "[allocs] %lu allocations from untracked sites (table full)\n",
+                (unsigned long)sites_dropped);
+
+    /* Worst sites first, selected in place: no allocating here */
+    for (int rank = 1; rank <= top; rank++) {
+        Site *worst = NULL;
+        for (int i = 0; i < MAX_SITES; i++)
+            if (sites[i].count && (!worst || sites[i].count > worst->count))
+                worst = &sites[i];
+        if (!worst) break;
+
+        fprintf(stderr, "[allocs] #%d: %lu allocations (%.2f/frame), %.1f KiB total\n", rank,
+                (unsigned long)worst->count, (double)worst->count / frames_counted,
+                worst->bytes / 1024.0);
+        fflush(stderr);
+        backtrace_symbols_fd(worst->pc, worst->depth, STDERR_FILENO);
+        worst->count = 0;
+    }
+
+    bool ok = per_frame <= max_per_frame;
+    fprintf(stderr, "[allocs] %s: %.2f allocations per frame, limit %.2f\n",
+            ok ? "PASS" : "FAIL", per_frame, max_per_frame);
+    fflush(stderr);
+    if (!ok) _exit(3);
+}
@@ -0,0 +1,62 @@
+#!/bin/bash
+# Check that playback allocates (almost) nothing per frame in steady state
+#
+# Usage: bench/allocs.sh <wlvideo> <wlvideo-allocs.so> [corpus dir]
+#
+# Runs wlvideo --benchmark on every 8-bit 1080p corpus clip (or CLIP)
+# with the allocation counter preloaded. The clips are made CORPUS_SECONDS
+# long (default 10) under <corpus dir>/allocs, so enough frames remain
+# after the warm-up. A clip fails when it averages more than
+# WLVIDEO_ALLOC_MAX heap allocations per decoded frame after warm-up; the
+# worst call sites are printed with backtraces. ALLOC_ARGS is passed to
+# wlvideo, e.g. ALLOC_ARGS=-n for software decode.
+#
+# The verdict comes from the counter's PASS/FAIL line, not the exit
+# status alone: a wlvideo error, or a run too short to count anything,
+# is reported as such and also fails the check.
+
+set -e
+
+USAGE="usage: $0 <wlvideo> <wlvideo-allocs.so> [corpus dir]"
+WLVIDEO="${1:?$USAGE}"
+PRELOAD="$(realpath "${2:?$USAGE}")"
+CORPUS="${3:-corpus}/allocs"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+if [ -n "$CLIP" ]; then
+    clips=("$CLIP")
+else
+    # 10-bit clips would not play: the software path takes 8-bit 4:2:0
+    CORPUS_SECONDS="${CORPUS_SECONDS:-10}" CORPUS_SIZES=1080p CORPUS_DEPTHS=8 \
+        "$HERE/gen-corpus.sh" "$CORPUS"
+    clips=("$CORPUS"/*-1080p-8bit.mkv)
+fi
+
+LOG="$(mktemp)"
+trap 'rm -f "$LOG"' EXIT
+
+over=0
+errors=0
+for clip in "${clips[@]}"; do
+    [ -e "$clip" ] || continue
+    echo "== $(basename "$clip")" >&2
+    status=0
+    # shellcheck disable=SC2086
+    LD_PRELOAD="$PRELOAD" "$WLVIDEO" --benchmark $ALLOC_ARGS "$clip" >/dev/null 2>"$LOG" || status=$?
+    cat "$LOG" >&2
+
+    # allocs.c exits 3 on FAIL, which also hides wlvideo's own status
+    if grep -q '^\[allocs\] FAIL:' "$LOG"; then
+        over=$((over + 1))
+        [ "$status" = 3 ] || echo "wlvideo also failed (exit $status)" >&2
+    elif [ "$status" != 0 ]; then
+        echo "wlvideo failed (exit $status)" >&2
+        errors=$((errors + 1))
+    elif ! grep -q '^\[allocs\] PASS:' "$LOG"; then
+        echo "no allocation count: the clip ended inside the warm-up" >&2
+        errors=$((errors + 1))
+    fi
+done
+
+echo "$over clip(s) over the allocation limit, $errors not measured" >&2
+[ "$over" = 0 ] && [ "$errors" = 0 ]
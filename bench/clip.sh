@@ -0,0 +1,31 @@
+#!/bin/bash
+# One meson benchmark(): make a corpus clip if needed and benchmark it
+#
+# Usage: bench/clip.sh <wlvideo> <results dir> <clip> [wlvideo options]
+#
+# <clip> is a corpus path (<dir>/<codec>-<size>-<depth>bit.mkv). The
+# options default to --benchmark. The JSON report is stored as
+# <results dir>/<name>.json, named after the clip and the mode, so
+# bench/compare.py can compare two builds, and echoed to stdout for
+# meson's log. Exits 77 (skipped) when the clip can't be encoded here.
+
+set -e
+
+WLVIDEO="${1:?usage: $0 <wlvideo> <results dir> <clip> [wlvideo options]}"
+RESULTS="${2:?usage: $0 <wlvideo> <results dir> <clip> [wlvideo options]}"
+CLIP="${3:?usage: $0 <wlvideo> <results dir> <clip> [wlvideo options]}"
+shift 3
+[ "$#" -gt 0 ] || set -- --benchmark
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+"$HERE/gen-corpus.sh" --clip "$CLIP" || exit $?
+
+name="$(basename "$CLIP" .mkv)"
+case "$*" in
+    *--benchmark=micro*) name="$name-micro" ;;
+esac
+mkdir -p "$RESULTS"
+
+"$WLVIDEO" "$@" "$CLIP" >"$RESULTS/$name.json.tmp" || { rm -f "$RESULTS/$name.json.tmp"; exit 1; }
+mv "$RESULTS/$name.json.tmp" "$RESULTS/$name.json"
+cat "$RESULTS/$name.json"
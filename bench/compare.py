@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Compare two directories of wlvideo --benchmark reports.
+
+Usage: bench/compare.py <baseline dir> <current dir> [--threshold PCT]
+
+Every clip present in both directories is compared metric by metric.
+A metric that got worse by more than the threshold (default 10%) is a
+regression; the exit status is 1 if there is any, so CI can gate on it.
+Timings below --floor milliseconds (default 0.05) are too noisy to judge.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+# (path into the report, True if higher is better)
+METRICS = [
+    (("fps",), True),
+    (("ttff_ms",), False),
+]
+for _stage in ("decode", "copy", "draw", "frame", "ring_init", "interleave", "upload"):
+    METRICS += [(("stages", _stage, "avg_ms"), False), (("stages", _stage, "p99_ms"), False)]
+for _stage in ("upload", "bind", "draw"):
+    METRICS += [(("gpu", _stage, "avg_ms"), False), (("gpu", _stage, "p99_ms"), False)]
+
+
+def lookup(report, path):
+    for key in path:
+        if not isinstance(report, dict) or report.get(key) is None:
+            return None
+        report = report[key]
+    return report
+
+
+def load(directory):
+    reports = {}
+    for name in sorted(os.listdir(directory)):
+        if not name.endswith(".json"):
+            continue
+        with open(os.path.join(directory, name)) as f:
+            try:
+                reports[name[:-5]] = json.load(f)
+            except json.JSONDecodeError as e:
+                print(f"warning: {name}: {e}", file=sys.stderr)
+    return reports
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("baseline")
+    ap.add_argument("current")
+    ap.add_argument("--threshold", type=float, default=10.0, help="regression threshold in percent")
+    ap.add_argument("--floor", type=float, default=0.05, help="ignore timings below this many ms")
+    args = ap.parse_args()
+
+    base, cur = load(args.baseline), load(args.current)
+    common = sorted(set(base) & set(cur))
+    for name in sorted(set(base) ^ set(cur)):
+        print(f"note: {name} only in {'baseline' if name in base else 'current'}")
+
+    regressions = 0
+    for clip in common:
+        for path, higher_better in METRICS:
+            old, new = lookup(base[clip], path), lookup(cur[clip], path)
+            if old is None or new is None or old <= 0:
+                continue
+            if not higher_better and max(old, new) < args.floor:
+                continue
+            change = (new - old) / old * 100.0
+            worse = -change if higher_better else change
+            if worse > args.threshold:
+                regressions += 1
+                mark = "REGRESSION"
+            elif worse < -args.threshold:
+                mark = "improved"
+            else:
+                continue
+            print(f"{mark:10} {clip:24} {'.'.join(path):22} {old:10.3f} -> {new:10.3f} ({change:+.1f}%)")
+
+    print(f"{len(common)} clips compared, {regressions} regressions over {args.threshold:g}%")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,121 @@
+#!/bin/bash
+# Synthesise the benchmark corpus with libavcodec's software encoders
+#
+# Usage: bench/gen-corpus.sh <dir>
+#        bench/gen-corpus.sh --clip <dir>/<codec>-<size>-<depth>bit.mkv
+#
+# One short clip per codec, resolution and bit depth. Encoders ffmpeg was
+# built without are skipped. Clips that already exist are kept, so
+# re-running is cheap. CORPUS_SECONDS sets the clip length (default 3),
+# CORPUS_SIZES the resolutions (default "720p 1080p 4k").
+#
+# CORPUS_DEPTHS defaults to "8": wlvideo's software path takes 8-bit
+# 4:2:0 (NV12, YUV420P, MJPEG's YUVJ420P) only, so 10-bit clips would
+# just fail to play. Set CORPUS_DEPTHS="8 10" to encode them anyway.
+#
+# --clip makes one clip, named as in the corpus, and exits 77 (skipped)
+# when ffmpeg or the encoder is missing; meson's benchmark() uses it.
+
+set -e
+
+CLIP=""
+if [ "$1" = --clip ]; then
+    CLIP="${2:?usage: $0 --clip <dir>/<codec>-<size>-<depth>bit.mkv}"
+    OUT="$(dirname "$CLIP")"
+else
+    OUT="${1:?usage: $0 <dir>}"
+fi
+SECONDS_LEN="${CORPUS_SECONDS:-3}"
+SIZES="${CORPUS_SIZES:-720p 1080p 4k}"
+DEPTHS="${CORPUS_DEPTHS:-8}"
+
+if ! command -v ffmpeg >/dev/null; then
+    echo "ffmpeg not found" >&2
+    [ -n "$CLIP" ] && exit 77
+    exit 1
+fi
+mkdir -p "$OUT"
+
+ENCODERS="$(ffmpeg -hide_banner -encoders 2>/dev/null)"
+have() { grep -q " $1 " <<<"$ENCODERS"; }
+
+AV1=""
+if have libsvtav1; then AV1="libsvtav1 -preset 12"
+elif have libaom-av1; then AV1="libaom-av1 -cpu-used 8 -usage realtime -row-mt 1"
+fi
+
+# codec name | encoder and speed options | 10-bit pixel format (empty = 8-bit only)
+CODECS=(
+    "h264|libx264 -preset ultrafast|yuv420p10le"
+    "hevc|libx265 -preset ultrafast -x265-params log-level=error|yuv420p10le"
+    "vp9|libvpx-vp9 -deadline realtime -cpu-used 8 -row-mt 1|yuv420p10le"
+    "av1|$AV1|yuv420p10le"
+    "mjpeg|mjpeg -q:v 3|"
+)
+
+size_of() {
+    case "$1" in
+        720p) echo 1280x720 ;;
+        1080p) echo 1920x1080 ;;
+        4k) echo 3840x2160 ;;
+        *) echo "unknown size $1" >&2; return 1 ;;
+    esac
+}
+
+# A single clip: its name selects codec, size and depth
+if [ -n "$CLIP" ]; then
+    base="$(basename "$CLIP" .mkv)"
+    found=""
+    IFS=- read -r want SIZES depth <<<"$base"
+    DEPTHS="${depth%bit}"
+    for entry in "${CODECS[@]}"; do
+        [ "${entry%%|*}" = "$want" ] && found="$entry"
+    done
+    [ -n "$found" ] || { echo "unknown codec in $base" >&2; exit 1; }
+    CODECS=("$found")
+fi
+
+made=0
+for entry in "${CODECS[@]}"; do
+    IFS='|' read -r name enc fmt10 <<<"$entry"
+    encoder="${enc%% *}"
+    if [ -z "$encoder" ] || ! have "$encoder"; then
+        echo "skip $name: no encoder" >&2
+        continue
+    fi
+
+    for size in $SIZES; do
+        dims="$(size_of "$size")"
+        for depth in $DEPTHS; do
+            if [ "$depth" = 10 ]; then
+                [ -n "$fmt10" ] || continue
+                pix="$fmt10"
+            elif [ "$name" = mjpeg ]; then
+                pix=yuvj420p
+            else
+                pix=yuv420p
+            fi
+
+            file="$OUT/$name-$size-${depth}bit.mkv"
+            [ -s "$file" ] && continue
+
+            echo "encode $(basename "$file")" >&2
+            # shellcheck disable=SC2086
+            if ffmpeg -hide_banner -loglevel error -y \
+                    -f lavfi -i "testsrc2=size=$dims:rate=30,format=$pix" -t "$SECONDS_LEN" \
+                    -c:v $enc -pix_fmt "$pix" "$file.tmp.mkv"; then
+                mv "$file.tmp.mkv" "$file"
+                made=$((made + 1))
+            else
+                rm -f "$file.tmp.mkv"
+                echo "skip $(basename "$file"): encoder refused $pix" >&2
+            fi
+        done
+    done
+done
+
+if [ -n "$CLIP" ]; then
+    [ -s "$CLIP" ] || exit 77
+    exit 0
+fi
+echo "Corpus in $OUT ($made new clips)" >&2
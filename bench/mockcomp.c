@@ -0,0 +1,1091 @@
+/*
+ * mockcomp.c — Minimal layer-shell compositor for driving wlvideo
+ *
+ * A headless Wayland server on libwayland-server that implements just what
+ * wlvideo binds: wl_compositor, wl_shm, linux-dmabuf (v3, buffers are
+ * accepted and released, never read), N wl_outputs and
+ * zwlr_layer_shell_v1. Each output has its own refresh timer that fires
+ * frame callbacks, so wlvideo's output state machine, surface recreation
+ * and multi-output pacing run exactly as on a real compositor.
+ *
+ * A script of timed events exercises the lifecycle paths:
+ *
+ *     # seconds  action  args
+ *     2.0  resize 0 1280x720     # mode change + layer configure
+ *     3.0  close 1               # layer_surface.closed on output 1
+ *     4.0  storm 20              # close every layer surface, and 19 replacements
+ *     5.0  unplug 0              # remove the wl_output global
+ *     5.5  replug 0              # bring output 0 back under the same name
+ *     6.0  plug 2560x1440@144    # hotplug a new output
+ *
+ * The client is started after `--` with WAYLAND_DISPLAY pointing at the
+ * mock. On exit a JSON report goes to stdout: per output, the commit rate
+ * and the latency from frame callback to the next buffer commit.
+ *
+ * No scanout and no pixels: subsurfaces and viewporter are not offered, so
+ * wlvideo takes its plain single-surface paths. EGL clients need a Mesa
+ * that can allocate without wl_drm, or LIBGL_ALWAYS_SOFTWARE=1 (wl_shm).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#include "wlr-layer-shell-unstable-v1-server-protocol.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+
+#define MAX_OUTPUTS    32
+#define MAX_EVENTS     4096
+#define LATENCY_CAP    65536
+#define STORM_INTERVAL 5    /* ms between rounds of a layer_closed storm */
+#define STORM_IDLE_MS  1000 /* A storm ends when no new layer shows up for this long */
+
+#define DRM_FORMAT_XRGB8888 0x34325258
+#define DRM_FORMAT_ARGB8888 0x34325241
+#define DRM_FORMAT_NV12     0x3231564e
+#define DRM_FORMAT_P010     0x30313050
+#define DRM_FORMAT_MOD_LINEAR 0ULL
+
+#define LOG(fmt, ...) do { if (verbose) fprintf(stderr, "[mockcomp] " fmt "\n", ##__VA_ARGS__); } while (0)
+#define ERR(fmt, ...) fprintf(stderr, "[mockcomp] " fmt "\n", ##__VA_ARGS__)
+
+/* ================================
+ * Section: Types
+ * ================================ */
+
+typedef struct Output {
+    int index;
+    char name[16];
+    int width, height;
+    int refresh_mhz;
+    struct wl_global *global;
+    struct wl_list resources;           /* wl_output resources */
+    struct wl_event_source *tick;
+    bool present;
+    uint64_t next_tick_ns;
+
+    /* Stats */
+    uint64_t commits;
+    uint64_t frames_done;
+    uint64_t configures;
+    uint64_t closes;
+    uint64_t first_commit_ns, last_commit_ns;
+    double *latency_ms;
+    size_t latency_count;
+    double latency_total;
+} Output;
+
+typedef struct Layer Layer;
+
+typedef struct {
+    struct wl_resource *resource;
+    struct wl_list link;                /* Server.surfaces */
+    struct wl_resource *pending_buffer;
+    struct wl_listener pending_buffer_destroy;
+    bool pending_attach;
+    struct wl_list pending_frames;      /* wl_callback resources */
+    struct wl_list frames;              /* committed, fired on next tick */
+    uint64_t done_ns;                   /* last frame callback, 0 once answered */
+    Layer *layer;
+} Surface;
+
+struct Layer {
+    struct wl_resource *resource;
+    struct wl_list link;                /* Server.layers */
+    Surface *surface;
+    Output *output;
+    uint32_t serial;
+    bool configured;
+    bool closed;
+};
+
+typedef enum { EV_RESIZE, EV_CLOSE, EV_STORM, EV_UNPLUG, EV_REPLUG, EV_PLUG } EventType;
+
+typedef struct {
+    double at;
+    EventType type;
+    int index;
+    int width, height, refresh_hz;
+    int count;
+} Event;
+
+typedef struct {
+    struct wl_display *display;
+    struct wl_event_loop *loop;
+    struct wl_event_source *script_timer;
+    struct wl_event_source *storm_timer;
+    struct wl_event_source *end_timer;
+
+    Output *outputs[MAX_OUTPUTS];
+    int output_count;
+    int default_w, default_h, default_hz;
+
+    struct wl_list surfaces;
+    struct wl_list layers;
+
+    Event events[MAX_EVENTS];
+    int event_count;
+    int next_event;
+    int storm_rounds;               /* Rounds left that must close something */
+    uint64_t storm_idle_ns;         /* Last round that found a layer to close */
+
+    uint64_t start_ns;
+    pid_t child;
+    int child_status;
+    bool child_exited;
+} Server;
+
+static Server server;
+static bool verbose;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ================================
+ * Section: Buffers
+ * ================================ */
+
+static void buffer_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static const struct wl_buffer_interface dmabuf_buffer_impl = {
+    .destroy = buffer_destroy,
+};
+
+/* linux-dmabuf params: planes are closed on arrival, any create succeeds */
+static void params_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static void params_add(struct wl_client *client, struct wl_resource *res, int32_t fd,
+                       uint32_t plane_idx, uint32_t offset, uint32_t stride,
+                       uint32_t modifier_hi, uint32_t modifier_lo) {
+    close(fd);
+}
+
+static struct wl_resource *create_dmabuf_buffer(struct wl_client *client, uint32_t id) {
+    struct wl_resource *buf = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if (!buf) {
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+    wl_resource_set_implementation(buf, &dmabuf_buffer_impl, NULL, NULL);
+    return buf;
+}
+
+static void params_create(struct wl_client *client, struct wl_resource *res, int32_t width,
+                          int32_t height, uint32_t format, uint32_t flags) {
+    struct wl_resource *buf = create_dmabuf_buffer(client, 0);
+    if (buf)
+        zwp_linux_buffer_params_v1_send_created(res, buf);
+}
+
+static void params_create_immed(struct wl_client *client, struct wl_resource *res, uint32_t buffer_id,
+                                int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+    create_dmabuf_buffer(client, buffer_id);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface params_impl = {
+    .destroy = params_destroy,
+    .add = params_add,
+    .create = params_create,
+    .create_immed = params_create_immed,
+};
+
+static void dmabuf_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static void dmabuf_create_params(struct wl_client *client, struct wl_resource *res, uint32_t id) {
+    struct wl_resource *params = wl_resource_create(client, &zwp_linux_buffer_params_v1_interface,
+                                                    wl_resource_get_version(res), id);
+    if (!params) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(params, &params_impl, NULL, NULL);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface dmabuf_impl = {
+    .destroy = dmabuf_destroy,
+    .create_params = dmabuf_create_params,
+};
+
+static void dmabuf_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    static const uint32_t formats[] = {
+        DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12, DRM_FORMAT_P010,
+    };
+    struct wl_resource *res = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(res, &dmabuf_impl, data, NULL);
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (version >= 3)
+            zwp_linux_dmabuf_v1_send_modifier(res, formats[i], DRM_FORMAT_MOD_LINEAR >> 32,
+                                              DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+        else
+            zwp_linux_dmabuf_v1_send_format(res, formats[i]);
+    }
+}
+
+/* ================================
+ * Section: Surfaces
+ * ================================ */
+
+static void callback_unlink(struct wl_resource *res) {
+    wl_list_remove(wl_resource_get_link(res));
+}
+
+static void release_callbacks(struct wl_list *list) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, list)
+        wl_resource_destroy(cb);
+}
+
+static void surface_set_pending(Surface *s, struct wl_resource *buffer) {
+    if (s->pending_buffer)
+        wl_list_remove(&s->pending_buffer_destroy.link);
+    s->pending_buffer = buffer;
+    if (buffer)
+        wl_resource_add_destroy_listener(buffer, &s->pending_buffer_destroy);
+}
+
+static void pending_buffer_destroyed(struct wl_listener *listener, void *data) {
+    Surface *s = wl_container_of(listener, s, pending_buffer_destroy);
+    wl_list_remove(&s->pending_buffer_destroy.link);
+    s->pending_buffer = NULL;
+}
+
+static void surface_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *res,
+                           struct wl_resource *buffer, int32_t x, int32_t y) {
+    Surface *s = wl_resource_get_user_data(res);
+    surface_set_pending(s, buffer);
+    s->pending_attach = true;
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *res,
+                           int32_t x, int32_t y, int32_t w, int32_t h) {
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *res, uint32_t id) {
+    Surface *s = wl_resource_get_user_data(res);
+    struct wl_resource *cb = wl_resource_create(client, &wl_callback_interface, 1, id);
+    if (!cb) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(cb, NULL, NULL, callback_unlink);
+    wl_list_insert(s->pending_frames.prev, wl_resource_get_link(cb));
+}
+
+static void surface_set_region(struct wl_client *client, struct wl_resource *res,
+                               struct wl_resource *region) {
+}
+
+static void layer_send_configure(Layer *l);
+
+static void surface_commit(struct wl_client *client, struct wl_resource *res) {
+    Surface *s = wl_resource_get_user_data(res);
+    uint64_t now = now_ns();
+
+    wl_list_insert_list(s->frames.prev, &s->pending_frames);
+    wl_list_init(&s->pending_frames);
+
+    Layer *l = s->layer;
+    if (s->pending_attach && s->pending_buffer) {
+        /* Nothing is composited: the buffer is free as soon as it lands */
+        wl_buffer_send_release(s->pending_buffer);
+        if (l && l->output && !l->closed) {
+            Output *o = l->output;
+            if (!o->first_commit_ns) o->first_commit_ns = now;
+            o->last_commit_ns = now;
+            o->commits++;
+            if (s->done_ns) {
+                double ms = (now - s->done_ns) / 1e6;
+                if (o->latency_count < LATENCY_CAP)
+                    o->latency_ms[o->latency_count++] = ms;
+                o->latency_total += ms;
+                s->done_ns = 0;
+            }
+        }
+    }
+    surface_set_pending(s, NULL);
+    s->pending_attach = false;
+
+    /* The initial bufferless commit of a layer surface asks for a configure */
+    if (l && !l->configured && !l->closed)
+        layer_send_configure(l);
+}
+
+static void surface_set_buffer_transform(struct wl_client *client, struct wl_resource *res,
+                                         int32_t transform) {
+}
+
+static void surface_set_buffer_scale(struct wl_client *client, struct wl_resource *res, int32_t scale) {
+}
+
+static const struct wl_surface_interface surface_impl = {
+    .destroy = surface_destroy,
+    .attach = surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_region,
+    .set_input_region = surface_set_region,
+    .commit = surface_commit,
+    .set_buffer_transform = surface_set_buffer_transform,
+    .set_buffer_scale = surface_set_buffer_scale,
+    .damage_buffer = surface_damage,
+};
+
+static void surface_resource_destroy(struct wl_resource *res) {
+    Surface *s = wl_resource_get_user_data(res);
+    if (s->layer)
+        s->layer->surface = NULL;
+    surface_set_pending(s, NULL);
+    release_callbacks(&s->pending_frames);
+    release_callbacks(&s->frames);
+    wl_list_remove(&s->link);
+    free(s);
+}
+
+static void region_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static void region_op(struct wl_client *client, struct wl_resource *res,
+                      int32_t x, int32_t y, int32_t w, int32_t h) {
+}
+
+static const struct wl_region_interface region_impl = {
+    .destroy = region_destroy,
+    .add = region_op,
+    .subtract = region_op,
+};
+
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *res, uint32_t id) {
+    Server *srv = wl_resource_get_user_data(res);
+    Surface *s = calloc(1, sizeof(Surface));
+    if (!s) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    s->resource = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(res), id);
+    if (!s->resource) {
+        free(s);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_list_init(&s->pending_frames);
+    wl_list_init(&s->frames);
+    s->pending_buffer_destroy.notify = pending_buffer_destroyed;
+    wl_list_insert(&srv->surfaces, &s->link);
+    wl_resource_set_implementation(s->resource, &surface_impl, s, surface_resource_destroy);
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *res, uint32_t id) {
+    struct wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    .create_surface = compositor_create_surface,
+    .create_region = compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *res = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(res, &compositor_impl, data, NULL);
+}
+
+/* ================================
+ * Section: Layer shell
+ * ================================ */
+
+static void layer_send_configure(Layer *l) {
+    Output *o = l->output;
+    l->serial++;
+    l->configured = true;
+    o->configures++;
+    zwlr_layer_surface_v1_send_configure(l->resource, l->serial, o->width, o->height);
+}
+
+static void layer_close(Layer *l) {
+    if (l->closed) return;
+    l->closed = true;
+    if (l->output) l->output->closes++;
+    zwlr_layer_surface_v1_send_closed(l->resource);
+}
+
+static void layer_set_size(struct wl_client *client, struct wl_resource *res, uint32_t w, uint32_t h) {
+}
+
+static void layer_set_anchor(struct wl_client *client, struct wl_resource *res, uint32_t anchor) {
+}
+
+static void layer_set_exclusive_zone(struct wl_client *client, struct wl_resource *res, int32_t zone) {
+}
+
+static void layer_set_margin(struct wl_client *client, struct wl_resource *res,
+                             int32_t top, int32_t right, int32_t bottom, int32_t left) {
+}
+
+static void layer_set_keyboard_interactivity(struct wl_client *client, struct wl_resource *res,
+                                             uint32_t ki) {
+}
+
+static void layer_get_popup(struct wl_client *client, struct wl_resource *res, struct wl_resource *popup) {
+}
+
+static void layer_ack_configure(struct wl_client *client, struct wl_resource *res, uint32_t serial) {
+}
+
+static void layer_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_impl = {
+    .set_size = layer_set_size,
+    .set_anchor = layer_set_anchor,
+    .set_exclusive_zone = layer_set_exclusive_zone,
+    .set_margin = layer_set_margin,
+    .set_keyboard_interactivity = layer_set_keyboard_interactivity,
+    .get_popup = layer_get_popup,
+    .ack_configure = layer_ack_configure,
+    .destroy = layer_destroy,
+};
+
+static void layer_resource_destroy(struct wl_resource *res) {
+    Layer *l = wl_resource_get_user_data(res);
+    if (l->surface)
+        l->surface->layer = NULL;
+    wl_list_remove(&l->link);
+    free(l);
+}
+
+static void shell_get_layer_surface(struct wl_client *client, struct wl_resource *res, uint32_t id,
+                                    struct wl_resource *surface, struct wl_resource *output,
+                                    uint32_t layer, const char *namespace) {
+    Server *srv = wl_resource_get_user_data(res);
+    Surface *s = wl_resource_get_user_data(surface);
+
+    /*
+     * No output: the compositor picks, here the first one present. A named
+     * output that was unplugged has lost its user data and gets closed.
+     */
+    Output *o = NULL;
+    if (output) {
+        o = wl_resource_get_user_data(output);
+    } else {
+        for (int i = 0; !o && i < srv->output_count; i++)
+            if (srv->outputs[i]->present) o = srv->outputs[i];
+    }
+
+    Layer *l = calloc(1, sizeof(Layer));
+    if (!l) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    l->resource = wl_resource_create(client, &zwlr_layer_surface_v1_interface,
+                                     wl_resource_get_version(res), id);
+    if (!l->resource) {
+        free(l);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    l->surface = s;
+    l->output = o;
+    s->layer = l;
+    wl_list_insert(&srv->layers, &l->link);
+    wl_resource_set_implementation(l->resource, &layer_impl, l, layer_resource_destroy);
+    LOG("layer surface '%s' on %s", namespace, o ? o->name : "(none)");
+
+    /* Output gone (or never there): the protocol answers with closed */
+    if (!o || !o->present)
+        layer_close(l);
+}
+
+static void shell_destroy(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static const struct zwlr_layer_shell_v1_interface shell_impl = {
+    .get_layer_surface = shell_get_layer_surface,
+    .destroy = shell_destroy,
+};
+
+static void shell_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *res = wl_resource_create(client, &zwlr_layer_shell_v1_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(res, &shell_impl, data, NULL);
+}
+
+/* ================================
+ * Section: Outputs
+ * ================================ */
+
+static void output_send_state(Output *o, struct wl_resource *res) {
+    int version = wl_resource_get_version(res);
+    wl_output_send_geometry(res, 0, 0, o->width * 254 / 960, o->height * 254 / 960,
+                            WL_OUTPUT_SUBPIXEL_UNKNOWN, "wlvideo", "mockcomp", WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(res, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                        o->width, o->height, o->refresh_mhz);
+    if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+        wl_output_send_scale(res, 1);
+    if (version >= WL_OUTPUT_NAME_SINCE_VERSION)
+        wl_output_send_name(res, o->name);
+    if (version >= WL_OUTPUT_DESCRIPTION_SINCE_VERSION)
+        wl_output_send_description(res, "mock output");
+    if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+        wl_output_send_done(res);
+}
+
+static void output_release(struct wl_client *client, struct wl_resource *res) {
+    wl_resource_destroy(res);
+}
+
+static const struct wl_output_interface output_impl = {
+    .release = output_release,
+};
+
+static void output_resource_destroy(struct wl_resource *res) {
+    wl_list_remove(wl_resource_get_link(res));
+}
+
+static void output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    Output *o = data;
+    struct wl_resource *res = wl_resource_create(client, &wl_output_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(res, &output_impl, o, output_resource_destroy);
+    wl_list_insert(&o->resources, wl_resource_get_link(res));
+    output_send_state(o, res);
+}
+
+/* Fire the frame callbacks of every surface on this output, then re-arm
+ * against an absolute schedule so the rate does not drift with ms rounding */
+static int output_tick(void *data) {
+    Output *o = data;
+    uint64_t now = now_ns();
+    uint32_t ms = (uint32_t)(now / 1000000);
+
+    Layer *l;
+    wl_list_for_each(l, &server.layers, link) {
+        if (l->output != o || !l->surface || wl_list_empty(&l->surface->frames))
+            continue;
+        struct wl_resource *cb, *tmp;
+        wl_resource_for_each_safe(cb, tmp, &l->surface->frames) {
+            wl_callback_send_done(cb, ms);
+            wl_resource_destroy(cb);
+        }
+        if (!l->surface->done_ns)
+            l->surface->done_ns = now;
+        o->frames_done++;
+    }
+
+    uint64_t period = 1000000000000ULL / o->refresh_mhz;
+    o->next_tick_ns += period;
+    if (o->next_tick_ns <= now)
+        o->next_tick_ns = now + period;
+    wl_event_source_timer_update(o->tick, (int)((o->next_tick_ns - now + 999999) / 1000000));
+    return 0;
+}
+
+/* Advertise the output and start its refresh timer */
+static int output_publish(Server *srv, Output *o) {
+    o->global = wl_global_create(srv->display, &wl_output_interface, 4, o, output_bind);
+    o->tick = wl_event_loop_add_timer(srv->loop, output_tick, o);
+    if (!o->global || !o->tick) {
+        ERR("failed to create output %s", o->name);
+        if (o->global) wl_global_destroy(o->global);
+        if (o->tick) wl_event_source_remove(o->tick);
+        o->global = NULL;
+        o->tick = NULL;
+        return -1;
+    }
+    o->present = true;
+    o->next_tick_ns = now_ns();
+    wl_event_source_timer_update(o->tick, 1);
+    return 0;
+}
+
+static Output *output_add(Server *srv, int w, int h, int hz) {
+    if (srv->output_count == MAX_OUTPUTS) {
+        ERR("too many outputs (max %d)", MAX_OUTPUTS);
+        return NULL;
+    }
+    Output *o = calloc(1, sizeof(Output));
+    if (!o) return NULL;
+    o->latency_ms = malloc(LATENCY_CAP * sizeof(double));
+    if (!o->latency_ms) {
+        free(o);
+        return NULL;
+    }
+    o->index = srv->output_count;
+    snprintf(o->name, sizeof(o->name), "MOCK-%d", o->index + 1);
+    o->width = w;
+    o->height = h;
+    o->refresh_mhz = hz * 1000;
+    wl_list_init(&o->resources);
+
+    if (output_publish(srv, o) < 0) {
+        free(o->latency_ms);
+        free(o);
+        return NULL;
+    }
+    srv->outputs[srv->output_count++] = o;
+    LOG("output %s %dx%d@%d", o->name, w, h, hz);
+    return o;
+}
+
+static void output_remove(Server *srv, Output *o) {
+    if (!o->present) return;
+    o->present = false;
+
+    Layer *l;
+    wl_list_for_each(l, &srv->layers, link)
+        if (l->output == o) layer_close(l);
+
+    /* Detach the bound resources so late requests naming it see no output */
+    struct wl_resource *res, *tmp;
+    wl_resource_for_each_safe(res, tmp, &o->resources) {
+        wl_list_remove(wl_resource_get_link(res));
+        wl_list_init(wl_resource_get_link(res));
+        wl_resource_set_user_data(res, NULL);
+    }
+    wl_global_destroy(o->global);
+    o->global = NULL;
+    wl_event_source_remove(o->tick);
+    o->tick = NULL;
+    LOG("output %s unplugged", o->name);
+}
+
+static void output_resize(Server *srv, Output *o, int w, int h) {
+    if (!o->present) return;
+    o->width = w;
+    o->height = h;
+    struct wl_resource *res;
+    wl_resource_for_each(res, &o->resources)
+        output_send_state(o, res);
+
+    Layer *l;
+    wl_list_for_each(l, &srv->layers, link)
+        if (l->output == o && l->configured && !l->closed)
+            layer_send_configure(l);
+    LOG("output %s resized to %dx%d", o->name, w, h);
+}
+
+/* ================================
+ * Section: Script
+ * ================================ */
+
+static bool parse_mode(const char *s, int *w, int *h, int *hz) {
+    *hz = server.default_hz;
+    int n = sscanf(s, "%dx%d@%d", w, h, hz);
+    return n >= 2 && *w > 0 && *h > 0 && *hz > 0;
+}
+
+static int load_script(Server *srv, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        ERR("%s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        double at;
+        char action[16], arg1[64] = "", arg2[64] = "";
+        int n = sscanf(line, "%lf %15s %63s %63s", &at, action, arg1, arg2);
+        if (n <= 0) continue;
+        if (n < 2 || srv->event_count == MAX_EVENTS)
+            goto bad;
+
+        Event *ev = &srv->events[srv->event_count];
+        *ev = (Event){ .at = at, .index = atoi(arg1) };
+        if (!strcmp(action, "resize")) {
+            ev->type = EV_RESIZE;
+            if (n < 4 || !parse_mode(arg2, &ev->width, &ev->height, &ev->refresh_hz)) goto bad;
+        } else if (!strcmp(action, "close")) {
+            ev->type = EV_CLOSE;
+            if (n < 3) goto bad;
+        } else if (!strcmp(action, "storm")) {
+            ev->type = EV_STORM;
+            ev->count = n >= 3 ? atoi(arg1) : 1;
+            if (ev->count < 1) goto bad;
+        } else if (!strcmp(action, "unplug")) {
+            ev->type = EV_UNPLUG;
+            if (n < 3) goto bad;
+        } else if (!strcmp(action, "replug")) {
+            ev->type = EV_REPLUG;
+            if (n < 3) goto bad;
+        } else if (!strcmp(action, "plug")) {
+            ev->type = EV_PLUG;
+            ev->width = srv->default_w;
+            ev->height = srv->default_h;
+            ev->refresh_hz = srv->default_hz;
+            if (n >= 3 && !parse_mode(arg1, &ev->width, &ev->height, &ev->refresh_hz)) goto bad;
+        } else {
+            goto bad;
+        }
+        srv->event_count++;
+        continue;
+bad:
+        ERR("%s:%d: bad event", path, lineno);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    /* Stable by time, so same-time events keep file order */
+    for (int i = 1; i < srv->event_count; i++) {
+        Event ev = srv->events[i];
+        int j = i;
+        for (; j > 0 && srv->events[j - 1].at > ev.at; j--)
+            srv->events[j] = srv->events[j - 1];
+        srv->events[j] = ev;
+    }
+    return 0;
+}
+
+static Output *script_output(Server *srv, int index) {
+    if (index < 0 || index >= srv->output_count || !srv->outputs[index]->present) {
+        ERR("script: no output %d", index);
+        return NULL;
+    }
+    return srv->outputs[index];
+}
+
+/*
+ * One round closes every open layer surface. A closed surface stays closed,
+ * so only rounds that found one count: the storm keeps polling every
+ * STORM_INTERVAL and closes each replacement the client creates, COUNT
+ * rounds in all, until STORM_IDLE_MS pass without a new layer surface.
+ */
+static int storm_round(void *data) {
+    Server *srv = data;
+    Layer *l;
+    bool closed = false;
+    wl_list_for_each(l, &srv->layers, link) {
+        if (!l->closed) {
+            layer_close(l);
+            closed = true;
+        }
+    }
+
+    uint64_t now = now_ns();
+    if (closed) {
+        srv->storm_rounds--;
+        srv->storm_idle_ns = now;
+    } else if (now - srv->storm_idle_ns > (uint64_t)STORM_IDLE_MS * 1000000) {
+        LOG("layer_closed storm ends with %d rounds unused", srv->storm_rounds);
+        srv->storm_rounds = 0;
+    }
+    if (srv->storm_rounds > 0)
+        wl_event_source_timer_update(srv->storm_timer, STORM_INTERVAL);
+    return 0;
+}
+
+static void arm_script(Server *srv) {
+    if (srv->next_event >= srv->event_count) return;
+    double elapsed_ms = (now_ns() - srv->start_ns) / 1e6;
+    double due = srv->events[srv->next_event].at * 1e3 - elapsed_ms;
+    wl_event_source_timer_update(srv->script_timer, due < 1 ? 1 : (int)(due + 0.5));
+}
+
+static int script_fire(void *data) {
+    Server *srv = data;
+    double elapsed = (now_ns() - srv->start_ns) / 1e9;
+
+    while (srv->next_event < srv->event_count && srv->events[srv->next_event].at <= elapsed + 0.0005) {
+        Event *ev = &srv->events[srv->next_event++];
+        Output *o;
+        Layer *l;
+        switch (ev->type) {
+        case EV_RESIZE:
+            if ((o = script_output(srv, ev->index))) {
+                o->refresh_mhz = ev->refresh_hz * 1000;
+                output_resize(srv, o, ev->width, ev->height);
+            }
+            break;
+        case EV_CLOSE:
+            if ((o = script_output(srv, ev->index)))
+                wl_list_for_each(l, &srv->layers, link)
+                    if (l->output == o) layer_close(l);
+            break;
+        case EV_STORM:
+            LOG("layer_closed storm, %d rounds", ev->count);
+            srv->storm_rounds = ev->count;
+            srv->storm_idle_ns = now_ns();
+            storm_round(srv);
+            break;
+        case EV_UNPLUG:
+            if ((o = script_output(srv, ev->index)))
+                output_remove(srv, o);
+            break;
+        case EV_REPLUG:
+            /* Same name and stats, new global: a monitor power cycle */
+            if (ev->index >= 0 && ev->index < srv->output_count && !srv->outputs[ev->index]->present) {
+                o = srv->outputs[ev->index];
+                if (output_publish(srv, o) == 0)
+                    LOG("output %s replugged", o->name);
+            } else {
+                ERR("script: output %d is not unplugged", ev->index);
+            }
+            break;
+        case EV_PLUG:
+            output_add(srv, ev->width, ev->height, ev->refresh_hz);
+            break;
+        }
+    }
+    arm_script(srv);
+    return 0;
+}
+
+/* ================================
+ * Section: Report
+ * ================================ */
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void write_report(Server *srv, FILE *f) {
+    double wall = (now_ns() - srv->start_ns) / 1e9;
+    double total_rate = 0;
+
+    fprintf(f, "{\n  \"outputs\": %d,\n  \"wall_s\": %.3f,\n  \"per_output\": [", srv->output_count, wall);
+    for (int i = 0; i < srv->output_count; i++) {
+        Output *o = srv->outputs[i];
+        double span = o->commits > 1 ? (o->last_commit_ns - o->first_commit_ns) / 1e9 : 0;
+        double rate = span > 0 ? (o->commits - 1) / span : 0;
+        total_rate += rate;
+
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"mode\": \"%dx%d@%.3f\", \"present\": %s, "
+                   "\"commits\": %lu, \"frames_done\": %lu, \"commit_hz\": %.2f, "
+                   "\"configures\": %lu, \"closed\": %lu, \"latency_ms\": ",
+                i ? "," : "", o->name, o->width, o->height, o->refresh_mhz / 1000.0,
+                o->present ? "true" : "false", (unsigned long)o->commits,
+                (unsigned long)o->frames_done, rate, (unsigned long)o->configures,
+                (unsigned long)o->closes);
+        if (o->latency_count == 0) {
+            fputs("null}", f);
+            continue;
+        }
+        qsort(o->latency_ms, o->latency_count, sizeof(double), cmp_double);
+        size_t p50 = (o->latency_count * 50 + 99) / 100, p99 = (o->latency_count * 99 + 99) / 100;
+        fprintf(f, "{\"avg\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+                o->latency_total / o->latency_count, o->latency_ms[p50 ? p50 - 1 : 0],
+                o->latency_ms[p99 ? p99 - 1 : 0], o->latency_ms[o->latency_count - 1]);
+    }
+    fprintf(f, "\n  ],\n  \"total_commit_hz\": %.2f", total_rate);
+    if (srv->child_exited)
+        fprintf(f, ",\n  \"client_exit\": %d", WIFEXITED(srv->child_status) ?
+                WEXITSTATUS(srv->child_status) : 128 + WTERMSIG(srv->child_status));
+    fprintf(f, "\n}\n");
+    fflush(f);
+}
+
+/* ================================
+ * Section: Main
+ * ================================ */
+
+static int on_end(void *data) {
+    Server *srv = data;
+    wl_display_terminate(srv->display);
+    return 0;
+}
+
+static int on_signal(int sig, void *data) {
+    Server *srv = data;
+    if (sig == SIGCHLD) {
+        int status;
+        if (waitpid(srv->child, &status, WNOHANG) != srv->child)
+            return 0;
+        srv->child_status = status;
+        srv->child_exited = true;
+        LOG("client exited");
+    }
+    wl_display_terminate(srv->display);
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS] -- CLIENT [ARGS...]\n\n", prog);
+    printf("Options:\n");
+    printf("  -o, --outputs N      Number of outputs (default: 1)\n");
+    printf("  -m, --mode WxH[@HZ]  Output mode (default: 1920x1080@60)\n");
+    printf("  -d, --duration SEC   Stop after SEC seconds (default: until the client exits)\n");
+    printf("  -s, --script FILE    Timed events: resize, close, storm, unplug, replug, plug\n");
+    printf("  -v, --verbose        Log protocol events to stderr\n");
+    printf("  -h, --help           Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    static struct option long_opts[] = {
+        {"outputs",  required_argument, 0, 'o'},
+        {"mode",     required_argument, 0, 'm'},
+        {"duration", required_argument, 0, 'd'},
+        {"script",   required_argument, 0, 's'},
+        {"verbose",  no_argument,       0, 'v'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    Server *srv = &server;
+    int outputs = 1;
+    double duration = 0;
+    const char *script = NULL;
+    srv->default_w = 1920;
+    srv->default_h = 1080;
+    srv->default_hz = 60;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+o:m:d:s:vh", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            outputs = atoi(optarg);
+            if (outputs < 0 || outputs > MAX_OUTPUTS) {
+                ERR("--outputs must be 0-%d", MAX_OUTPUTS);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (!parse_mode(optarg, &srv->default_w, &srv->default_h, &srv->default_hz)) {
+                ERR("bad mode '%s'", optarg);
+                return 1;
+            }
+            break;
+        case 'd': duration = atof(optarg); break;
+        case 's': script = optarg; break;
+        case 'v': verbose = true; break;
+        case 'h': print_usage(argv[0]); return 0;
+        default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (script && load_script(srv, script) < 0)
+        return 1;
+
+    int ret = 1;
+    wl_list_init(&srv->surfaces);
+    wl_list_init(&srv->layers);
+    srv->display = wl_display_create();
+    if (!srv->display) {
+        ERR("wl_display_create failed");
+        return 1;
+    }
+    srv->loop = wl_display_get_event_loop(srv->display);
+
+    const char *sock_name = wl_display_add_socket_auto(srv->display);
+    if (!sock_name) {
+        ERR("failed to add a Wayland socket");
+        goto fail;
+    }
+    if (wl_display_init_shm(srv->display) < 0 ||
+        !wl_global_create(srv->display, &wl_compositor_interface, 4, srv, compositor_bind) ||
+        !wl_global_create(srv->display, &zwlr_layer_shell_v1_interface, 1, srv, shell_bind) ||
+        !wl_global_create(srv->display, &zwp_linux_dmabuf_v1_interface, 3, srv, dmabuf_bind)) {
+        ERR("failed to create globals");
+        goto fail;
+    }
+    for (int i = 0; i < outputs; i++)
+        if (!output_add(srv, srv->default_w, srv->default_h, srv->default_hz))
+            goto fail;
+
+    /* Signals go through the loop's signalfd; SIGCHLD before the client can exit */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    wl_event_loop_add_signal(srv->loop, SIGCHLD, on_signal, srv);
+    wl_event_loop_add_signal(srv->loop, SIGINT, on_signal, srv);
+    wl_event_loop_add_signal(srv->loop, SIGTERM, on_signal, srv);
+
+    srv->child = fork();
+    if (srv->child < 0) {
+        ERR("fork: %s", strerror(errno));
+        goto fail;
+    }
+    if (srv->child == 0) {
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        setenv("WAYLAND_DISPLAY", sock_name, 1);
+        unsetenv("WAYLAND_SOCKET");
+        /* The report owns stdout */
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        execvp(argv[optind], argv + optind);
+        fprintf(stderr, "[mockcomp] exec %s: %s\n", argv[optind], strerror(errno));
+        _exit(127);
+    }
+    LOG("%s: %d output(s), client pid %d", sock_name, outputs, (int)srv->child);
+
+    srv->start_ns = now_ns();
+    srv->script_timer = wl_event_loop_add_timer(srv->loop, script_fire, srv);
+    srv->storm_timer = wl_event_loop_add_timer(srv->loop, storm_round, srv);
+    arm_script(srv);
+    if (duration > 0) {
+        srv->end_timer = wl_event_loop_add_timer(srv->loop, on_end, srv);
+        wl_event_source_timer_update(srv->end_timer, (int)(duration * 1e3));
+    }
+
+    wl_display_run(srv->display);
+    write_report(srv, stdout);
+
+    if (!srv->child_exited) {
+        kill(srv->child, SIGTERM);
+        waitpid(srv->child, &srv->child_status, 0);
+    }
+    ret = 0;
+
+fail:
+    wl_display_destroy_clients(srv->display);
+    wl_display_destroy(srv->display);
+    for (int i = 0; i < srv->output_count; i++) {
+        free(srv->outputs[i]->latency_ms);
+        free(srv->outputs[i]);
+    }
+    return ret;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Run wlvideo under the mock compositor with a growing number of outputs
+#
+# Usage: bench/outputs.sh <mockcomp> <wlvideo> <results dir> [corpus dir]
+#
+# One report per output count (OUTPUT_COUNTS, default "1 2 4 8") with the
+# per-output commit rate and frame-callback-to-commit latency. The clip is
+# CLIP, or the 1080p h264 clip from the corpus. WLVIDEO_ARGS is passed to
+# wlvideo (default: --backend shm, which needs no GPU), MOCK_ARGS to the
+# mock, e.g. MOCK_ARGS="--script bench/lifecycle.script".
+
+set -e
+
+USAGE="usage: $0 <mockcomp> <wlvideo> <results dir> [corpus dir]"
+MOCKCOMP="${1:?$USAGE}"
+WLVIDEO="${2:?$USAGE}"
+RESULTS="${3:?$USAGE}"
+CORPUS="${4:-$(dirname "$RESULTS")/corpus}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+DURATION="${DURATION:-10}"
+WLVIDEO_ARGS="${WLVIDEO_ARGS---backend shm}"
+
+if [ -z "$CLIP" ]; then
+    CORPUS_SIZES="${CORPUS_SIZES:-1080p}" "$HERE/gen-corpus.sh" "$CORPUS"
+    CLIP="$CORPUS/h264-1080p-8bit.mkv"
+fi
+[ -e "$CLIP" ] || { echo "No clip: $CLIP" >&2; exit 1; }
+mkdir -p "$RESULTS"
+
+for n in ${OUTPUT_COUNTS:-1 2 4 8}; do
+    # shellcheck disable=SC2086
+    "$MOCKCOMP" --outputs "$n" --duration "$DURATION" $MOCK_ARGS -- \
+        "$WLVIDEO" $WLVIDEO_ARGS "$CLIP" >"$RESULTS/outputs-$n.json"
+    python3 - "$RESULTS/outputs-$n.json" <<'PY'
+import json, sys
+r = json.load(open(sys.argv[1]))
+lat = [o["latency_ms"]["p99"] for o in r["per_output"] if o["latency_ms"]]
+print(f"{r['outputs']:2} outputs: {r['total_commit_hz']:8.1f} commits/s total, "
+      f"worst p99 latency {max(lat) if lat else float('nan'):.2f} ms", file=sys.stderr)
+PY
+done
+
+echo "Results in $RESULTS" >&2
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Run wlvideo --benchmark over the corpus, one JSON report per clip
+#
+# Usage: bench/run.sh <wlvideo> <results dir> [corpus dir]
+#
+# The corpus (default: <results dir>/../corpus) is generated first if
+# needed. BENCH_ARGS is passed to every run, e.g. BENCH_ARGS=-n for
+# software decode or BENCH_ARGS=--benchmark=realtime. Compare two result
+# directories with bench/compare.py.
+
+set -e
+
+WLVIDEO="${1:?usage: $0 <wlvideo> <results dir> [corpus dir]}"
+RESULTS="${2:?usage: $0 <wlvideo> <results dir> [corpus dir]}"
+CORPUS="${3:-$(dirname "$RESULTS")/corpus}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+"$HERE/gen-corpus.sh" "$CORPUS"
+mkdir -p "$RESULTS"
+
+failed=0
+for clip in "$CORPUS"/*.mkv; do
+    [ -e "$clip" ] || continue
+    name="$(basename "$clip" .mkv)"
+    # shellcheck disable=SC2086
+    if "$WLVIDEO" --benchmark $BENCH_ARGS "$clip" >"$RESULTS/$name.json.tmp"; then
+        mv "$RESULTS/$name.json.tmp" "$RESULTS/$name.json"
+        echo "ok   $name" >&2
+    else
+        rm -f "$RESULTS/$name.json.tmp"
+        echo "FAIL $name" >&2
+        failed=$((failed + 1))
+    fi
+done
+
+echo "Results in $RESULTS ($failed failed)" >&2
+[ "$failed" = 0 ]
@@ -0,0 +1,136 @@
+#!/bin/bash
+# Time-accelerated soak: loop a clip under the mock compositor and check
+# that resource usage stays flat
+#
+# Usage: bench/soak.sh <mockcomp> <wlvideo> <results dir> [corpus dir]
+#
+# wlvideo runs on the virtual clock (WLVIDEO_CLOCK=virtual): it steps
+# straight to each frame deadline, and the mock outputs refresh at
+# SOAK_HZ (default 600), so SOAK_MINUTES (default 10) of real time loop
+# the clip for hours. Two outputs cycle through layer_closed storms,
+# unplug and replug and mode changes every 20 s, and now and then a
+# SIGUSR2 moves the client's clock a minute ahead, like a suspend gap.
+# Set WLVIDEO_TIME_SCALE instead to soak on a scaled wall clock; the
+# suspend gaps are skipped then.
+#
+# Every SAMPLE_SECONDS (default 5) RSS and the open fd count are read from
+# /proc, and a SIGUSR1 stats dump supplies the live image count (wl_shm
+# or dma-buf buffers, VkImages or EGLImages, by backend) and the ring
+# usage. After the first WARMUP_PERCENT (default 20) of samples, none of
+# them may grow past the warm-up peak beyond the slack below; the exit
+# status is 1 if one does. Samples land in <results dir>/soak.csv and the
+# log in <results dir>/soak.log.
+#
+#   RSS_SLACK_KIB   default 8192
+#   FD_SLACK        default 2
+#   CLIP            default: the 720p h264 clip from the corpus
+#   WLVIDEO_ARGS    extra wlvideo options (-v is always passed: the stats
+#                   dump needs it), e.g. "-B shm" without a usable GPU
+
+set -e
+
+USAGE="usage: $0 <mockcomp> <wlvideo> <results dir> [corpus dir]"
+MOCKCOMP="${1:?$USAGE}"
+WLVIDEO="${2:?$USAGE}"
+RESULTS="${3:?$USAGE}"
+CORPUS="${4:-$(dirname "$RESULTS")/corpus}"
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+SOAK_MINUTES="${SOAK_MINUTES:-10}"
+SAMPLE_SECONDS="${SAMPLE_SECONDS:-5}"
+WARMUP_PERCENT="${WARMUP_PERCENT:-20}"
+RSS_SLACK_KIB="${RSS_SLACK_KIB:-8192}"
+FD_SLACK="${FD_SLACK:-2}"
+WLVIDEO_ARGS="${WLVIDEO_ARGS-}"
+if [ -n "$WLVIDEO_TIME_SCALE" ]; then
+    export WLVIDEO_TIME_SCALE
+    SOAK_HZ="${SOAK_HZ:-60}"
+else
+    export WLVIDEO_CLOCK=virtual
+    SOAK_HZ="${SOAK_HZ:-600}"
+fi
+
+if [ -z "$CLIP" ]; then
+    CORPUS_SIZES=720p "$HERE/gen-corpus.sh" "$CORPUS"
+    CLIP="$CORPUS/h264-720p-8bit.mkv"
+fi
+[ -e "$CLIP" ] || { echo "No clip: $CLIP" >&2; exit 1; }
+mkdir -p "$RESULTS"
+
+DURATION=$((SOAK_MINUTES * 60))
+SCRIPT="$RESULTS/soak.script"
+LOG="$RESULTS/soak.log"
+CSV="$RESULTS/soak.csv"
+
+# One 20 s cycle of compositor events, repeated for the whole run. Only
+# one output is ever gone at a time, so the no-output timeout never fires.
+{
+    echo "# generated by bench/soak.sh"
+    for ((t = 2; t + 20 <= DURATION; t += 20)); do
+        echo "$t storm 3"
+        echo "$((t + 4)) unplug 1"
+        echo "$((t + 5)) replug 1"
+        echo "$((t + 8)) resize 0 1280x720@$SOAK_HZ"
+        echo "$((t + 11)) resize 0 1920x1080@$SOAK_HZ"
+        echo "$((t + 14)) unplug 0"
+        echo "$((t + 15)) replug 0"
+    done
+} >"$SCRIPT"
+
+# shellcheck disable=SC2086
+"$MOCKCOMP" --outputs 2 --mode "1920x1080@$SOAK_HZ" --duration "$DURATION" --script "$SCRIPT" -- \
+    "$WLVIDEO" -v $WLVIDEO_ARGS "$CLIP" >"$RESULTS/soak-mock.json" 2>"$LOG" &
+MOCK=$!
+trap 'kill $MOCK 2>/dev/null' EXIT
+
+CLIENT=""
+for _ in $(seq 50); do
+    CLIENT="$(pgrep -P "$MOCK" | head -n1)" && [ -n "$CLIENT" ] && break
+    sleep 0.1
+done
+[ -n "$CLIENT" ] || { echo "wlvideo did not start" >&2; exit 1; }
+
+echo "seconds,rss_kib,fds,live_images,ring_kib" >"$CSV"
+start=$SECONDS
+sample=0
+while kill -0 "$CLIENT" 2>/dev/null; do
+    sleep "$SAMPLE_SECONDS"
+    kill -0 "$CLIENT" 2>/dev/null || break
+    sample=$((sample + 1))
+
+    # Suspend gap: a minute of virtual time
+    if [ -n "$WLVIDEO_CLOCK" ] && [ $((sample % 17)) = 0 ]; then
+        kill -USR2 "$CLIENT" 2>/dev/null || break
+    fi
+
+    kill -USR1 "$CLIENT" 2>/dev/null || break
+    sleep 0.5
+    rss="$(awk '/^VmRSS:/ { print $2 }' "/proc/$CLIENT/status" 2>/dev/null)" || break
+    fds="$(find "/proc/$CLIENT/fd" -mindepth 1 -maxdepth 1 2>/dev/null | wc -l)"
+    live="$(grep -a 'Live images:' "$LOG" | tail -n1 | sed -n 's/.*Live images: \([0-9]*\).*/\1/p')"
+    ring="$(grep -a 'Memory: ring' "$LOG" | tail -n1 | sed -n 's/.*Memory: ring \([0-9]*\) KiB.*/\1/p')"
+    echo "$((SECONDS - start)),$rss,$fds,${live:-0},${ring:-0}" >>"$CSV"
+done
+
+wait "$MOCK" || true
+trap - EXIT
+
+python3 - "$CSV" "$WARMUP_PERCENT" "$RSS_SLACK_KIB" "$FD_SLACK" <<'PY'
+import csv, sys
+path, warmup_pct, rss_slack, fd_slack = sys.argv[1], int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4])
+rows = [{k: int(v) for k, v in r.items()} for r in csv.DictReader(open(path))]
+if len(rows) < 5:
+    sys.exit(f"soak: only {len(rows)} samples, wlvideo exited early (see soak.log)")
+split = max(1, len(rows) * warmup_pct // 100)
+warm, rest = rows[:split], rows[split:]
+slack = {"rss_kib": rss_slack, "fds": fd_slack, "live_images": 0, "ring_kib": 0}
+failed = 0
+for key, allowed in slack.items():
+    peak = max(r[key] for r in warm)
+    worst = max(rest, key=lambda r: r[key])
+    ok = worst[key] <= peak + allowed
+    failed += not ok
+    print(f"{'ok  ' if ok else 'GREW'} {key:11} warm-up peak {peak:8}  later max {worst[key]:8} "
+          f"(at {worst['seconds']} s, slack {allowed})", file=sys.stderr)
+sys.exit(1 if failed else 0)
+PY
@@ -0,0 +1,15 @@
+#version 450
+
+/*
+ * NV12 sampling through an immutable sampler with a VkSamplerYcbcrConversion
+ * attached: chroma reconstruction, range expansion and the YCbCr->RGB
+ * matrix all happen in the sampler, so the shader is a plain fetch.
+ */
+layout(set = 0, binding = 0) uniform sampler2D u_tex;
+
+layout(location = 0) in vec2 v_uv;
+layout(location = 0) out vec4 frag_color;
+
+void main() {
+    frag_color = vec4(texture(u_tex, v_uv).rgb, 1.0);
+}
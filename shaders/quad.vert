@@ -0,0 +1,19 @@
+#version 450
+
+/*
+ * Fullscreen quad as a 4-vertex strip with no vertex buffer. The transform
+ * is renderer_compute_transform()'s, which is in GL clip space (Y up), so
+ * Y is flipped for Vulkan. Texture row 0 is the top of the frame.
+ */
+layout(push_constant) uniform Push {
+    vec4 transform;
+} pc;
+
+layout(location = 0) out vec2 v_uv;
+
+void main() {
+    vec2 pos = vec2(float(gl_VertexIndex & 1), float((gl_VertexIndex >> 1) & 1)) * 2.0 - 1.0;
+    vec2 p = pos * pc.transform.xy + pc.transform.zw;
+    gl_Position = vec4(p.x, -p.y, 0.0, 1.0);
+    v_uv = vec2(pos.x + 1.0, 1.0 - pos.y) * 0.5;
+}
@@ -0,0 +1,484 @@
+/*
+ * bench.c — Headless benchmark (--benchmark)
+ *
+ * Runs the real Decoder, SoftwareRing and EGL Renderer without a Wayland
+ * compositor: the renderer comes up on Mesa's surfaceless platform (or the
+ * default EGL display) and draws into a pbuffer the size of the video, so
+ * the same code paths can be profiled and compared in CI on llvmpipe.
+ *
+ * The other --backend choices present through wl_surfaces and do need a
+ * compositor (a session or wlvideo-mockcomp). They draw to a surface with
+ * no role: never mapped, but its buffers are committed and released as on
+ * an output. Their draw stage is the CPU side of conversion and submission.
+ *
+ * One pass over the file, either back to back (fast) or paced at the
+ * source frame rate (realtime). Each draw is followed by glFinish, so the
+ * draw time is what the GPU needed for the frame rather than how long it
+ * took to queue. Render path selection mirrors main.c: zero-copy if the
+ * first hardware frame imports, the software ring otherwise.
+ *
+ * --benchmark=micro times the kernels on their own instead, at the clip's
+ * resolution on synthetic pictures: ring allocation, the NV12 plane copy,
+ * the YUV420P interleave and the upload plus draw of one ring slot.
+ *
+ * The report is one JSON object on stdout; logs stay on stderr.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wlvideo.h"
+
+/* ================================
+ * Section: Samples
+ * ================================ */
+
+typedef struct {
+    double *ms;
+    size_t count;
+    size_t cap;
+    double total;
+} Samples;
+
+static void samples_add(Samples *s, double ms) {
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        double *ms_new = realloc(s->ms, cap * sizeof(double));
+        if (!ms_new) return;
+        s->ms = ms_new;
+        s->cap = cap;
+    }
+    s->ms[s->count++] = ms;
+    s->total += ms;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile; s->ms must be sorted */
+static double samples_pct(const Samples *s, int pct) {
+    size_t idx = (s->count * pct + 99) / 100;
+    return s->ms[idx > 0 ? idx - 1 : 0];
+}
+
+static double ms_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/* ================================
+ * Section: Report
+ * ================================ */
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* "name": {count, fps, min/avg/p50/p99/max}; sorts the samples */
+static void json_stage(FILE *f, const char *name, Samples *s, double bytes_per_sample, bool first) {
+    fputs(first ? "\n    " : ",\n    ", f);
+    json_string(f, name);
+    if (s->count == 0) {
+        fputs(": null", f);
+        return;
+    }
+    qsort(s->ms, s->count, sizeof(double), cmp_double);
+    fprintf(f, ": {\"count\": %zu, \"fps\": %.2f, \"min_ms\": %.4f, \"avg_ms\": %.4f, "
+               "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f",
+            s->count, s->total > 0 ? s->count * 1e3 / s->total : 0.0,
+            s->ms[0], s->total / s->count, samples_pct(s, 50), samples_pct(s, 99),
+            s->ms[s->count - 1]);
+    if (bytes_per_sample > 0 && s->total > 0)
+        fprintf(f, ", \"mib_per_s\": %.1f",
+                bytes_per_sample * s->count / (1024.0 * 1024.0) / (s->total / 1e3));
+    fputc('}', f);
+}
+
+/* ================================
+ * Section: Renderer
+ * ================================ */
+
+static const char *const backend_names[] = {
+    [BACKEND_EGL] = "egl",
+    [BACKEND_SHM] = "shm",
+    [BACKEND_DIRECT] = "direct",
+    [BACKEND_VULKAN] = "vulkan",
+};
+
+/* Headless EGL, or the configured backend on a role-less wl_surface */
+static int bench_renderer_init(App *app, Output *out) {
+    Config *cfg = &app->config;
+    if (cfg->backend == BACKEND_EGL) {
+        if (renderer_init(&app->renderer, NULL, false) < 0) {
+            LOG_ERROR("Benchmark: headless EGL renderer init failed");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (wayland_init(app) < 0) {
+        LOG_ERROR("Benchmark: --backend %s needs a Wayland compositor", backend_names[cfg->backend]);
+        return -1;
+    }
+    out->surface = wl_compositor_create_surface(app->compositor);
+    if (!out->surface || app_init_renderer(app) < 0) {
+        LOG_ERROR("Benchmark: %s renderer init failed", backend_names[cfg->backend]);
+        return -1;
+    }
+    return 0;
+}
+
+/* Buffer releases (and the EGL fallback's frame events) between frames */
+static void bench_dispatch(App *app) {
+    if (app->display)
+        wl_display_roundtrip(app->display);
+}
+
+static void bench_renderer_destroy(App *app, Output *out) {
+    if (app->renderer)
+        renderer_destroy_output(app->renderer, out);
+    renderer_destroy(app->renderer);
+    app->renderer = NULL;
+    if (out->surface)
+        wl_surface_destroy(out->surface);
+    out->surface = NULL;
+    if (app->display)
+        wayland_destroy(app);
+    app->display = NULL;
+}
+
+/* ================================
+ * Section: Microbenchmarks
+ * ================================ */
+
+/* Ring allocations are slow and log each time; kernels run many more */
+#define MICRO_RING_ITERS 16
+#define MICRO_ITERS 240
+
+/* Planes as the decoder hands them over: 64-byte aligned rows, a gradient */
+static uint8_t *micro_picture(int w, int h, uint8_t *planes[3], int linesize[3], bool nv12) {
+    int y_stride = (w + 63) & ~63;
+    int c_stride = nv12 ? y_stride : ((w / 2 + 63) & ~63);
+    size_t y_size = (size_t)y_stride * h;
+    size_t c_size = (size_t)c_stride * (h / 2);
+    uint8_t *buf = malloc(y_size + c_size * (nv12 ? 1 : 2));
+    if (!buf) return NULL;
+
+    for (int row = 0; row < h; row++)
+        for (int x = 0; x < y_stride; x++)
+            buf[(size_t)row * y_stride + x] = (uint8_t)(16 + (x + row) % 220);
+    memset(buf + y_size, 128, c_size * (nv12 ? 1 : 2));
+
+    planes[0] = buf;
+    planes[1] = buf + y_size;
+    planes[2] = nv12 ? NULL : buf + y_size + c_size;
+    linesize[0] = y_stride;
+    linesize[1] = linesize[2] = c_stride;
+    return buf;
+}
+
+static void micro_copy(SoftwareRing *ring, Samples *s, int w, int h, bool nv12,
+                       volatile sig_atomic_t *stop) {
+    uint8_t *planes[3];
+    int linesize[3];
+    uint8_t *buf = micro_picture(w, h, planes, linesize, nv12);
+    if (!buf) return;
+
+    for (int i = 0; i < MICRO_ITERS && !*stop; i++) {
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        sw_ring_write(ring, i % SW_RING_SIZE, planes, linesize, w, h);
+        samples_add(s, ms_since(&t0));
+    }
+    free(buf);
+}
+
+static int micro_run(App *app, volatile sig_atomic_t *stop) {
+    Config *cfg = &app->config;
+    int ret = 1;
+
+    Samples ring_init = {0}, copy = {0}, interleave = {0}, upload = {0};
+    Output out = { .name = "benchmark", .scale = 1, .state = OUT_READY,
+                   .egl_surface = EGL_NO_SURFACE };
+
+    /* Only the clip's geometry is used */
+    if (decoder_init(&app->decoder, cfg->video_path, false, NULL, false) < 0) {
+        LOG_ERROR("Benchmark: decoder init failed");
+        return 1;
+    }
+    int w, h;
+    double fps;
+    bool hw_active;
+    decoder_get_info(app->decoder, &w, &h, &fps, &hw_active);
+    decoder_destroy(app->decoder);
+    app->decoder = NULL;
+
+    if (bench_renderer_init(app, &out) < 0)
+        goto out;
+
+    for (int i = 0; i < MICRO_RING_ITERS && !*stop; i++) {
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool ok = sw_ring_init(&app->sw_ring, w, h) == 0 && sw_ring_ensure(&app->sw_ring);
+        sw_ring_destroy(&app->sw_ring);
+        if (!ok) goto out;
+        samples_add(&ring_init, ms_since(&t0));
+    }
+
+    if (sw_ring_init(&app->sw_ring, w, h) < 0 || !sw_ring_ensure(&app->sw_ring))
+        goto out;
+    micro_copy(&app->sw_ring, &copy, w, h, true, stop);
+    micro_copy(&app->sw_ring, &interleave, w, h, false, stop);
+
+    /* Every draw names a new frame, so each one uploads (or rebinds) its slot */
+    out.width = out.configured_width = w;
+    out.height = out.configured_height = h;
+    if (renderer_create_output(app->renderer, &out) < 0)
+        goto out;
+    for (int i = 0; i < MICRO_ITERS && !*stop; i++) {
+        Frame frame = {
+            .type = FRAME_SW,
+            .seq = (uint64_t)i + 1,
+            .width = w,
+            .height = h,
+            .colorspace = CS_BT709,
+            .color_range = CR_LIMITED,
+            .sw = { .ring_slot = i % SW_RING_SIZE, .available = true },
+        };
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        renderer_draw(app->renderer, &out, &frame, &app->sw_ring, cfg->scale_mode, false);
+        renderer_finish(app->renderer);
+        samples_add(&upload, ms_since(&t0));
+        bench_dispatch(app);
+    }
+
+    double picture = (double)w * h * 3 / 2;
+    FILE *f = stdout;
+    fprintf(f, "{\n  \"file\": ");
+    json_string(f, cfg->video_path);
+    fprintf(f, ",\n  \"renderer\": ");
+    json_string(f, renderer_get_gl_renderer(app->renderer));
+    fprintf(f, ",\n  \"backend\": \"%s\"", backend_names[cfg->backend]);
+    fprintf(f, ",\n  \"mode\": \"micro\",\n  \"ring\": \"%s\"",
+            app->sw_ring.dmabuf_fd >= 0 ? "udmabuf" : "heap");
+    fprintf(f, ",\n  \"video\": {\"width\": %d, \"height\": %d}", w, h);
+    fprintf(f, ",\n  \"stages\": {");
+    json_stage(f, "ring_init", &ring_init, 0, true);
+    json_stage(f, "copy", &copy, picture, false);
+    json_stage(f, "interleave", &interleave, picture, false);
+    json_stage(f, "upload", &upload, picture, false);
+    fprintf(f, "\n  },\n  \"gpu\": ");
+    renderer_write_gpu_timers_json(app->renderer, f, &out);
+    fprintf(f, "\n}\n");
+    fflush(f);
+    ret = 0;
+
+out:
+    if (ret && app->renderer)
+        LOG_ERROR("Benchmark: %dx%d ring allocation or output setup failed", w, h);
+    sw_ring_destroy(&app->sw_ring);
+    bench_renderer_destroy(app, &out);
+    free(ring_init.ms);
+    free(copy.ms);
+    free(interleave.ms);
+    free(upload.ms);
+    return ret;
+}
+
+/* ================================
+ * Section: Run
+ * ================================ */
+
+int benchmark_run(App *app, volatile sig_atomic_t *stop) {
+    Config *cfg = &app->config;
+    int ret = 1;
+
+    cfg->render_threads = false;
+    cfg->gpu_timers = true;
+    if (cfg->benchmark == BENCH_MICRO)
+        return micro_run(app, stop);
+
+    Samples decode = {0}, copy = {0}, draw = {0}, frame_total = {0};
+    Output out = { .name = "benchmark", .scale = 1, .state = OUT_READY,
+                   .egl_surface = EGL_NO_SURFACE };
+    Frame frame = {0};
+
+    struct timespec t_start;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (bench_renderer_init(app, &out) < 0)
+        goto out;
+    double renderer_init_ms = ms_since(&t0);
+
+    /* The direct backend keeps frames on the compositor, as in main.c */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (decoder_init(&app->decoder, cfg->video_path, cfg->hw_accel, cfg->gpu_device,
+                     cfg->backend == BACKEND_DIRECT) < 0) {
+        LOG_ERROR("Benchmark: decoder init failed");
+        goto out;
+    }
+    double decoder_init_ms = ms_since(&t0);
+
+    int vid_w, vid_h;
+    double fps;
+    bool hw_active;
+    decoder_get_info(app->decoder, &vid_w, &vid_h, &fps, &hw_active);
+    app->frame_duration = 1.0 / fps;
+    app->video_width = vid_w;
+    app->video_height = vid_h;
+
+    if (sw_ring_init(&app->sw_ring, vid_w, vid_h) < 0)
+        goto out;
+
+    /* One offscreen output at video size: scaling is 1:1 */
+    out.width = out.configured_width = vid_w;
+    out.height = out.configured_height = vid_h;
+    if (renderer_create_output(app->renderer, &out) < 0)
+        goto out;
+
+    bool path_determined, use_dmabuf;
+    if (decoder_get_gpu_vendor(app->decoder) == GPU_VENDOR_NVIDIA) {
+        use_dmabuf = false;
+        path_determined = true;
+        decoder_set_dmabuf_export_result(app->decoder, false);
+    } else {
+        use_dmabuf = decoder_dmabuf_export_supported(app->decoder);
+        path_determined = !use_dmabuf;
+    }
+
+    LOG_INFO("Benchmark: %dx%d @ %.2f fps, %s", vid_w, vid_h, fps,
+             cfg->benchmark == BENCH_REALTIME ? "paced at source rate" : "as fast as possible");
+
+    double ttff_ms = -1;
+    uint64_t frames = 0, copied = 0;
+    struct timespec t_loop;
+    clock_gettime(CLOCK_MONOTONIC, &t_loop);
+
+    while (!*stop) {
+        bench_dispatch(app);
+        struct timespec tf;
+        clock_gettime(CLOCK_MONOTONIC, &tf);
+
+        bool need_sw = !path_determined || !use_dmabuf;
+        if (!decoder_get_frame(app->decoder, &frame, &app->sw_ring, need_sw))
+            break;
+        double decode_ms = ms_since(&tf);
+        double copy_ms = decoder_get_copy_ms(app->decoder);
+
+        struct timespec td;
+        clock_gettime(CLOCK_MONOTONIC, &td);
+        bool try_dmabuf = !path_determined || use_dmabuf;
+        out.draw_skipped = false;
+        bool ok = renderer_draw(app->renderer, &out, &frame, &app->sw_ring,
+                                cfg->scale_mode, try_dmabuf);
+        renderer_finish(app->renderer);
+        double draw_ms = ms_since(&td);
+
+        /* Backend busy, not broken: the frame just isn't shown */
+        if (out.draw_skipped) {
+            if (frame.type == FRAME_HW)
+                decoder_close_dmabuf(&frame.hw.dmabuf);
+            continue;
+        }
+
+        if (!ok && !frame.sw.available) {
+            LOG_ERROR("Benchmark: draw failed on frame %lu", (unsigned long)frames);
+            break;
+        }
+        if (!path_determined) {
+            path_determined = true;
+            use_dmabuf = frame.type == FRAME_HW && ok;
+            decoder_set_dmabuf_export_result(app->decoder, use_dmabuf);
+            LOG_INFO("Benchmark: render path %s", use_dmabuf ? "zero-copy" : "software");
+        }
+        if (use_dmabuf && app->sw_ring.data) {
+            sw_ring_destroy(&app->sw_ring);
+            decoder_release_staging(app->decoder);
+        }
+        if (frame.type == FRAME_HW)
+            decoder_close_dmabuf(&frame.hw.dmabuf);
+
+        if (ttff_ms < 0) ttff_ms = ms_since(&t_start);
+        samples_add(&decode, decode_ms - copy_ms);
+        if (copy_ms > 0) {
+            samples_add(&copy, copy_ms);
+            copied++;
+        }
+        samples_add(&draw, draw_ms);
+        samples_add(&frame_total, ms_since(&tf));
+        frames++;
+
+        /* Realtime: hold each frame until the next one is due */
+        if (cfg->benchmark == BENCH_REALTIME) {
+            double due = frames * app->frame_duration * 1e3 - ms_since(&t_loop);
+            if (due > 0) {
+                long long ns = (long long)(due * 1e6);
+                struct timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    double wall_ms = ms_since(&t_loop);
+
+    if (frames == 0) {
+        LOG_ERROR("Benchmark: no frames rendered");
+        goto out;
+    }
+
+    FILE *f = stdout;
+    fprintf(f, "{\n  \"file\": ");
+    json_string(f, cfg->video_path);
+    fprintf(f, ",\n  \"renderer\": ");
+    json_string(f, renderer_get_gl_renderer(app->renderer));
+    fprintf(f, ",\n  \"backend\": \"%s\"", backend_names[cfg->backend]);
+    fprintf(f, ",\n  \"mode\": \"%s\",\n  \"path\": \"%s\"",
+            cfg->benchmark == BENCH_REALTIME ? "realtime" : "fast",
+            use_dmabuf ? "zero-copy" : "software");
+    fprintf(f, ",\n  \"video\": {\"width\": %d, \"height\": %d, \"fps\": %.3f, \"hw_decode\": %s}",
+            vid_w, vid_h, fps, hw_active ? "true" : "false");
+    fprintf(f, ",\n  \"frames\": %lu,\n  \"wall_s\": %.3f,\n  \"fps\": %.2f",
+            (unsigned long)frames, wall_ms / 1e3, frames * 1e3 / wall_ms);
+    fprintf(f, ",\n  \"init_ms\": {\"renderer\": %.2f, \"decoder\": %.2f}",
+            renderer_init_ms, decoder_init_ms);
+    fprintf(f, ",\n  \"ttff_ms\": %.2f", ttff_ms);
+    fprintf(f, ",\n  \"stages\": {");
+    json_stage(f, "decode", &decode, 0, true);
+    json_stage(f, "copy", &copy, (double)vid_w * vid_h * 3 / 2, false);
+    json_stage(f, "draw", &draw, 0, false);
+    json_stage(f, "frame", &frame_total, 0, false);
+    fprintf(f, "\n  },\n  \"gpu\": ");
+    renderer_write_gpu_timers_json(app->renderer, f, &out);
+    fprintf(f, "\n}\n");
+    fflush(f);
+
+    LOG_INFO("Benchmark: %lu frames (%lu copied) in %.2f s", (unsigned long)frames,
+             (unsigned long)copied, wall_ms / 1e3);
+    ret = 0;
+
+out:
+    sw_ring_destroy(&app->sw_ring);
+    decoder_destroy(app->decoder);
+    app->decoder = NULL;
+    bench_renderer_destroy(app, &out);
+    free(decode.ms);
+    free(copy.ms);
+    free(draw.ms);
+    free(frame_total.ms);
+    return ret;
+}
@@ -9,18 +9,27 @@
  * Updated for FFmpeg 7.0+ API compatibility (AV_PROFILE_* constants)
  *
  * Key design decisions:
- * - surface_generation is stable within a playback session, changes only on seek
- * - This allows EGLImage cache to work effectively (same surface_id + generation = cache hit)
+ * - Exported frames carry the dma-buf inode (buffer_id), which stays the same
+ *   for a VA surface across loops, so the renderer import caches survive seeking
+ * - surface_generation changes only on seek; (surface_id, generation) is the
+ *   fallback key when the inode is unknown
  * - DMA-BUF FDs are always closed by decoder_close_dmabuf(), caller must ensure it's called
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <glob.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
 
 #include "wlvideo.h"
 #include "config.h"
@@ -71,6 +80,17 @@ const char *fourcc_to_str(uint32_t f) {
     return buf;
 }
 
+/* How long the decoder waits for a ring slot a backend is still reading */
+#define RING_SLOT_WAIT_NS 100000000ull
+
+/*
+ * Exported frames kept referenced for direct presentation, so their VA
+ * surfaces aren't decoded into while the compositor still reads them: every
+ * frame one main loop iteration may decode, plus the two the compositor can
+ * still hold from earlier iterations (on screen and queued).
+ */
+#define DECODER_HELD_FRAMES (MAX_SKIP_FRAMES + 2)
+
 struct Decoder {
     AVFormatContext *fmt_ctx;
     AVCodecContext *codec_ctx;
@@ -89,6 +109,7 @@ struct Decoder {
     bool eof;
 
     int current_ring_slot;
+    size_t staging_bytes;   /* Accounted size of sw_frame's buffers */
 
     ColorSpace colorspace;
     ColorRange color_range;
@@ -99,16 +120,28 @@ struct Decoder {
 
     /*
      * Surface generation: stable identifier that changes only on seek/loop.
-     * Combined with VA surface ID, this forms a unique key for EGL cache.
-     * The generation is NOT incremented per-frame to allow cache hits.
+     * Combined with VA surface ID, this forms a unique key for the direct
+     * and Vulkan caches. The generation is NOT incremented per-frame to
+     * allow cache hits.
      */
     uint64_t surface_generation;
     enum AVCodecID codec_id;
     int bit_depth;
 
+    /*
+     * Direct presentation hands VA surfaces to the compositor, which reads
+     * them after we've moved on. Keep references to the last few exported
+     * frames so their surfaces aren't decoded into while still on screen.
+     */
+    AVFrame *held[DECODER_HELD_FRAMES];
+    int held_next;
+    bool hold_frames;
+
     /* Statistics */
     uint64_t frames_decoded;
     uint64_t dmabuf_exports;
+    uint64_t ring_drops;        /* Software copies dropped: every slot in use */
+    double last_copy_ms;        /* Ring copy of the last frame, 0 if none */
 };
 
 /* ================================
@@ -231,6 +264,8 @@ static ColorRange detect_range(const AVFrame *f, const AVCodecContext *c) {
     enum AVColorRange cr = f->color_range;
     if (cr == AVCOL_RANGE_UNSPECIFIED && c)
         cr = c->color_range;
+    if (cr == AVCOL_RANGE_UNSPECIFIED && f->format == AV_PIX_FMT_YUVJ420P)
+        cr = AVCOL_RANGE_JPEG;
     return (cr == AVCOL_RANGE_JPEG) ? CR_FULL : CR_LIMITED;
 }
 
@@ -258,6 +293,7 @@ static enum AVPixelFormat get_hw_format(AVCodecContext *ctx,
     for (const enum AVPixelFormat *p = fmts; *p != AV_PIX_FMT_NONE; p++) {
         if (*p == AV_PIX_FMT_NV12) return AV_PIX_FMT_NV12;
         if (*p == AV_PIX_FMT_YUV420P) return AV_PIX_FMT_YUV420P;
+        if (*p == AV_PIX_FMT_YUVJ420P) return AV_PIX_FMT_YUVJ420P;
     }
 
     return fmts[0];
@@ -361,7 +397,7 @@ static int init_cuda(Decoder *dec) {
  * Section: Decoder initialization and destruction
  * ================================ */
 
-int decoder_init(Decoder **out, const char *path, bool hw_accel, const char *gpu_device) {
+int decoder_init(Decoder **out, const char *path, bool hw_accel, const char *gpu_device, bool hold_frames) {
     Decoder *dec = calloc(1, sizeof(Decoder));
     if (!dec) return -1;
 
@@ -482,6 +518,11 @@ int decoder_init(Decoder **out, const char *path, bool hw_accel, const char *gpu
 
                     dec->codec_ctx->hw_device_ctx = av_buffer_ref(dec->hw_ctx);
                     dec->codec_ctx->get_format = get_hw_format;
+                    if (hold_frames) {
+                        /* Pool slack for the frames held while presented */
+                        dec->codec_ctx->extra_hw_frames = DECODER_HELD_FRAMES;
+                        dec->hold_frames = true;
+                    }
                     dec->hw_type = AV_HWDEVICE_TYPE_VAAPI;
                     dec->hw_active = true;
                     LOG_INFO("Using VA-API for %s", avcodec_get_name(dec->codec_id));
@@ -563,9 +604,14 @@ void decoder_destroy(Decoder *dec) {
                  (unsigned long)dec->frames_decoded,
                  (unsigned long)dec->dmabuf_exports);
     }
+    if (dec->ring_drops)
+        LOG_INFO("Decoder: %lu software frames dropped, ring slots still in use",
+                 (unsigned long)dec->ring_drops);
 
+    for (int i = 0; i < DECODER_HELD_FRAMES; i++)
+        av_frame_free(&dec->held[i]);
     av_frame_free(&dec->frame);
-    av_frame_free(&dec->sw_frame);
+    decoder_release_staging(dec);
     av_packet_free(&dec->packet);
     avcodec_free_context(&dec->codec_ctx);
     av_buffer_unref(&dec->hw_ctx);
@@ -578,12 +624,9 @@ void decoder_destroy(Decoder *dec) {
  * ================================ */
 
 #ifdef HAVE_VAAPI
-static bool export_vaapi_dmabuf(Decoder *dec, AVFrame *f, Frame *frame) {
-    if (f->format != AV_PIX_FMT_VAAPI) return false;
-
+static bool export_vaapi_surface(Decoder *dec, VASurfaceID surface, Frame *frame) {
     AVHWDeviceContext *dev = (AVHWDeviceContext *)dec->hw_ctx->data;
     AVVAAPIDeviceContext *va = dev->hwctx;
-    VASurfaceID surface = (VASurfaceID)(uintptr_t)f->data[3];
 
     VADRMPRIMESurfaceDescriptor desc;
     VAStatus st = vaExportSurfaceHandle(
@@ -666,78 +709,272 @@ static bool export_vaapi_dmabuf(Decoder *dec, AVFrame *f, Frame *frame) {
         }
     }
 
+    /*
+     * While any fd to a surface's dma-buf is open, exporting it again yields
+     * the same dma-buf, so the inode identifies the buffer across loops. The
+     * EGLImage cache keeps one fd per entry for exactly that reason.
+     */
+    struct stat sb;
+    frame->hw.buffer_id = dmabuf->fd[0] >= 0 && fstat(dmabuf->fd[0], &sb) == 0 ? sb.st_ino : 0;
+
     dec->dmabuf_exports++;
     return dmabuf->num_planes > 0;
 }
+
+static bool export_vaapi_dmabuf(Decoder *dec, AVFrame *f, Frame *frame) {
+    if (f->format != AV_PIX_FMT_VAAPI) return false;
+    return export_vaapi_surface(dec, (VASurfaceID)(uintptr_t)f->data[3], frame);
+}
 #endif
 
 /* ================================
  * Section: Software frame extraction
  * ================================ */
 
-static bool extract_sw_frame(Decoder *dec, Frame *frame, SoftwareRing *ring) {
-    AVFrame *src = dec->frame;
+/*
+ * Content fingerprint (xxHash64-style round over 64-bit words). Every row
+ * of both planes is read: a change confined to rows a sampled hash skips
+ * would hash equal, and dedup would then drop a real frame. It runs right
+ * after the ring copy, while the slot is still in cache. Used to detect
+ * repeated frames (paused scenes, pulldown duplicates, title cards). Never
+ * returns 0, which means "unknown".
+ */
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
 
-    /* Transfer from GPU to CPU if needed */
-#ifdef HAVE_VAAPI
-    if (src->format == AV_PIX_FMT_VAAPI) {
-        if (!dec->sw_frame) dec->sw_frame = av_frame_alloc();
-        av_frame_unref(dec->sw_frame);
-        dec->sw_frame->format = AV_PIX_FMT_NV12;
-        if (av_hwframe_transfer_data(dec->sw_frame, src, 0) < 0)
-            return false;
-        src = dec->sw_frame;
+static inline uint64_t hash_round(uint64_t acc, uint64_t v) {
+    acc += v * HASH_PRIME2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * HASH_PRIME1;
+}
+
+static uint64_t hash_rows(uint64_t h, const uint8_t *p, int stride, int width, int rows) {
+    for (int row = 0; row < rows; row++) {
+        const uint8_t *line = p + (size_t)row * stride;
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            uint64_t v;
+            memcpy(&v, line + x, 8);
+            h = hash_round(h, v);
+        }
+        for (; x < width; x++)
+            h = hash_round(h, line[x]);
     }
-#endif
-#ifdef HAVE_CUDA
-    if (src->format == AV_PIX_FMT_CUDA) {
-        if (!dec->sw_frame) dec->sw_frame = av_frame_alloc();
+    return h;
+}
+
+static uint64_t content_hash(const SoftwareRing *ring, const uint8_t *y, const uint8_t *uv, int w, int h) {
+    uint64_t acc = HASH_PRIME1 ^ ((uint64_t)w << 32 | (uint32_t)h);
+    acc = hash_rows(acc, y, ring->y_stride, w, h);
+    acc = hash_rows(acc, uv, ring->uv_stride, w, h / 2);
+    acc ^= acc >> 33;
+    acc *= HASH_PRIME2;
+    acc ^= acc >> 29;
+    return acc ? acc : 1;
+}
+
+/*
+ * Mark every tile whose bytes in this plane differ between two slots.
+ * NV12 chroma rows are as wide in bytes as luma rows, so the same column
+ * split applies to both planes; only the rows per tile differ.
+ */
+static void diff_plane(uint8_t *map, int tiles_x, const uint8_t *cur, const uint8_t *prev,
+                       int stride, int width, int rows, int tile_rows) {
+    for (int y = 0; y < rows; y++) {
+        uint8_t *mrow = map + (y / tile_rows) * tiles_x;
+        const uint8_t *a = cur + (size_t)y * stride;
+        const uint8_t *b = prev + (size_t)y * stride;
+        for (int tx = 0; tx < tiles_x; tx++) {
+            if (mrow[tx]) continue;
+            int x0 = tx * DAMAGE_TILE;
+            int n = width - x0 < DAMAGE_TILE ? width - x0 : DAMAGE_TILE;
+            if (memcmp(a + x0, b + x0, n) != 0)
+                mrow[tx] = 1;
+        }
+    }
+}
+
+/*
+ * Build the slot's tile change map against the slot holding the previous
+ * frame, while both are still hot from the copy. Without a direct
+ * predecessor (first frame, seek, skipped extraction) the map is marked
+ * invalid and consumers treat the whole frame as changed.
+ */
+static void diff_tiles(SoftwareRing *ring, int slot, uint64_t seq, int w, int h) {
+    int prev = (slot + SW_RING_SIZE - 1) % SW_RING_SIZE;
+    bool valid = ring->tile_map && seq > 1 && ring->slot_seq[prev] == seq - 1;
+
+    ring->slot_seq[slot] = seq;
+    ring->tiles_valid[slot] = valid;
+    if (!valid) return;
+
+    uint8_t *map = (uint8_t *)sw_ring_get_tiles(ring, slot);
+    memset(map, 0, (size_t)ring->tiles_x * ring->tiles_y);
+    diff_plane(map, ring->tiles_x, sw_ring_get_y(ring, slot), sw_ring_get_y(ring, prev),
+               ring->y_stride, w, h, DAMAGE_TILE);
+    diff_plane(map, ring->tiles_x, sw_ring_get_uv(ring, slot), sw_ring_get_uv(ring, prev),
+               ring->uv_stride, w, h / 2, DAMAGE_TILE / 2);
+
+    int changed = 0;
+    for (int i = 0; i < ring->tiles_x * ring->tiles_y; i++)
+        changed += map[i];
+    ring->tiles_changed[slot] = changed;
+}
+
+/*
+ * Drop the staging frame's pixel buffers and their budget reservation. The
+ * AVFrame shell is kept; decoder_release_staging() frees it entirely.
+ */
+static void staging_unref(Decoder *dec) {
+    if (dec->staging_bytes) {
+        mem_release(MEM_STAGING, dec->staging_bytes);
+        dec->staging_bytes = 0;
+    }
+    if (dec->sw_frame)
         av_frame_unref(dec->sw_frame);
-        dec->sw_frame->format = AV_PIX_FMT_NV12;
-        if (av_hwframe_transfer_data(dec->sw_frame, src, 0) < 0)
-            return false;
-        src = dec->sw_frame;
+}
+
+#if defined(HAVE_VAAPI) || defined(HAVE_CUDA)
+/* Bytes held by the pixel buffers of a transfer frame */
+static size_t frame_buffer_size(const AVFrame *f) {
+    size_t size = 0;
+    for (int i = 0; i < 8 && f->buf[i]; i++)
+        size += f->buf[i]->size;
+    return size;
+}
+
+/*
+ * Allocate the staging frame's pixel buffers, reserving their budget first:
+ * an upper bound for av_frame_get_buffer() (strides to 64, height to 32,
+ * plane padding) is reserved before anything is allocated and trimmed to
+ * the real size afterwards, so a denied reservation never allocates.
+ */
+static bool staging_alloc(Decoder *dec, AVFrame *f, int w, int h) {
+    int bound = av_image_get_buffer_size(AV_PIX_FMT_NV12, FFALIGN(w, 64), FFALIGN(h, 32), 64);
+    if (bound <= 0 || !mem_reserve(MEM_STAGING, (size_t)bound + 512))
+        return false;
+    dec->staging_bytes = (size_t)bound + 512;
+
+    f->format = AV_PIX_FMT_NV12;
+    f->width = w;
+    f->height = h;
+    if (av_frame_get_buffer(f, 0) < 0) {
+        staging_unref(dec);
+        return false;
     }
-#endif
 
-    if (src->format != AV_PIX_FMT_NV12 && src->format != AV_PIX_FMT_YUV420P) {
-        LOG_ERROR("Unsupported format: %s", av_get_pix_fmt_name(src->format));
+    size_t bytes = frame_buffer_size(f);
+    if (bytes > dec->staging_bytes && !mem_reserve(MEM_STAGING, bytes - dec->staging_bytes)) {
+        staging_unref(dec);
         return false;
     }
+    if (bytes < dec->staging_bytes)
+        mem_release(MEM_STAGING, dec->staging_bytes - bytes);
+    dec->staging_bytes = bytes;
+    return true;
+}
 
+/*
+ * The staging frame keeps its pixel buffers from one transfer to the next:
+ * they are allocated and reserved once per frame size, and
+ * av_hwframe_transfer_data() writes into them in place. Letting the
+ * transfer allocate instead costs a multi-megabyte malloc/free (an
+ * mmap/munmap pair at these sizes) on every software frame.
+ */
+static bool staging_ensure(Decoder *dec, int w, int h) {
+    AVFrame *f = dec->sw_frame;
+    if (f && f->buf[0] && f->width == w && f->height == h)
+        return true;
+
+    if (!f && !(f = dec->sw_frame = av_frame_alloc()))
+        return false;
+    staging_unref(dec);
+    if (!staging_alloc(dec, f, w, h))
+        return false;
+    LOG_DEBUG("Staging frame allocated: %dx%d, %zu KiB", w, h, dec->staging_bytes / 1024);
+    return true;
+}
+
+static bool transfer_to_staging(Decoder *dec, AVFrame *src) {
+    if (!staging_ensure(dec, src->width, src->height))
+        return false;
+    return av_hwframe_transfer_data(dec->sw_frame, src, 0) >= 0;
+}
+#endif
+
+/*
+ * Pick the slot for the next frame. Where a backend reads slots in place, a
+ * slot it still reads is passed over; if every slot is busy the oldest one
+ * gets RING_SLOT_WAIT_NS to come free. -1 means none did: the software copy
+ * is dropped rather than written under a reader.
+ */
+static int ring_claim_slot(Decoder *dec, SoftwareRing *ring) {
     int slot = dec->current_ring_slot;
+
+    if (ring->slot_wait) {
+        int i = 0;
+        while (i < SW_RING_SIZE && !ring->slot_wait(ring->slot_wait_ctx, (slot + i) % SW_RING_SIZE, 0))
+            i++;
+        if (i == SW_RING_SIZE) {
+            if (!ring->slot_wait(ring->slot_wait_ctx, slot, RING_SLOT_WAIT_NS)) {
+                if (dec->ring_drops++ == 0)
+                    LOG_WARN("Ring slots still in use, dropping software frames");
+                return -1;
+            }
+            i = 0;
+        }
+        slot = (slot + i) % SW_RING_SIZE;
+    }
+
     dec->current_ring_slot = (slot + 1) % SW_RING_SIZE;
+    return slot;
+}
 
+/* Bracket CPU writes to a udmabuf ring so the kernel keeps caches coherent */
+static void ring_sync(SoftwareRing *ring, uint64_t flags) {
+    if (ring->dmabuf_fd < 0) return;
+    struct dma_buf_sync sync = { .flags = flags };
+    while (ioctl(ring->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * Copy one picture into a ring slot as NV12. planes/linesize follow AVFrame:
+ * planes[2] NULL means planes[1] already holds interleaved chroma (NV12),
+ * otherwise U and V (YUV420P) are interleaved on the way in.
+ */
+void sw_ring_write(SoftwareRing *ring, int slot, uint8_t *const planes[3], const int linesize[3],
+                   int w, int h) {
     uint8_t *y_dst = sw_ring_get_y(ring, slot);
     uint8_t *uv_dst = sw_ring_get_uv(ring, slot);
-    int w = src->width;
-    int h = src->height;
+
+    ring_sync(ring, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
 
     /* Copy Y plane */
-    if (src->linesize[0] == ring->y_stride) {
-        memcpy(y_dst, src->data[0], (size_t)ring->y_stride * h);
+    if (linesize[0] == ring->y_stride) {
+        memcpy(y_dst, planes[0], (size_t)ring->y_stride * h);
     } else {
-        int copy_w = src->linesize[0] < ring->y_stride ? src->linesize[0] : w;
+        int copy_w = linesize[0] < ring->y_stride ? linesize[0] : w;
         for (int row = 0; row < h; row++)
-            memcpy(y_dst + row * ring->y_stride, src->data[0] + row * src->linesize[0], copy_w);
+            memcpy(y_dst + row * ring->y_stride, planes[0] + row * linesize[0], copy_w);
     }
 
     /* Copy UV plane(s) */
     int uv_h = h / 2;
-    if (src->format == AV_PIX_FMT_NV12) {
-        if (src->linesize[1] == ring->uv_stride) {
-            memcpy(uv_dst, src->data[1], (size_t)ring->uv_stride * uv_h);
+    if (!planes[2]) {
+        if (linesize[1] == ring->uv_stride) {
+            memcpy(uv_dst, planes[1], (size_t)ring->uv_stride * uv_h);
         } else {
-            int copy_w = src->linesize[1] < ring->uv_stride ? src->linesize[1] : w;
+            int copy_w = linesize[1] < ring->uv_stride ? linesize[1] : w;
             for (int row = 0; row < uv_h; row++)
-                memcpy(uv_dst + row * ring->uv_stride, src->data[1] + row * src->linesize[1], copy_w);
+                memcpy(uv_dst + row * ring->uv_stride, planes[1] + row * linesize[1], copy_w);
         }
     } else {
         /* YUV420P: interleave U and V into NV12 */
         int uv_w = w / 2;
         for (int row = 0; row < uv_h; row++) {
-            const uint8_t *u = src->data[1] + row * src->linesize[1];
-            const uint8_t *v = src->data[2] + row * src->linesize[2];
+            const uint8_t *u = planes[1] + row * linesize[1];
+            const uint8_t *v = planes[2] + row * linesize[2];
             uint8_t *dst = uv_dst + row * ring->uv_stride;
             for (int x = 0; x < uv_w; x++) {
                 dst[x * 2] = u[x];
@@ -746,6 +983,51 @@ static bool extract_sw_frame(Decoder *dec, Frame *frame, SoftwareRing *ring) {
         }
     }
 
+    ring_sync(ring, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+}
+
+static bool extract_sw_frame(Decoder *dec, Frame *frame, SoftwareRing *ring) {
+    AVFrame *src = dec->frame;
+
+    if (!sw_ring_ensure(ring))
+        return false;
+
+    /* Transfer from GPU to CPU if needed */
+#ifdef HAVE_VAAPI
+    if (src->format == AV_PIX_FMT_VAAPI) {
+        if (!transfer_to_staging(dec, src))
+            return false;
+        src = dec->sw_frame;
+    }
+#endif
+#ifdef HAVE_CUDA
+    if (src->format == AV_PIX_FMT_CUDA) {
+        if (!transfer_to_staging(dec, src))
+            return false;
+        src = dec->sw_frame;
+    }
+#endif
+
+    /* YUVJ420P (MJPEG) is YUV420P with full range, see detect_range() */
+    if (src->format != AV_PIX_FMT_NV12 && src->format != AV_PIX_FMT_YUV420P &&
+        src->format != AV_PIX_FMT_YUVJ420P) {
+        LOG_ERROR("Unsupported format: %s", av_get_pix_fmt_name(src->format));
+        return false;
+    }
+
+    int slot = ring_claim_slot(dec, ring);
+    if (slot < 0)
+        return false;
+
+    sw_ring_write(ring, slot, src->data, src->linesize, src->width, src->height);
+
+    uint8_t *y_dst = sw_ring_get_y(ring, slot);
+    uint8_t *uv_dst = sw_ring_get_uv(ring, slot);
+    int w = src->width;
+    int h = src->height;
+
+    frame->content_hash = content_hash(ring, y_dst, uv_dst, w, h);
+    diff_tiles(ring, slot, frame->seq, w, h);
     frame->sw.ring_slot = slot;
     frame->sw.pixel_format = AV_PIX_FMT_NV12;
     frame->sw.available = true;
@@ -777,6 +1059,8 @@ bool decoder_get_frame(Decoder *dec, Frame *frame, SoftwareRing *ring, bool need
 
             frame->type = FRAME_SW;
             frame->sw.available = false;
+            frame->seq = dec->frames_decoded + 1;
+            frame->content_hash = 0;
 
             /* Initialize DMA-BUF FDs to invalid to ensure clean state */
             for (int i = 0; i < 4; i++) {
@@ -794,11 +1078,35 @@ bool decoder_get_frame(Decoder *dec, Frame *frame, SoftwareRing *ring, bool need
 
             if (!hw_ok) need_sw = true;
 
+            dec->last_copy_ms = 0;
             if (ring && need_sw) {
-                if (!extract_sw_frame(dec, frame, ring)) {
-                    if (!hw_ok) return false;
+                struct timespec c0, c1;
+                uint64_t drops = dec->ring_drops;
+                clock_gettime(CLOCK_MONOTONIC, &c0);
+                bool copied = extract_sw_frame(dec, frame, ring);
+                clock_gettime(CLOCK_MONOTONIC, &c1);
+                dec->last_copy_ms = (c1.tv_sec - c0.tv_sec) * 1e3 + (c1.tv_nsec - c0.tv_nsec) / 1e6;
+                /* A dropped copy still counts as decoded; nothing new is shown */
+                if (!copied && !hw_ok && dec->ring_drops == drops) return false;
+            }
+
+#ifdef HAVE_VAAPI
+            /*
+             * Hand the decoder's reference over to the hold ring instead of
+             * taking a second one: av_frame_ref() allocates a buffer ref per
+             * plane plus the frames context ref on every frame. dec->frame
+             * is done with by now, receive_frame refills it next time.
+             */
+            if (hw_ok && dec->hold_frames) {
+                AVFrame **h = &dec->held[dec->held_next];
+                if (!*h) *h = av_frame_alloc();
+                if (*h) {
+                    av_frame_unref(*h);
+                    av_frame_move_ref(*h, f);
                 }
+                dec->held_next = (dec->held_next + 1) % DECODER_HELD_FRAMES;
             }
+#endif
 
             dec->frames_decoded++;
             return hw_ok || frame->sw.available;
@@ -877,6 +1185,11 @@ GpuVendor decoder_get_gpu_vendor(Decoder *dec) {
     return dec ? dec->gpu_vendor : GPU_VENDOR_UNKNOWN;
 }
 
+/* Time the last decoder_get_frame() spent filling the ring (--benchmark) */
+double decoder_get_copy_ms(Decoder *dec) {
+    return dec ? dec->last_copy_ms : 0;
+}
+
 bool decoder_dmabuf_export_supported(Decoder *dec) {
     if (!dec) return false;
     if (!dec->dmabuf_export_tested) return true;
@@ -898,6 +1211,49 @@ void decoder_set_dmabuf_export_result(Decoder *dec, bool works) {
     dec->dmabuf_export_works = works;
 }
 
+/*
+ * Surfaces in the decoder's fixed VA pool (extra_hw_frames included), or 0
+ * before the first frame or with a dynamically growing pool.
+ */
+int decoder_get_pool_size(Decoder *dec) {
+    if (!dec || !dec->hw_active || !dec->codec_ctx->hw_frames_ctx) return 0;
+    AVHWFramesContext *fc = (AVHWFramesContext *)dec->codec_ctx->hw_frames_ctx->data;
+    return fc->initial_pool_size > 0 ? fc->initial_pool_size : 0;
+}
+
+/*
+ * Export every surface of the pool as a HW frame, for pre-importing the
+ * pool before it cycles through playback. Returns the number of frames
+ * filled; the caller closes each with decoder_close_dmabuf().
+ */
+int decoder_export_pool(Decoder *dec, Frame *frames, int max) {
+#ifdef HAVE_VAAPI
+    if (decoder_get_pool_size(dec) == 0 || dec->hw_type != AV_HWDEVICE_TYPE_VAAPI)
+        return 0;
+
+    AVHWFramesContext *fc = (AVHWFramesContext *)dec->codec_ctx->hw_frames_ctx->data;
+    AVVAAPIFramesContext *va = fc->hwctx;
+    int n = 0;
+    for (int i = 0; i < va->nb_surfaces && n < max; i++) {
+        Frame *f = &frames[n];
+        memset(f, 0, sizeof(*f));
+        if (!export_vaapi_surface(dec, va->surface_ids[i], f)) {
+            decoder_close_dmabuf(&f->hw.dmabuf);
+            continue;
+        }
+        f->width = fc->width;
+        f->height = fc->height;
+        f->colorspace = dec->colorspace;
+        f->color_range = dec->color_range;
+        n++;
+    }
+    return n;
+#else
+    (void)dec; (void)frames; (void)max;
+    return 0;
+#endif
+}
+
 /*
  * Explicitly increment surface generation. Call when:
  * - Renderer is reset due to compositor restart
@@ -910,11 +1266,29 @@ void decoder_increment_generation(Decoder *dec) {
     LOG_DEBUG("Decoder generation incremented to %lu", (unsigned long)dec->surface_generation);
 }
 
+/*
+ * Free the GPU->CPU staging frame and its buffers. Called once the
+ * zero-copy path is confirmed; extract_sw_frame() reallocates it if
+ * software frames are needed again (e.g. after a renderer reset).
+ */
+void decoder_release_staging(Decoder *dec) {
+    if (!dec) return;
+    staging_unref(dec);
+    av_frame_free(&dec->sw_frame);
+}
+
 /* ================================
  * Section: Ring buffer
  * ================================ */
 
+/*
+ * Set up ring geometry only. Slots are allocated by sw_ring_ensure() the
+ * first time a software frame is actually needed, so a process that settles
+ * on the zero-copy path never pays for them.
+ */
 int sw_ring_init(SoftwareRing *ring, int width, int height) {
+    ring->data = NULL;
+    ring->dmabuf_fd = -1;
     ring->width = width;
     ring->height = height;
     ring->y_stride = (width + 63) & ~63;
@@ -922,21 +1296,118 @@ int sw_ring_init(SoftwareRing *ring, int width, int height) {
 
     size_t y_size = (size_t)ring->y_stride * height;
     size_t uv_size = (size_t)ring->uv_stride * (height / 2);
-    ring->slot_size = y_size + uv_size;
+    ring->slot_size = (y_size + uv_size + 4095) & ~(size_t)4095;
+
+    ring->tile_map = NULL;
+    ring->slot_wait = NULL;
+    ring->slot_wait_ctx = NULL;
+    ring->tiles_x = (width + DAMAGE_TILE - 1) / DAMAGE_TILE;
+    ring->tiles_y = (height + DAMAGE_TILE - 1) / DAMAGE_TILE;
+    for (int i = 0; i < SW_RING_SIZE; i++) {
+        ring->slot_seq[i] = 0;
+        ring->tiles_valid[i] = false;
+    }
+
+    LOG_INFO("Ring buffer: %d×%d, %zu KiB/slot (allocated on demand)",
+             width, height, ring->slot_size / 1024);
+    return 0;
+}
+
+/*
+ * Back the ring with a sealed memfd wrapped as a dma-buf by /dev/udmabuf.
+ * udmabuf requires F_SEAL_SHRINK so the pages can't vanish under the GPU.
+ * Fails quietly when the device is missing or not accessible.
+ */
+static bool ring_alloc_udmabuf(SoftwareRing *ring, size_t total) {
+    int memfd = memfd_create("wlvideo-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) return false;
+
+    int dev = -1;
+    if (ftruncate(memfd, (off_t)total) < 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+        goto fail;
+
+    dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0) goto fail;
 
-    ring->data = aligned_alloc(64, ring->slot_size * SW_RING_SIZE);
+    struct udmabuf_create create = {
+        .memfd = (uint32_t)memfd,
+        .flags = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size = total,
+    };
+    int fd = ioctl(dev, UDMABUF_CREATE, &create);
+    if (fd < 0) goto fail;
+
+    void *map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        goto fail;
+    }
+
+    /* The mapping and the udmabuf both keep the pages alive */
+    close(dev);
+    close(memfd);
+    ring->data = map;
+    ring->dmabuf_fd = fd;
+    return true;
+
+fail:
+    LOG_DEBUG("udmabuf ring unavailable: %s", strerror(errno));
+    if (dev >= 0) close(dev);
+    close(memfd);
+    return false;
+}
+
+bool sw_ring_ensure(SoftwareRing *ring) {
+    static uint64_t next_generation = 1;
+
+    if (ring->data) return true;
+
+    size_t total = ring->slot_size * SW_RING_SIZE;
+    if (!mem_reserve(MEM_RING, total)) {
+        LOG_ERROR("Ring buffer (%zu KiB) exceeds memory budget", total / 1024);
+        return false;
+    }
+
+    if (!ring_alloc_udmabuf(ring, total)) {
+        ring->dmabuf_fd = -1;
+        ring->data = aligned_alloc(64, total);
+    }
     if (!ring->data) {
-        LOG_ERROR("Failed to allocate ring buffer (%zu KiB)", ring->slot_size * SW_RING_SIZE / 1024);
-        return -1;
+        LOG_ERROR("Failed to allocate ring buffer (%zu KiB)", total / 1024);
+        mem_release(MEM_RING, total);
+        return false;
     }
+    ring->generation = next_generation++;
 
-    LOG_INFO("Ring buffer: %d×%d, %zu KiB/slot", width, height, ring->slot_size / 1024);
-    return 0;
+    /* Change maps are a nicety; without them every frame is fully damaged */
+    ring->tile_map = calloc((size_t)ring->tiles_x * ring->tiles_y, SW_RING_SIZE);
+    for (int i = 0; i < SW_RING_SIZE; i++) {
+        ring->slot_seq[i] = 0;
+        ring->tiles_valid[i] = false;
+    }
+
+    LOG_DEBUG("Ring buffer allocated: %zu KiB (%s)", total / 1024,
+              ring->dmabuf_fd >= 0 ? "udmabuf" : "heap");
+    return true;
 }
 
 void sw_ring_destroy(SoftwareRing *ring) {
-    free(ring->data);
+    if (!ring->data) return;
+    size_t total = ring->slot_size * SW_RING_SIZE;
+    if (ring->dmabuf_fd >= 0) {
+        munmap(ring->data, total);
+        close(ring->dmabuf_fd);
+        ring->dmabuf_fd = -1;
+    } else {
+        free(ring->data);
+    }
     ring->data = NULL;
+    free(ring->tile_map);
+    ring->tile_map = NULL;
+    mem_release(MEM_RING, total);
+    LOG_DEBUG("Ring buffer released");
 }
 
 uint8_t *sw_ring_get_y(SoftwareRing *ring, int slot) {
@@ -946,3 +1417,7 @@ uint8_t *sw_ring_get_y(SoftwareRing *ring, int slot) {
 uint8_t *sw_ring_get_uv(SoftwareRing *ring, int slot) {
     return ring->data + slot * ring->slot_size + (size_t)ring->y_stride * ring->height;
 }
+
+const uint8_t *sw_ring_get_tiles(const SoftwareRing *ring, int slot) {
+    return ring->tile_map + (size_t)slot * ring->tiles_x * ring->tiles_y;
+}
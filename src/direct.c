@@ -0,0 +1,512 @@
+/*
+ * direct.c — Direct scanout-friendly presentation (no EGL/GL)
+ *
+ * Frames are wrapped as wl_buffers through linux-dmabuf and attached to the
+ * output as-is; wp_viewporter does the scaling. There is no GL context, no
+ * shader pass and no intermediate swapchain, and the compositor is free to
+ * put the video on an overlay plane.
+ *
+ * Surface layout per output:
+ *
+ *   layer surface   1×1 black buffer, viewport-scaled to the output
+ *     └ subsurface  the video, positioned and viewport-scaled per frame
+ *
+ * The subsurface is what lets fit leave letterbox bars without breaking the
+ * layer-shell size contract. fill, stretch and --span map onto a viewport
+ * source crop plus destination size, derived from the same transform the GL
+ * path uses.
+ *
+ * Buffer sources:
+ *   - exported VA surfaces, cached per dma-buf (buffer_id) like the
+ *     EGLImage cache, so the wl_buffers survive a loop seek
+ *   - udmabuf-backed ring slots (see sw_ring_ensure), cached per slot
+ *
+ * A buffer is busy from attach until wl_buffer.release and is never
+ * rewritten or evicted in between: busy ring slots are passed over by the
+ * decoder (SoftwareRing.slot_wait), and a VA surface that finds only busy
+ * cache entries skips the frame.
+ *
+ * If a frame can't be wrapped (heap ring, compositor refuses the format or
+ * modifier), the renderer switches the app to the EGL backend.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+
+#include "wlvideo.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+
+/* ================================
+ * Section: Types
+ * ================================ */
+
+typedef struct {
+    uintptr_t surface_id;           /* 0 = free */
+    uint64_t generation;
+    uint64_t buffer_id;             /* dma-buf inode, 0 = keyed on surface_id */
+    int fd;                         /* Pins buffer_id's dma-buf while it is set */
+    struct wl_buffer *buffer;
+    uint64_t last_use;
+    bool busy;                      /* Attached, not yet released */
+} DirectBuffer;
+
+struct DirectOutput {
+    struct wl_surface *parent;      /* Layer surface these objects belong to */
+    struct wl_surface *video;
+    struct wl_subsurface *sub;
+    struct wp_viewport *bg_viewport;
+    struct wp_viewport *video_viewport;
+
+    /* Last applied state, to avoid redundant requests */
+    int bg_w, bg_h;
+    int vx, vy, vw, vh;
+    wl_fixed_t src[4];
+};
+
+struct DirectRenderer {
+    struct wl_display *display;
+    struct wl_event_queue *queue;   /* Private queue for buffer creation */
+    struct wl_compositor *compositor;
+    struct wl_subcompositor *subcompositor;
+    struct zwp_linux_dmabuf_v1 *dmabuf;
+    struct wp_viewporter *viewporter;
+
+    struct wl_buffer *black;        /* 1×1 opaque black, owned by the App */
+
+    DirectBuffer cache[EGL_CACHE_SIZE];
+    DirectBuffer ring[SW_RING_SIZE];
+    SoftwareRing *ring_hooked;      /* Ring whose slot_wait points here */
+    uint64_t ring_gen;
+    uint64_t tick;
+
+    bool hw_failed;                 /* Compositor refused a VA surface */
+    bool fallback_requested;
+
+    /* Statistics */
+    uint64_t stat_frames;
+    uint64_t stat_created;
+    uint64_t stat_hits;
+};
+
+/* ================================
+ * Section: Buffer creation
+ * ================================ */
+
+typedef struct {
+    struct wl_buffer *buffer;
+    bool done;
+} CreateResult;
+
+static void params_created(void *data, struct zwp_linux_buffer_params_v1 *params,
+                           struct wl_buffer *buffer) {
+    (void)params;
+    CreateResult *res = data;
+    res->buffer = buffer;
+    res->done = true;
+}
+
+static void params_failed(void *data, struct zwp_linux_buffer_params_v1 *params) {
+    (void)params;
+    CreateResult *res = data;
+    res->buffer = NULL;
+    res->done = true;
+}
+
+static const struct zwp_linux_buffer_params_v1_listener params_listener = {
+    .created = params_created,
+    .failed = params_failed,
+};
+
+static void buffer_release(void *data, struct wl_buffer *buffer) {
+    (void)buffer;
+    DirectBuffer *b = data;
+    b->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+/*
+ * Create a wl_buffer for a dma-buf. Uses the asynchronous request on a
+ * private queue rather than create_immed, so a refused format is a
+ * recoverable 'failed' event instead of a fatal protocol error, and the
+ * roundtrip doesn't dispatch unrelated events under the caller.
+ */
+static struct wl_buffer *create_buffer(DirectRenderer *d, const DmaBuf *buf, int w, int h) {
+    struct zwp_linux_buffer_params_v1 *params = zwp_linux_dmabuf_v1_create_params(d->dmabuf);
+    if (!params) return NULL;
+    wl_proxy_set_queue((struct wl_proxy *)params, d->queue);
+
+    for (int p = 0; p < buf->num_planes; p++) {
+        if (buf->fd[p] < 0) {
+            zwp_linux_buffer_params_v1_destroy(params);
+            return NULL;
+        }
+        uint64_t mod = buf->modifier[p] == DRM_FORMAT_MOD_INVALID ? DRM_FORMAT_MOD_LINEAR : buf->modifier[p];
+        zwp_linux_buffer_params_v1_add(params, buf->fd[p], (uint32_t)p, buf->offset[p], buf->stride[p],
+                                       (uint32_t)(mod >> 32), (uint32_t)(mod & 0xffffffff));
+    }
+
+    CreateResult res = {0};
+    zwp_linux_buffer_params_v1_add_listener(params, &params_listener, &res);
+    zwp_linux_buffer_params_v1_create(params, w, h, buf->fourcc, 0);
+
+    while (!res.done) {
+        if (wl_display_roundtrip_queue(d->display, d->queue) < 0)
+            break;
+    }
+    zwp_linux_buffer_params_v1_destroy(params);
+
+    if (res.buffer)
+        d->stat_created++;
+    return res.buffer;
+}
+
+static void direct_buffer_reset(DirectBuffer *b) {
+    if (b->buffer) wl_buffer_destroy(b->buffer);
+    if (b->buffer_id) close(b->fd);
+    *b = (DirectBuffer){0};
+}
+
+/*
+ * The buffer was created on the private queue and inherits it; move it to
+ * the default queue so its release events are dispatched by the main loop.
+ */
+static bool attach_listener(DirectBuffer *b, struct wl_buffer *buffer) {
+    if (!buffer) return false;
+    wl_proxy_set_queue((struct wl_proxy *)buffer, NULL);
+    b->buffer = buffer;
+    b->busy = false;
+    wl_buffer_add_listener(buffer, &buffer_listener, b);
+    return true;
+}
+
+static bool buffer_match(const DirectBuffer *b, const Frame *frame) {
+    if (!b->buffer) return false;
+    if (frame->hw.buffer_id)
+        return b->buffer_id == frame->hw.buffer_id;
+    return !b->buffer_id && b->surface_id == frame->hw.surface_id &&
+           b->generation == frame->hw.generation;
+}
+
+/*
+ * Cached wl_buffer for an exported VA surface. LRU eviction only considers
+ * idle entries; if every entry is still on the compositor, *busy is set and
+ * NULL returned so the frame is skipped rather than the import failed.
+ */
+static DirectBuffer *hw_buffer(DirectRenderer *d, Frame *frame, bool *busy) {
+    *busy = false;
+    d->tick++;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
+        DirectBuffer *b = &d->cache[i];
+        if (buffer_match(b, frame)) {
+            b->last_use = d->tick;
+            d->stat_hits++;
+            return b;
+        }
+    }
+
+    DirectBuffer *victim = NULL;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
+        DirectBuffer *b = &d->cache[i];
+        if (!b->buffer) { victim = b; break; }
+        if (!b->busy && (!victim || b->last_use < victim->last_use))
+            victim = b;
+    }
+    if (!victim) {
+        *busy = true;
+        return NULL;
+    }
+    direct_buffer_reset(victim);
+
+    const DmaBuf *buf = &frame->hw.dmabuf;
+    int w = buf->width > 0 ? buf->width : frame->width;
+    int h = buf->height > 0 ? buf->height : frame->height;
+    if (!attach_listener(victim, create_buffer(d, buf, w, h))) {
+        LOG_WARN("Compositor refused VA surface buffer (%s, modifier 0x%llx)",
+                 fourcc_to_str(buf->fourcc), (unsigned long long)buf->modifier[0]);
+        return NULL;
+    }
+    victim->surface_id = frame->hw.surface_id;
+    victim->generation = frame->hw.generation;
+    /* Hold the dma-buf open so later exports of the surface keep its inode */
+    if (frame->hw.buffer_id) {
+        victim->fd = dup(buf->fd[0]);
+        victim->buffer_id = victim->fd >= 0 ? frame->hw.buffer_id : 0;
+    }
+    victim->last_use = d->tick;
+    return victim;
+}
+
+/*
+ * SoftwareRing.slot_wait: a slot is free once the compositor has released
+ * its wl_buffer. Releases arrive through the main loop's dispatch, so there
+ * is nothing to wait on here and the timeout is ignored.
+ */
+static bool ring_slot_wait(void *ctx, int slot, uint64_t timeout_ns) {
+    (void)timeout_ns;
+    DirectRenderer *d = ctx;
+    return !d->ring[slot].busy;
+}
+
+/* wl_buffer for a udmabuf-backed ring slot, created once per slot */
+static DirectBuffer *ring_buffer(DirectRenderer *d, Frame *frame, SoftwareRing *ring) {
+    if (d->ring_gen != ring->generation) {
+        for (int i = 0; i < SW_RING_SIZE; i++)
+            direct_buffer_reset(&d->ring[i]);
+        d->ring_gen = ring->generation;
+    }
+    ring->slot_wait = ring_slot_wait;
+    ring->slot_wait_ctx = d;
+    d->ring_hooked = ring;
+
+    int slot = frame->sw.ring_slot;
+    DirectBuffer *b = &d->ring[slot];
+    if (b->buffer) {
+        d->stat_hits++;
+        return b;
+    }
+
+    size_t base = (size_t)slot * ring->slot_size;
+    DmaBuf buf = {
+        .fd = { ring->dmabuf_fd, ring->dmabuf_fd, -1, -1 },
+        .offset = { (uint32_t)base, (uint32_t)(base + (size_t)ring->y_stride * ring->height) },
+        .stride = { (uint32_t)ring->y_stride, (uint32_t)ring->uv_stride },
+        .fourcc = DRM_FORMAT_NV12,
+        .modifier = { DRM_FORMAT_MOD_LINEAR, DRM_FORMAT_MOD_LINEAR },
+        .num_planes = 2,
+    };
+    if (!attach_listener(b, create_buffer(d, &buf, frame->width, frame->height))) {
+        LOG_WARN("Compositor refused linear NV12 ring buffer");
+        return NULL;
+    }
+    b->surface_id = (uintptr_t)slot + 1;
+    return b;
+}
+
+/* ================================
+ * Section: Public API
+ * ================================ */
+
+DirectRenderer *direct_renderer_create(App *app) {
+    if (!app->dmabuf || !app->viewporter || !app->subcompositor ||
+        (!app->shm && !app->single_pixel)) {
+        LOG_ERROR("Direct presentation needs linux-dmabuf, wp_viewporter, wl_subcompositor and wl_shm");
+        return NULL;
+    }
+
+    DirectRenderer *d = calloc(1, sizeof(DirectRenderer));
+    if (!d) return NULL;
+
+    d->display = app->display;
+    d->compositor = app->compositor;
+    d->subcompositor = app->subcompositor;
+    d->dmabuf = app->dmabuf;
+    d->viewporter = app->viewporter;
+
+    d->queue = wl_display_create_queue(app->display);
+    d->black = wayland_black_buffer(app);
+    if (!d->queue || !d->black) {
+        LOG_ERROR("Direct presentation: setup failed");
+        direct_renderer_destroy(d);
+        return NULL;
+    }
+
+    LOG_INFO("Renderer: direct wl_buffer presentation (linux-dmabuf + viewporter)");
+    return d;
+}
+
+void direct_renderer_destroy(DirectRenderer *d) {
+    if (!d) return;
+    if (d->ring_hooked && d->ring_hooked->slot_wait_ctx == d) {
+        d->ring_hooked->slot_wait = NULL;
+        d->ring_hooked->slot_wait_ctx = NULL;
+    }
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        direct_buffer_reset(&d->cache[i]);
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        direct_buffer_reset(&d->ring[i]);
+    if (d->queue) wl_event_queue_destroy(d->queue);
+    free(d);
+}
+
+int direct_create_output(DirectRenderer *d, Output *out) {
+    direct_destroy_output(d, out);
+
+    struct DirectOutput *o = calloc(1, sizeof(struct DirectOutput));
+    if (!o) return -1;
+
+    o->video = wl_compositor_create_surface(d->compositor);
+    if (!o->video) {
+        free(o);
+        return -1;
+    }
+    o->sub = wl_subcompositor_get_subsurface(d->subcompositor, o->video, out->surface);
+    wl_subsurface_set_desync(o->sub);
+
+    /* The video never takes input */
+    struct wl_region *empty = wl_compositor_create_region(d->compositor);
+    wl_surface_set_input_region(o->video, empty);
+    wl_region_destroy(empty);
+
+    o->bg_viewport = wp_viewporter_get_viewport(d->viewporter, out->surface);
+    o->video_viewport = wp_viewporter_get_viewport(d->viewporter, o->video);
+
+    o->parent = out->surface;
+    out->direct = o;
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+    return 0;
+}
+
+void direct_destroy_output(DirectRenderer *d, Output *out) {
+    (void)d;
+    struct DirectOutput *o = out->direct;
+    if (!o) return;
+
+    /*
+     * No commit here: attaching NULL would unmap the layer surface. The
+     * viewport removal lands with whatever the next backend commits.
+     */
+    if (o->bg_viewport) wp_viewport_destroy(o->bg_viewport);
+    if (o->video_viewport) wp_viewport_destroy(o->video_viewport);
+    if (o->sub) wl_subsurface_destroy(o->sub);
+    if (o->video) wl_surface_destroy(o->video);
+
+    free(o);
+    out->direct = NULL;
+    LOG_DEBUG("Output %s: direct presentation surfaces destroyed", out->name);
+}
+
+/* Hand the app over to the EGL backend; takes effect on the next reset */
+static void request_fallback(DirectRenderer *d, const char *why) {
+    if (d->fallback_requested) return;
+    d->fallback_requested = true;
+    LOG_WARN("Direct presentation unavailable (%s), switching to EGL", why);
+    if (g_app) {
+        g_app->config.backend = BACKEND_EGL;
+        g_app->renderer_needs_reset = true;
+    }
+}
+
+bool direct_output_attached(const Output *out) {
+    return out->direct && out->direct->parent == out->surface;
+}
+
+bool direct_draw(DirectRenderer *d, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale) {
+    if (!out->surface) return false;
+
+    /* Layer surface was recreated underneath us: rebuild the subsurface */
+    if (!direct_output_attached(out) && direct_create_output(d, out) < 0)
+        return false;
+    struct DirectOutput *o = out->direct;
+
+    DirectBuffer *b = NULL;
+    bool hw = false;
+    if (frame->type == FRAME_HW && !d->hw_failed) {
+        bool busy;
+        b = hw_buffer(d, frame, &busy);
+        if (busy) {
+            /* Every cached buffer is still on screen: show this frame later */
+            out->draw_skipped = true;
+            wl_surface_commit(out->surface);
+            return false;
+        }
+        if (b) hw = true;
+        else d->hw_failed = true;
+    }
+    if (!b && frame->sw.available && ring->data && ring->dmabuf_fd >= 0)
+        b = ring_buffer(d, frame, ring);
+
+    if (!b) {
+        if (frame->type != FRAME_HW || d->hw_failed)
+            request_fallback(d, ring->dmabuf_fd < 0 ? "software frames need /dev/udmabuf"
+                                                    : "compositor refused the buffers");
+        /* Keep the frame callback requested for this draw alive */
+        wl_surface_commit(out->surface);
+        return false;
+    }
+
+    /* Background fills the output; only touched when the size changes */
+    if (o->bg_w != out->width || o->bg_h != out->height) {
+        wl_surface_attach(out->surface, d->black, 0, 0);
+        wp_viewport_set_destination(o->bg_viewport, out->width, out->height);
+        wl_surface_damage_buffer(out->surface, 0, 0, 1, 1);
+        o->bg_w = out->width;
+        o->bg_h = out->height;
+    }
+
+    /* Video rectangle in output coordinates, clipped to the output */
+    float t[4];
+    renderer_compute_transform(t, frame->width, frame->height, out, scale);
+    double W = out->width, H = out->height;
+    double rx0 = (t[2] - t[0] + 1.0) * 0.5 * W, rx1 = (t[2] + t[0] + 1.0) * 0.5 * W;
+    double ry0 = (1.0 - t[3] - t[1]) * 0.5 * H, ry1 = (1.0 - t[3] + t[1]) * 0.5 * H;
+    double cx0 = rx0 < 0 ? 0 : rx0, cx1 = rx1 > W ? W : rx1;
+    double cy0 = ry0 < 0 ? 0 : ry0, cy1 = ry1 > H ? H : ry1;
+
+    int vx = (int)(cx0 + 0.5), vy = (int)(cy0 + 0.5);
+    int vw = (int)(cx1 + 0.5) - vx, vh = (int)(cy1 + 0.5) - vy;
+    if (vw < 1) vw = 1;
+    if (vh < 1) vh = 1;
+
+    /* Matching source crop in buffer pixels */
+    double sx = (cx0 - rx0) / (rx1 - rx0) * frame->width;
+    double sy = (cy0 - ry0) / (ry1 - ry0) * frame->height;
+    double sw = (cx1 - cx0) / (rx1 - rx0) * frame->width;
+    double sh = (cy1 - cy0) / (ry1 - ry0) * frame->height;
+
+    if (vx != o->vx || vy != o->vy) {
+        wl_subsurface_set_position(o->sub, vx, vy);
+        o->vx = vx;
+        o->vy = vy;
+    }
+    wl_fixed_t src[4] = { wl_fixed_from_double(sx), wl_fixed_from_double(sy),
+                          wl_fixed_from_double(sw), wl_fixed_from_double(sh) };
+    if (memcmp(src, o->src, sizeof(src)) != 0) {
+        wp_viewport_set_source(o->video_viewport, src[0], src[1], src[2], src[3]);
+        memcpy(o->src, src, sizeof(src));
+    }
+    if (vw != o->vw || vh != o->vh) {
+        wp_viewport_set_destination(o->video_viewport, vw, vh);
+        o->vw = vw;
+        o->vh = vh;
+    }
+
+    wl_surface_attach(o->video, b->buffer, 0, 0);
+    wl_surface_damage_buffer(o->video, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(o->video);
+    b->busy = true;
+
+    /* Parent commit applies position changes and fires the frame callback */
+    wl_surface_commit(out->surface);
+
+    d->stat_frames++;
+    return hw;
+}
+
+/* dma-buf wl_buffers still alive, cached VA surfaces and ring slots */
+int direct_live_buffers(const DirectRenderer *d) {
+    if (!d) return 0;
+    int n = 0;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        if (d->cache[i].buffer) n++;
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        if (d->ring[i].buffer) n++;
+    return n;
+}
+
+void direct_log_stats(DirectRenderer *d) {
+    if (!d || d->stat_frames == 0) return;
+    LOG_INFO("Direct presentation: %lu frames, %lu wl_buffers created, %lu reused",
+             (unsigned long)d->stat_frames,
+             (unsigned long)d->stat_created,
+             (unsigned long)d->stat_hits);
+}
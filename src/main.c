@@ -17,17 +17,24 @@
  * - Strict state machine for output lifecycle to prevent duplicate operations
  */
 
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <time.h>
 #include <poll.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "wlvideo.h"
 
@@ -35,11 +42,26 @@ App *g_app = NULL;
 double g_log_start_time = 0;
 static volatile sig_atomic_t quit = 0;
 
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t clock_jump_requested = 0;
+
 static void handle_signal(int sig) {
     (void)sig;
     quit = 1;
 }
 
+/* SIGUSR1: dump the running stats without stopping */
+static void handle_stats_signal(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+/* SIGUSR2: under the virtual clock, a suspend gap of CLOCK_SUSPEND_GAP */
+static void handle_clock_signal(int sig) {
+    (void)sig;
+    clock_jump_requested = 1;
+}
+
 static const char *vendor_name(GpuVendor v) {
     switch (v) {
     case GPU_VENDOR_INTEL: return "Intel";
@@ -49,10 +71,326 @@ static const char *vendor_name(GpuVendor v) {
     }
 }
 
-static double now(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec * 1e-9;
+/* ================================
+ * Section: Clock
+ * ================================
+ * The scaled clock runs scale times faster than CLOCK_MONOTONIC from the
+ * moment it is installed, so it starts continuous with the real one.
+ *
+ * The virtual clock starts at CLOCK_MONOTONIC too but only moves when
+ * stepped: the main loop jumps it to each frame deadline instead of
+ * sleeping, advances it by the real time spent waiting on the compositor,
+ * and moves it CLOCK_SUSPEND_GAP at once on SIGUSR2. Playback then runs as
+ * fast as the outputs take frames, without ever falling behind its own
+ * schedule. Log timestamps read it from other threads, hence the atomic.
+ */
+
+/* Virtual seconds a SIGUSR2 skips, like a suspend and resume */
+#define CLOCK_SUSPEND_GAP 60.0
+
+ClockSource g_clock_source = NULL;
+
+static double clock_scale = 1.0;
+static double clock_origin;
+static _Atomic double virtual_now;
+
+static double scaled_clock(void) {
+    return clock_origin + (clock_monotonic() - clock_origin) * clock_scale;
+}
+
+static double virtual_clock(void) {
+    return virtual_now;
+}
+
+void clock_set_source(ClockSource source) {
+    g_clock_source = source;
+}
+
+bool clock_set_scale(double scale) {
+    if (!(scale > 0)) return false;
+    clock_scale = scale;
+    clock_origin = clock_monotonic();
+    clock_set_source(scale == 1.0 ? NULL : scaled_clock);
+    return true;
+}
+
+int clock_timeout_ms(double seconds) {
+    if (seconds <= 0) return 0;
+    if (g_clock_source == scaled_clock) seconds /= clock_scale;
+    return (int)(seconds * 1000 + 0.5);
+}
+
+void clock_set_virtual(void) {
+    virtual_now = clock_monotonic();
+    clock_set_source(virtual_clock);
+}
+
+bool clock_is_virtual(void) {
+    return g_clock_source == virtual_clock;
+}
+
+void clock_advance(double seconds) {
+    if (clock_is_virtual() && seconds > 0)
+        virtual_now += seconds;
+}
+
+/* ================================
+ * Section: Memory budget
+ * ================================
+ * Ring slots, transfer staging and renderer caches are accounted here so a
+ * single --memory-budget caps them together. Callers reserve before they
+ * allocate and release after they free; a refused reservation is treated by
+ * the caller like an allocation failure. The decoder reserves from its
+ * startup thread while the renderer comes up, hence the lock.
+ */
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *mem_category_name(MemCategory cat) {
+    switch (cat) {
+    case MEM_RING: return "ring";
+    case MEM_STAGING: return "staging";
+    case MEM_CACHE: return "cache";
+    default: return "?";
+    }
+}
+
+bool mem_reserve(MemCategory cat, size_t bytes) {
+    if (!g_app || bytes == 0) return true;
+    MemoryBudget *mb = &g_app->mem;
+    pthread_mutex_lock(&mem_lock);
+
+    if (mb->limit && mb->total + bytes > mb->limit) {
+        if (mb->denied++ == 0) {
+            LOG_WARN("Memory budget exceeded: %s wants %zu KiB, %zu/%zu KiB in use",
+                     mem_category_name(cat), bytes / 1024,
+                     mb->total / 1024, mb->limit / 1024);
+        }
+        pthread_mutex_unlock(&mem_lock);
+        return false;
+    }
+
+    mb->used[cat] += bytes;
+    mb->total += bytes;
+    if (mb->total > mb->peak) mb->peak = mb->total;
+    mem_log_usage(true);
+    pthread_mutex_unlock(&mem_lock);
+    return true;
+}
+
+void mem_release(MemCategory cat, size_t bytes) {
+    if (!g_app || bytes == 0) return;
+    MemoryBudget *mb = &g_app->mem;
+
+    pthread_mutex_lock(&mem_lock);
+    if (bytes > mb->used[cat]) bytes = mb->used[cat];
+    mb->used[cat] -= bytes;
+    mb->total -= bytes;
+    mem_log_usage(true);
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_log_usage(bool verbose_only) {
+    if (!g_app) return;
+    MemoryBudget *mb = &g_app->mem;
+
+    char limit[32];
+    if (mb->limit)
+        snprintf(limit, sizeof(limit), "%zu KiB", mb->limit / 1024);
+    else
+        snprintf(limit, sizeof(limit), "unlimited");
+
+    if (verbose_only) {
+        LOG_DEBUG("Memory: ring %zu KiB, staging %zu KiB, cache %zu KiB (total %zu KiB, budget %s)",
+                  mb->used[MEM_RING] / 1024, mb->used[MEM_STAGING] / 1024,
+                  mb->used[MEM_CACHE] / 1024, mb->total / 1024, limit);
+    } else {
+        LOG_INFO("Memory: ring %zu KiB, staging %zu KiB, cache %zu KiB "
+                 "(total %zu KiB, peak %zu KiB, budget %s, %lu denied)",
+                 mb->used[MEM_RING] / 1024, mb->used[MEM_STAGING] / 1024,
+                 mb->used[MEM_CACHE] / 1024, mb->total / 1024, mb->peak / 1024,
+                 limit, (unsigned long)mb->denied);
+    }
+}
+
+/* ================================
+ * Section: Background QoS
+ * ================================
+ * --background keeps the wallpaper out of the way of foreground work:
+ *   - main (demux/render) thread: idle I/O class, nice 10, wider timer slack
+ *   - decoder threads: SCHED_IDLE (nice 19 if refused), inherited by the
+ *     FFmpeg workers because they're spawned from the init thread
+ *   - GPU: low EGL context priority (see renderer_init)
+ * Every knob is read back and logged so the effect can be verified.
+ */
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+#define QOS_MAIN_NICE 10
+#define QOS_TIMER_SLACK_NS 500000UL
+
+static const char *ioprio_class_name(int cls) {
+    switch (cls) {
+    case 0: return "none";
+    case 1: return "realtime";
+    case 2: return "best-effort";
+    case 3: return "idle";
+    default: return "unknown";
+    }
+}
+
+static void qos_apply_main_thread(void) {
+    /* I/O priority: the main thread does all file reads (av_read_frame) */
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+        LOG_WARN("QoS: ioprio_set failed: %s", strerror(errno));
+    long io = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    LOG_INFO("QoS: I/O class %s", io < 0 ? "unknown" : ioprio_class_name((int)(io >> IOPRIO_CLASS_SHIFT)));
+
+    /* Timer slack lets the kernel coalesce our poll() wakeups */
+    if (prctl(PR_SET_TIMERSLACK, QOS_TIMER_SLACK_NS, 0, 0, 0) < 0)
+        LOG_WARN("QoS: PR_SET_TIMERSLACK failed: %s", strerror(errno));
+    int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    LOG_INFO("QoS: timer slack %d us", slack < 0 ? -1 : slack / 1000);
+
+    /* Nice is per-thread on Linux */
+    errno = 0;
+    if (setpriority(PRIO_PROCESS, 0, QOS_MAIN_NICE) < 0)
+        LOG_WARN("QoS: setpriority failed: %s", strerror(errno));
+    errno = 0;
+    int nice_val = getpriority(PRIO_PROCESS, 0);
+    LOG_INFO("QoS: main thread nice %d", errno ? 0 : nice_val);
+}
+
+static void qos_apply_decode_thread(void) {
+    struct sched_param sp = { .sched_priority = 0 };
+    if (sched_setscheduler(0, SCHED_IDLE, &sp) < 0) {
+        LOG_WARN("QoS: SCHED_IDLE refused (%s), using nice 19", strerror(errno));
+        setpriority(PRIO_PROCESS, 0, 19);
+    }
+
+    int policy = sched_getscheduler(0);
+    errno = 0;
+    int nice_val = getpriority(PRIO_PROCESS, 0);
+    LOG_INFO("QoS: decode threads %s, nice %d",
+             policy == SCHED_IDLE ? "SCHED_IDLE" : policy == SCHED_BATCH ? "SCHED_BATCH" : "SCHED_OTHER",
+             errno ? 0 : nice_val);
+}
+
+/* ================================
+ * Section: Parallel startup
+ * ================================
+ * The decoder comes up on a short-lived thread while Wayland and EGL
+ * initialise: probing, codec open and the VA device scan, ring geometry,
+ * then the first frame, so the main loop starts with a frame in hand. The
+ * first frame always takes a software copy (no render path is chosen yet),
+ * exactly as it would on the main thread. Until the join, the thread owns
+ * app->decoder and app->sw_ring.
+ *
+ * With --background the thread drops itself to SCHED_IDLE. Scheduling
+ * policy can't be raised back without CAP_SYS_NICE, so this is also the
+ * only way to get idle-class codec workers (they inherit it) without
+ * demoting the main thread.
+ *
+ * The trade-off: main blocks in decoder_startup_wait() on idle-class work,
+ * so on a saturated CPU the first frame waits until a core goes idle.
+ * Decoding it after the join wouldn't change that, because the frame
+ * threads doing the work are idle-class either way. It is the same wait
+ * every later frame has under --background, which is what the flag asks
+ * for; without it the thread keeps the main thread's policy.
+ */
+
+typedef struct {
+    App *app;
+    const char *gpu;
+    RenderBackend backend;          /* As requested; app_init_renderer may fall back meanwhile */
+    bool hold_frames;               /* Direct backend: pool slack for held frames */
+    bool idle;
+    bool started;
+    pthread_t thread;
+    int ret;
+    bool have_frame;
+    Frame frame;
+    double init_ms;
+    double first_frame_ms;
+} DecoderStartup;
+
+static void *decoder_startup_thread(void *arg) {
+    DecoderStartup *job = arg;
+    App *app = job->app;
+    if (job->idle)
+        qos_apply_decode_thread();
+
+    double t0 = clock_monotonic();
+    job->ret = decoder_init(&app->decoder, app->config.video_path, app->config.hw_accel, job->gpu,
+                            job->hold_frames);
+    job->init_ms = (clock_monotonic() - t0) * 1e3;
+    if (job->ret < 0)
+        return NULL;
+
+    int vid_w, vid_h;
+    double fps;
+    bool hw_active;
+    decoder_get_info(app->decoder, &vid_w, &vid_h, &fps, &hw_active);
+
+    /* Geometry only; slots are allocated on first software frame */
+    if (sw_ring_init(&app->sw_ring, vid_w, vid_h) < 0) {
+        LOG_ERROR("Ring buffer init failed");
+        job->ret = -1;
+        return NULL;
+    }
+
+    /* Paths that never import a DMA-BUF skip the export from the start */
+    if (job->backend == BACKEND_SHM ||
+        decoder_get_gpu_vendor(app->decoder) == GPU_VENDOR_NVIDIA)
+        decoder_set_dmabuf_export_result(app->decoder, false);
+
+    t0 = clock_monotonic();
+    for (int i = 0; i < 4; i++)
+        job->frame.hw.dmabuf.fd[i] = -1;
+    job->have_frame = decoder_get_frame(app->decoder, &job->frame, &app->sw_ring, true);
+    job->first_frame_ms = (clock_monotonic() - t0) * 1e3;
+    return NULL;
+}
+
+static void decoder_startup_begin(DecoderStartup *job, App *app, const char *gpu) {
+    *job = (DecoderStartup){
+        .app = app,
+        .gpu = gpu,
+        .backend = app->config.backend,
+        .hold_frames = app->config.backend == BACKEND_DIRECT,
+        .idle = app->config.background,
+        .ret = -1,
+    };
+    job->started = pthread_create(&job->thread, NULL, decoder_startup_thread, job) == 0;
+    if (!job->started) {
+        LOG_WARN("Cannot spawn decoder startup thread, initialising in sequence%s",
+                 job->idle ? " (decode threads keep normal priority)" : "");
+        job->idle = false;
+        decoder_startup_thread(job);
+    }
+}
+
+static int decoder_startup_wait(DecoderStartup *job) {
+    if (job->started) {
+        pthread_join(job->thread, NULL);
+        job->started = false;
+    }
+    return job->ret;
+}
+
+/* Undo a finished startup: the decoder, its ring and the prefetched frame */
+static void decoder_startup_discard(DecoderStartup *job) {
+    App *app = job->app;
+    decoder_startup_wait(job);
+    if (job->have_frame && job->frame.type == FRAME_HW)
+        decoder_close_dmabuf(&job->frame.hw.dmabuf);
+    job->have_frame = false;
+    sw_ring_destroy(&app->sw_ring);
+    decoder_destroy(app->decoder);
+    app->decoder = NULL;
 }
 
 static void print_usage(const char *prog) {
@@ -63,6 +401,18 @@ static void print_usage(const char *prog) {
         "  -o, --output <n>   Target output (default: all)\n"
         "  -g, --gpu <path>      VA-API device (e.g., /dev/dri/renderD128)\n"
         "  -s, --scale <mode>    fit, fill, stretch (default: fill)\n"
+        "  -r, --render-scale <f>\n"
+        "                        Render at a fraction of output size, or auto (egl)\n"
+        "  -B, --backend <name>  egl, shm, direct, vulkan (default: egl)\n"
+        "  -m, --memory-budget <MiB>\n"
+        "                        Cap ring, staging and cache memory (default: unlimited)\n"
+        "  -S, --span            Lay one video out across all outputs\n"
+        "  -b, --background      Idle CPU/IO priority, low-priority GPU context\n"
+        "  -T, --render-threads  Draw and swap each output on its own thread (egl)\n"
+        "  -P, --preimport       Import every decoder surface at startup (egl)\n"
+        "  -G, --gpu-timers      Time GPU upload, bind and draw per output (egl)\n"
+        "  -k, --benchmark[=realtime|micro]\n"
+        "                        Play once, JSON throughput report on stdout\n"
         "  -l, --no-loop         Don't loop\n"
         "  -n, --no-hwaccel      Software decode\n"
         "  -v, --verbose         Debug output\n"
@@ -78,11 +428,72 @@ static ScaleMode parse_scale(const char *s) {
     return SCALE_FILL;
 }
 
+static bool parse_backend(const char *s, RenderBackend *out) {
+    if (!strcmp(s, "egl")) *out = BACKEND_EGL;
+    else if (!strcmp(s, "shm")) *out = BACKEND_SHM;
+    else if (!strcmp(s, "direct")) *out = BACKEND_DIRECT;
+    else if (!strcmp(s, "vulkan")) *out = BACKEND_VULKAN;
+    else {
+        LOG_ERROR("Unknown backend '%s' (expected egl, shm, direct or vulkan)", s);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_benchmark(const char *s, BenchmarkMode *out) {
+    if (!s || !strcmp(s, "fast")) *out = BENCH_FAST;
+    else if (!strcmp(s, "realtime")) *out = BENCH_REALTIME;
+    else if (!strcmp(s, "micro")) *out = BENCH_MICRO;
+    else {
+        LOG_ERROR("Unknown benchmark mode '%s' (expected fast, realtime or micro)", s);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_budget(const char *s, size_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long mib = strtoull(s, &end, 10);
+    if (errno || end == s || *end || s[0] == '-' || mib > SIZE_MAX / (1024 * 1024)) {
+        LOG_ERROR("Invalid memory budget '%s' (expected MiB)", s);
+        return false;
+    }
+    *out = (size_t)mib * 1024 * 1024;
+    return true;
+}
+
+/* "auto" (0: match the video's on-screen resolution) or a fraction in (0, 1] */
+static bool parse_render_scale(const char *s, float *out) {
+    if (!strcmp(s, "auto")) {
+        *out = 0.0f;
+        return true;
+    }
+    char *end;
+    errno = 0;
+    double f = strtod(s, &end);
+    if (errno || end == s || *end || !(f > 0.0 && f <= 1.0)) {
+        LOG_ERROR("Invalid render scale '%s' (expected auto or a fraction in (0, 1])", s);
+        return false;
+    }
+    *out = (float)f;
+    return true;
+}
+
 static int parse_args(Config *cfg, int argc, char **argv) {
     static struct option opts[] = {
         {"output", required_argument, 0, 'o'},
         {"gpu", required_argument, 0, 'g'},
         {"scale", required_argument, 0, 's'},
+        {"render-scale", required_argument, 0, 'r'},
+        {"backend", required_argument, 0, 'B'},
+        {"memory-budget", required_argument, 0, 'm'},
+        {"span", no_argument, 0, 'S'},
+        {"background", no_argument, 0, 'b'},
+        {"render-threads", no_argument, 0, 'T'},
+        {"preimport", no_argument, 0, 'P'},
+        {"gpu-timers", no_argument, 0, 'G'},
+        {"benchmark", optional_argument, 0, 'k'},
         {"no-loop", no_argument, 0, 'l'},
         {"no-hwaccel", no_argument, 0, 'n'},
         {"verbose", no_argument, 0, 'v'},
@@ -93,16 +504,34 @@ static int parse_args(Config *cfg, int argc, char **argv) {
     cfg->output_name = NULL;
     cfg->gpu_device = NULL;
     cfg->scale_mode = SCALE_FILL;
+    cfg->render_scale = 1.0f;
+    cfg->backend = BACKEND_EGL;
+    cfg->memory_budget = 0;
     cfg->loop = true;
+    cfg->span = false;
+    cfg->background = false;
+    cfg->render_threads = false;
+    cfg->preimport = false;
+    cfg->gpu_timers = false;
+    cfg->benchmark = BENCH_OFF;
     cfg->hw_accel = true;
     cfg->verbose = false;
 
     int c;
-    while ((c = getopt_long(argc, argv, "o:g:s:lnvh", opts, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "o:g:s:r:B:m:SbTPGk::lnvh", opts, NULL)) != -1) {
         switch (c) {
         case 'o': cfg->output_name = optarg; break;
         case 'g': cfg->gpu_device = optarg; break;
         case 's': cfg->scale_mode = parse_scale(optarg); break;
+        case 'r': if (!parse_render_scale(optarg, &cfg->render_scale)) return -1; break;
+        case 'B': if (!parse_backend(optarg, &cfg->backend)) return -1; break;
+        case 'm': if (!parse_budget(optarg, &cfg->memory_budget)) return -1; break;
+        case 'S': cfg->span = true; break;
+        case 'b': cfg->background = true; break;
+        case 'T': cfg->render_threads = true; break;
+        case 'P': cfg->preimport = true; break;
+        case 'G': cfg->gpu_timers = true; break;
+        case 'k': if (!parse_benchmark(optarg, &cfg->benchmark)) return -1; break;
         case 'l': cfg->loop = false; break;
         case 'n': cfg->hw_accel = false; break;
         case 'v': cfg->verbose = true; break;
@@ -206,6 +635,53 @@ static bool output_matches_filter(Output *out, const Config *cfg) {
     return strcmp(out->name, cfg->output_name) == 0;
 }
 
+/*
+ * Span mode layout: the canvas is the bounding box of every output that has
+ * a configured surface, in compositor coordinates. Each output then draws
+ * its own sub-rectangle of the single decoded frame. Recomputed every
+ * iteration since outputs come and go; an output whose rectangle changed
+ * is forced to redraw.
+ */
+static void update_span_layout(App *app) {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    bool any = false;
+    Output *out;
+
+    if (app->config.span) {
+        wl_list_for_each(out, &app->outputs, link) {
+            if (!out->surface || out->width <= 0 || out->height <= 0) continue;
+            if (out->state != OUT_READY && out->state != OUT_WAITING_CALLBACK) continue;
+            if (!any || out->x < x0) x0 = out->x;
+            if (!any || out->y < y0) y0 = out->y;
+            if (!any || out->x + out->width > x1) x1 = out->x + out->width;
+            if (!any || out->y + out->height > y1) y1 = out->y + out->height;
+            any = true;
+        }
+    }
+
+    wl_list_for_each(out, &app->outputs, link) {
+        int cx = 0, cy = 0, cw = 0, ch = 0;
+        if (any && out->surface) {
+            cx = out->x - x0;
+            cy = out->y - y0;
+            cw = x1 - x0;
+            ch = y1 - y0;
+        }
+        if (cx != out->canvas_x || cy != out->canvas_y ||
+            cw != out->canvas_w || ch != out->canvas_h) {
+            out->canvas_x = cx;
+            out->canvas_y = cy;
+            out->canvas_w = cw;
+            out->canvas_h = ch;
+            out->shown_seq = 0;
+            out->shown_hash = 0;
+            if (cw > 0)
+                LOG_INFO("Output %s: span region %dx%d+%d+%d of %dx%d",
+                         out->name, out->width, out->height, cx, cy, cw, ch);
+        }
+    }
+}
+
 /*
  * Reset the EGL renderer after context loss.
  *
@@ -214,6 +690,40 @@ static bool output_matches_filter(Output *out, const Config *cfg) {
  * - Compositor restarts (layer_closed received)
  * - EGL_CONTEXT_LOST error
  */
+int app_init_renderer(App *app) {
+    if (app->config.backend == BACKEND_SHM)
+        return renderer_init_shm(&app->renderer, app->shm, app->config.background ? 1 : 0);
+    if (app->config.backend == BACKEND_DIRECT) {
+        if (renderer_init_direct(&app->renderer, app) == 0)
+            return 0;
+        LOG_WARN("Falling back to the EGL backend");
+        app->config.backend = BACKEND_EGL;
+    }
+    if (app->config.backend == BACKEND_VULKAN) {
+        if (renderer_init_vulkan(&app->renderer, app) == 0)
+            return 0;
+        LOG_WARN("Falling back to the EGL backend");
+        app->config.backend = BACKEND_EGL;
+    }
+    return renderer_init(&app->renderer, app->display, app->config.background);
+}
+
+/* Per-output counters, swap times and GPU stage times (exit and SIGUSR1) */
+static void log_output_stats(App *app) {
+    Output *out;
+    wl_list_for_each(out, &app->outputs, link) {
+        if (out->frames_rendered > 0)
+            LOG_INFO("Output %s: %lu frames rendered, %lu deduplicated, %lu skipped", out->name,
+                     (unsigned long)out->frames_rendered, (unsigned long)out->frames_deduped,
+                     (unsigned long)out->frames_skipped);
+        if (out->swap_count > 0)
+            LOG_INFO("Output %s: swap %.2f ms avg, %.2f ms max, %lu of %lu over %.0f ms", out->name,
+                     out->swap_ms_total / out->swap_count, out->swap_ms_max,
+                     (unsigned long)out->swaps_slow, (unsigned long)out->swap_count, SWAP_SLOW_MS);
+        renderer_log_gpu_timers(app->renderer, out, false);
+    }
+}
+
 static bool reset_renderer(App *app) {
     LOG_INFO("Resetting renderer (EGL context) after compositor event");
 
@@ -225,7 +735,7 @@ static bool reset_renderer(App *app) {
         app->renderer = NULL;
     }
 
-    if (renderer_init(&app->renderer, app->display) < 0) {
+    if (app_init_renderer(app) < 0) {
         LOG_ERROR("Renderer reinit failed");
         return false;
     }
@@ -260,11 +770,34 @@ static bool reset_renderer(App *app) {
         }
     }
 
-    app->render_path_determined = false;
+    /* wl_shm can only present software frames, nothing to probe */
+    app->render_path_determined = app->config.backend == BACKEND_SHM;
+    app->use_dmabuf_path = false;
     app->renderer_needs_reset = false;
     return true;
 }
 
+/*
+ * Once zero-copy is confirmed: size the EGLImage cache to the decoder's VA
+ * surface pool and, with --preimport, import every surface before playback
+ * first reaches it.
+ */
+static void prepare_surface_pool(App *app) {
+    int pool = decoder_get_pool_size(app->decoder);
+    if (pool == 0) return;
+    renderer_set_cache_size(app->renderer, pool);
+    if (!app->config.preimport) return;
+
+    Frame frames[EGL_CACHE_MAX];
+    int n = decoder_export_pool(app->decoder, frames, EGL_CACHE_MAX);
+    int imported = 0;
+    for (int i = 0; i < n; i++) {
+        if (renderer_preimport(app->renderer, &frames[i])) imported++;
+        decoder_close_dmabuf(&frames[i].hw.dmabuf);
+    }
+    LOG_INFO("Pre-imported %d of %d decoder surfaces", imported, pool);
+}
+
 /*
  * Process deferred output lifecycle operations.
  *
@@ -370,7 +903,7 @@ static bool process_output_lifecycle(App *app, double current_time) {
         /* Handle case where Wayland surface exists but EGL surface is missing */
         if (out->surface && app->renderer &&
             (out->state == OUT_READY || out->state == OUT_WAITING_CALLBACK) &&
-            (!out->egl_surface || out->egl_surface == EGL_NO_SURFACE)) {
+            !renderer_output_attached(app->renderer, out)) {
 
             LOG_DEBUG("Output %s: reattaching EGL surface", out->name);
             if (renderer_create_output(app->renderer, out) == 0) {
@@ -395,37 +928,92 @@ static bool process_output_lifecycle(App *app, double current_time) {
 int main(int argc, char **argv) {
     App app = {0};
     g_app = &app;
-    g_log_start_time = now();
+    double t_launch = clock_monotonic();
+    g_log_start_time = clock_now();
+    const char *time_scale = getenv("WLVIDEO_TIME_SCALE");
+    const char *clock_name = getenv("WLVIDEO_CLOCK");
+    if (time_scale && !clock_set_scale(atof(time_scale))) {
+        LOG_ERROR("Invalid WLVIDEO_TIME_SCALE '%s'", time_scale);
+        return 1;
+    }
+    if (clock_name) {
+        if (strcmp(clock_name, "virtual") != 0 || time_scale) {
+            LOG_ERROR("Invalid WLVIDEO_CLOCK '%s' (expected virtual, without WLVIDEO_TIME_SCALE)",
+                      clock_name);
+            return 1;
+        }
+        clock_set_virtual();
+    }
     wl_list_init(&app.outputs);
 
     if (parse_args(&app.config, argc, argv) < 0)
         return 1;
 
     LOG_INFO("wlvideo: %s", app.config.video_path);
+    if (clock_is_virtual())
+        LOG_WARN("WLVIDEO_CLOCK: virtual clock, SIGUSR2 skips %.0f s", CLOCK_SUSPEND_GAP);
+    else if (g_clock_source)
+        LOG_WARN("WLVIDEO_TIME_SCALE: clock runs at %gx", atof(time_scale));
+
+    app.mem.limit = app.config.memory_budget;
+    if (app.mem.limit)
+        LOG_INFO("Memory budget: %zu MiB", app.mem.limit / (1024 * 1024));
 
     struct sigaction sa = { .sa_handler = handle_signal };
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    struct sigaction sa_stats = { .sa_handler = handle_stats_signal };
+    sigemptyset(&sa_stats.sa_mask);
+    sigaction(SIGUSR1, &sa_stats, NULL);
+    struct sigaction sa_clock = { .sa_handler = handle_clock_signal };
+    sigemptyset(&sa_clock.sa_mask);
+    sigaction(SIGUSR2, &sa_clock, NULL);
+
+    /* No outputs or layer surfaces (no compositor at all for egl): a JSON report and exit */
+    if (app.config.benchmark != BENCH_OFF)
+        return benchmark_run(&app, &quit);
+
+    if (app.config.background)
+        qos_apply_main_thread();
+
+    /*
+     * Decoder and first frame in parallel with Wayland, EGL and surfaces.
+     * The decoder sizes its surface pool for the direct backend, which may
+     * still fall back to EGL in app_init_renderer(), so that one waits.
+     */
+    DecoderStartup startup = { .app = &app };
+    bool decoder_early = app.config.backend != BACKEND_DIRECT;
+    if (decoder_early)
+        decoder_startup_begin(&startup, &app, app.config.gpu_device);
 
-    /* Initialize subsystems */
+    double t0 = clock_monotonic();
     if (wayland_init(&app) < 0) {
         LOG_ERROR("Wayland init failed");
+        decoder_startup_discard(&startup);
         return 1;
     }
+    double wayland_ms = (clock_monotonic() - t0) * 1e3;
 
-    if (renderer_init(&app.renderer, app.display) < 0) {
+    t0 = clock_monotonic();
+    if (app_init_renderer(&app) < 0) {
         LOG_ERROR("Renderer init failed");
+        decoder_startup_discard(&startup);
         wayland_destroy(&app);
         return 1;
     }
+    double renderer_ms = (clock_monotonic() - t0) * 1e3;
 
-    /* Decide which GPU to use for decoding */
+    /*
+     * Decide which GPU to use for decoding. The only step that needs the
+     * renderer: on a mismatch the early decoder is thrown away and brought
+     * up again on the render GPU.
+     */
     const char *decode_gpu = app.config.gpu_device;
     GpuVendor render_vendor = renderer_get_gpu_vendor(app.renderer);
     GpuVendor requested_vendor = vendor_from_node(app.config.gpu_device);
 
-    if (decode_gpu && render_vendor != GPU_VENDOR_UNKNOWN &&
+    if (app.config.gpu_device && render_vendor != GPU_VENDOR_UNKNOWN &&
         requested_vendor != GPU_VENDOR_UNKNOWN &&
         requested_vendor != render_vendor &&
         !getenv("WLVIDEO_ALLOW_GPU_MISMATCH")) {
@@ -433,47 +1021,26 @@ int main(int argc, char **argv) {
                  vendor_name(requested_vendor), vendor_name(render_vendor));
         LOG_WARN("Using render GPU for zero-copy. Set WLVIDEO_ALLOW_GPU_MISMATCH=1 to override.");
         decode_gpu = NULL;
+        if (decoder_early) {
+            decoder_startup_discard(&startup);
+            decoder_early = false;
+        }
     }
+    if (!decoder_early)
+        decoder_startup_begin(&startup, &app, decode_gpu);
 
-    if (decoder_init(&app.decoder, app.config.video_path, app.config.hw_accel, decode_gpu) < 0) {
-        LOG_ERROR("Decoder init failed");
-        renderer_destroy(app.renderer);
-        wayland_destroy(&app);
-        return 1;
-    }
-
-    int vid_w, vid_h;
-    double fps;
-    bool hw_active;
-    decoder_get_info(app.decoder, &vid_w, &vid_h, &fps, &hw_active);
-    app.frame_duration = 1.0 / fps;
-
-    GpuVendor decode_vendor = decoder_get_gpu_vendor(app.decoder);
-    LOG_INFO("Video: %dx%d @ %.2f fps, HW: %s, GPU: %s",
-             vid_w, vid_h, fps, hw_active ? "yes" : "no", vendor_name(decode_vendor));
-
-    if (sw_ring_init(&app.sw_ring, vid_w, vid_h) < 0) {
-        LOG_ERROR("Ring buffer init failed");
-        decoder_destroy(app.decoder);
-        renderer_destroy(app.renderer);
-        wayland_destroy(&app);
-        return 1;
+    /* Create surfaces on outputs, then wait for all configures at once */
+    Output *out;
+    wl_list_for_each(out, &app.outputs, link) {
+        if (output_matches_filter(out, &app.config) && wayland_create_surface(out, &app) < 0)
+            LOG_ERROR("Output %s: surface creation failed", out->name);
     }
+    wl_display_roundtrip(app.display);
 
-    /* Create surfaces on outputs */
     int surface_count = 0;
-    Output *out;
     wl_list_for_each(out, &app.outputs, link) {
-        if (!output_matches_filter(out, &app.config))
-            continue;
-
-        if (wayland_create_surface(out, &app) < 0) {
-            LOG_ERROR("Output %s: surface creation failed", out->name);
+        if (!out->surface)
             continue;
-        }
-
-        /* Wait for configure */
-        wl_display_roundtrip(app.display);
 
         if (out->state != OUT_READY) {
             LOG_WARN("Output %s: not configured after roundtrip", out->name);
@@ -490,20 +1057,40 @@ int main(int argc, char **argv) {
         surface_count++;
     }
 
+    if (decoder_startup_wait(&startup) < 0) {
+        LOG_ERROR("Decoder init failed");
+        decoder_startup_discard(&startup);
+        renderer_destroy(app.renderer);
+        wayland_destroy(&app);
+        return 1;
+    }
+
+    int vid_w, vid_h;
+    double fps;
+    bool hw_active;
+    decoder_get_info(app.decoder, &vid_w, &vid_h, &fps, &hw_active);
+    app.frame_duration = 1.0 / fps;
+    app.video_width = vid_w;
+    app.video_height = vid_h;
+
+    GpuVendor decode_vendor = decoder_get_gpu_vendor(app.decoder);
+    LOG_INFO("Video: %dx%d @ %.2f fps, HW: %s, GPU: %s",
+             vid_w, vid_h, fps, hw_active ? "yes" : "no", vendor_name(decode_vendor));
+
+    LOG_DEBUG("Startup: Wayland %.1f ms, renderer %.1f ms; in parallel decoder %.1f ms, "
+              "first frame %.1f ms", wayland_ms, renderer_ms, startup.init_ms, startup.first_frame_ms);
+
     if (surface_count == 0) {
         LOG_ERROR("No surfaces created");
-        sw_ring_destroy(&app.sw_ring);
-        decoder_destroy(app.decoder);
+        decoder_startup_discard(&startup);
         renderer_destroy(app.renderer);
         wayland_destroy(&app);
         return 1;
     }
 
-    wl_display_roundtrip(app.display);
-
     /* Main loop */
     app.running = true;
-    app.last_output_ready_time = now();
+    app.last_output_ready_time = clock_now();
     app.no_output_iterations = 0;
 
     /*
@@ -512,7 +1099,11 @@ int main(int argc, char **argv) {
      * - NVIDIA: DMA-BUF export works, but import fails or produces garbage
      *           due to tiled modifiers (0x30000000xxxxxxxx). Force software path.
      */
-    if (decode_vendor == GPU_VENDOR_NVIDIA) {
+    if (app.config.backend == BACKEND_SHM) {
+        app.use_dmabuf_path = false;
+        app.render_path_determined = true;
+        decoder_set_dmabuf_export_result(app.decoder, false);
+    } else if (decode_vendor == GPU_VENDOR_NVIDIA) {
         LOG_INFO("NVIDIA detected: forcing software render path (DMA-BUF modifiers incompatible)");
         app.use_dmabuf_path = false;
         app.render_path_determined = true;  /* Don't even try DMA-BUF */
@@ -526,24 +1117,21 @@ int main(int argc, char **argv) {
     int wl_fd = wl_display_get_fd(app.display);
     struct pollfd pfd = { .fd = wl_fd, .events = POLLIN };
 
-    Frame frame = {0};
-    /* Initialize DMA-BUF FDs to invalid */
-    for (int i = 0; i < 4; i++) {
-        frame.hw.dmabuf.fd[i] = -1;
-    }
-
-    bool have_frame = false;
+    /* Frame 0 was decoded during startup */
+    Frame frame = startup.frame;
+    bool have_frame = startup.have_frame;
+    bool first_frame_logged = false;
     int64_t displayed_frame = -1;
 
     /* How many frames we can skip per iteration before resetting clock */
-    const int max_skip = 5;
+    const int max_skip = MAX_SKIP_FRAMES;
     const int reset_threshold = max_skip * 2;
 
     /* Timeout for no-output condition (30 seconds) */
     const double no_output_timeout = 30.0;
 
     while (app.running && !quit) {
-        double t = now();
+        double t = clock_now();
 
         /* Reset renderer if requested (e.g., after compositor restart) */
         if (app.renderer_needs_reset) {
@@ -557,6 +1145,24 @@ int main(int argc, char **argv) {
             }
         }
 
+        if (clock_jump_requested) {
+            clock_jump_requested = 0;
+            if (clock_is_virtual()) {
+                LOG_INFO("Virtual clock: skipping %.0f s", CLOCK_SUSPEND_GAP);
+                clock_advance(CLOCK_SUSPEND_GAP);
+                t = clock_now();
+            }
+        }
+
+        if (stats_requested) {
+            stats_requested = 0;
+            LOG_INFO("Stats after %lu frames (%lu output draws skipped as duplicates)",
+                     (unsigned long)app.frame_counter, (unsigned long)app.frames_deduped);
+            log_output_stats(&app);
+            renderer_log_stats(app.renderer);
+            mem_log_usage(false);
+        }
+
         /* Process deferred surface lifecycle operations */
         bool surfaces_recreated = process_output_lifecycle(&app, t);
 
@@ -625,22 +1231,42 @@ int main(int argc, char **argv) {
             break;
         }
 
-        /* Compute poll timeout */
+        /*
+         * Compute poll timeout. On the virtual clock a frame deadline is
+         * reached by stepping, not sleeping (just past it, so rounding
+         * can't land a hair short); with no output alive either, the
+         * lifecycle timers are stepped 100 ms per 10 ms of polling.
+         * Waits for the compositor still pass real time.
+         */
         int timeout_ms;
+        bool real_wait = true;
 
         if (!app.clock_started) {
             timeout_ms = 16;
         } else if (!any_output_ready(&app)) {
             timeout_ms = 100;
+            if (clock_is_virtual() && !any_output_active(&app)) {
+                clock_advance(0.1);
+                timeout_ms = 10;
+                real_wait = false;
+            }
         } else {
             double next = app.start_time + (displayed_frame + 1) * app.frame_duration;
-            double delta = next - t;
-            timeout_ms = delta > 0 ? (int)(delta * 1000 + 0.5) : 0;
-            if (timeout_ms > 100) timeout_ms = 100;
+            if (clock_is_virtual()) {
+                clock_advance(next - t + 1e-6);
+                timeout_ms = 0;
+                real_wait = false;
+            } else {
+                timeout_ms = clock_timeout_ms(next - t);
+                if (timeout_ms > 100) timeout_ms = 100;
+            }
         }
 
+        double poll_start = clock_monotonic();
         int ret = poll(&pfd, 1, timeout_ms);
-        t = now();
+        if (real_wait)
+            clock_advance(clock_monotonic() - poll_start);
+        t = clock_now();
 
         if (ret < 0) {
             wl_display_cancel_read(app.display);
@@ -683,7 +1309,7 @@ int main(int argc, char **argv) {
         if (!app.clock_started) {
             app.clock_started = true;
             app.start_time = t;
-            displayed_frame = -1;
+            displayed_frame = have_frame ? 0 : -1;
         }
 
         /* Figure out which frame should be displayed now */
@@ -706,7 +1332,8 @@ int main(int argc, char **argv) {
                             app.running = false;
                             break;
                         }
-                        renderer_clear_cache(app.renderer);
+                        /* Same surface pool after the seek: the import caches stay */
+                        renderer_log_cache_stats(app.renderer);
                         app.start_time = t;
                         displayed_frame = -1;
                         target = 0;
@@ -735,19 +1362,58 @@ int main(int argc, char **argv) {
             }
         }
 
-        /* Render to all ready outputs */
-        if (have_frame) {
+        /*
+         * Render to all ready outputs. A software frame whose ring copy was
+         * dropped (every slot still being read) has nothing to show; the
+         * outputs keep the previous one.
+         */
+        if (have_frame && (frame.type == FRAME_HW || frame.sw.available)) {
+            update_span_layout(&app);
+            wl_list_for_each(out, &app.outputs, link)
+                wayland_update_render_size(out);
+
+            int active = 0;
+            wl_list_for_each(out, &app.outputs, link)
+                if (renderer_output_attached(app.renderer, out) &&
+                    (out->state == OUT_READY || out->state == OUT_WAITING_CALLBACK))
+                    active++;
+            renderer_set_active_outputs(app.renderer, active);
+
             bool all_renders_failed = true;
 
             wl_list_for_each(out, &app.outputs, link) {
                 if (out->state != OUT_READY) continue;
 
+                /*
+                 * Skip draw, swap and commit when this output already shows
+                 * this frame, or an identical one. No commit means no frame
+                 * callback either, so the output simply stays READY.
+                 */
+                if (out->shown_seq == frame.seq ||
+                    (frame.content_hash && out->shown_hash == frame.content_hash)) {
+                    if (out->shown_seq != frame.seq) {
+                        out->shown_seq = frame.seq;
+                        out->frames_deduped++;
+                        app.frames_deduped++;
+                    }
+                    all_renders_failed = false;
+                    continue;
+                }
+
                 wayland_request_frame(out);
 
                 bool try_dmabuf = !app.render_path_determined || app.use_dmabuf_path;
+                out->draw_skipped = false;
                 bool ok = renderer_draw(app.renderer, out, &frame, &app.sw_ring,
                                         app.config.scale_mode, try_dmabuf);
 
+                /* Nothing presented this tick; the callback brings it back */
+                if (out->draw_skipped) {
+                    out->frames_skipped++;
+                    all_renders_failed = false;
+                    continue;
+                }
+
                 /* Handle render failure (e.g., invalid EGL surface) */
                 if (!ok && !frame.sw.available) {
                     LOG_WARN("Output %s: render failed, marking for recreation", out->name);
@@ -761,6 +1427,11 @@ int main(int argc, char **argv) {
 
                 all_renders_failed = false;
 
+                if (!first_frame_logged) {
+                    first_frame_logged = true;
+                    LOG_INFO("Time to first frame: %.1f ms", (clock_monotonic() - t_launch) * 1e3);
+                }
+
                 /* Detect render path on first frame */
                 if (!app.render_path_determined) {
                     app.render_path_determined = true;
@@ -768,6 +1439,7 @@ int main(int argc, char **argv) {
                         app.use_dmabuf_path = ok;
                         decoder_set_dmabuf_export_result(app.decoder, ok);
                         LOG_INFO("Render path: %s", ok ? "zero-copy" : "software");
+                        if (ok) prepare_surface_pool(&app);
                     } else {
                         app.use_dmabuf_path = false;
                         LOG_INFO("Render path: software");
@@ -775,8 +1447,13 @@ int main(int argc, char **argv) {
                 }
 
                 out->frames_rendered++;
+                out->shown_seq = frame.seq;
+                out->shown_hash = frame.content_hash;
             }
 
+            /* Threaded outputs must be done before Wayland events are dispatched */
+            renderer_flush(app.renderer);
+
             /*
              * If all renders failed (no output succeeded), close FDs now to prevent leak.
              * Normally FDs are closed at start of next frame, but if no output rendered
@@ -787,20 +1464,32 @@ int main(int argc, char **argv) {
                 have_frame = false;
             }
 
+            /*
+             * Once zero-copy is confirmed the ring and staging frame are
+             * dead weight. They are reallocated lazily if a renderer reset
+             * sends us back through path detection.
+             */
+            if (app.render_path_determined && app.use_dmabuf_path && app.sw_ring.data) {
+                sw_ring_destroy(&app.sw_ring);
+                decoder_release_staging(app.decoder);
+                frame.sw.available = false;
+                mem_log_usage(false);
+            }
+
             app.frame_counter++;
         }
     }
 
     /* Cleanup */
-    LOG_INFO("Exiting after %lu frames", (unsigned long)app.frame_counter);
+    LOG_INFO("Exiting after %lu frames (%lu output draws skipped as duplicates)",
+             (unsigned long)app.frame_counter, (unsigned long)app.frames_deduped);
 
     if (have_frame && frame.type == FRAME_HW)
         decoder_close_dmabuf(&frame.hw.dmabuf);
 
     /* Log per-output stats and cleanup */
+    log_output_stats(&app);
     wl_list_for_each(out, &app.outputs, link) {
-        if (out->frames_rendered > 0)
-            LOG_INFO("Output %s: %lu frames rendered", out->name, (unsigned long)out->frames_rendered);
         renderer_destroy_output(app.renderer, out);
         wayland_destroy_surface(out);
     }
@@ -809,6 +1498,7 @@ int main(int argc, char **argv) {
     decoder_destroy(app.decoder);
     renderer_destroy(app.renderer);
     wayland_destroy(&app);
+    mem_log_usage(false);
 
     return 0;
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 /*
- * render.c — EGL/OpenGL ES 2.0 renderer
+ * render.c — EGL/OpenGL ES renderer (GLES3 when available, GLES2 fallback)
+ *
+ * A Renderer created with renderer_init_shm(), renderer_init_direct() or
+ * renderer_init_vulkan() has no EGL state at all and forwards every call to
+ * shm.c, direct.c or vulkan.c.
  *
  * Two rendering paths:
  * 1. DMA-BUF import: create EGLImage from DMA-BUF, bind as external texture.
@@ -7,8 +11,17 @@
  * 2. Software upload: upload Y and UV planes separately, convert in shader.
  *    Used when DMA-BUF import fails.
  *
+ * With several outputs, either path first converts into a shared RGB
+ * texture once per frame, and each output just blits it.
+ *
+ * On a GLES3 context the software path uploads through a small ring of
+ * fenced pixel buffer objects into immutable R8/RG8 textures, with strided
+ * rows handled by GL_UNPACK_ROW_LENGTH in a single call per plane.
+ *
  * EGLImage cache avoids repeated eglCreateImageKHR calls for the same surface.
- * Cache entries are keyed by (surface_id, generation) to handle surface reuse.
+ * Entries are keyed by the dma-buf inode, which is stable across loops as
+ * long as the entry holds an fd to it, and grow to the decoder's pool size.
+ * Frames without an inode fall back to (surface_id, generation).
  *
  * Key design decisions:
  * - dmabuf_tested/dmabuf_works track driver compatibility, not surface state
@@ -21,6 +34,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <wayland-egl.h>
 #include <drm_fourcc.h>
 
@@ -28,15 +45,30 @@
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
-#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
 #include <GLES2/gl2ext.h>
 
+/* PBO ring depth: upload of frame N+1 proceeds while N is still sampled */
+#define PBO_RING_SIZE 3
+
+#ifndef EGL_OPENGL_ES3_BIT
+#define EGL_OPENGL_ES3_BIT 0x00000040
+#endif
+
 static PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
 static PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
 static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES;
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC eglSwapBuffersWithDamage;
+static PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+static PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+static PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
 
 extern const char *fourcc_to_str(uint32_t f);
 
+/* Output render threads, defined after the drawing code they use */
+static void render_thread_start(Renderer *r, Output *out);
+static void render_thread_stop(Renderer *r, Output *out);
+
 static const char *egl_error_name(EGLint err) {
     switch (err) {
     case EGL_SUCCESS: return "SUCCESS";
@@ -87,46 +119,41 @@ static const char *vert_src =
     "    v_uv = a_uv;\n"
     "}\n";
 
-/* NV12 fragment shader with colorspace/range conversion */
-static const char *frag_nv12_src =
+/*
+ * NV12 fragment shader template, specialised per colorspace and range by
+ * nv12_program(): range expansion is folded into a constant matrix and
+ * offset, so each pixel costs one subtract and one mat3 multiply with no
+ * uniforms to branch on. mediump covers 8-bit colour; texture coordinates
+ * stay highp where available so 4K planes are addressed exactly.
+ */
+static const char *frag_nv12_fmt =
     "#version 100\n"
-    "precision highp float;\n"
+    "precision mediump float;\n"
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "varying highp vec2 v_uv;\n"
+    "#else\n"
     "varying vec2 v_uv;\n"
+    "#endif\n"
     "uniform sampler2D u_tex_y;\n"
     "uniform sampler2D u_tex_uv;\n"
-    "uniform int u_colorspace;\n"
-    "uniform int u_range;\n"
-    "\n"
-    "vec3 yuv_to_rgb_601(float y, float u, float v) {\n"
-    "    return vec3(y + 1.402*v, y - 0.344*u - 0.714*v, y + 1.772*u);\n"
-    "}\n"
-    "vec3 yuv_to_rgb_709(float y, float u, float v) {\n"
-    "    return vec3(y + 1.575*v, y - 0.187*u - 0.468*v, y + 1.856*u);\n"
-    "}\n"
-    "vec3 yuv_to_rgb_2020(float y, float u, float v) {\n"
-    "    return vec3(y + 1.475*v, y - 0.165*u - 0.571*v, y + 1.881*u);\n"
-    "}\n"
-    "\n"
+    "const mat3 yuv_to_rgb = mat3(%.6f, %.6f, %.6f,\n"
+    "                             %.6f, %.6f, %.6f,\n"
+    "                             %.6f, %.6f, %.6f);\n"
+    "const vec3 yuv_offset = vec3(%.6f, %.6f, %.6f);\n"
     "void main() {\n"
-    "    float y_raw = texture2D(u_tex_y, v_uv).r;\n"
-    "    vec2 uv_raw = texture2D(u_tex_uv, v_uv).rg;\n"
-    "    float y, u, v;\n"
-    "    if (u_range == 0) {\n"
-    "        y = (y_raw - 0.0627) * 1.164;\n"
-    "        u = (uv_raw.r - 0.502) * 1.138;\n"
-    "        v = (uv_raw.g - 0.502) * 1.138;\n"
-    "    } else {\n"
-    "        y = y_raw;\n"
-    "        u = uv_raw.r - 0.5;\n"
-    "        v = uv_raw.g - 0.5;\n"
-    "    }\n"
-    "    vec3 rgb;\n"
-    "    if (u_colorspace == 0) rgb = yuv_to_rgb_601(y, u, v);\n"
-    "    else if (u_colorspace == 2) rgb = yuv_to_rgb_2020(y, u, v);\n"
-    "    else rgb = yuv_to_rgb_709(y, u, v);\n"
-    "    gl_FragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);\n"
+    "    vec3 yuv = vec3(texture2D(u_tex_y, v_uv).r, texture2D(u_tex_uv, v_uv).rg) - yuv_offset;\n"
+    "    gl_FragColor = vec4(clamp(yuv_to_rgb * yuv, 0.0, 1.0), 1.0);\n"
     "}\n";
 
+/* Chroma weights per colorspace: R += rv*V, G -= gu*U + gv*V, B += bu*U */
+static const struct {
+    float rv, gu, gv, bu;
+} yuv_coeffs[] = {
+    [CS_BT601]  = { 1.402f, 0.344f, 0.714f, 1.772f },
+    [CS_BT709]  = { 1.575f, 0.187f, 0.468f, 1.856f },
+    [CS_BT2020] = { 1.475f, 0.165f, 0.571f, 1.881f },
+};
+
 /* External texture shader for DMA-BUF path */
 static const char *frag_external_src =
     "#version 100\n"
@@ -138,13 +165,37 @@ static const char *frag_external_src =
     "    gl_FragColor = texture2D(u_tex, v_uv);\n"
     "}\n";
 
+/*
+ * RGB blit shader for the shared conversion target. The target was rendered
+ * with the same quad, so its rows are bottom-up: flip V when sampling.
+ */
+static const char *frag_rgb_src =
+    "#version 100\n"
+    "precision mediump float;\n"
+    "varying vec2 v_uv;\n"
+    "uniform sampler2D u_tex;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(u_tex, vec2(v_uv.x, 1.0 - v_uv.y));\n"
+    "}\n";
+
 /* ================================
  * Section: Cache entry
  * ================================ */
 
+/* One specialised NV12 program, built the first time a frame needs it */
+typedef struct {
+    GLuint prog;
+    GLint u_transform, u_tex_y, u_tex_uv;
+    bool tried;
+} Nv12Program;
+
 typedef struct {
     uintptr_t surface_id;
     uint64_t generation;
+    uint64_t buffer_id;         /* dma-buf inode, 0 = keyed on surface_id */
+    int fd;                     /* Pins buffer_id's dma-buf, -1 = none */
+    ColorSpace colorspace;      /* YUV hints baked into the image */
+    ColorRange color_range;
     EGLImage image;
     uint64_t last_use;
 } CacheEntry;
@@ -159,9 +210,10 @@ struct Renderer {
     EGLConfig cfg;
 
     /* Shader programs */
-    GLuint prog_nv12, prog_ext;
-    GLint u_transform_nv12, u_tex_y, u_tex_uv, u_colorspace, u_range;
+    Nv12Program nv12[CS_BT2020 + 1][CR_FULL + 1];
+    GLuint prog_ext, prog_rgb;
     GLint u_transform_ext, u_tex_ext;
+    GLint u_transform_rgb, u_tex_rgb;
 
     /* Geometry and textures */
     GLuint vbo;
@@ -172,15 +224,63 @@ struct Renderer {
     int tex_uv_w, tex_uv_h;     /* UV texture dimensions */
     bool tex_allocated;
 
-    /* EGLImage cache */
-    CacheEntry cache[EGL_CACHE_SIZE];
+    /*
+     * What the textures currently hold, so a frame drawn to several outputs
+     * is uploaded (or its EGLImage bound) only once. uploaded_seq == 0 and
+     * bound_image == EGL_NO_IMAGE mean "nothing valid".
+     */
+    uint64_t uploaded_seq;
+    int uploaded_slot;
+    EGLImage bound_image;
+
+    /*
+     * Shared conversion target: with more than one output, each new frame
+     * is converted YUV->RGB once into rgb_tex, then every output does a
+     * plain textured blit. Sized to the largest area any output needs,
+     * capped at video resolution.
+     */
+    bool shared_convert;
+    GLuint rgb_fbo, rgb_tex;
+    int rgb_w, rgb_h;
+    size_t rgb_bytes;
+    uint64_t rgb_seq;           /* Frame currently held, 0 = none */
+    bool rgb_via_dmabuf;        /* How rgb_seq was produced */
+    GLint max_tex_size;
+
+    /* EGLImage cache, cache_size entries (EGL_CACHE_SIZE..EGL_CACHE_MAX) */
+    CacheEntry *cache;
+    int cache_size;
     uint64_t frame_count;
 
+    /* GLES3 upload path */
+    bool gles3;
+    bool has_unpack_row_length;     /* GLES3 or GL_EXT_unpack_subimage */
+    GLuint pbo[PBO_RING_SIZE];
+    GLsync pbo_fence[PBO_RING_SIZE];
+    size_t pbo_size;                /* Per PBO, 0 = ring not allocated */
+    int pbo_next;
+    bool pbo_disabled;
+
+    /*
+     * udmabuf-backed ring slots imported once each, so software frames are
+     * sampled in place. Keyed on the ring's allocation generation. Each
+     * slot's fence follows its last draw; the decoder waits on it through
+     * the ring's slot_wait hook before rewriting the slot.
+     */
+    EGLImage ring_image[SW_RING_SIZE];
+    EGLSyncKHR ring_fence[SW_RING_SIZE];
+    SoftwareRing *ring_hooked;      /* Ring whose slot_wait points here */
+    uint64_t ring_image_gen;        /* 0 = none imported */
+    uint64_t ring_bound_seq;        /* Frame last bound from a ring image */
+    bool ring_import_failed;
+
     /* Driver capability flags */
     bool has_dmabuf;
     bool has_modifiers;
     bool has_yuv_hint;
     bool has_rg_texture;
+    bool has_buffer_age;            /* EGL_EXT_buffer_age: partial repaint */
+    bool has_fence_sync;            /* EGL_KHR_fence_sync: ring slot fences */
 
     /*
      * DMA-BUF import compatibility state.
@@ -194,13 +294,87 @@ struct Renderer {
     /* Statistics */
     uint64_t stat_cache_hits;
     uint64_t stat_cache_misses;
+    uint64_t stat_cache_preimports;
+    uint64_t stat_cache_hits_logged;    /* Totals at the last periodic report */
+    uint64_t stat_cache_misses_logged;
     uint64_t stat_egl_creates;
     uint64_t stat_egl_destroys;
+    uint64_t stat_uploads;
+    uint64_t stat_uploads_skipped;
+    uint64_t stat_conversions;
+    uint64_t stat_blits;
+    uint64_t stat_ring_draws;
+    uint64_t stat_tile_uploads;     /* Uploads that only sent changed tiles */
+    uint64_t stat_partial_draws;
+    uint64_t stat_damage_px;        /* Pixels repainted by partial draws */
+    uint64_t stat_full_px;          /* ...and what full repaints would have cost */
 
     char gl_renderer[128];
+
+    /* Program binary cache directory, empty = disabled */
+    char progcache_dir[256];
+    uint64_t stat_progcache_hits;
+    uint64_t stat_progcache_misses;
+
+    /* --render-threads: per-output threads, frame_fence marks conversion */
+    bool threaded;
+    RenderThread *threads;
+    GLsync frame_fence;
+    uint64_t stat_threaded_draws;
+
+    /* --gpu-timers: GL_EXT_disjoint_timer_query, see gpu_frame_begin */
+    bool has_timer_query;
+    struct GpuTimerFrame *timing;   /* Slot the current draw records into */
+    bool timing_open;
+    uint32_t timer_epoch;           /* Bumped whenever GPU timing was disjoint */
+
+    /* Surfaceless/default display, outputs are pbuffers (--benchmark) */
+    bool headless;
+
+    /* Non-NULL: alternative backend, none of the EGL/GL state is used */
+    ShmRenderer *shm;
+    DirectRenderer *direct;
+    VulkanRenderer *vk;
     GpuVendor gpu_vendor;
 };
 
+/*
+ * With --render-threads every EGL output gets a thread owning a context
+ * shared with the main one and made current on that output's surface
+ * once, for good. Per frame the main thread converts YUV->RGB once into
+ * the shared target, fences, and hands each thread a job; the threads
+ * wait on the fence on the GPU, blit, and swap in parallel. The main
+ * thread collects them in renderer_flush() before it dispatches Wayland
+ * events again, so configure handling never races a swap, and waits on
+ * their completion fences before converting the next frame over the
+ * target they sampled.
+ */
+struct RenderThread {
+    Renderer *r;
+    Output *out;
+    RenderThread *next;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EGLContext ctx;
+
+    /* Owned by the thread: uniforms are program state, so no sharing */
+    GLuint prog;
+    GLint u_transform, u_tex;
+
+    /* Handshake, guarded by lock */
+    bool started, start_ok;
+    bool busy, quit;
+
+    /* Current job, written by main while !busy */
+    GLsync ready;
+    float transform[4];
+
+    /* Result, read by main after the job completes */
+    GLsync done;
+    EGLint swap_error;
+};
+
 /* ================================
  * Section: Shader compilation
  * ================================ */
@@ -252,610 +426,2444 @@ static GLuint link_program(const char *vert, const char *frag) {
     return prog;
 }
 
-static bool has_egl_extension(EGLDisplay dpy, const char *ext) {
-    const char *exts = eglQueryString(dpy, EGL_EXTENSIONS);
-    if (!exts) return false;
+/* ================================
+ * Section: EGLImage cache
+ * ================================ */
 
-    size_t len = strlen(ext);
-    const char *p = exts;
-    while ((p = strstr(p, ext))) {
-        if ((p == exts || p[-1] == ' ') && (p[len] == 0 || p[len] == ' '))
-            return true;
-        p += len;
+static void cache_entry_release(Renderer *r, CacheEntry *e) {
+    if (e->image != EGL_NO_IMAGE) {
+        if (e->image == r->bound_image)
+            r->bound_image = EGL_NO_IMAGE;
+        eglDestroyImageKHR(r->dpy, e->image);
+        r->stat_egl_destroys++;
     }
-    return false;
+    if (e->fd >= 0) close(e->fd);
+    memset(e, 0, sizeof(*e));
+    e->image = EGL_NO_IMAGE;
+    e->fd = -1;
 }
 
-/* ================================
- * Section: Initialization and destruction
- * ================================ */
+/* Grow the cache to entries slots (never shrinks; existing images stay) */
+static bool cache_resize(Renderer *r, int entries) {
+    if (entries > EGL_CACHE_MAX) entries = EGL_CACHE_MAX;
+    if (entries <= r->cache_size) return true;
+
+    CacheEntry *cache = realloc(r->cache, entries * sizeof(CacheEntry));
+    if (!cache) return false;
+    for (int i = r->cache_size; i < entries; i++) {
+        memset(&cache[i], 0, sizeof(CacheEntry));
+        cache[i].image = EGL_NO_IMAGE;
+        cache[i].fd = -1;
+    }
+    r->cache = cache;
+    r->cache_size = entries;
+    return true;
+}
 
-int renderer_init(Renderer **out, struct wl_display *display) {
-    Renderer *r = calloc(1, sizeof(Renderer));
-    if (!r) return -1;
+static bool cache_match(const CacheEntry *e, const Frame *frame) {
+    if (e->image == EGL_NO_IMAGE) return false;
+    if (frame->hw.buffer_id)
+        return e->buffer_id == frame->hw.buffer_id &&
+               e->colorspace == frame->colorspace && e->color_range == frame->color_range;
+    return !e->buffer_id && e->surface_id == frame->hw.surface_id &&
+           e->generation == frame->hw.generation;
+}
 
-    r->dpy = eglGetDisplay((EGLNativeDisplayType)display);
-    if (r->dpy == EGL_NO_DISPLAY) {
-        LOG_ERROR("eglGetDisplay failed");
-        goto fail;
-    }
+/* Find or allocate cache entry for a HW frame */
+static CacheEntry *cache_get(Renderer *r, const Frame *frame, bool *is_hit) {
+    *is_hit = false;
 
-    EGLint major, minor;
-    if (!eglInitialize(r->dpy, &major, &minor)) {
-        LOG_ERROR("eglInitialize failed");
-        goto fail;
+    /* Look for existing entry */
+    for (int i = 0; i < r->cache_size; i++) {
+        if (cache_match(&r->cache[i], frame)) {
+            *is_hit = true;
+            r->stat_cache_hits++;
+            return &r->cache[i];
+        }
     }
-    LOG_INFO("EGL %d.%d", major, minor);
 
-    /* Check extensions */
-    r->has_dmabuf = has_egl_extension(r->dpy, "EGL_EXT_image_dma_buf_import");
-    r->has_modifiers = r->has_dmabuf && has_egl_extension(r->dpy, "EGL_EXT_image_dma_buf_import_modifiers");
-    r->has_yuv_hint = has_egl_extension(r->dpy, "EGL_EXT_yuv_surface");
+    r->stat_cache_misses++;
 
-    if (r->has_dmabuf) {
-        eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
-        eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
-        glEGLImageTargetTexture2DOES = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
-        if (!eglCreateImageKHR || !eglDestroyImageKHR || !glEGLImageTargetTexture2DOES)
-            r->has_dmabuf = false;
+    /* Find empty or LRU slot */
+    int best = 0;
+    uint64_t oldest = r->cache[0].last_use;
+    for (int i = 0; i < r->cache_size; i++) {
+        if (r->cache[i].image == EGL_NO_IMAGE) {
+            best = i;
+            break;
+        }
+        if (r->cache[i].last_use < oldest) {
+            oldest = r->cache[i].last_use;
+            best = i;
+        }
     }
 
-    LOG_INFO("DMA-BUF import: %s", r->has_dmabuf ? "yes" : "no");
-    LOG_INFO("DMA-BUF modifiers: %s", r->has_modifiers ? "yes" : "no");
+    CacheEntry *e = &r->cache[best];
+    cache_entry_release(r, e);
+    e->surface_id = frame->hw.surface_id;
+    e->generation = frame->hw.generation;
+    e->colorspace = frame->colorspace;
+    e->color_range = frame->color_range;
+    return e;
+}
 
-    /* Choose config */
-    EGLint cfg_attr[] = {
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-        EGL_NONE
-    };
+/* ================================
+ * Section: Program binary cache
+ * ================================ */
 
-    EGLint num_cfg;
-    if (!eglChooseConfig(r->dpy, cfg_attr, &r->cfg, 1, &num_cfg) || num_cfg == 0) {
-        LOG_ERROR("eglChooseConfig failed");
-        goto fail;
+/*
+ * Linked programs are persisted with glGetProgramBinary (core in GLES3,
+ * GL_OES_get_program_binary on GLES2) under $XDG_CACHE_HOME/wlvideo, one
+ * file per program named by a hash of the GL renderer, driver version and
+ * shader sources. A driver update changes the name; a binary the driver
+ * rejects anyway is deleted and rebuilt from source.
+ */
+#define PROGCACHE_MAGIC 0x53564c57u     /* "WLVS" */
+#define PROGCACHE_MAX_SIZE (16u << 20)
+
+static PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+static PFNGLPROGRAMBINARYOESPROC program_binary;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+} ProgcacheHeader;
+
+static uint64_t fnv1a(uint64_t h, const char *s) {
+    for (; s && *s; s++) {
+        h ^= (uint8_t)*s;
+        h *= 0x100000001b3ull;
     }
+    return h;
+}
 
-    eglBindAPI(EGL_OPENGL_ES_API);
+/* Pick the cache directory and binary entry points; leaves it off on failure */
+static void progcache_init(Renderer *r, const char *gl_exts) {
+    r->progcache_dir[0] = 0;
+
+    if (r->gles3) {
+        get_program_binary = glGetProgramBinary;
+        program_binary = glProgramBinary;
+    } else if (gl_exts && strstr(gl_exts, "GL_OES_get_program_binary")) {
+        get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+        program_binary = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+    } else {
+        get_program_binary = NULL;
+        program_binary = NULL;
+    }
 
-    EGLint ctx_attr[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
-    r->ctx = eglCreateContext(r->dpy, r->cfg, EGL_NO_CONTEXT, ctx_attr);
-    if (r->ctx == EGL_NO_CONTEXT) {
-        LOG_ERROR("eglCreateContext failed");
-        goto fail;
+    GLint formats = 0;
+    if (get_program_binary && program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0) {
+        LOG_INFO("Program binary cache: unsupported by driver");
+        return;
     }
 
-    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (xdg && *xdg)
+        n = snprintf(r->progcache_dir, sizeof(r->progcache_dir), "%s/wlvideo", xdg);
+    else if (home && *home)
+        n = snprintf(r->progcache_dir, sizeof(r->progcache_dir), "%s/.cache/wlvideo", home);
+    else
+        n = -1;
 
-    const char *gl_renderer = (const char *)glGetString(GL_RENDERER);
-    if (gl_renderer) {
-        strncpy(r->gl_renderer, gl_renderer, sizeof(r->gl_renderer) - 1);
-        r->gpu_vendor = vendor_from_gl_renderer(gl_renderer);
-        LOG_INFO("GL: %s", r->gl_renderer);
+    if (n < 0 || (size_t)n >= sizeof(r->progcache_dir)) {
+        r->progcache_dir[0] = 0;
+        return;
     }
 
-    const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
-    r->has_rg_texture = gl_exts && strstr(gl_exts, "GL_EXT_texture_rg");
+    /* Parent of the cache root may be missing too (fresh $HOME/.cache) */
+    char *slash = strrchr(r->progcache_dir, '/');
+    if (slash && slash != r->progcache_dir) {
+        *slash = 0;
+        mkdir(r->progcache_dir, 0700);
+        *slash = '/';
+    }
+    if (mkdir(r->progcache_dir, 0700) < 0 && errno != EEXIST) {
+        LOG_DEBUG("Program binary cache: cannot create %s: %s", r->progcache_dir, strerror(errno));
+        r->progcache_dir[0] = 0;
+        return;
+    }
+    LOG_INFO("Program binary cache: %s", r->progcache_dir);
+}
 
-    /* Compile shaders */
-    r->prog_nv12 = link_program(vert_src, frag_nv12_src);
-    if (!r->prog_nv12) goto fail;
+static bool progcache_path(Renderer *r, const char *vert, const char *frag, char *path, size_t size) {
+    if (!r->progcache_dir[0]) return false;
 
-    r->u_transform_nv12 = glGetUniformLocation(r->prog_nv12, "u_transform");
-    r->u_tex_y = glGetUniformLocation(r->prog_nv12, "u_tex_y");
-    r->u_tex_uv = glGetUniformLocation(r->prog_nv12, "u_tex_uv");
-    r->u_colorspace = glGetUniformLocation(r->prog_nv12, "u_colorspace");
-    r->u_range = glGetUniformLocation(r->prog_nv12, "u_range");
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = fnv1a(h, r->gl_renderer);
+    h = fnv1a(h, (const char *)glGetString(GL_VERSION));
+    h = fnv1a(h, vert);
+    h = fnv1a(h, frag);
 
-    r->prog_ext = link_program(vert_src, frag_external_src);
-    if (r->prog_ext) {
-        r->u_transform_ext = glGetUniformLocation(r->prog_ext, "u_transform");
-        r->u_tex_ext = glGetUniformLocation(r->prog_ext, "u_tex");
-    }
+    int n = snprintf(path, size, "%s/%016llx.glbin", r->progcache_dir, (unsigned long long)h);
+    return n > 0 && (size_t)n < size;
+}
 
-    /* Fullscreen quad geometry */
-    static const float verts[] = {
-        -1, -1,  0, 1,
-         1, -1,  1, 1,
-        -1,  1,  0, 0,
-         1,  1,  1, 0,
-    };
-    glGenBuffers(1, &r->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+static GLuint progcache_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
 
-    glGenTextures(1, &r->tex_y);
-    glGenTextures(1, &r->tex_uv);
-    glGenTextures(1, &r->tex_dmabuf);
+    ProgcacheHeader hdr;
+    void *data = NULL;
+    GLuint prog = 0;
 
-    for (int i = 0; i < EGL_CACHE_SIZE; i++)
-        r->cache[i].image = EGL_NO_IMAGE;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != PROGCACHE_MAGIC ||
+        hdr.length == 0 || hdr.length > PROGCACHE_MAX_SIZE)
+        goto fail;
 
-    *out = r;
-    return 0;
+    data = malloc(hdr.length);
+    if (!data || fread(data, 1, hdr.length, f) != hdr.length)
+        goto fail;
+
+    prog = glCreateProgram();
+    program_binary(prog, hdr.format, data, (GLint)hdr.length);
+
+    GLint ok = 0;
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        glDeleteProgram(prog);
+        prog = 0;
+        goto fail;
+    }
+
+    free(data);
+    fclose(f);
+    return prog;
 
 fail:
-    renderer_destroy(r);
-    return -1;
+    LOG_DEBUG("Program binary %s rejected, rebuilding", path);
+    free(data);
+    fclose(f);
+    unlink(path);
+    return 0;
 }
 
-void renderer_destroy(Renderer *r) {
-    if (!r) return;
-
-    renderer_log_stats(r);
+static void progcache_store(GLuint prog, const char *path) {
+    GLint len = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+    if (len <= 0 || (uint32_t)len > PROGCACHE_MAX_SIZE) return;
+
+    void *data = malloc(len);
+    if (!data) return;
+
+    GLenum format = 0;
+    GLsizei written = 0;
+    get_program_binary(prog, len, &written, &format, data);
+
+    /* Write aside and rename, so a concurrent start never reads a torn file */
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *f = written > 0 ? fopen(tmp, "wb") : NULL;
+    if (f) {
+        ProgcacheHeader hdr = { PROGCACHE_MAGIC, format, (uint32_t)written };
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                  fwrite(data, 1, written, f) == (size_t)written;
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp, path) < 0)
+            unlink(tmp);
+    }
+    free(data);
+}
 
-    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+/* link_program() behind the binary cache */
+static GLuint build_program(Renderer *r, const char *vert, const char *frag) {
+    char path[300];
+    bool cached = progcache_path(r, vert, frag, path, sizeof(path));
 
-    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
-        if (r->cache[i].image != EGL_NO_IMAGE) {
-            eglDestroyImageKHR(r->dpy, r->cache[i].image);
-            r->stat_egl_destroys++;
+    if (cached) {
+        GLuint prog = progcache_load(path);
+        if (prog) {
+            r->stat_progcache_hits++;
+            return prog;
         }
+        r->stat_progcache_misses++;
     }
 
-    glDeleteTextures(1, &r->tex_y);
-    glDeleteTextures(1, &r->tex_uv);
-    glDeleteTextures(1, &r->tex_dmabuf);
-    glDeleteBuffers(1, &r->vbo);
-    glDeleteProgram(r->prog_nv12);
-    glDeleteProgram(r->prog_ext);
-
-    if (r->ctx != EGL_NO_CONTEXT) eglDestroyContext(r->dpy, r->ctx);
-    if (r->dpy != EGL_NO_DISPLAY) eglTerminate(r->dpy);
+    GLuint prog = link_program(vert, frag);
+    if (prog && cached)
+        progcache_store(prog, path);
+    return prog;
+}
 
-    free(r);
+/*
+ * The NV12 program for a colorspace/range pair. Range expansion is folded
+ * into the matrix: rgb = M * (yuv - offset) with M = C * diag(sy, sc, sc).
+ * A variant that fails to build falls back to BT.709 limited, which
+ * renderer_init() insists on.
+ */
+static Nv12Program *nv12_program(Renderer *r, ColorSpace cs, ColorRange range) {
+    Nv12Program *p = &r->nv12[cs][range];
+    if (p->prog || p->tried)
+        return p->prog ? p : &r->nv12[CS_BT709][CR_LIMITED];
+    p->tried = true;
+
+    bool full = range == CR_FULL;
+    float sy = full ? 1.0f : 1.164f;
+    float sc = full ? 1.0f : 1.138f;
+    float oy = full ? 0.0f : 0.0627f;
+    float oc = full ? 0.5f : 0.502f;
+
+    /* mat3() takes columns: the Y, U and V contributions to (R, G, B) */
+    char frag[1024];
+    snprintf(frag, sizeof(frag), frag_nv12_fmt,
+             sy, sy, sy,
+             0.0f, -yuv_coeffs[cs].gu * sc, yuv_coeffs[cs].bu * sc,
+             yuv_coeffs[cs].rv * sc, -yuv_coeffs[cs].gv * sc, 0.0f,
+             oy, oc, oc);
+
+    p->prog = build_program(r, vert_src, frag);
+    if (!p->prog) {
+        LOG_WARN("NV12 shader variant %d/%d failed, using BT.709 limited", cs, range);
+        return &r->nv12[CS_BT709][CR_LIMITED];
+    }
+    p->u_transform = glGetUniformLocation(p->prog, "u_transform");
+    p->u_tex_y = glGetUniformLocation(p->prog, "u_tex_y");
+    p->u_tex_uv = glGetUniformLocation(p->prog, "u_tex_uv");
+    return p;
 }
 
-GpuVendor renderer_get_gpu_vendor(Renderer *r) {
-    return r ? r->gpu_vendor : GPU_VENDOR_UNKNOWN;
+static bool has_egl_extension(EGLDisplay dpy, const char *ext) {
+    const char *exts = eglQueryString(dpy, EGL_EXTENSIONS);
+    if (!exts) return false;
+
+    size_t len = strlen(ext);
+    const char *p = exts;
+    while ((p = strstr(p, ext))) {
+        if ((p == exts || p[-1] == ' ') && (p[len] == 0 || p[len] == ' '))
+            return true;
+        p += len;
+    }
+    return false;
 }
 
-const char *renderer_get_gl_renderer(Renderer *r) {
-    return r ? r->gl_renderer : NULL;
+/* ================================
+ * Section: Shared RGB conversion target
+ * ================================ */
+
+static void rgb_target_release(Renderer *r) {
+    if (r->rgb_fbo) glDeleteFramebuffers(1, &r->rgb_fbo);
+    if (r->rgb_tex) glDeleteTextures(1, &r->rgb_tex);
+    r->rgb_fbo = 0;
+    r->rgb_tex = 0;
+    r->rgb_w = r->rgb_h = 0;
+    r->rgb_seq = 0;
+    mem_release(MEM_CACHE, r->rgb_bytes);
+    r->rgb_bytes = 0;
 }
 
-void renderer_log_stats(Renderer *r) {
-    if (!r) return;
-    if (r->stat_cache_hits + r->stat_cache_misses > 0) {
-        LOG_INFO("EGL cache: %lu hits, %lu misses (%.1f%% hit rate)",
-                 (unsigned long)r->stat_cache_hits,
-                 (unsigned long)r->stat_cache_misses,
-                 100.0 * r->stat_cache_hits / (r->stat_cache_hits + r->stat_cache_misses));
+/* (Re)allocate the RGBA target if it's smaller than w×h. Never shrinks. */
+static bool rgb_target_ensure(Renderer *r, int w, int h) {
+    if (r->rgb_fbo && w <= r->rgb_w && h <= r->rgb_h)
+        return true;
+
+    if (r->rgb_w > w) w = r->rgb_w;
+    if (r->rgb_h > h) h = r->rgb_h;
+    rgb_target_release(r);
+
+    size_t bytes = (size_t)w * h * 4;
+    if (!mem_reserve(MEM_CACHE, bytes))
+        return false;
+    r->rgb_bytes = bytes;
+
+    glGenTextures(1, &r->rgb_tex);
+    glBindTexture(GL_TEXTURE_2D, r->rgb_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &r->rgb_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, r->rgb_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r->rgb_tex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        LOG_WARN("RGB conversion target incomplete (0x%x), converting per output", status);
+        rgb_target_release(r);
+        r->shared_convert = false;
+        return false;
     }
-    if (r->stat_egl_creates > 0) {
-        LOG_INFO("EGLImage: %lu created, %lu destroyed",
-                 (unsigned long)r->stat_egl_creates,
-                 (unsigned long)r->stat_egl_destroys);
+
+    r->rgb_w = w;
+    r->rgb_h = h;
+    LOG_DEBUG("RGB conversion target: %dx%d", w, h);
+    return true;
+}
+
+/*
+ * Enable the shared conversion stage when more than one output is drawing.
+ * With a single output, converting straight to the window is cheaper than
+ * convert + blit, so the target is released.
+ */
+void renderer_set_active_outputs(Renderer *r, int count) {
+    if (!r || r->shm || r->direct || r->vk) return;
+    bool want = (count > 1 || r->threaded) && r->prog_rgb;
+    if (want == r->shared_convert) return;
+
+    r->shared_convert = want;
+    if (!want) {
+        eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+        rgb_target_release(r);
     }
+    LOG_INFO("Shared RGB conversion: %s (%d outputs)", want ? "on" : "off", count);
 }
 
 /* ================================
- * Section: Output management
+ * Section: PBO upload ring
  * ================================ */
 
-int renderer_create_output(Renderer *r, Output *out) {
-    /* Validate inputs */
-    if (!r || !out) {
-        LOG_ERROR("renderer_create_output: NULL argument");
-        return -1;
+static void pbo_ring_release(Renderer *r) {
+    for (int i = 0; i < PBO_RING_SIZE; i++) {
+        if (r->pbo_fence[i]) glDeleteSync(r->pbo_fence[i]);
+        r->pbo_fence[i] = NULL;
     }
-
-    if (!out->surface) {
-        LOG_ERROR("Output %s: no Wayland surface", out->name);
-        return -1;
+    if (r->pbo_size) {
+        glDeleteBuffers(PBO_RING_SIZE, r->pbo);
+        mem_release(MEM_STAGING, r->pbo_size * PBO_RING_SIZE);
     }
+    memset(r->pbo, 0, sizeof(r->pbo));
+    r->pbo_size = 0;
+    r->pbo_next = 0;
+}
 
-    if (out->width <= 0 || out->height <= 0) {
-        LOG_ERROR("Output %s: invalid dimensions %dx%d", out->name, out->width, out->height);
-        return -1;
+static bool pbo_ring_ensure(Renderer *r, size_t size) {
+    if (!r->gles3 || r->pbo_disabled) return false;
+    if (r->pbo_size == size) return true;
+
+    pbo_ring_release(r);
+    if (!mem_reserve(MEM_STAGING, size * PBO_RING_SIZE)) {
+        r->pbo_disabled = true;
+        return false;
     }
 
-    /* Clean up any existing EGL resources first */
-    if (out->egl_surface && out->egl_surface != EGL_NO_SURFACE) {
-        EGLSurface cur_draw = eglGetCurrentSurface(EGL_DRAW);
-        if (cur_draw == out->egl_surface) {
-            eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
-        }
-        eglDestroySurface(r->dpy, out->egl_surface);
-        out->egl_surface = EGL_NO_SURFACE;
+    glGenBuffers(PBO_RING_SIZE, r->pbo);
+    for (int i = 0; i < PBO_RING_SIZE; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->pbo[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
     }
-    if (out->egl_window) {
-        wl_egl_window_destroy(out->egl_window);
-        out->egl_window = NULL;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    r->pbo_size = size;
+    LOG_DEBUG("PBO ring: %d × %zu KiB", PBO_RING_SIZE, size / 1024);
+    return true;
+}
+
+/* ================================
+ * Section: Ring slot images
+ * ================================ */
+
+/*
+ * SoftwareRing.slot_wait while slots are sampled in place: a slot is free
+ * once the fence after its last draw has signalled. Runs on the main
+ * thread, where the context that issued the fence is current, so the
+ * flush bit gets a pending fence to the GPU.
+ */
+static bool ring_slot_wait(void *ctx, int slot, uint64_t timeout_ns) {
+    Renderer *r = ctx;
+    EGLSyncKHR fence = r->ring_fence[slot];
+    if (fence == EGL_NO_SYNC_KHR) return true;
+
+    EGLint st = eglClientWaitSyncKHR(r->dpy, fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, timeout_ns);
+    if (st != EGL_CONDITION_SATISFIED_KHR) return false;
+    eglDestroySyncKHR(r->dpy, fence);
+    r->ring_fence[slot] = EGL_NO_SYNC_KHR;
+    return true;
+}
+
+static void ring_images_release(Renderer *r) {
+    if (r->ring_hooked && r->ring_hooked->slot_wait_ctx == r) {
+        r->ring_hooked->slot_wait = NULL;
+        r->ring_hooked->slot_wait_ctx = NULL;
     }
+    r->ring_hooked = NULL;
 
-    out->egl_window = wl_egl_window_create(out->surface, out->width, out->height);
-    if (!out->egl_window) {
-        LOG_ERROR("Output %s: wl_egl_window_create failed", out->name);
+    for (int i = 0; i < SW_RING_SIZE; i++) {
+        if (r->ring_fence[i] != EGL_NO_SYNC_KHR) {
+            eglDestroySyncKHR(r->dpy, r->ring_fence[i]);
+            r->ring_fence[i] = EGL_NO_SYNC_KHR;
+        }
+        if (r->ring_image[i] == EGL_NO_IMAGE) continue;
+        if (r->ring_image[i] == r->bound_image)
+            r->bound_image = EGL_NO_IMAGE;
+        eglDestroyImageKHR(r->dpy, r->ring_image[i]);
+        r->ring_image[i] = EGL_NO_IMAGE;
+        r->stat_egl_destroys++;
+    }
+    r->ring_image_gen = 0;
+    r->ring_bound_seq = 0;
+}
+
+/* ================================
+ * Section: GPU timers
+ * ================================ */
+
+/*
+ * --gpu-timers: GL_EXT_disjoint_timer_query spans around texture upload,
+ * EGLImage binding and drawing, per output. A draw records into one of
+ * GPU_TIMER_LAG frame slots; results are folded in only once the GPU
+ * reports them available, so timing never stalls the pipeline. A slot
+ * still outstanding when its turn comes round again is dropped rather
+ * than waited for. Outputs on render threads are not timed.
+ */
+#define GPU_TIMER_LAG 4         /* Frames a result has to come back */
+#define GPU_TIMER_SPANS 8       /* Spans per frame (shared convert: two draws) */
+#define GPU_TIMER_WINDOW 256    /* Recent samples behind the p99 */
+#define GPU_TIMER_REPORT 600    /* Timed frames between -v reports */
+
+typedef enum {
+    GPU_STAGE_UPLOAD,
+    GPU_STAGE_BIND,
+    GPU_STAGE_DRAW,
+    GPU_STAGE_COUNT
+} GpuStage;
+
+static const char *const gpu_stage_names[GPU_STAGE_COUNT] = { "upload", "bind", "draw" };
+
+typedef struct GpuTimerFrame {
+    GLuint query[GPU_TIMER_SPANS];
+    uint8_t stage[GPU_TIMER_SPANS];
+    int count;                  /* Spans issued, 0 = nothing outstanding */
+    uint32_t epoch;
+} GpuTimerFrame;
+
+typedef struct {
+    uint64_t count;
+    double min_ms;
+    double total_ms;
+    float window[GPU_TIMER_WINDOW];
+} GpuStageStats;
+
+typedef struct GpuTimers {
+    GpuTimerFrame frames[GPU_TIMER_LAG];
+    int next;
+    GpuStageStats stage[GPU_STAGE_COUNT];
+    uint64_t frames_timed;
+    uint64_t frames_dropped;    /* Not back within GPU_TIMER_LAG frames */
+    uint64_t frames_disjoint;   /* Discarded, GPU timing was disturbed */
+} GpuTimers;
+
+static PFNGLGENQUERIESEXTPROC gen_queries;
+static PFNGLDELETEQUERIESEXTPROC delete_queries;
+static PFNGLBEGINQUERYEXTPROC begin_query;
+static PFNGLENDQUERYEXTPROC end_query;
+static PFNGLGETQUERYOBJECTUIVEXTPROC get_query_uiv;
+static PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64v;
+
+static void gpu_timers_init(Renderer *r, const char *gl_exts) {
+    r->has_timer_query = false;
+    if (!g_app || !g_app->config.gpu_timers) return;
+
+    if (!gl_exts || !strstr(gl_exts, "GL_EXT_disjoint_timer_query")) {
+        LOG_WARN("GPU timers: GL_EXT_disjoint_timer_query unsupported, not timing");
+        return;
+    }
+    gen_queries = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+    delete_queries = (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+    begin_query = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+    end_query = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+    get_query_uiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+    get_query_ui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!gen_queries || !delete_queries || !begin_query || !end_query ||
+        !get_query_uiv || !get_query_ui64v) {
+        LOG_WARN("GPU timers: query entry points missing, not timing");
+        return;
+    }
+
+    /* Reading the flag clears it; start from a clean slate */
+    GLint disjoint;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+    r->has_timer_query = true;
+    LOG_INFO("GPU timers: upload, bind and draw timed per output");
+}
+
+static void gpu_stage_add(GpuStageStats *s, double ms) {
+    if (s->count == 0 || ms < s->min_ms) s->min_ms = ms;
+    s->window[s->count % GPU_TIMER_WINDOW] = (float)ms;
+    s->total_ms += ms;
+    s->count++;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static double gpu_stage_p99(const GpuStageStats *s) {
+    float sorted[GPU_TIMER_WINDOW];
+    int n = s->count < GPU_TIMER_WINDOW ? (int)s->count : GPU_TIMER_WINDOW;
+    memcpy(sorted, s->window, sizeof(float) * n);
+    qsort(sorted, n, sizeof(float), cmp_float);
+    int idx = (n * 99 + 99) / 100 - 1;
+    return sorted[idx < 0 ? 0 : idx];
+}
+
+/* Fold in every slot whose results are back; never waits on the GPU */
+static void gpu_timers_collect(Renderer *r, GpuTimers *t, const Output *out) {
+    for (int i = 0; i < GPU_TIMER_LAG; i++) {
+        GpuTimerFrame *f = &t->frames[i];
+        if (f->count == 0) continue;
+
+        if (f->epoch != r->timer_epoch) {
+            f->count = 0;
+            t->frames_disjoint++;
+            continue;
+        }
+
+        bool ready = true;
+        for (int s = 0; s < f->count && ready; s++) {
+            GLuint avail = 0;
+            get_query_uiv(f->query[s], GL_QUERY_RESULT_AVAILABLE_EXT, &avail);
+            ready = avail != 0;
+        }
+        if (!ready) continue;
+
+        double ms[GPU_STAGE_COUNT] = { 0 };
+        bool seen[GPU_STAGE_COUNT] = { false };
+        for (int s = 0; s < f->count; s++) {
+            GLuint64 ns = 0;
+            get_query_ui64v(f->query[s], GL_QUERY_RESULT_EXT, &ns);
+            ms[f->stage[s]] += ns / 1e6;
+            seen[f->stage[s]] = true;
+        }
+        for (int s = 0; s < GPU_STAGE_COUNT; s++)
+            if (seen[s]) gpu_stage_add(&t->stage[s], ms[s]);
+        f->count = 0;
+
+        if (++t->frames_timed % GPU_TIMER_REPORT == 0)
+            renderer_log_gpu_timers(r, out, true);
+    }
+}
+
+/* Close the open span, if any */
+static void gpu_span_end(Renderer *r) {
+    if (!r->timing_open) return;
+    end_query(GL_TIME_ELAPSED_EXT);
+    r->timing->count++;
+    r->timing_open = false;
+}
+
+/* Spans don't nest: starting one ends the previous */
+static void gpu_span_begin(Renderer *r, GpuStage stage) {
+    GpuTimerFrame *f = r->timing;
+    if (!f) return;
+    gpu_span_end(r);
+    if (f->count == GPU_TIMER_SPANS) return;
+    f->stage[f->count] = (uint8_t)stage;
+    begin_query(GL_TIME_ELAPSED_EXT, f->query[f->count]);
+    r->timing_open = true;
+}
+
+static void gpu_frame_begin(Renderer *r, Output *out) {
+    r->timing = NULL;
+    r->timing_open = false;
+    if (!r->has_timer_query || out->render_thread) return;
+
+    if (!out->gpu_timers) {
+        out->gpu_timers = calloc(1, sizeof(GpuTimers));
+        if (!out->gpu_timers) return;
+        for (int i = 0; i < GPU_TIMER_LAG; i++)
+            gen_queries(GPU_TIMER_SPANS, out->gpu_timers->frames[i].query);
+    }
+    GpuTimers *t = out->gpu_timers;
+
+    /* A disjoint event spoils whatever is in flight, on every output */
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) r->timer_epoch++;
+
+    gpu_timers_collect(r, t, out);
+
+    GpuTimerFrame *f = &t->frames[t->next];
+    if (f->count > 0) {
+        f->count = 0;
+        t->frames_dropped++;
+    }
+    f->epoch = r->timer_epoch;
+    r->timing = f;
+}
+
+static void gpu_frame_end(Renderer *r, Output *out) {
+    if (!r->timing) return;
+    gpu_span_end(r);
+    out->gpu_timers->next = (out->gpu_timers->next + 1) % GPU_TIMER_LAG;
+    r->timing = NULL;
+}
+
+static void gpu_timers_release(Renderer *r, Output *out) {
+    if (!out->gpu_timers) return;
+    if (eglGetCurrentContext() != r->ctx)
+        eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+    for (int i = 0; i < GPU_TIMER_LAG; i++)
+        delete_queries(GPU_TIMER_SPANS, out->gpu_timers->frames[i].query);
+    free(out->gpu_timers);
+    out->gpu_timers = NULL;
+}
+
+/* {"upload": {...}, ...} for the benchmark report, null without timings */
+void renderer_write_gpu_timers_json(Renderer *r, FILE *f, const Output *out) {
+    GpuTimers *t = out->gpu_timers;
+    if (t && r && r->has_timer_query) {
+        /* Pick up the last frames still in flight */
+        glFinish();
+        gpu_timers_collect(r, t, out);
+    }
+    if (!t || t->frames_timed == 0) {
+        fputs("null", f);
+        return;
+    }
+
+    fprintf(f, "{\"frames\": %lu, \"dropped\": %lu, \"disjoint\": %lu",
+            (unsigned long)t->frames_timed, (unsigned long)t->frames_dropped,
+            (unsigned long)t->frames_disjoint);
+    for (int s = 0; s < GPU_STAGE_COUNT; s++) {
+        const GpuStageStats *st = &t->stage[s];
+        if (st->count == 0) continue;
+        fprintf(f, ", \"%s\": {\"count\": %lu, \"min_ms\": %.4f, \"avg_ms\": %.4f, \"p99_ms\": %.4f}",
+                gpu_stage_names[s], (unsigned long)st->count, st->min_ms,
+                st->total_ms / st->count, gpu_stage_p99(st));
+    }
+    fputc('}', f);
+}
+
+void renderer_log_gpu_timers(Renderer *r, const Output *out, bool verbose_only) {
+    (void)r;
+    const GpuTimers *t = out->gpu_timers;
+    if (!t || t->frames_timed == 0) return;
+    if (verbose_only && !(g_app && g_app->config.verbose)) return;
+
+    char line[256];
+    int len = 0;
+    for (int s = 0; s < GPU_STAGE_COUNT; s++) {
+        const GpuStageStats *st = &t->stage[s];
+        if (st->count == 0 || len >= (int)sizeof(line)) continue;
+        len += snprintf(line + len, sizeof(line) - len, "%s%s %.3f/%.3f/%.3f",
+                        len ? ", " : "", gpu_stage_names[s], st->min_ms,
+                        st->total_ms / st->count, gpu_stage_p99(st));
+    }
+    if (len == 0) return;
+
+    if (verbose_only)
+        LOG_DEBUG("Output %s: GPU ms min/avg/p99: %s (%lu frames, %lu dropped, %lu disjoint)",
+                  out->name, line, (unsigned long)t->frames_timed,
+                  (unsigned long)t->frames_dropped, (unsigned long)t->frames_disjoint);
+    else
+        LOG_INFO("Output %s: GPU ms min/avg/p99: %s (%lu frames, %lu dropped, %lu disjoint)",
+                 out->name, line, (unsigned long)t->frames_timed,
+                 (unsigned long)t->frames_dropped, (unsigned long)t->frames_disjoint);
+}
+
+/* ================================
+ * Section: Initialization and destruction
+ * ================================ */
+
+/* EGL_IMG_context_priority */
+#ifndef EGL_CONTEXT_PRIORITY_LEVEL_IMG
+#define EGL_CONTEXT_PRIORITY_LEVEL_IMG 0x3100
+#define EGL_CONTEXT_PRIORITY_HIGH_IMG 0x3101
+#define EGL_CONTEXT_PRIORITY_MEDIUM_IMG 0x3102
+#define EGL_CONTEXT_PRIORITY_LOW_IMG 0x3103
+#endif
+
+static const char *context_priority_name(EGLint prio) {
+    switch (prio) {
+    case EGL_CONTEXT_PRIORITY_HIGH_IMG: return "high";
+    case EGL_CONTEXT_PRIORITY_MEDIUM_IMG: return "medium";
+    case EGL_CONTEXT_PRIORITY_LOW_IMG: return "low";
+    default: return "unknown";
+    }
+}
+
+/*
+ * Display for headless runs: Mesa's surfaceless platform needs neither a
+ * compositor nor a window system, and still offers pbuffers. Other EGL
+ * implementations get the default display and must provide pbuffers.
+ */
+static EGLDisplay headless_display(void) {
+    const char *client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_exts && strstr(client_exts, "EGL_MESA_platform_surfaceless") &&
+        strstr(client_exts, "EGL_EXT_platform_base")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (dpy != EGL_NO_DISPLAY) {
+                LOG_INFO("EGL: surfaceless platform");
+                return dpy;
+            }
+        }
+    }
+    LOG_INFO("EGL: default display (no surfaceless platform)");
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int renderer_init(Renderer **out, struct wl_display *display, bool low_priority) {
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return -1;
+    if (!cache_resize(r, EGL_CACHE_SIZE)) {
+        free(r);
         return -1;
     }
 
-    out->egl_surface = eglCreateWindowSurface(r->dpy, r->cfg, (EGLNativeWindowType)out->egl_window, NULL);
-    if (out->egl_surface == EGL_NO_SURFACE) {
-        EGLint err = eglGetError();
-        LOG_ERROR("Output %s: eglCreateWindowSurface failed: %s (0x%x)",
-                  out->name, egl_error_name(err), err);
-        if (g_app && (err == EGL_BAD_ALLOC || err == EGL_BAD_SURFACE ||
-                      err == EGL_BAD_NATIVE_WINDOW || err == EGL_CONTEXT_LOST))
-            g_app->renderer_needs_reset = true;
-        wl_egl_window_destroy(out->egl_window);
-        out->egl_window = NULL;
+    /* No Wayland display: headless (--benchmark), pbuffer outputs only */
+    r->headless = !display;
+    r->dpy = display ? eglGetDisplay((EGLNativeDisplayType)display) : headless_display();
+    if (r->dpy == EGL_NO_DISPLAY) {
+        LOG_ERROR("eglGetDisplay failed");
+        goto fail;
+    }
+
+    EGLint major, minor;
+    if (!eglInitialize(r->dpy, &major, &minor)) {
+        LOG_ERROR("eglInitialize failed");
+        goto fail;
+    }
+    LOG_INFO("EGL %d.%d", major, minor);
+
+    /* Check extensions */
+    r->has_dmabuf = has_egl_extension(r->dpy, "EGL_EXT_image_dma_buf_import");
+    r->has_modifiers = r->has_dmabuf && has_egl_extension(r->dpy, "EGL_EXT_image_dma_buf_import_modifiers");
+    r->has_yuv_hint = has_egl_extension(r->dpy, "EGL_EXT_yuv_surface");
+    r->has_buffer_age = has_egl_extension(r->dpy, "EGL_EXT_buffer_age");
+
+    /* KHR and EXT variants share a signature */
+    if (has_egl_extension(r->dpy, "EGL_KHR_swap_buffers_with_damage"))
+        eglSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if (has_egl_extension(r->dpy, "EGL_EXT_swap_buffers_with_damage"))
+        eglSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    else
+        eglSwapBuffersWithDamage = NULL;
+
+    if (has_egl_extension(r->dpy, "EGL_KHR_fence_sync")) {
+        eglCreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        eglDestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        eglClientWaitSyncKHR = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+        r->has_fence_sync = eglCreateSyncKHR && eglDestroySyncKHR && eglClientWaitSyncKHR;
+    }
+
+    if (r->has_dmabuf) {
+        eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+        glEGLImageTargetTexture2DOES = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+        if (!eglCreateImageKHR || !eglDestroyImageKHR || !glEGLImageTargetTexture2DOES)
+            r->has_dmabuf = false;
+    }
+
+    LOG_INFO("DMA-BUF import: %s", r->has_dmabuf ? "yes" : "no");
+    LOG_INFO("DMA-BUF modifiers: %s", r->has_modifiers ? "yes" : "no");
+    LOG_INFO("Partial repaint: buffer age %s, swap with damage %s",
+             r->has_buffer_age ? "yes" : "no", eglSwapBuffersWithDamage ? "yes" : "no");
+
+    /* Choose config: prefer one that can also back a GLES3 context */
+    EGLint cfg_attr[] = {
+        EGL_SURFACE_TYPE, r->headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_NONE
+    };
+
+    EGLint num_cfg = 0;
+    bool es3_config = eglChooseConfig(r->dpy, cfg_attr, &r->cfg, 1, &num_cfg) && num_cfg > 0;
+    if (!es3_config) {
+        cfg_attr[9] = EGL_OPENGL_ES2_BIT;
+        if (!eglChooseConfig(r->dpy, cfg_attr, &r->cfg, 1, &num_cfg) || num_cfg == 0) {
+            LOG_ERROR("eglChooseConfig failed");
+            goto fail;
+        }
+    }
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    /*
+     * Background mode: ask for a low-priority GPU context so the wallpaper
+     * yields to foreground clients. The driver may ignore or clamp the
+     * request, so read the level back to report what we actually got.
+     */
+    bool has_ctx_priority = has_egl_extension(r->dpy, "EGL_IMG_context_priority");
+    EGLint ctx_attr[5] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    if (low_priority && has_ctx_priority) {
+        ctx_attr[2] = EGL_CONTEXT_PRIORITY_LEVEL_IMG;
+        ctx_attr[3] = EGL_CONTEXT_PRIORITY_LOW_IMG;
+        ctx_attr[4] = EGL_NONE;
+    }
+
+    /* Negotiate GLES3, fall back to GLES2 */
+    r->ctx = es3_config ? eglCreateContext(r->dpy, r->cfg, EGL_NO_CONTEXT, ctx_attr) : EGL_NO_CONTEXT;
+    if (r->ctx == EGL_NO_CONTEXT) {
+        ctx_attr[1] = 2;
+        r->ctx = eglCreateContext(r->dpy, r->cfg, EGL_NO_CONTEXT, ctx_attr);
+    }
+    if (r->ctx == EGL_NO_CONTEXT) {
+        LOG_ERROR("eglCreateContext failed");
+        goto fail;
+    }
+
+    if (low_priority) {
+        EGLint prio = 0;
+        if (!has_ctx_priority)
+            LOG_WARN("QoS: GPU context priority unavailable (no EGL_IMG_context_priority)");
+        else if (eglQueryContext(r->dpy, r->ctx, EGL_CONTEXT_PRIORITY_LEVEL_IMG, &prio))
+            LOG_INFO("QoS: GPU context priority %s", context_priority_name(prio));
+    }
+
+    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+
+    const char *gl_renderer = (const char *)glGetString(GL_RENDERER);
+    if (gl_renderer) {
+        strncpy(r->gl_renderer, gl_renderer, sizeof(r->gl_renderer) - 1);
+        r->gpu_vendor = vendor_from_gl_renderer(gl_renderer);
+        LOG_INFO("GL: %s", r->gl_renderer);
+    }
+
+    const char *gl_version = (const char *)glGetString(GL_VERSION);
+    r->gles3 = ctx_attr[1] >= 3 && gl_version && strncmp(gl_version, "OpenGL ES 3", 11) == 0;
+    LOG_INFO("GL context: %s", gl_version ? gl_version : "unknown");
+
+    const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+    r->has_rg_texture = r->gles3 || (gl_exts && strstr(gl_exts, "GL_EXT_texture_rg"));
+    r->has_unpack_row_length = r->gles3 || (gl_exts && strstr(gl_exts, "GL_EXT_unpack_subimage"));
+    LOG_INFO("Upload path: %s", r->gles3 ? "GLES3 (PBO ring, immutable textures)" :
+             r->has_unpack_row_length ? "GLES2 (strided)" : "GLES2 (per-row)");
+
+    /*
+     * Build shaders, from the binary cache where possible. Only the most
+     * common NV12 variant is built up front, as the one all others fall
+     * back to; the rest are built when a frame first needs them.
+     */
+    progcache_init(r, gl_exts);
+    gpu_timers_init(r, gl_exts);
+    if (!nv12_program(r, CS_BT709, CR_LIMITED)->prog) goto fail;
+
+    r->prog_ext = build_program(r, vert_src, frag_external_src);
+    if (r->prog_ext) {
+        r->u_transform_ext = glGetUniformLocation(r->prog_ext, "u_transform");
+        r->u_tex_ext = glGetUniformLocation(r->prog_ext, "u_tex");
+    }
+
+    /* Optional: without it every output converts on its own */
+    r->prog_rgb = build_program(r, vert_src, frag_rgb_src);
+    if (r->prog_rgb) {
+        r->u_transform_rgb = glGetUniformLocation(r->prog_rgb, "u_transform");
+        r->u_tex_rgb = glGetUniformLocation(r->prog_rgb, "u_tex");
+    }
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &r->max_tex_size);
+
+    /*
+     * Threads blit the shared RGB target and sync with GLES3 fences. The
+     * main thread converts with no surface bound while they own the window
+     * surfaces, which takes EGL_KHR_surfaceless_context.
+     */
+    r->threaded = g_app && g_app->config.render_threads;
+    if (r->threaded && (!r->gles3 || !r->prog_rgb)) {
+        LOG_WARN("Render threads need GLES3 and the RGB blit shader, drawing outputs serially");
+        r->threaded = false;
+    }
+    if (r->threaded && !has_egl_extension(r->dpy, "EGL_KHR_surfaceless_context")) {
+        LOG_WARN("Render threads need EGL_KHR_surfaceless_context, drawing outputs serially");
+        r->threaded = false;
+    }
+    if (r->threaded) {
+        r->shared_convert = true;
+        LOG_INFO("Render threads: one per output");
+    }
+
+    /* Fullscreen quad geometry */
+    static const float verts[] = {
+        -1, -1,  0, 1,
+         1, -1,  1, 1,
+        -1,  1,  0, 0,
+         1,  1,  1, 0,
+    };
+    glGenBuffers(1, &r->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+
+    glGenTextures(1, &r->tex_y);
+    glGenTextures(1, &r->tex_uv);
+    glGenTextures(1, &r->tex_dmabuf);
+
+    for (int i = 0; i < SW_RING_SIZE; i++) {
+        r->ring_image[i] = EGL_NO_IMAGE;
+        r->ring_fence[i] = EGL_NO_SYNC_KHR;
+    }
+    r->bound_image = EGL_NO_IMAGE;
+    r->uploaded_slot = -1;
+
+    *out = r;
+    return 0;
+
+fail:
+    renderer_destroy(r);
+    return -1;
+}
+
+int renderer_init_shm(Renderer **out, struct wl_shm *shm, int threads) {
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return -1;
+
+    r->dpy = EGL_NO_DISPLAY;
+    r->ctx = EGL_NO_CONTEXT;
+    r->shm = shm_renderer_create(shm, threads);
+    if (!r->shm) {
+        free(r);
         return -1;
     }
+    snprintf(r->gl_renderer, sizeof(r->gl_renderer), "wl_shm (CPU)");
 
-    LOG_DEBUG("Output %s: EGL surface created (%dx%d)", out->name, out->width, out->height);
+    *out = r;
     return 0;
 }
 
-void renderer_destroy_output(Renderer *r, Output *out) {
-    if (!r) return;
+int renderer_init_direct(Renderer **out, App *app) {
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return -1;
 
-    if (out->egl_surface && out->egl_surface != EGL_NO_SURFACE) {
-        /* Make sure we're not current on this surface before destroying */
-        EGLSurface cur_draw = eglGetCurrentSurface(EGL_DRAW);
-        if (cur_draw == out->egl_surface) {
-            eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
-        }
-        eglDestroySurface(r->dpy, out->egl_surface);
-        out->egl_surface = EGL_NO_SURFACE;
-        LOG_DEBUG("Output %s: EGL surface destroyed", out->name);
+    r->dpy = EGL_NO_DISPLAY;
+    r->ctx = EGL_NO_CONTEXT;
+    r->direct = direct_renderer_create(app);
+    if (!r->direct) {
+        free(r);
+        return -1;
     }
-    if (out->egl_window) {
-        wl_egl_window_destroy(out->egl_window);
-        out->egl_window = NULL;
+    snprintf(r->gl_renderer, sizeof(r->gl_renderer), "direct (compositor)");
+
+    *out = r;
+    return 0;
+}
+
+int renderer_init_vulkan(Renderer **out, App *app) {
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return -1;
+
+    r->dpy = EGL_NO_DISPLAY;
+    r->ctx = EGL_NO_CONTEXT;
+    r->vk = vk_renderer_create(app);
+    if (!r->vk) {
+        free(r);
+        return -1;
     }
+    r->gpu_vendor = vk_renderer_vendor(r->vk);
+    snprintf(r->gl_renderer, sizeof(r->gl_renderer), "Vulkan: %s", vk_renderer_name(r->vk));
+
+    *out = r;
+    return 0;
+}
+
+void renderer_destroy(Renderer *r) {
+    if (!r) return;
+
+    renderer_log_stats(r);
+
+    if (r->shm || r->direct || r->vk) {
+        shm_renderer_destroy(r->shm);
+        direct_renderer_destroy(r->direct);
+        vk_renderer_destroy(r->vk);
+        free(r);
+        return;
+    }
+
+    while (r->threads)
+        render_thread_stop(r, r->threads->out);
+
+    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+    if (r->frame_fence) glDeleteSync(r->frame_fence);
+
+    for (int i = 0; i < r->cache_size; i++)
+        cache_entry_release(r, &r->cache[i]);
+    free(r->cache);
+
+    rgb_target_release(r);
+    pbo_ring_release(r);
+    ring_images_release(r);
+    glDeleteTextures(1, &r->tex_y);
+    glDeleteTextures(1, &r->tex_uv);
+    glDeleteTextures(1, &r->tex_dmabuf);
+    glDeleteBuffers(1, &r->vbo);
+    for (int cs = 0; cs <= CS_BT2020; cs++)
+        for (int range = 0; range <= CR_FULL; range++)
+            glDeleteProgram(r->nv12[cs][range].prog);
+    glDeleteProgram(r->prog_ext);
+    glDeleteProgram(r->prog_rgb);
+
+    if (r->ctx != EGL_NO_CONTEXT) eglDestroyContext(r->dpy, r->ctx);
+    if (r->dpy != EGL_NO_DISPLAY) eglTerminate(r->dpy);
+
+    free(r);
+}
+
+GpuVendor renderer_get_gpu_vendor(Renderer *r) {
+    return r ? r->gpu_vendor : GPU_VENDOR_UNKNOWN;
+}
+
+const char *renderer_get_gl_renderer(Renderer *r) {
+    return r ? r->gl_renderer : NULL;
+}
+
+static int cache_live(const Renderer *r) {
+    int n = 0;
+    for (int i = 0; i < r->cache_size; i++)
+        if (r->cache[i].image != EGL_NO_IMAGE) n++;
+    return n;
+}
+
+/*
+ * Imported images (or, for shm, wl_buffers) alive right now, whichever
+ * backend is active: what a leak would grow, unlike the cache capacity.
+ */
+int renderer_live_images(Renderer *r) {
+    if (!r) return 0;
+    if (r->shm) return shm_live_buffers(r->shm);
+    if (r->direct) return direct_live_buffers(r->direct);
+    if (r->vk) return vk_live_images(r->vk);
+    int n = cache_live(r);
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        if (r->ring_image[i] != EGL_NO_IMAGE) n++;
+    return n;
+}
+
+void renderer_log_stats(Renderer *r) {
+    if (!r) return;
+    LOG_INFO("Live images: %d (%s)", renderer_live_images(r),
+             r->shm ? "wl_shm buffers" : r->direct ? "dma-buf wl_buffers" :
+             r->vk ? "VkImages" : "EGLImages");
+    if (r->shm || r->direct || r->vk) {
+        shm_log_stats(r->shm);
+        direct_log_stats(r->direct);
+        vk_log_stats(r->vk);
+        return;
+    }
+    if (r->stat_cache_hits + r->stat_cache_misses > 0) {
+        LOG_INFO("EGL cache: %lu hits, %lu misses (%.1f%% hit rate), %lu pre-imported, %d/%d entries live",
+                 (unsigned long)r->stat_cache_hits,
+                 (unsigned long)r->stat_cache_misses,
+                 100.0 * r->stat_cache_hits / (r->stat_cache_hits + r->stat_cache_misses),
+                 (unsigned long)r->stat_cache_preimports, cache_live(r), r->cache_size);
+    }
+    if (r->stat_uploads + r->stat_uploads_skipped > 0) {
+        LOG_INFO("Texture upload: %lu uploads, %lu skipped (already resident)",
+                 (unsigned long)r->stat_uploads,
+                 (unsigned long)r->stat_uploads_skipped);
+    }
+    if (r->stat_tile_uploads > 0) {
+        LOG_INFO("Tile uploads: %lu frames sent only changed tiles",
+                 (unsigned long)r->stat_tile_uploads);
+    }
+    if (r->stat_partial_draws > 0) {
+        LOG_INFO("Partial repaint: %lu draws, %.1f%% of full-frame pixels",
+                 (unsigned long)r->stat_partial_draws,
+                 100.0 * r->stat_damage_px / (r->stat_full_px ? r->stat_full_px : 1));
+    }
+    if (r->stat_ring_draws > 0) {
+        LOG_INFO("Ring slots: %lu frames sampled in place (no upload)",
+                 (unsigned long)r->stat_ring_draws);
+    }
+    if (r->stat_conversions > 0) {
+        LOG_INFO("Shared RGB conversion: %lu conversions, %lu blits",
+                 (unsigned long)r->stat_conversions,
+                 (unsigned long)r->stat_blits);
+    }
+    if (r->stat_threaded_draws > 0) {
+        LOG_INFO("Render threads: %lu output draws handed off",
+                 (unsigned long)r->stat_threaded_draws);
+    }
+    if (r->stat_progcache_hits + r->stat_progcache_misses > 0) {
+        LOG_INFO("Program binary cache: %lu loaded, %lu built from source",
+                 (unsigned long)r->stat_progcache_hits,
+                 (unsigned long)r->stat_progcache_misses);
+    }
+    if (r->stat_egl_creates > 0) {
+        LOG_INFO("EGLImage: %lu created, %lu destroyed",
+                 (unsigned long)r->stat_egl_creates,
+                 (unsigned long)r->stat_egl_destroys);
+    }
+}
+
+/* ================================
+ * Section: Output management
+ * ================================ */
+
+/* EGL window size: the output size unless --render-scale shrank it */
+static int render_w(const Output *out) {
+    return out->render_width > 0 ? out->render_width : out->width;
+}
+
+static int render_h(const Output *out) {
+    return out->render_height > 0 ? out->render_height : out->height;
+}
+
+/* Headless output: a pbuffer of the output size, swaps are no-ops */
+static int create_pbuffer_output(Renderer *r, Output *out) {
+    EGLint attr[] = { EGL_WIDTH, render_w(out), EGL_HEIGHT, render_h(out), EGL_NONE };
+    out->egl_surface = eglCreatePbufferSurface(r->dpy, r->cfg, attr);
+    if (out->egl_surface == EGL_NO_SURFACE) {
+        EGLint err = eglGetError();
+        LOG_ERROR("Output %s: eglCreatePbufferSurface failed: %s (0x%x)",
+                  out->name, egl_error_name(err), err);
+        return -1;
+    }
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+    LOG_DEBUG("Output %s: pbuffer created (%dx%d)", out->name, render_w(out), render_h(out));
+    return 0;
+}
+
+int renderer_create_output(Renderer *r, Output *out) {
+    /* Validate inputs */
+    if (!r || !out) {
+        LOG_ERROR("renderer_create_output: NULL argument");
+        return -1;
+    }
+
+    if (r->shm || r->direct || r->vk) {
+        if (!out->surface || out->width <= 0 || out->height <= 0) return -1;
+        if (r->vk) return vk_create_output(r->vk, out);
+        return r->shm ? shm_create_output(r->shm, out) : direct_create_output(r->direct, out);
+    }
+
+    if (!out->surface && !r->headless) {
+        LOG_ERROR("Output %s: no Wayland surface", out->name);
+        return -1;
+    }
+
+    if (out->width <= 0 || out->height <= 0) {
+        LOG_ERROR("Output %s: invalid dimensions %dx%d", out->name, out->width, out->height);
+        return -1;
+    }
+
+    /* Clean up any existing EGL resources first */
+    render_thread_stop(r, out);
+    if (out->egl_surface && out->egl_surface != EGL_NO_SURFACE) {
+        EGLSurface cur_draw = eglGetCurrentSurface(EGL_DRAW);
+        if (cur_draw == out->egl_surface) {
+            eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+        }
+        eglDestroySurface(r->dpy, out->egl_surface);
+        out->egl_surface = EGL_NO_SURFACE;
+    }
+    if (out->egl_window) {
+        wl_egl_window_destroy(out->egl_window);
+        out->egl_window = NULL;
+    }
+
+    if (r->headless)
+        return create_pbuffer_output(r, out);
+
+    /* Fit: black background on the layer surface, video on a subsurface */
+    if (g_app && wayland_letterbox_wanted(g_app)) {
+        if (!out->video_surface && wayland_create_letterbox(out) < 0)
+            LOG_WARN("Output %s: letterbox subsurface unavailable, drawing bars with GL", out->name);
+    } else {
+        wayland_destroy_letterbox(out);
+    }
+
+    struct wl_surface *target = out->video_surface ? out->video_surface : out->surface;
+    out->egl_window = wl_egl_window_create(target, render_w(out), render_h(out));
+    if (!out->egl_window) {
+        LOG_ERROR("Output %s: wl_egl_window_create failed", out->name);
+        return -1;
+    }
+
+    out->egl_surface = eglCreateWindowSurface(r->dpy, r->cfg, (EGLNativeWindowType)out->egl_window, NULL);
+    if (out->egl_surface == EGL_NO_SURFACE) {
+        EGLint err = eglGetError();
+        LOG_ERROR("Output %s: eglCreateWindowSurface failed: %s (0x%x)",
+                  out->name, egl_error_name(err), err);
+        if (g_app && (err == EGL_BAD_ALLOC || err == EGL_BAD_SURFACE ||
+                      err == EGL_BAD_NATIVE_WINDOW || err == EGL_CONTEXT_LOST))
+            g_app->renderer_needs_reset = true;
+        wl_egl_window_destroy(out->egl_window);
+        out->egl_window = NULL;
+        return -1;
+    }
+
+    /*
+     * Pacing comes from our own frame callbacks (wayland_request_frame),
+     * so the driver must not also throttle inside eglSwapBuffers: with the
+     * default interval of 1, Mesa blocks on the previous frame callback and
+     * one hidden or slow output would stall every other output and the
+     * decode loop behind it. The interval is per surface.
+     */
+    if (!eglMakeCurrent(r->dpy, out->egl_surface, out->egl_surface, r->ctx) ||
+        !eglSwapInterval(r->dpy, 0)) {
+        EGLint err = eglGetError();
+        LOG_WARN("Output %s: eglSwapInterval(0) failed: %s (0x%x), swaps may block",
+                 out->name, egl_error_name(err), err);
+    }
+
+    if (r->threaded) {
+        eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+        render_thread_start(r, out);
+    }
+
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+
+    LOG_DEBUG("Output %s: EGL surface created (%dx%d)", out->name, render_w(out), render_h(out));
+    return 0;
+}
+
+void renderer_destroy_output(Renderer *r, Output *out) {
+    if (!r) return;
+    if (r->shm || r->direct || r->vk) {
+        if (r->shm) shm_destroy_output(r->shm, out);
+        else if (r->vk) vk_destroy_output(r->vk, out);
+        else direct_destroy_output(r->direct, out);
+        return;
+    }
+
+    render_thread_stop(r, out);
+
+    if (out->egl_surface && out->egl_surface != EGL_NO_SURFACE) {
+        /* Make sure we're not current on this surface before destroying */
+        EGLSurface cur_draw = eglGetCurrentSurface(EGL_DRAW);
+        if (cur_draw == out->egl_surface) {
+            eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+        }
+        eglDestroySurface(r->dpy, out->egl_surface);
+        out->egl_surface = EGL_NO_SURFACE;
+        LOG_DEBUG("Output %s: EGL surface destroyed", out->name);
+    }
+    if (out->egl_window) {
+        wl_egl_window_destroy(out->egl_window);
+        out->egl_window = NULL;
+    }
+    gpu_timers_release(r, out);
+    wayland_destroy_letterbox(out);
+}
+
+/* Whether the output has something to present into (EGL surface or shm buffers) */
+bool renderer_output_attached(Renderer *r, const Output *out) {
+    if (r && r->shm) return out->shm != NULL;
+    if (r && r->direct) return direct_output_attached(out);
+    if (r && r->vk) return vk_output_attached(out);
+    return out->egl_surface && out->egl_surface != EGL_NO_SURFACE;
+}
+
+/* ================================
+ * Section: Cache and state management
+ * ================================ */
+
+/*
+ * Clear the EGLImage cache. Call when:
+ * - Surfaces are recreated (cached images are no longer valid)
+ *
+ * Not needed when looping: entries are keyed on the dma-buf, which the
+ * decoder's pool keeps across a seek.
+ *
+ * Does NOT reset DMA-BUF compatibility state - that's driver-level,
+ * not surface-level.
+ */
+void renderer_clear_cache(Renderer *r) {
+    if (r && r->vk) vk_clear_cache(r->vk);
+    if (!r || r->shm || r->direct || r->vk) return;
+
+    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+
+    int cleared = 0;
+    for (int i = 0; i < r->cache_size; i++) {
+        if (r->cache[i].image != EGL_NO_IMAGE)
+            cleared++;
+        cache_entry_release(r, &r->cache[i]);
+    }
+    r->bound_image = EGL_NO_IMAGE;
+
+    if (cleared > 0) {
+        LOG_DEBUG("EGL cache cleared (%d images)", cleared);
+    }
+}
+
+/* Size the EGLImage cache to the decoder's surface pool */
+void renderer_set_cache_size(Renderer *r, int entries) {
+    if (!r || r->shm || r->direct || r->vk) return;
+    int old = r->cache_size;
+    if (!cache_resize(r, entries)) {
+        LOG_WARN("EGL cache: cannot grow to %d entries", entries);
+        return;
+    }
+    if (r->cache_size != old)
+        LOG_DEBUG("EGL cache: %d entries for a %d-surface pool", r->cache_size, entries);
+}
+
+/* Hit rate since the previous call, e.g. per loop of the video (-v only) */
+void renderer_log_cache_stats(Renderer *r) {
+    if (!r || r->shm || r->direct || r->vk) return;
+    uint64_t hits = r->stat_cache_hits - r->stat_cache_hits_logged;
+    uint64_t misses = r->stat_cache_misses - r->stat_cache_misses_logged;
+    r->stat_cache_hits_logged = r->stat_cache_hits;
+    r->stat_cache_misses_logged = r->stat_cache_misses;
+    if (hits + misses == 0) return;
+    LOG_DEBUG("EGL cache: %lu hits, %lu misses this pass (%.1f%% hit rate, %d/%d entries live)",
+              (unsigned long)hits, (unsigned long)misses,
+              100.0 * hits / (hits + misses), cache_live(r), r->cache_size);
+}
+
+/*
+ * Reset DMA-BUF compatibility state. Call ONLY when:
+ * - EGL context is actually lost (EGL_CONTEXT_LOST)
+ * - Renderer is being recreated after compositor restart
+ *
+ * This forces re-testing of DMA-BUF import capability.
+ */
+void renderer_reset_dmabuf_state(Renderer *r) {
+    if (!r) return;
+
+    r->dmabuf_tested = false;
+    r->dmabuf_works = false;
+    LOG_DEBUG("DMA-BUF compatibility state reset");
+}
+
+/*
+ * Reset texture allocation state. Call when:
+ * - Renderer is being recreated
+ * - Video dimensions might have changed
+ */
+void renderer_reset_texture_state(Renderer *r) {
+    if (!r) return;
+
+    r->tex_y_w = 0;
+    r->tex_y_h = 0;
+    r->tex_uv_w = 0;
+    r->tex_uv_h = 0;
+    r->tex_allocated = false;
+    r->uploaded_seq = 0;
+    r->uploaded_slot = -1;
+    r->bound_image = EGL_NO_IMAGE;
+    r->rgb_seq = 0;
+    LOG_DEBUG("Texture state reset");
+}
+
+/* ================================
+ * Section: Rendering helpers
+ * ================================ */
+
+/*
+ * Compute scale transform for aspect ratio.
+ *
+ * The video is scaled against the canvas: the output itself, or in span
+ * mode the whole desktop. For a span, the canvas-space quad is then mapped
+ * into this output's NDC so it only rasterises its own sub-rectangle.
+ */
+void renderer_compute_transform(float *out, int vid_w, int vid_h, const Output *o, ScaleMode mode) {
+    bool span = o->canvas_w > 0 && o->canvas_h > 0;
+    int cw = span ? o->canvas_w : o->width;
+    int ch = span ? o->canvas_h : o->height;
+
+    float sx = 1.0f, sy = 1.0f;
+    float vid_aspect = (float)vid_w / vid_h;
+    float out_aspect = (float)cw / ch;
+
+    switch (mode) {
+    case SCALE_FIT:
+        if (vid_aspect > out_aspect) sy = out_aspect / vid_aspect;
+        else sx = vid_aspect / out_aspect;
+        break;
+    case SCALE_FILL:
+        if (vid_aspect > out_aspect) sx = vid_aspect / out_aspect;
+        else sy = out_aspect / vid_aspect;
+        break;
+    case SCALE_STRETCH:
+        break;
+    }
+
+    if (!span) {
+        out[0] = sx; out[1] = sy; out[2] = 0.0f; out[3] = 0.0f;
+        return;
+    }
+
+    /* Canvas NDC -> output NDC (Y is flipped between pixel and NDC space) */
+    float kx = (float)cw / o->width;
+    float ky = (float)ch / o->height;
+    out[0] = sx * kx;
+    out[1] = sy * ky;
+    out[2] = kx - 1.0f - 2.0f * o->canvas_x / o->width;
+    out[3] = 1.0f - ky + 2.0f * o->canvas_y / o->height;
+}
+
+/*
+ * Letterboxed outputs draw into a window covering only video_rect: rebase
+ * the output transform onto that window so the video fills it.
+ */
+static void window_transform(const Output *out, float *t) {
+    const Rect *a = &out->video_rect;
+    if (!out->video_surface || a->width <= 0 || a->height <= 0) return;
+
+    double W = out->width, H = out->height;
+    double cx = (t[2] + 1.0) * 0.5 * W, cy = (1.0 - t[3]) * 0.5 * H;
+    t[0] = (float)(t[0] * W / a->width);
+    t[1] = (float)(t[1] * H / a->height);
+    t[2] = (float)(2.0 * (cx - a->x) / a->width - 1.0);
+    t[3] = (float)(1.0 - 2.0 * (cy - a->y) / a->height);
+}
+
+/* Draw the fullscreen quad with the currently bound program */
+static void draw_quad(Renderer *r) {
+    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 16, (void*)0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 16, (void*)8);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/* ================================
+ * Section: DMA-BUF rendering (zero-copy path)
+ * ================================ */
+
+/*
+ * Build the import attribute list for a (at most two-plane) dma-buf and
+ * create the EGLImage. mod[] must already have INVALID mapped to LINEAR.
+ */
+static EGLImage create_dmabuf_image(Renderer *r, const DmaBuf *dmabuf, const uint64_t *mod,
+                                    int w, int h, const Frame *frame) {
+    EGLint attr[64];
+    int i = 0;
+
+    attr[i++] = EGL_WIDTH; attr[i++] = w;
+    attr[i++] = EGL_HEIGHT; attr[i++] = h;
+    attr[i++] = EGL_LINUX_DRM_FOURCC_EXT; attr[i++] = dmabuf->fourcc;
+
+    /* Plane 0 */
+    attr[i++] = EGL_DMA_BUF_PLANE0_FD_EXT; attr[i++] = dmabuf->fd[0];
+    attr[i++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT; attr[i++] = dmabuf->offset[0];
+    attr[i++] = EGL_DMA_BUF_PLANE0_PITCH_EXT; attr[i++] = dmabuf->stride[0];
+    if (r->has_modifiers) {
+        attr[i++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT; attr[i++] = mod[0] & 0xffffffff;
+        attr[i++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT; attr[i++] = mod[0] >> 32;
+    }
+
+    /* Plane 1 */
+    if (dmabuf->num_planes > 1 && dmabuf->fd[1] >= 0) {
+        attr[i++] = EGL_DMA_BUF_PLANE1_FD_EXT; attr[i++] = dmabuf->fd[1];
+        attr[i++] = EGL_DMA_BUF_PLANE1_OFFSET_EXT; attr[i++] = dmabuf->offset[1];
+        attr[i++] = EGL_DMA_BUF_PLANE1_PITCH_EXT; attr[i++] = dmabuf->stride[1];
+        if (r->has_modifiers) {
+            attr[i++] = EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT; attr[i++] = mod[1] & 0xffffffff;
+            attr[i++] = EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT; attr[i++] = mod[1] >> 32;
+        }
+    }
+
+    /* Colorspace hints */
+    #define EGL_YUV_COLOR_SPACE_HINT_EXT 0x327B
+    #define EGL_ITU_REC601_EXT 0x327F
+    #define EGL_ITU_REC709_EXT 0x3280
+    #define EGL_ITU_REC2020_EXT 0x3281
+    #define EGL_SAMPLE_RANGE_HINT_EXT 0x327C
+    #define EGL_YUV_FULL_RANGE_EXT 0x3282
+    #define EGL_YUV_NARROW_RANGE_EXT 0x3283
+
+    if (r->has_yuv_hint) {
+        attr[i++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
+        attr[i++] = (frame->colorspace == CS_BT601) ? EGL_ITU_REC601_EXT :
+                    (frame->colorspace == CS_BT2020) ? EGL_ITU_REC2020_EXT : EGL_ITU_REC709_EXT;
+        attr[i++] = EGL_SAMPLE_RANGE_HINT_EXT;
+        attr[i++] = (frame->color_range == CR_FULL) ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
+    }
+
+    attr[i++] = EGL_NONE;
+
+    return eglCreateImageKHR(r->dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attr);
+}
+
+/* Bind an EGLImage to the external texture and draw it */
+static void draw_external(Renderer *r, EGLImage image, bool force_rebind, const float *transform) {
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, r->tex_dmabuf);
+    if (force_rebind || r->bound_image != image) {
+        gpu_span_begin(r, GPU_STAGE_BIND);
+        glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, image);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        r->bound_image = image;
+    }
+
+    glUseProgram(r->prog_ext);
+    glUniform4fv(r->u_transform_ext, 1, transform);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, r->tex_dmabuf);
+    glUniform1i(r->u_tex_ext, 0);
+
+    gpu_span_begin(r, GPU_STAGE_DRAW);
+    draw_quad(r);
+    gpu_span_end(r);
+}
+
+/*
+ * Cached EGLImage for a HW frame, importing it on a miss. NULL when the
+ * import fails; with settle, that also settles dmabuf_works on the first
+ * attempt, otherwise the failure is only logged.
+ */
+static CacheEntry *cache_import(Renderer *r, Frame *frame, bool settle) {
+    DmaBuf *dmabuf = &frame->hw.dmabuf;
+
+    bool cache_hit;
+    CacheEntry *ce = cache_get(r, frame, &cache_hit);
+    if (cache_hit) return ce;
+
+    /* Need to create new EGLImage */
+    uint64_t mod[4];
+    for (int i = 0; i < 4; i++)
+        mod[i] = (dmabuf->modifier[i] == DRM_FORMAT_MOD_INVALID) ? DRM_FORMAT_MOD_LINEAR : dmabuf->modifier[i];
+
+    /* Check modifier support */
+    for (int p = 0; p < dmabuf->num_planes; p++) {
+        if (!r->has_modifiers && mod[p] != DRM_FORMAT_MOD_LINEAR) {
+            if (!settle) {
+                LOG_DEBUG("Pre-import skipped: modifier 0x%llx unsupported", (unsigned long long)mod[p]);
+                cache_entry_release(r, ce);
+                return NULL;
+            }
+            if (!r->dmabuf_tested)
+                LOG_WARN("EGL doesn't support modifier 0x%llx", (unsigned long long)mod[p]);
+            r->dmabuf_tested = true;
+            r->dmabuf_works = false;
+            cache_entry_release(r, ce);
+            return NULL;
+        }
+    }
+
+    int w = dmabuf->width > 0 ? dmabuf->width : frame->width;
+    int h = dmabuf->height > 0 ? dmabuf->height : frame->height;
+
+    ce->image = create_dmabuf_image(r, dmabuf, mod, w, h, frame);
+    r->stat_egl_creates++;
+
+    if (ce->image == EGL_NO_IMAGE) {
+        EGLint err = eglGetError();
+        if (!settle) {
+            LOG_WARN("Pre-import of surface %#lx failed: %s (0x%x), skipped",
+                     (unsigned long)frame->hw.surface_id, egl_error_name(err), err);
+            cache_entry_release(r, ce);
+            return NULL;
+        }
+        if (!r->dmabuf_tested) {
+            LOG_WARN("DMA-BUF import failed: %s (0x%x)", egl_error_name(err), err);
+            LOG_WARN("  fourcc=%s %dx%d mod=0x%llx", fourcc_to_str(dmabuf->fourcc), w, h, (unsigned long long)mod[0]);
+        }
+        r->dmabuf_tested = true;
+        r->dmabuf_works = false;
+        cache_entry_release(r, ce);
+        return NULL;
+    }
+
+    /* Hold the dma-buf open so later exports of the surface keep its inode */
+    if (frame->hw.buffer_id) {
+        ce->fd = dup(dmabuf->fd[0]);
+        ce->buffer_id = ce->fd >= 0 ? frame->hw.buffer_id : 0;
+    }
+
+    if (!r->dmabuf_tested) {
+        LOG_INFO("DMA-BUF import OK, using zero-copy path");
+        r->dmabuf_tested = true;
+        r->dmabuf_works = true;
+    }
+    return ce;
+}
+
+static bool render_dmabuf(Renderer *r, Frame *frame, const float *transform) {
+    if (!r->has_dmabuf || !r->prog_ext) return false;
+    if (r->dmabuf_tested && !r->dmabuf_works) return false;
+
+    CacheEntry *ce = cache_import(r, frame, true);
+    if (!ce) return false;
+    ce->last_use = r->frame_count;
+
+    /* Bind texture (rebinding only when the image changed) and draw */
+    draw_external(r, ce->image, false, transform);
+    return true;
+}
+
+/*
+ * Import a pool surface ahead of playback so its first appearance is a
+ * cache hit. Only once zero-copy is known to work; no GL state is touched.
+ * A failed pre-import skips the surface and leaves dmabuf_works alone: the
+ * surface is imported again (and judged) when it is first drawn.
+ */
+bool renderer_preimport(Renderer *r, Frame *frame) {
+    if (!r || r->shm || r->direct || r->vk || !r->has_dmabuf) return false;
+    if (!r->dmabuf_tested || !r->dmabuf_works) return false;
+
+    uint64_t misses = r->stat_cache_misses;
+    CacheEntry *ce = cache_import(r, frame, false);
+    /* Pre-imports are counted on their own, not as misses */
+    bool imported = r->stat_cache_misses != misses;
+    r->stat_cache_misses = misses;
+    if (!ce) return false;
+    ce->last_use = r->frame_count;
+    if (imported) r->stat_cache_preimports++;
+    return true;
+}
+
+/* ================================
+ * Section: Software rendering
+ * ================================ */
+
+/*
+ * Copy a ring slot into the next PBO and leave it bound to
+ * GL_PIXEL_UNPACK_BUFFER. The fence from that PBO's previous use guarantees
+ * the GPU is done reading it, so the map can be unsynchronized. The fence
+ * is only polled: a PBO still in flight keeps its fence, the ring moves on
+ * to the next one and this frame is uploaded directly.
+ */
+static bool pbo_fill(Renderer *r, const uint8_t *slot, size_t size) {
+    int i = r->pbo_next;
+
+    if (r->pbo_fence[i]) {
+        GLenum st = glClientWaitSync(r->pbo_fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (st == GL_TIMEOUT_EXPIRED) {
+            LOG_DEBUG("PBO %d still in flight, uploading directly", i);
+            r->pbo_next = (i + 1) % PBO_RING_SIZE;
+            return false;
+        }
+        glDeleteSync(r->pbo_fence[i]);
+        r->pbo_fence[i] = NULL;
+        if (st == GL_WAIT_FAILED) {
+            LOG_DEBUG("PBO %d fence wait failed, uploading directly", i);
+            return false;
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r->pbo[i]);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                                 GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!dst) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        LOG_WARN("PBO map failed, disabling PBO uploads");
+        pbo_ring_release(r);
+        r->pbo_disabled = true;
+        return false;
+    }
+    memcpy(dst, slot, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    return true;
+}
+
+static void pbo_finish(Renderer *r) {
+    int i = r->pbo_next;
+    r->pbo_fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->pbo_next = (i + 1) % PBO_RING_SIZE;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/*
+ * (Re)create a plane texture. On GLES3 textures are immutable
+ * (glTexStorage2D), so a size change always means a fresh texture name.
+ */
+static void alloc_plane(Renderer *r, GLuint *tex, int w, int h, bool two_channel) {
+    glDeleteTextures(1, tex);
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_2D, *tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (r->gles3) {
+        glTexStorage2D(GL_TEXTURE_2D, 1, two_channel ? GL_RG8 : GL_R8, w, h);
+    } else {
+        GLenum fmt = two_channel ? (r->has_rg_texture ? GL_RG_EXT : GL_LUMINANCE_ALPHA)
+                                 : (r->has_rg_texture ? GL_RED_EXT : GL_LUMINANCE);
+        glTexImage2D(GL_TEXTURE_2D, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE, NULL);
+    }
+}
+
+/*
+ * Upload one plane. stride is in bytes, bpp is bytes per texel. data is a
+ * client pointer, or an offset into the bound PBO.
+ */
+static void upload_plane(Renderer *r, GLuint tex, int w, int h, GLenum fmt,
+                         int stride, int bpp, const uint8_t *data) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    if (stride == w * bpp) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, fmt, GL_UNSIGNED_BYTE, data);
+    } else if (r->has_unpack_row_length) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bpp);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, fmt, GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    } else {
+        for (int row = 0; row < h; row++)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, w, 1, fmt, GL_UNSIGNED_BYTE, data + (size_t)row * stride);
+    }
+}
+
+/*
+ * Upload the dirty tiles of one plane, merging horizontal runs into a
+ * single glTexSubImage2D. tile is the tile size in texels of this plane.
+ */
+static void upload_plane_tiles(const SoftwareRing *ring, const uint8_t *map, GLuint tex,
+                               int w, int h, int tile, GLenum fmt, int stride, int bpp,
+                               const uint8_t *data) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bpp);
+
+    for (int ty = 0; ty < ring->tiles_y; ty++) {
+        const uint8_t *row = map + ty * ring->tiles_x;
+        int y = ty * tile;
+        if (y >= h) break;
+        int rows = h - y < tile ? h - y : tile;
+
+        for (int tx = 0; tx < ring->tiles_x;) {
+            if (!row[tx]) {
+                tx++;
+                continue;
+            }
+            int end = tx;
+            while (end < ring->tiles_x && row[end])
+                end++;
+
+            int x = tx * tile;
+            int x_end = end * tile < w ? end * tile : w;
+            if (x < x_end)
+                glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, x_end - x, rows, fmt, GL_UNSIGNED_BYTE,
+                                data + (size_t)y * stride + (size_t)x * bpp);
+            tx = end;
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+/*
+ * When the textures hold the immediately preceding frame, only the tiles
+ * the decoder flagged as changed need sending. Not worth it once more than
+ * half the frame moved: the per-call overhead eats the savings.
+ */
+static bool upload_tiles(Renderer *r, Frame *frame, SoftwareRing *ring, GLenum y_fmt, GLenum uv_fmt) {
+    int slot = frame->sw.ring_slot;
+
+    if (!r->has_unpack_row_length || !ring->tile_map) return false;
+    if (r->uploaded_seq == 0 || frame->seq != r->uploaded_seq + 1) return false;
+    if (!ring->tiles_valid[slot] || ring->slot_seq[slot] != frame->seq) return false;
+    if (ring->tiles_changed[slot] * 2 > ring->tiles_x * ring->tiles_y) return false;
+
+    const uint8_t *map = sw_ring_get_tiles(ring, slot);
+    int w = frame->width, h = frame->height;
+
+    upload_plane_tiles(ring, map, r->tex_y, w, h, DAMAGE_TILE, y_fmt,
+                       ring->y_stride, 1, sw_ring_get_y(ring, slot));
+    upload_plane_tiles(ring, map, r->tex_uv, w / 2, h / 2, DAMAGE_TILE / 2, uv_fmt,
+                       ring->uv_stride, 2, sw_ring_get_uv(ring, slot));
+    return true;
+}
+
+/*
+ * Upload the ring slot into the Y/UV textures. Skipped when the textures
+ * already hold this frame, which is the case for every output after the
+ * first one, so upload bandwidth doesn't scale with output count.
+ */
+static void upload_software(Renderer *r, Frame *frame, SoftwareRing *ring) {
+    int slot = frame->sw.ring_slot;
+    if (frame->seq != 0 && r->uploaded_seq == frame->seq && r->uploaded_slot == slot) {
+        r->stat_uploads_skipped++;
+        return;
+    }
+
+    const uint8_t *y_data = sw_ring_get_y(ring, slot);
+    const uint8_t *uv_data = sw_ring_get_uv(ring, slot);
+    int w = frame->width, h = frame->height;
+    int uv_w = w / 2, uv_h = h / 2;
+
+    GLenum y_fmt = r->has_rg_texture ? GL_RED_EXT : GL_LUMINANCE;
+    GLenum uv_fmt = r->has_rg_texture ? GL_RG_EXT : GL_LUMINANCE_ALPHA;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    /* Reallocate textures if dimensions changed */
+    bool realloc = r->tex_y_w != w || r->tex_y_h != h ||
+                   r->tex_uv_w != uv_w || r->tex_uv_h != uv_h;
+    if (r->tex_y_w != w || r->tex_y_h != h) {
+        alloc_plane(r, &r->tex_y, w, h, false);
+        r->tex_y_w = w;
+        r->tex_y_h = h;
+        r->tex_allocated = true;
+        LOG_DEBUG("Y texture reallocated: %dx%d", w, h);
+    }
+    if (r->tex_uv_w != uv_w || r->tex_uv_h != uv_h) {
+        alloc_plane(r, &r->tex_uv, uv_w, uv_h, true);
+        r->tex_uv_w = uv_w;
+        r->tex_uv_h = uv_h;
+        LOG_DEBUG("UV texture reallocated: %dx%d", uv_w, uv_h);
+    }
+
+    if (!realloc && upload_tiles(r, frame, ring, y_fmt, uv_fmt)) {
+        r->uploaded_seq = frame->seq;
+        r->uploaded_slot = slot;
+        r->stat_uploads++;
+        r->stat_tile_uploads++;
+        return;
+    }
+
+    /* Stage the whole slot (Y then UV, contiguous) through a PBO if we can */
+    bool via_pbo = pbo_ring_ensure(r, ring->slot_size) && pbo_fill(r, y_data, ring->slot_size);
+    if (via_pbo) {
+        uv_data = (const uint8_t *)(uintptr_t)(uv_data - y_data);
+        y_data = NULL;
+    }
+
+    /* UV rows are uv_w two-byte texels, compare stride against that */
+    upload_plane(r, r->tex_y, w, h, y_fmt, ring->y_stride, 1, y_data);
+    upload_plane(r, r->tex_uv, uv_w, uv_h, uv_fmt, ring->uv_stride, 2, uv_data);
+
+    if (via_pbo)
+        pbo_finish(r);
+
+    r->uploaded_seq = frame->seq;
+    r->uploaded_slot = slot;
+    r->stat_uploads++;
+}
+
+/*
+ * Sample a udmabuf-backed ring slot directly through the external-texture
+ * path. Each slot is imported once; the image is rebound whenever a new
+ * frame lands in it so drivers that snapshot on bind see the new pixels.
+ * One loop iteration can decode several frames through the ring, so a
+ * slot may come round again while its last draw is still queued: every
+ * draw is followed by a fence the decoder waits on (ring_slot_wait).
+ * Without EGL_KHR_fence_sync the slots are uploaded instead.
+ */
+static bool render_ring_dmabuf(Renderer *r, Frame *frame, SoftwareRing *ring, const float *transform) {
+    if (ring->dmabuf_fd < 0 || r->ring_import_failed) return false;
+    if (!r->has_dmabuf || !r->has_fence_sync || !r->prog_ext) return false;
+
+    if (r->ring_image_gen != ring->generation) {
+        ring_images_release(r);
+        r->ring_image_gen = ring->generation;
+    }
+
+    int slot = frame->sw.ring_slot;
+    if (r->ring_image[slot] == EGL_NO_IMAGE) {
+        size_t base = (size_t)slot * ring->slot_size;
+        DmaBuf d = {
+            .fd = { ring->dmabuf_fd, ring->dmabuf_fd, -1, -1 },
+            .offset = { (uint32_t)base, (uint32_t)(base + (size_t)ring->y_stride * ring->height) },
+            .stride = { (uint32_t)ring->y_stride, (uint32_t)ring->uv_stride },
+            .fourcc = DRM_FORMAT_NV12,
+            .modifier = { DRM_FORMAT_MOD_LINEAR, DRM_FORMAT_MOD_LINEAR },
+            .width = frame->width,
+            .height = frame->height,
+            .num_planes = 2,
+        };
+        r->ring_image[slot] = create_dmabuf_image(r, &d, d.modifier, frame->width, frame->height, frame);
+        r->stat_egl_creates++;
+        if (r->ring_image[slot] == EGL_NO_IMAGE) {
+            EGLint err = eglGetError();
+            LOG_INFO("Ring slot import failed: %s (0x%x), using texture uploads",
+                     egl_error_name(err), err);
+            ring_images_release(r);
+            r->ring_import_failed = true;
+            return false;
+        }
+        if (slot == 0)
+            LOG_INFO("Software frames sampled in place via udmabuf");
+    }
+
+    draw_external(r, r->ring_image[slot], frame->seq != r->ring_bound_seq, transform);
+    if (frame->seq != r->ring_bound_seq)
+        r->stat_ring_draws++;
+    r->ring_bound_seq = frame->seq;
+
+    /* Same context, in-order queue: the newest fence covers earlier draws */
+    if (r->ring_fence[slot] != EGL_NO_SYNC_KHR)
+        eglDestroySyncKHR(r->dpy, r->ring_fence[slot]);
+    r->ring_fence[slot] = eglCreateSyncKHR(r->dpy, EGL_SYNC_FENCE_KHR, NULL);
+    ring->slot_wait = ring_slot_wait;
+    ring->slot_wait_ctx = r;
+    r->ring_hooked = ring;
+    return true;
+}
+
+static void render_software(Renderer *r, Frame *frame, SoftwareRing *ring, const float *transform) {
+    if (render_ring_dmabuf(r, frame, ring, transform))
+        return;
+
+    gpu_span_begin(r, GPU_STAGE_UPLOAD);
+    upload_software(r, frame, ring);
+    gpu_span_end(r);
+
+    Nv12Program *p = nv12_program(r, frame->colorspace, frame->color_range);
+    glUseProgram(p->prog);
+    glUniform4fv(p->u_transform, 1, transform);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->tex_y);
+    glUniform1i(p->u_tex_y, 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, r->tex_uv);
+    glUniform1i(p->u_tex_uv, 1);
+
+    gpu_span_begin(r, GPU_STAGE_DRAW);
+    draw_quad(r);
+    gpu_span_end(r);
+}
+
+/* ================================
+ * Section: Shared RGB conversion
+ * ================================ */
+
+/*
+ * Convert the frame into the RGB target unless it already holds it. Returns
+ * false if there was nothing to convert from; *via_dmabuf reports which
+ * path produced the pixels, like renderer_draw's return value.
+ */
+static bool convert_to_rgb(Renderer *r, Frame *frame, SoftwareRing *ring, bool try_dmabuf, bool *via_dmabuf) {
+    if (frame->seq != 0 && r->rgb_seq == frame->seq) {
+        *via_dmabuf = r->rgb_via_dmabuf;
+        return true;
+    }
+
+    static const float identity[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->rgb_fbo);
+    glViewport(0, 0, r->rgb_w, r->rgb_h);
+
+    bool dmabuf_ok = false;
+    bool converted = false;
+    if (try_dmabuf && frame->type == FRAME_HW)
+        converted = dmabuf_ok = render_dmabuf(r, frame, identity);
+    if (!dmabuf_ok && frame->sw.available && ring->data) {
+        render_software(r, frame, ring, identity);
+        converted = true;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!converted) return false;
+
+    r->rgb_seq = frame->seq;
+    r->rgb_via_dmabuf = dmabuf_ok;
+    r->stat_conversions++;
+    *via_dmabuf = dmabuf_ok;
+    return true;
+}
+
+/*
+ * Size of the conversion target this output needs: the on-screen extent of
+ * the video, capped at video resolution (no point converting more pixels
+ * than the source has) and the GL texture limit.
+ */
+static void rgb_needed_size(Renderer *r, const float *transform, const Output *out,
+                            const Frame *frame, int *w, int *h) {
+    int nw = (int)(transform[0] * render_w(out) + 0.5f);
+    int nh = (int)(transform[1] * render_h(out) + 0.5f);
+    if (nw > frame->width) nw = frame->width;
+    if (nh > frame->height) nh = frame->height;
+    if (r->max_tex_size > 0 && nw > r->max_tex_size) nw = r->max_tex_size;
+    if (r->max_tex_size > 0 && nh > r->max_tex_size) nh = r->max_tex_size;
+    *w = nw > 1 ? nw : 1;
+    *h = nh > 1 ? nh : 1;
+}
+
+static void blit_rgb(Renderer *r, const float *transform) {
+    glUseProgram(r->prog_rgb);
+    glUniform4fv(r->u_transform_rgb, 1, transform);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->rgb_tex);
+    glUniform1i(r->u_tex_rgb, 0);
+
+    gpu_span_begin(r, GPU_STAGE_DRAW);
+    draw_quad(r);
+    gpu_span_end(r);
+    r->stat_blits++;
 }
 
 /* ================================
- * Section: Cache and state management
+ * Section: Damage tracking
  * ================================ */
 
+static void rect_union(Rect *a, const Rect *b) {
+    int x1 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+    int y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+    a->x = a->x < b->x ? a->x : b->x;
+    a->y = a->y < b->y ? a->y : b->y;
+    a->width = x1 - a->x;
+    a->height = y1 - a->y;
+}
+
 /*
- * Clear the EGLImage cache. Call when:
- * - Surfaces are recreated (cached images are no longer valid)
- * - Seeking to a new position (surface generations changed)
- *
- * Does NOT reset DMA-BUF compatibility state - that's driver-level,
- * not surface-level.
+ * Map the bounding box of the frame's changed tiles to output pixels (top-
+ * left origin), padded by a source texel plus a pixel so bilinear filtering
+ * across tile edges is covered. False means "treat as fully damaged".
  */
-void renderer_clear_cache(Renderer *r) {
-    if (!r) return;
-
-    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
+static bool frame_damage(const Frame *frame, const SoftwareRing *ring, const Output *out,
+                         const float *t, Rect *d) {
+    int slot = frame->sw.ring_slot;
+    if (!ring->tile_map || !ring->tiles_valid[slot] || ring->slot_seq[slot] != frame->seq)
+        return false;
+    if (ring->tiles_changed[slot] == 0)
+        return false;
 
-    int cleared = 0;
-    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
-        if (r->cache[i].image != EGL_NO_IMAGE) {
-            eglDestroyImageKHR(r->dpy, r->cache[i].image);
-            r->cache[i].image = EGL_NO_IMAGE;
-            r->stat_egl_destroys++;
-            cleared++;
+    const uint8_t *map = sw_ring_get_tiles(ring, slot);
+    int tx0 = ring->tiles_x, ty0 = ring->tiles_y, tx1 = 0, ty1 = 0;
+    for (int ty = 0; ty < ring->tiles_y; ty++) {
+        for (int tx = 0; tx < ring->tiles_x; tx++) {
+            if (!map[ty * ring->tiles_x + tx]) continue;
+            if (tx < tx0) tx0 = tx;
+            if (ty < ty0) ty0 = ty;
+            if (tx + 1 > tx1) tx1 = tx + 1;
+            if (ty + 1 > ty1) ty1 = ty + 1;
         }
-        r->cache[i].surface_id = 0;
-        r->cache[i].generation = 0;
     }
 
-    if (cleared > 0) {
-        LOG_DEBUG("EGL cache cleared (%d images)", cleared);
-    }
+    int W = render_w(out), H = render_h(out);
+    float rx0 = (t[2] - t[0] + 1.0f) * 0.5f * W;
+    float rx1 = (t[2] + t[0] + 1.0f) * 0.5f * W;
+    float ry0 = (1.0f - t[3] - t[1]) * 0.5f * H;
+    float ry1 = (1.0f - t[3] + t[1]) * 0.5f * H;
+    float sx = (rx1 - rx0) / frame->width;
+    float sy = (ry1 - ry0) / frame->height;
+
+    int vx1 = tx1 * DAMAGE_TILE < frame->width ? tx1 * DAMAGE_TILE : frame->width;
+    int vy1 = ty1 * DAMAGE_TILE < frame->height ? ty1 * DAMAGE_TILE : frame->height;
+    int x0 = (int)(rx0 + tx0 * DAMAGE_TILE * sx - sx) - 1;
+    int y0 = (int)(ry0 + ty0 * DAMAGE_TILE * sy - sy) - 1;
+    int x1 = (int)(rx0 + vx1 * sx + sx + 0.999f) + 1;
+    int y1 = (int)(ry0 + vy1 * sy + sy + 0.999f) + 1;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > W) x1 = W;
+    if (y1 > H) y1 = H;
+    if (x1 <= x0 || y1 <= y0) return false;
+
+    *d = (Rect){ x0, y0, x1 - x0, y1 - y0 };
+    return true;
 }
 
 /*
- * Reset DMA-BUF compatibility state. Call ONLY when:
- * - EGL context is actually lost (EGL_CONTEXT_LOST)
- * - Renderer is being recreated after compositor restart
- *
- * This forces re-testing of DMA-BUF import capability.
+ * Decide how much of the output this draw must repaint. A partial repaint
+ * needs the back buffer's age, the previous frame on screen, an unchanged
+ * layout and a damage history covering every swap the buffer missed.
+ * Hardware frames carry no change map and are always drawn in full.
  */
-void renderer_reset_dmabuf_state(Renderer *r) {
-    if (!r) return;
+static bool output_damage(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring,
+                          const float *transform, bool try_dmabuf, Rect *damage) {
+    *damage = (Rect){ 0, 0, render_w(out), render_h(out) };
 
-    r->dmabuf_tested = false;
-    r->dmabuf_works = false;
-    LOG_DEBUG("DMA-BUF compatibility state reset");
-}
+    if (!r->has_buffer_age) return false;
+    if (try_dmabuf && frame->type == FRAME_HW) return false;
+    if (!frame->sw.available || !ring->data) return false;
+    if (out->shown_seq == 0 || frame->seq != out->shown_seq + 1) return false;
+    if (memcmp(out->damage_transform, transform, sizeof(out->damage_transform)) != 0) return false;
 
-/*
- * Reset texture allocation state. Call when:
- * - Renderer is being recreated
- * - Video dimensions might have changed
- */
-void renderer_reset_texture_state(Renderer *r) {
-    if (!r) return;
+    Rect d;
+    if (!frame_damage(frame, ring, out, transform, &d)) return false;
 
-    r->tex_y_w = 0;
-    r->tex_y_h = 0;
-    r->tex_uv_w = 0;
-    r->tex_uv_h = 0;
-    r->tex_allocated = false;
-    LOG_DEBUG("Texture state reset");
+    EGLint age = 0;
+    if (!eglQuerySurface(r->dpy, out->egl_surface, EGL_BUFFER_AGE_EXT, &age))
+        return false;
+    if (age < 1 || age - 1 > out->damage_count) return false;
+
+    Rect area = d;
+    for (int i = 0; i < age - 1; i++)
+        rect_union(&area, &out->damage[i]);
+
+    *damage = area;
+    memmove(&out->damage[1], &out->damage[0], sizeof(Rect) * (DAMAGE_HISTORY - 1));
+    out->damage[0] = d;
+    if (out->damage_count < DAMAGE_HISTORY) out->damage_count++;
+    return true;
+}
+
+/* Full repaint: restart the history from a fully damaged buffer */
+static void output_damage_reset(Output *out, const float *transform) {
+    out->damage[0] = (Rect){ 0, 0, render_w(out), render_h(out) };
+    out->damage_count = 1;
+    memcpy(out->damage_transform, transform, sizeof(out->damage_transform));
 }
 
 /* ================================
- * Section: Rendering helpers
+ * Section: Presentation
  * ================================ */
 
-/* Compute scale transform for aspect ratio */
-static void compute_transform(float *out, int vid_w, int vid_h, int out_w, int out_h, ScaleMode mode) {
-    float sx = 1.0f, sy = 1.0f;
-    float vid_aspect = (float)vid_w / vid_h;
-    float out_aspect = (float)out_w / out_h;
-
-    switch (mode) {
-    case SCALE_FIT:
-        if (vid_aspect > out_aspect) sy = out_aspect / vid_aspect;
-        else sx = vid_aspect / out_aspect;
-        break;
-    case SCALE_FILL:
-        if (vid_aspect > out_aspect) sx = vid_aspect / out_aspect;
-        else sy = out_aspect / vid_aspect;
-        break;
-    case SCALE_STRETCH:
-        break;
+/* Swap (with damage when given one) and account the time spent inside */
+static EGLBoolean timed_swap(Renderer *r, Output *out, const EGLint *damage) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    EGLBoolean swapped = damage && eglSwapBuffersWithDamage
+        ? eglSwapBuffersWithDamage(r->dpy, out->egl_surface, damage, 1)
+        : eglSwapBuffers(r->dpy, out->egl_surface);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double swap_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    out->swap_count++;
+    out->swap_ms_total += swap_ms;
+    if (swap_ms > out->swap_ms_max) out->swap_ms_max = swap_ms;
+    if (swap_ms > SWAP_SLOW_MS) {
+        out->swaps_slow++;
+        LOG_DEBUG("Output %s: eglSwapBuffers took %.2f ms", out->name, swap_ms);
     }
-
-    out[0] = sx; out[1] = sy; out[2] = 0.0f; out[3] = 0.0f;
+    return swapped;
 }
 
-/* Find or allocate cache entry for surface */
-static CacheEntry *cache_get(Renderer *r, uintptr_t surface_id, uint64_t generation, bool *is_hit) {
-    *is_hit = false;
-
-    /* Look for existing entry */
-    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
-        if (r->cache[i].surface_id == surface_id &&
-            r->cache[i].generation == generation &&
-            r->cache[i].image != EGL_NO_IMAGE) {
-            *is_hit = true;
-            r->stat_cache_hits++;
-            return &r->cache[i];
-        }
+/*
+ * Classify a failed swap. Surface or context loss requests a renderer
+ * reset and returns true; anything else might be transient and is only
+ * logged. Must run on the main thread.
+ */
+static bool swap_error_fatal(const Output *out, EGLint err) {
+    if (err == EGL_BAD_SURFACE || err == EGL_BAD_NATIVE_WINDOW) {
+        LOG_WARN("Output %s: eglSwapBuffers failed: %s (surface invalid)",
+                 out->name, egl_error_name(err));
+        if (g_app) g_app->renderer_needs_reset = true;
+        return true;
     }
-
-    r->stat_cache_misses++;
-
-    /* Find empty or LRU slot */
-    int best = 0;
-    uint64_t oldest = r->cache[0].last_use;
-    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
-        if (r->cache[i].surface_id == 0 || r->cache[i].image == EGL_NO_IMAGE) {
-            best = i;
-            break;
-        }
-        if (r->cache[i].last_use < oldest) {
-            oldest = r->cache[i].last_use;
-            best = i;
-        }
+    if (err == EGL_CONTEXT_LOST) {
+        LOG_WARN("Output %s: EGL context lost", out->name);
+        if (g_app) g_app->renderer_needs_reset = true;
+        return true;
     }
-
-    CacheEntry *e = &r->cache[best];
-    if (e->image != EGL_NO_IMAGE) {
-        eglDestroyImageKHR(r->dpy, e->image);
-        e->image = EGL_NO_IMAGE;
-        r->stat_egl_destroys++;
+    if (err == EGL_BAD_ALLOC) {
+        LOG_WARN("Output %s: EGL allocation failed", out->name);
+        if (g_app) g_app->renderer_needs_reset = true;
+        return true;
     }
-    e->surface_id = surface_id;
-    e->generation = generation;
-    return e;
+    /* Other errors might be transient, log but don't fail */
+    if (err != EGL_SUCCESS) {
+        LOG_DEBUG("Output %s: eglSwapBuffers warning: %s (0x%x)",
+                  out->name, egl_error_name(err), err);
+    }
+    return false;
 }
 
 /* ================================
- * Section: DMA-BUF rendering (zero-copy path)
+ * Section: Output render threads
  * ================================ */
 
-static bool render_dmabuf(Renderer *r, Output *out, Frame *frame, ScaleMode scale) {
-    if (!r->has_dmabuf || !r->prog_ext) return false;
-    if (r->dmabuf_tested && !r->dmabuf_works) return false;
-
-    DmaBuf *dmabuf = &frame->hw.dmabuf;
-
-    /* Check cache */
-    bool cache_hit;
-    CacheEntry *ce = cache_get(r, frame->hw.surface_id, frame->hw.generation, &cache_hit);
-
-    if (!cache_hit) {
-        /* Need to create new EGLImage */
-        uint64_t mod[4];
-        for (int i = 0; i < 4; i++)
-            mod[i] = (dmabuf->modifier[i] == DRM_FORMAT_MOD_INVALID) ? DRM_FORMAT_MOD_LINEAR : dmabuf->modifier[i];
-
-        /* Check modifier support */
-        for (int p = 0; p < dmabuf->num_planes; p++) {
-            if (!r->has_modifiers && mod[p] != DRM_FORMAT_MOD_LINEAR) {
-                if (!r->dmabuf_tested)
-                    LOG_WARN("EGL doesn't support modifier 0x%llx", (unsigned long long)mod[p]);
-                r->dmabuf_tested = true;
-                r->dmabuf_works = false;
-                ce->surface_id = 0;
-                return false;
-            }
-        }
+static void render_thread_job(RenderThread *t) {
+    Renderer *r = t->r;
+    Output *out = t->out;
 
-        int w = dmabuf->width > 0 ? dmabuf->width : frame->width;
-        int h = dmabuf->height > 0 ? dmabuf->height : frame->height;
+    glWaitSync(t->ready, 0, GL_TIMEOUT_IGNORED);
 
-        EGLint attr[64];
-        int i = 0;
+    glViewport(0, 0, render_w(out), render_h(out));
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-        attr[i++] = EGL_WIDTH; attr[i++] = w;
-        attr[i++] = EGL_HEIGHT; attr[i++] = h;
-        attr[i++] = EGL_LINUX_DRM_FOURCC_EXT; attr[i++] = dmabuf->fourcc;
+    glUseProgram(t->prog);
+    glUniform4fv(t->u_transform, 1, t->transform);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->rgb_tex);
+    glUniform1i(t->u_tex, 0);
+    draw_quad(r);
 
-        /* Plane 0 */
-        attr[i++] = EGL_DMA_BUF_PLANE0_FD_EXT; attr[i++] = dmabuf->fd[0];
-        attr[i++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT; attr[i++] = dmabuf->offset[0];
-        attr[i++] = EGL_DMA_BUF_PLANE0_PITCH_EXT; attr[i++] = dmabuf->stride[0];
-        if (r->has_modifiers) {
-            attr[i++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT; attr[i++] = mod[0] & 0xffffffff;
-            attr[i++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT; attr[i++] = mod[0] >> 32;
-        }
+    t->done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    t->swap_error = timed_swap(r, out, NULL) ? EGL_SUCCESS : eglGetError();
+}
 
-        /* Plane 1 */
-        if (dmabuf->num_planes > 1 && dmabuf->fd[1] >= 0) {
-            attr[i++] = EGL_DMA_BUF_PLANE1_FD_EXT; attr[i++] = dmabuf->fd[1];
-            attr[i++] = EGL_DMA_BUF_PLANE1_OFFSET_EXT; attr[i++] = dmabuf->offset[1];
-            attr[i++] = EGL_DMA_BUF_PLANE1_PITCH_EXT; attr[i++] = dmabuf->stride[1];
-            if (r->has_modifiers) {
-                attr[i++] = EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT; attr[i++] = mod[1] & 0xffffffff;
-                attr[i++] = EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT; attr[i++] = mod[1] >> 32;
-            }
-        }
+static void *render_thread_main(void *arg) {
+    RenderThread *t = arg;
+    Renderer *r = t->r;
+
+    bool ok = eglMakeCurrent(r->dpy, t->out->egl_surface, t->out->egl_surface, t->ctx);
+    if (ok) {
+        eglSwapInterval(r->dpy, 0);
+        t->prog = link_program(vert_src, frag_rgb_src);
+        t->u_transform = glGetUniformLocation(t->prog, "u_transform");
+        t->u_tex = glGetUniformLocation(t->prog, "u_tex");
+        ok = t->prog != 0;
+    }
 
-        /* Colorspace hints */
-        #define EGL_YUV_COLOR_SPACE_HINT_EXT 0x327B
-        #define EGL_ITU_REC601_EXT 0x327F
-        #define EGL_ITU_REC709_EXT 0x3280
-        #define EGL_ITU_REC2020_EXT 0x3281
-        #define EGL_SAMPLE_RANGE_HINT_EXT 0x327C
-        #define EGL_YUV_FULL_RANGE_EXT 0x3282
-        #define EGL_YUV_NARROW_RANGE_EXT 0x3283
-
-        if (r->has_yuv_hint) {
-            attr[i++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
-            attr[i++] = (frame->colorspace == CS_BT601) ? EGL_ITU_REC601_EXT :
-                        (frame->colorspace == CS_BT2020) ? EGL_ITU_REC2020_EXT : EGL_ITU_REC709_EXT;
-            attr[i++] = EGL_SAMPLE_RANGE_HINT_EXT;
-            attr[i++] = (frame->color_range == CR_FULL) ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
-        }
+    pthread_mutex_lock(&t->lock);
+    t->started = true;
+    t->start_ok = ok;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+
+    while (ok) {
+        pthread_mutex_lock(&t->lock);
+        while (!t->busy && !t->quit)
+            pthread_cond_wait(&t->cond, &t->lock);
+        bool quit = t->quit;
+        pthread_mutex_unlock(&t->lock);
+        if (quit) break;
+
+        render_thread_job(t);
+
+        pthread_mutex_lock(&t->lock);
+        t->busy = false;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
 
-        attr[i++] = EGL_NONE;
+    if (t->prog) glDeleteProgram(t->prog);
+    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+    return NULL;
+}
 
-        ce->image = eglCreateImageKHR(r->dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attr);
-        r->stat_egl_creates++;
+static void render_thread_wait(RenderThread *t) {
+    pthread_mutex_lock(&t->lock);
+    while (t->busy)
+        pthread_cond_wait(&t->cond, &t->lock);
+    pthread_mutex_unlock(&t->lock);
+}
 
-        if (ce->image == EGL_NO_IMAGE) {
-            EGLint err = eglGetError();
-            if (!r->dmabuf_tested) {
-                LOG_WARN("DMA-BUF import failed: %s (0x%x)", egl_error_name(err), err);
-                LOG_WARN("  fourcc=%s %dx%d mod=0x%llx", fourcc_to_str(dmabuf->fourcc), w, h, (unsigned long long)mod[0]);
-            }
-            r->dmabuf_tested = true;
-            r->dmabuf_works = false;
-            ce->surface_id = 0;
-            return false;
-        }
+static void render_thread_stop(Renderer *r, Output *out) {
+    RenderThread *t = out->render_thread;
+    if (!t) return;
 
-        if (!r->dmabuf_tested) {
-            LOG_INFO("DMA-BUF import OK, using zero-copy path");
-            r->dmabuf_tested = true;
-            r->dmabuf_works = true;
+    for (RenderThread **p = &r->threads; *p; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
         }
     }
 
-    ce->last_use = r->frame_count;
-
-    /* Bind texture and draw */
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, r->tex_dmabuf);
-    glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES, ce->image);
-    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glUseProgram(r->prog_ext);
+    pthread_mutex_lock(&t->lock);
+    t->quit = true;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+
+    if (t->done) glDeleteSync(t->done);
+    eglDestroyContext(r->dpy, t->ctx);
+    pthread_cond_destroy(&t->cond);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+    out->render_thread = NULL;
+}
 
-    float transform[4];
-    compute_transform(transform, frame->width, frame->height, out->width, out->height, scale);
-    glUniform4fv(r->u_transform_ext, 1, transform);
+/*
+ * Give the output its own thread. The surface must not be current on the
+ * main thread. On failure the output is simply drawn serially.
+ */
+static void render_thread_start(Renderer *r, Output *out) {
+    RenderThread *t = calloc(1, sizeof(*t));
+    if (!t) return;
+    t->r = r;
+    t->out = out;
+
+    EGLint ctx_attr[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    t->ctx = eglCreateContext(r->dpy, r->cfg, r->ctx, ctx_attr);
+    if (t->ctx == EGL_NO_CONTEXT) {
+        LOG_WARN("Output %s: shared context failed, drawing on main thread", out->name);
+        free(t);
+        return;
+    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, r->tex_dmabuf);
-    glUniform1i(r->u_tex_ext, 0);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    if (pthread_create(&t->thread, NULL, render_thread_main, t) != 0) {
+        LOG_WARN("Output %s: render thread creation failed", out->name);
+        eglDestroyContext(r->dpy, t->ctx);
+        pthread_cond_destroy(&t->cond);
+        pthread_mutex_destroy(&t->lock);
+        free(t);
+        return;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 16, (void*)0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 16, (void*)8);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    pthread_mutex_lock(&t->lock);
+    while (!t->started)
+        pthread_cond_wait(&t->cond, &t->lock);
+    bool ok = t->start_ok;
+    pthread_mutex_unlock(&t->lock);
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    return true;
+    out->render_thread = t;
+    t->next = r->threads;
+    r->threads = t;
+    if (!ok) {
+        LOG_WARN("Output %s: render thread setup failed, drawing on main thread", out->name);
+        render_thread_stop(r, out);
+        return;
+    }
+    LOG_DEBUG("Output %s: render thread started", out->name);
 }
 
-/* ================================
- * Section: Software rendering
- * ================================ */
+/*
+ * Main-thread half of a threaded draw: make sure the shared target holds
+ * this frame, then queue the blit. The fence is created once per frame
+ * and shared by all threads.
+ */
+static bool draw_threaded(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring,
+                          ScaleMode scale, bool try_dmabuf, bool *via_dmabuf) {
+    RenderThread *t = out->render_thread;
 
-static void render_software(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale) {
-    int slot = frame->sw.ring_slot;
-    const uint8_t *y_data = sw_ring_get_y(ring, slot);
-    const uint8_t *uv_data = sw_ring_get_uv(ring, slot);
-    int w = frame->width, h = frame->height;
+    if (eglGetCurrentContext() != r->ctx || eglGetCurrentSurface(EGL_DRAW) != EGL_NO_SURFACE)
+        eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
 
-    GLenum y_fmt = r->has_rg_texture ? GL_RED_EXT : GL_LUMINANCE;
-    GLenum uv_fmt = r->has_rg_texture ? GL_RG_EXT : GL_LUMINANCE_ALPHA;
+    r->frame_count++;
+    if (!ring->data && r->ring_image_gen)
+        ring_images_release(r);
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    float transform[4];
+    renderer_compute_transform(transform, frame->width, frame->height, out, scale);
+    window_transform(out, transform);
+
+    /* Growing the target replaces the texture other threads may be sampling */
+    int need_w, need_h;
+    rgb_needed_size(r, transform, out, frame, &need_w, &need_h);
+    if (!r->rgb_fbo || need_w > r->rgb_w || need_h > r->rgb_h)
+        renderer_flush(r);
+    if (!rgb_target_ensure(r, need_w, need_h))
+        return false;
 
-    /* Y texture */
-    glBindTexture(GL_TEXTURE_2D, r->tex_y);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    uint64_t had = r->rgb_seq;
+    if (!convert_to_rgb(r, frame, ring, try_dmabuf, via_dmabuf))
+        return false;
 
-    /* Reallocate Y texture if dimensions changed */
-    if (r->tex_y_w != w || r->tex_y_h != h) {
-        glTexImage2D(GL_TEXTURE_2D, 0, y_fmt, w, h, 0, y_fmt, GL_UNSIGNED_BYTE, NULL);
-        r->tex_y_w = w;
-        r->tex_y_h = h;
-        r->tex_allocated = true;
-        LOG_DEBUG("Y texture reallocated: %dx%d", w, h);
+    if (!r->frame_fence || r->rgb_seq != had) {
+        if (r->frame_fence) glDeleteSync(r->frame_fence);
+        r->frame_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
     }
 
-    if (ring->y_stride == w)
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, y_fmt, GL_UNSIGNED_BYTE, y_data);
-    else
-        for (int row = 0; row < h; row++)
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, w, 1, y_fmt, GL_UNSIGNED_BYTE, y_data + row * ring->y_stride);
-
-    /* UV texture */
-    glBindTexture(GL_TEXTURE_2D, r->tex_uv);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    int uv_w = w / 2, uv_h = h / 2;
-
-    /* Reallocate UV texture if dimensions changed */
-    if (r->tex_uv_w != uv_w || r->tex_uv_h != uv_h) {
-        glTexImage2D(GL_TEXTURE_2D, 0, uv_fmt, uv_w, uv_h, 0, uv_fmt, GL_UNSIGNED_BYTE, NULL);
-        r->tex_uv_w = uv_w;
-        r->tex_uv_h = uv_h;
-        LOG_DEBUG("UV texture reallocated: %dx%d", uv_w, uv_h);
-    }
+    pthread_mutex_lock(&t->lock);
+    t->ready = r->frame_fence;
+    memcpy(t->transform, transform, sizeof(transform));
+    t->busy = true;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
 
-    if (ring->uv_stride == w)
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, uv_w, uv_h, uv_fmt, GL_UNSIGNED_BYTE, uv_data);
-    else
-        for (int row = 0; row < uv_h; row++)
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, uv_w, 1, uv_fmt, GL_UNSIGNED_BYTE, uv_data + row * ring->uv_stride);
+    r->stat_threaded_draws++;
+    return true;
+}
 
-    /* Draw */
-    glUseProgram(r->prog_nv12);
+void renderer_flush(Renderer *r) {
+    if (!r || !r->threads) return;
 
-    float transform[4];
-    compute_transform(transform, w, h, out->width, out->height, scale);
-    glUniform4fv(r->u_transform_nv12, 1, transform);
+    eglMakeCurrent(r->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, r->ctx);
 
-    glUniform1i(r->u_colorspace, (frame->colorspace == CS_BT601) ? 0 : (frame->colorspace == CS_BT2020) ? 2 : 1);
-    glUniform1i(r->u_range, (frame->color_range == CR_FULL) ? 1 : 0);
+    for (RenderThread *t = r->threads; t; t = t->next) {
+        render_thread_wait(t);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, r->tex_y);
-    glUniform1i(r->u_tex_y, 0);
+        if (t->swap_error != EGL_SUCCESS) {
+            swap_error_fatal(t->out, t->swap_error);
+            t->swap_error = EGL_SUCCESS;
+        }
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, r->tex_uv);
-    glUniform1i(r->u_tex_uv, 1);
+        /* The next conversion overwrites what this thread sampled */
+        if (t->done) {
+            /* Letterboxed: apply the swap the thread made on the subsurface */
+            if (t->out->video_surface)
+                wl_surface_commit(t->out->surface);
+            glWaitSync(t->done, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(t->done);
+            t->done = NULL;
+        }
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, r->vbo);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 16, (void*)0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 16, (void*)8);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    /* Every thread has queued its wait by now */
+    if (r->frame_fence) {
+        glDeleteSync(r->frame_fence);
+        r->frame_fence = NULL;
+    }
+}
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+/* Wait until the GPU has executed everything queued so far (--benchmark) */
+void renderer_finish(Renderer *r) {
+    if (!r || r->shm || r->direct || r->vk) return;
+    renderer_flush(r);
+    glFinish();
 }
 
 /* ================================
@@ -863,6 +2871,13 @@ static void render_software(Renderer *r, Output *out, Frame *frame, SoftwareRing
  * ================================ */
 
 bool renderer_draw(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale, bool try_dmabuf) {
+    if (r && r->shm)
+        return shm_draw(r->shm, out, frame, ring, scale);
+    if (r && r->direct)
+        return direct_draw(r->direct, out, frame, ring, scale);
+    if (r && r->vk)
+        return vk_draw(r->vk, out, frame, ring, scale);
+
     /* Validate renderer */
     if (!r || !r->dpy || r->ctx == EGL_NO_CONTEXT) {
         LOG_DEBUG("Output %s: renderer not initialized", out->name);
@@ -881,6 +2896,12 @@ bool renderer_draw(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring, S
         return false;
     }
 
+    /* Threaded outputs: convert here, the output's thread blits and swaps */
+    if (out->render_thread) {
+        bool dmabuf_ok = false;
+        return draw_threaded(r, out, frame, ring, scale, try_dmabuf, &dmabuf_ok) && dmabuf_ok;
+    }
+
     if (!eglMakeCurrent(r->dpy, out->egl_surface, out->egl_surface, r->ctx)) {
         EGLint err = eglGetError();
         LOG_WARN("Output %s: eglMakeCurrent failed: %s (0x%x)",
@@ -894,43 +2915,79 @@ bool renderer_draw(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring, S
         return false;
     }
 
-    glViewport(0, 0, out->width, out->height);
-    glClearColor(0, 0, 0, 1);
-    glClear(GL_COLOR_BUFFER_BIT);
-
     r->frame_count++;
+    gpu_frame_begin(r, out);
 
-    bool dmabuf_ok = false;
-    if (try_dmabuf && frame->type == FRAME_HW)
-        dmabuf_ok = render_dmabuf(r, out, frame, scale);
+    /* Ring was released (zero-copy confirmed): drop the slot imports too */
+    if (!ring->data && r->ring_image_gen)
+        ring_images_release(r);
 
-    if (!dmabuf_ok && frame->sw.available)
-        render_software(r, out, frame, ring, scale);
+    float transform[4];
+    renderer_compute_transform(transform, frame->width, frame->height, out, scale);
+    window_transform(out, transform);
 
-    if (!eglSwapBuffers(r->dpy, out->egl_surface)) {
-        EGLint err = eglGetError();
-        if (err == EGL_BAD_SURFACE || err == EGL_BAD_NATIVE_WINDOW) {
-            LOG_WARN("Output %s: eglSwapBuffers failed: %s (surface invalid)",
-                     out->name, egl_error_name(err));
-            if (g_app) g_app->renderer_needs_reset = true;
-            return false;
-        }
-        if (err == EGL_CONTEXT_LOST) {
-            LOG_WARN("Output %s: EGL context lost", out->name);
-            if (g_app) g_app->renderer_needs_reset = true;
-            return false;
-        }
-        if (err == EGL_BAD_ALLOC) {
-            LOG_WARN("Output %s: EGL allocation failed", out->name);
-            if (g_app) g_app->renderer_needs_reset = true;
-            return false;
+    Rect damage;
+    bool partial = output_damage(r, out, frame, ring, transform, try_dmabuf, &damage);
+    if (!partial)
+        output_damage_reset(out, transform);
+
+    /* GL scissor and EGL damage rects both count rows from the bottom */
+    EGLint damage_rect[4] = {
+        damage.x, render_h(out) - damage.y - damage.height, damage.width, damage.height
+    };
+
+    /* Shared stage: convert once per frame, then a plain blit per output */
+    bool dmabuf_ok = false;
+    bool blitted = false;
+    if (r->shared_convert) {
+        int need_w, need_h;
+        rgb_needed_size(r, transform, out, frame, &need_w, &need_h);
+        /* A growing target is reallocated, which also forces a reconvert */
+        if (rgb_target_ensure(r, need_w, need_h) &&
+            convert_to_rgb(r, frame, ring, try_dmabuf, &dmabuf_ok)) {
+            glViewport(0, 0, render_w(out), render_h(out));
+            if (partial) {
+                glEnable(GL_SCISSOR_TEST);
+                glScissor(damage_rect[0], damage_rect[1], damage_rect[2], damage_rect[3]);
+            }
+            glClearColor(0, 0, 0, 1);
+            glClear(GL_COLOR_BUFFER_BIT);
+            blit_rgb(r, transform);
+            blitted = true;
         }
-        /* Other errors might be transient, log but don't fail */
-        if (err != EGL_SUCCESS) {
-            LOG_DEBUG("Output %s: eglSwapBuffers warning: %s (0x%x)",
-                      out->name, egl_error_name(err), err);
+    }
+
+    if (!blitted) {
+        glViewport(0, 0, render_w(out), render_h(out));
+        if (partial) {
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(damage_rect[0], damage_rect[1], damage_rect[2], damage_rect[3]);
         }
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        if (try_dmabuf && frame->type == FRAME_HW)
+            dmabuf_ok = render_dmabuf(r, frame, transform);
+
+        if (!dmabuf_ok && frame->sw.available && ring->data)
+            render_software(r, frame, ring, transform);
+    }
+
+    if (partial) {
+        glDisable(GL_SCISSOR_TEST);
+        r->stat_partial_draws++;
+        r->stat_damage_px += (uint64_t)damage.width * damage.height;
+        r->stat_full_px += (uint64_t)render_w(out) * render_h(out);
     }
 
+    gpu_frame_end(r, out);
+    EGLBoolean swapped = timed_swap(r, out, partial ? damage_rect : NULL);
+    if (!swapped && swap_error_fatal(out, eglGetError()))
+        return false;
+
+    /* The subsurface is synchronized: its new buffer lands with this commit */
+    if (out->video_surface)
+        wl_surface_commit(out->surface);
+
     return dmabuf_ok;
 }
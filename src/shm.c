@@ -0,0 +1,540 @@
+/*
+ * shm.c — wl_shm presentation backend (no EGL/GL)
+ *
+ * For GPU-less machines and VMs where EGL only offers a slow software
+ * rasteriser. Each output gets two XRGB8888 buffers in one wl_shm pool; a
+ * frame is converted straight from the NV12 ring slot into whichever buffer
+ * the compositor has released.
+ *
+ * Conversion is split into horizontal slices over a small worker pool. Each
+ * slice scales with a nearest-neighbour gather (fit/fill/stretch and span
+ * layout come from renderer_compute_transform, so the geometry matches the
+ * GL path) and converts four pixels at a time using GCC vector extensions,
+ * which lower to SSE2 on x86-64 and NEON on AArch64. The integer matrices
+ * are the yuv_coeffs (render.c) in 2.14 fixed point.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "wlvideo.h"
+
+/* Upper bound on conversion threads, including the calling thread */
+#define SHM_MAX_THREADS 8
+
+#define SHM_BUFFERS 2
+
+/* Fixed-point precision of the YUV->RGB coefficients */
+#define CSC_SHIFT 14
+
+/* ================================
+ * Section: Types
+ * ================================ */
+
+typedef struct {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    bool busy;              /* Attached and not yet released by the compositor */
+} ShmBuffer;
+
+struct ShmOutput {
+    ShmBuffer buf[SHM_BUFFERS];
+    void *map;
+    size_t map_size;
+    int width, height;
+    int stride;             /* Bytes */
+};
+
+typedef struct {
+    int32_t ky, y_off;
+    int32_t rv, gu, gv, bu;
+} CscCoeffs;
+
+typedef struct {
+    const uint8_t *y, *uv;
+    int y_stride, uv_stride;
+    int src_w, src_h;
+
+    uint32_t *dst;
+    int dst_w, dst_h;
+    int dst_stride;         /* Pixels */
+
+    /* Video rectangle in output pixels (may extend past the edges) */
+    int rx0, ry0, rx1, ry1;
+    /* Visible part of it */
+    int cx0, cy0, cx1, cy1;
+
+    const int32_t *xmap_y;  /* Per visible column: source luma x */
+    const int32_t *xmap_uv; /* Per visible column: source chroma byte offset */
+
+    CscCoeffs csc;
+} ConvertJob;
+
+typedef struct ShmRenderer ShmRenderer;
+
+typedef struct {
+    ShmRenderer *owner;
+    int index;
+    pthread_t thread;
+} ShmWorker;
+
+struct ShmRenderer {
+    struct wl_shm *shm;
+
+    /* Worker pool: slice 0 runs on the caller, slice i on workers[i - 1] */
+    ShmWorker workers[SHM_MAX_THREADS - 1];
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    uint64_t job_gen;
+    int pending;
+    bool quit;
+    ConvertJob job;
+
+    int32_t *xmap;
+    int xmap_cap;
+
+    int live_buffers;       /* wl_buffers across all outputs */
+
+    /* Statistics */
+    uint64_t stat_frames;
+    uint64_t stat_no_buffer;
+    double stat_convert_time;
+};
+
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+/* ================================
+ * Section: Colour conversion
+ * ================================ */
+
+/*
+ * Same matrices and range expansion as render.c's yuv_coeffs, pre-multiplied for
+ * 8-bit inputs: limited range is (Y - 16) * 1.164 and (C - 128) * 1.138.
+ */
+static CscCoeffs csc_coeffs(ColorSpace cs, ColorRange range) {
+    static const float m[3][4] = {
+        /*   rv     gu     gv     bu  */
+        { 1.402f, 0.344f, 0.714f, 1.772f },   /* BT.601 */
+        { 1.575f, 0.187f, 0.468f, 1.856f },   /* BT.709 */
+        { 1.475f, 0.165f, 0.571f, 1.881f },   /* BT.2020 */
+    };
+    const float *k = m[cs == CS_BT601 ? 0 : cs == CS_BT2020 ? 2 : 1];
+    bool full = range == CR_FULL;
+    float ky = full ? 1.0f : 1.164f;
+    float kc = full ? 1.0f : 1.138f;
+    float one = (float)(1 << CSC_SHIFT);
+
+    return (CscCoeffs){
+        .ky = (int32_t)(ky * one + 0.5f),
+        .y_off = full ? 0 : 16,
+        .rv = (int32_t)(k[0] * kc * one + 0.5f),
+        .gu = (int32_t)(k[1] * kc * one + 0.5f),
+        .gv = (int32_t)(k[2] * kc * one + 0.5f),
+        .bu = (int32_t)(k[3] * kc * one + 0.5f),
+    };
+}
+
+static inline v4si clamp_u8(v4si v) {
+    v &= ~(v >> 31);                    /* < 0 -> 0 */
+    v4si lt = (v - 256) >> 31;          /* all ones where v < 256 */
+    return (v & lt) | (255 & ~lt);
+}
+
+static inline v4si yuv_to_xrgb4(v4si y, v4si u, v4si v, const CscCoeffs *c) {
+    const int32_t round = 1 << (CSC_SHIFT - 1);
+    y = (y - c->y_off) * c->ky + round;
+    u -= 128;
+    v -= 128;
+
+    v4si r = clamp_u8((y + v * c->rv) >> CSC_SHIFT);
+    v4si g = clamp_u8((y - u * c->gu - v * c->gv) >> CSC_SHIFT);
+    v4si b = clamp_u8((y + u * c->bu) >> CSC_SHIFT);
+    return (r << 16) | (g << 8) | b | (int32_t)-16777216;   /* 0xff000000 */
+}
+
+static void fill_black(uint32_t *dst, int n) {
+    for (int i = 0; i < n; i++)
+        dst[i] = 0xff000000u;
+}
+
+static void convert_row(const ConvertJob *j, uint32_t *dst, const uint8_t *yrow, const uint8_t *uvrow) {
+    int n = j->cx1 - j->cx0;
+    const int32_t *xy = j->xmap_y;
+    const int32_t *xc = j->xmap_uv;
+    int x = 0;
+
+    for (; x + 4 <= n; x += 4) {
+        v4si y = { yrow[xy[x]], yrow[xy[x + 1]], yrow[xy[x + 2]], yrow[xy[x + 3]] };
+        v4si u = { uvrow[xc[x]], uvrow[xc[x + 1]], uvrow[xc[x + 2]], uvrow[xc[x + 3]] };
+        v4si v = { uvrow[xc[x] + 1], uvrow[xc[x + 1] + 1], uvrow[xc[x + 2] + 1], uvrow[xc[x + 3] + 1] };
+        v4si px = yuv_to_xrgb4(y, u, v, &j->csc);
+        memcpy(dst + x, &px, sizeof(px));
+    }
+
+    /* Tail: pad the vector with the last pixel, store only what's needed */
+    if (x < n) {
+        int idx[4];
+        for (int i = 0; i < 4; i++)
+            idx[i] = x + i < n ? x + i : n - 1;
+        v4si y = { yrow[xy[idx[0]]], yrow[xy[idx[1]]], yrow[xy[idx[2]]], yrow[xy[idx[3]]] };
+        v4si u = { uvrow[xc[idx[0]]], uvrow[xc[idx[1]]], uvrow[xc[idx[2]]], uvrow[xc[idx[3]]] };
+        v4si v = { uvrow[xc[idx[0]] + 1], uvrow[xc[idx[1]] + 1], uvrow[xc[idx[2]] + 1], uvrow[xc[idx[3]] + 1] };
+        v4si px = yuv_to_xrgb4(y, u, v, &j->csc);
+        memcpy(dst + x, &px, (size_t)(n - x) * sizeof(uint32_t));
+    }
+}
+
+static void convert_slice(const ConvertJob *j, int slice, int nslices) {
+    int row0 = (int)((int64_t)j->dst_h * slice / nslices);
+    int row1 = (int)((int64_t)j->dst_h * (slice + 1) / nslices);
+    int rh = j->ry1 - j->ry0;
+
+    for (int dy = row0; dy < row1; dy++) {
+        uint32_t *dst = j->dst + (size_t)dy * j->dst_stride;
+
+        if (dy < j->cy0 || dy >= j->cy1) {
+            fill_black(dst, j->dst_w);
+            continue;
+        }
+
+        int sy = (int)((int64_t)(dy - j->ry0) * j->src_h / rh);
+        if (sy >= j->src_h) sy = j->src_h - 1;
+        const uint8_t *yrow = j->y + (size_t)sy * j->y_stride;
+        const uint8_t *uvrow = j->uv + (size_t)(sy / 2) * j->uv_stride;
+
+        fill_black(dst, j->cx0);
+        convert_row(j, dst + j->cx0, yrow, uvrow);
+        fill_black(dst + j->cx1, j->dst_w - j->cx1);
+    }
+}
+
+/* ================================
+ * Section: Worker pool
+ * ================================ */
+
+static void *worker_main(void *arg) {
+    ShmWorker *w = arg;
+    ShmRenderer *s = w->owner;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->quit && s->job_gen == seen)
+            pthread_cond_wait(&s->start, &s->lock);
+        if (s->quit) break;
+        seen = s->job_gen;
+        pthread_mutex_unlock(&s->lock);
+
+        convert_slice(&s->job, w->index, s->nworkers + 1);
+
+        pthread_mutex_lock(&s->lock);
+        if (--s->pending == 0)
+            pthread_cond_signal(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* Run s->job across the pool and wait for every slice */
+static void run_job(ShmRenderer *s) {
+    if (s->nworkers == 0) {
+        convert_slice(&s->job, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->pending = s->nworkers;
+    s->job_gen++;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+
+    convert_slice(&s->job, 0, s->nworkers + 1);
+
+    pthread_mutex_lock(&s->lock);
+    while (s->pending > 0)
+        pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* ================================
+ * Section: Buffers
+ * ================================ */
+
+static void buffer_release(void *data, struct wl_buffer *buffer) {
+    (void)buffer;
+    ShmBuffer *b = data;
+    b->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void buffers_destroy(ShmRenderer *s, struct ShmOutput *so) {
+    for (int i = 0; i < SHM_BUFFERS; i++) {
+        if (so->buf[i].buffer) {
+            wl_buffer_destroy(so->buf[i].buffer);
+            s->live_buffers--;
+        }
+        so->buf[i] = (ShmBuffer){0};
+    }
+    if (so->map) munmap(so->map, so->map_size);
+    so->map = NULL;
+    so->map_size = 0;
+    so->width = so->height = 0;
+}
+
+static bool buffers_create(ShmRenderer *s, struct ShmOutput *so, const char *name, int w, int h) {
+    int stride = w * 4;
+    size_t buf_size = (size_t)stride * h;
+    size_t total = buf_size * SHM_BUFFERS;
+
+    int fd = memfd_create("wlvideo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        LOG_ERROR("Output %s: memfd_create failed: %s", name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, (off_t)total) < 0) {
+        LOG_ERROR("Output %s: ftruncate(%zu) failed: %s", name, total, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Output %s: mmap failed: %s", name, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(s->shm, fd, (int32_t)total);
+    for (int i = 0; i < SHM_BUFFERS; i++) {
+        ShmBuffer *b = &so->buf[i];
+        b->buffer = wl_shm_pool_create_buffer(pool, (int32_t)(buf_size * i), w, h, stride,
+                                              WL_SHM_FORMAT_XRGB8888);
+        b->pixels = (uint32_t *)((uint8_t *)map + buf_size * i);
+        b->busy = false;
+        wl_buffer_add_listener(b->buffer, &buffer_listener, b);
+        s->live_buffers++;
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    so->map = map;
+    so->map_size = total;
+    so->width = w;
+    so->height = h;
+    so->stride = stride;
+    LOG_DEBUG("Output %s: %d shm buffers %dx%d (%zu KiB)", name, SHM_BUFFERS, w, h, total / 1024);
+    return true;
+}
+
+/* Integer output scale: buffers are allocated in device pixels */
+static int buffer_scale(const Output *out) {
+    return out->scale > 1 ? out->scale : 1;
+}
+
+/* ================================
+ * Section: Public API
+ * ================================ */
+
+ShmRenderer *shm_renderer_create(struct wl_shm *shm, int threads) {
+    if (!shm) {
+        LOG_ERROR("Compositor does not offer wl_shm");
+        return NULL;
+    }
+
+    ShmRenderer *s = calloc(1, sizeof(ShmRenderer));
+    if (!s) return NULL;
+    s->shm = shm;
+
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+    if (threads > SHM_MAX_THREADS) threads = SHM_MAX_THREADS;
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    for (int i = 0; i < threads - 1; i++) {
+        ShmWorker *w = &s->workers[i];
+        w->owner = s;
+        w->index = i + 1;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            LOG_WARN("Converter thread %d failed to start, continuing with %d", i + 1, i + 1);
+            break;
+        }
+        s->nworkers++;
+    }
+
+    LOG_INFO("Renderer: wl_shm, %d conversion thread(s)", s->nworkers + 1);
+    return s;
+}
+
+void shm_renderer_destroy(ShmRenderer *s) {
+    if (!s) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->quit = true;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < s->nworkers; i++)
+        pthread_join(s->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->start);
+    pthread_mutex_destroy(&s->lock);
+    free(s->xmap);
+    free(s);
+}
+
+int shm_create_output(ShmRenderer *s, Output *out) {
+    /* Buffers are tied to the old surface's release events, start fresh */
+    shm_destroy_output(s, out);
+
+    out->shm = calloc(1, sizeof(struct ShmOutput));
+    if (!out->shm) return -1;
+
+    int bs = buffer_scale(out);
+    if (!buffers_create(s, out->shm, out->name, out->width * bs, out->height * bs)) {
+        free(out->shm);
+        out->shm = NULL;
+        return -1;
+    }
+    wl_surface_set_buffer_scale(out->surface, bs);
+
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+    return 0;
+}
+
+void shm_destroy_output(ShmRenderer *s, Output *out) {
+    if (!out->shm) return;
+    buffers_destroy(s, out->shm);
+    free(out->shm);
+    out->shm = NULL;
+    LOG_DEBUG("Output %s: shm buffers destroyed", out->name);
+}
+
+bool shm_draw(ShmRenderer *s, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale) {
+    struct ShmOutput *so = out->shm;
+    if (!so || !out->surface) return false;
+
+    /* Follow configure-driven resizes and output scale changes */
+    int bs = buffer_scale(out);
+    if (so->width != out->width * bs || so->height != out->height * bs) {
+        buffers_destroy(s, so);
+        if (!buffers_create(s, so, out->name, out->width * bs, out->height * bs)) {
+            wl_surface_commit(out->surface);
+            return false;
+        }
+        wl_surface_set_buffer_scale(out->surface, bs);
+    }
+
+    ShmBuffer *b = NULL;
+    for (int i = 0; i < SHM_BUFFERS; i++) {
+        if (!so->buf[i].busy) {
+            b = &so->buf[i];
+            break;
+        }
+    }
+
+    /*
+     * No buffer released yet: still commit so the frame callback requested
+     * for this draw fires, the compositor keeps showing the last buffer.
+     * Nothing was attached, so the frame is retried rather than shown.
+     */
+    if (!b || !frame->sw.available || !ring->data) {
+        if (!b) s->stat_no_buffer++;
+        out->draw_skipped = true;
+        wl_surface_commit(out->surface);
+        return false;
+    }
+
+    double t0 = clock_monotonic();
+
+    /* Video rectangle from the same transform the GL path uses */
+    float t[4];
+    renderer_compute_transform(t, frame->width, frame->height, out, scale);
+    int W = so->width, H = so->height;
+
+    ConvertJob *j = &s->job;
+    *j = (ConvertJob){
+        .y = sw_ring_get_y(ring, frame->sw.ring_slot),
+        .uv = sw_ring_get_uv(ring, frame->sw.ring_slot),
+        .y_stride = ring->y_stride,
+        .uv_stride = ring->uv_stride,
+        .src_w = frame->width,
+        .src_h = frame->height,
+        .dst = b->pixels,
+        .dst_w = W,
+        .dst_h = H,
+        .dst_stride = so->stride / 4,
+        .rx0 = (int)((t[2] - t[0] + 1.0f) * 0.5f * W + 0.5f),
+        .rx1 = (int)((t[2] + t[0] + 1.0f) * 0.5f * W + 0.5f),
+        .ry0 = (int)((1.0f - t[3] - t[1]) * 0.5f * H + 0.5f),
+        .ry1 = (int)((1.0f - t[3] + t[1]) * 0.5f * H + 0.5f),
+        .csc = csc_coeffs(frame->colorspace, frame->color_range),
+    };
+    if (j->rx1 <= j->rx0) j->rx1 = j->rx0 + 1;
+    if (j->ry1 <= j->ry0) j->ry1 = j->ry0 + 1;
+    j->cx0 = j->rx0 < 0 ? 0 : j->rx0 > W ? W : j->rx0;
+    j->cx1 = j->rx1 < 0 ? 0 : j->rx1 > W ? W : j->rx1;
+    j->cy0 = j->ry0 < 0 ? 0 : j->ry0 > H ? H : j->ry0;
+    j->cy1 = j->ry1 < 0 ? 0 : j->ry1 > H ? H : j->ry1;
+
+    /* Column maps for the visible span, shared by every row */
+    int n = j->cx1 - j->cx0;
+    if (n * 2 > s->xmap_cap) {
+        int32_t *m = realloc(s->xmap, sizeof(int32_t) * 2 * n);
+        if (!m) {
+            wl_surface_commit(out->surface);
+            return false;
+        }
+        s->xmap = m;
+        s->xmap_cap = n * 2;
+    }
+    int32_t *xy = s->xmap, *xc = s->xmap + n;
+    int rw = j->rx1 - j->rx0;
+    for (int i = 0; i < n; i++) {
+        int sx = (int)((int64_t)(j->cx0 + i - j->rx0) * j->src_w / rw);
+        if (sx >= j->src_w) sx = j->src_w - 1;
+        xy[i] = sx;
+        xc[i] = (sx / 2) * 2;
+    }
+    j->xmap_y = xy;
+    j->xmap_uv = xc;
+
+    run_job(s);
+
+    s->stat_convert_time += clock_monotonic() - t0;
+    s->stat_frames++;
+
+    wl_surface_attach(out->surface, b->buffer, 0, 0);
+    wl_surface_damage_buffer(out->surface, 0, 0, W, H);
+    wl_surface_commit(out->surface);
+    b->busy = true;
+    return false;
+}
+
+int shm_live_buffers(const ShmRenderer *s) {
+    return s ? s->live_buffers : 0;
+}
+
+void shm_log_stats(ShmRenderer *s) {
+    if (!s || s->stat_frames == 0) return;
+    LOG_INFO("wl_shm: %lu frames converted, %.2f ms/frame average (%d threads), %lu without a free buffer",
+             (unsigned long)s->stat_frames,
+             1000.0 * s->stat_convert_time / s->stat_frames,
+             s->nworkers + 1,
+             (unsigned long)s->stat_no_buffer);
+}
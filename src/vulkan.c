@@ -0,0 +1,1863 @@
+/*
+ * vulkan.c — Vulkan presentation backend (--backend vulkan)
+ *
+ * An alternative to the EGL/GLES renderer with explicit synchronisation and
+ * less driver work per frame:
+ *
+ *   - decoder DMA-BUFs and udmabuf ring slots are imported as VkImages with
+ *     VK_EXT_external_memory_dma_buf + VK_EXT_image_drm_format_modifier,
+ *     cached per dma-buf (buffer_id) like the EGLImage cache
+ *   - heap ring slots are copied through a persistently mapped staging
+ *     buffer into one optimal-tiling NV12 image
+ *   - NV12 is sampled through a VkSamplerYcbcrConversion, one pipeline per
+ *     colorspace/range pair, so chroma reconstruction and the YCbCr->RGB
+ *     matrix live in the sampler
+ *   - every Output owns a swapchain, a command buffer and its fence; the
+ *     present mode is MAILBOX or IMMEDIATE so vkQueuePresentKHR never waits
+ *     and pacing stays with the wl_surface.frame callbacks
+ *
+ * Runs on lavapipe, so the path can be exercised without a GPU. Anything
+ * missing at startup (no Vulkan 1.1 device, no YCbCr sampler support, no
+ * Wayland presentation) sends the app back to the EGL backend.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <drm_fourcc.h>
+
+#include "config.h"
+#include "wlvideo.h"
+
+#ifdef HAVE_VULKAN
+
+#define VK_USE_PLATFORM_WAYLAND_KHR
+#include <vulkan/vulkan.h>
+
+/* SPIR-V generated from shaders/ by glslangValidator at build time */
+#include "quad.vert.h"
+#include "nv12.frag.h"
+
+/* Swapchain images requested per output; 3 lets MAILBOX replace, not wait */
+#define VK_SWAPCHAIN_IMAGES 3
+#define VK_MAX_IMAGES 8
+
+/* One sampler conversion per colorspace/range pair */
+#define VK_VARIANTS ((CS_BT2020 + 1) * (CR_FULL + 1))
+
+/* How long a draw waits for the output's previous submission */
+#define VK_FENCE_TIMEOUT_NS 100000000ull
+
+#define NV12_FORMAT VK_FORMAT_G8_B8R8_2PLANE_420_UNORM
+
+/* ================================
+ * Section: Types
+ * ================================ */
+
+typedef struct {
+    VkSamplerYcbcrConversion conversion;
+    VkSampler sampler;
+    VkDescriptorSetLayout set_layout;
+    VkPipelineLayout layout;
+    VkPipeline pipeline;
+    bool tried;
+} VkVariant;
+
+typedef struct {
+    uintptr_t surface_id;           /* 0 = free */
+    uint64_t generation;
+    uint64_t buffer_id;             /* dma-buf inode (the import pins it), 0 = keyed on surface_id */
+    VkImage image;
+    VkDeviceMemory memory[2];
+    int memory_count;
+    VkImageView view;
+    int view_variant;               /* Conversion baked into view, -1 = none */
+    uint64_t last_use;
+    VkFence fence;                  /* Newest submit sampling it, NULL = idle */
+    bool acquired_once;             /* Left in GENERAL by an earlier release */
+} VkImported;
+
+struct VulkanOutput {
+    struct wl_surface *parent;      /* Layer surface the VkSurfaceKHR wraps */
+    VkSurfaceKHR surface;
+    VkSwapchainKHR swapchain;
+    VkExtent2D extent;
+    bool stale;                     /* OUT_OF_DATE/SUBOPTIMAL seen */
+
+    uint32_t image_count;
+    VkImage images[VK_MAX_IMAGES];
+    VkImageView views[VK_MAX_IMAGES];
+    VkFramebuffer framebuffers[VK_MAX_IMAGES];
+    VkSemaphore render_done[VK_MAX_IMAGES];
+    VkSemaphore acquired;
+
+    VkCommandBuffer cmd;
+    VkFence fence;
+    bool pending;                   /* fence belongs to an unwaited submit */
+
+    VkDescriptorPool pool;
+    VkDescriptorSet sets[VK_VARIANTS];
+};
+
+struct VulkanRenderer {
+    struct wl_display *display;
+
+    VkInstance instance;
+    VkPhysicalDevice phys;
+    VkPhysicalDeviceMemoryProperties mem_props;
+    VkDevice device;
+    uint32_t queue_family;
+    VkQueue queue;
+    VkCommandPool cmd_pool;
+
+    VkShaderModule vert, frag;
+    VkFormat swap_format;           /* Fixed by the first swapchain */
+    VkColorSpaceKHR swap_colorspace;
+    VkRenderPass render_pass;
+    VkVariant variants[VK_VARIANTS];
+    VkFilter chroma_filter;
+
+    /* DMA-BUF import */
+    bool has_import;
+    bool has_foreign_queue;
+    PFN_vkGetMemoryFdPropertiesKHR get_memory_fd_properties;
+    VkImported cache[EGL_CACHE_SIZE];
+    VkImported ring[SW_RING_SIZE];
+    uint64_t ring_gen;
+    SoftwareRing *ring_hooked;      /* Ring whose slot_wait points here */
+    uint64_t tick;
+    bool hw_failed;
+    bool ring_import_failed;
+
+    /* Upload path for heap ring slots */
+    VkImage upload_image;
+    VkDeviceMemory upload_memory;
+    VkImageView upload_view;
+    int upload_view_variant;
+    int upload_w, upload_h;
+    size_t upload_bytes;
+    bool upload_ready;              /* Image is in SHADER_READ_ONLY layout */
+    uint64_t uploaded_seq;
+    VkBuffer staging;
+    VkDeviceMemory staging_memory;
+    void *staging_map;
+    size_t staging_size;
+    VkFence staging_fence;          /* Last submission reading the staging buffer */
+
+    char device_name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE];
+    uint32_t vendor_id;
+
+    /* Statistics */
+    uint64_t stat_frames;
+    uint64_t stat_imports;
+    uint64_t stat_import_hits;
+    uint64_t stat_uploads;
+    uint64_t stat_skipped;
+};
+
+static const char *vk_result_name(VkResult res) {
+    switch (res) {
+    case VK_SUCCESS: return "SUCCESS";
+    case VK_NOT_READY: return "NOT_READY";
+    case VK_TIMEOUT: return "TIMEOUT";
+    case VK_SUBOPTIMAL_KHR: return "SUBOPTIMAL";
+    case VK_ERROR_OUT_OF_HOST_MEMORY: return "OUT_OF_HOST_MEMORY";
+    case VK_ERROR_OUT_OF_DEVICE_MEMORY: return "OUT_OF_DEVICE_MEMORY";
+    case VK_ERROR_INITIALIZATION_FAILED: return "INITIALIZATION_FAILED";
+    case VK_ERROR_DEVICE_LOST: return "DEVICE_LOST";
+    case VK_ERROR_EXTENSION_NOT_PRESENT: return "EXTENSION_NOT_PRESENT";
+    case VK_ERROR_FEATURE_NOT_PRESENT: return "FEATURE_NOT_PRESENT";
+    case VK_ERROR_INCOMPATIBLE_DRIVER: return "INCOMPATIBLE_DRIVER";
+    case VK_ERROR_FORMAT_NOT_SUPPORTED: return "FORMAT_NOT_SUPPORTED";
+    case VK_ERROR_SURFACE_LOST_KHR: return "SURFACE_LOST";
+    case VK_ERROR_OUT_OF_DATE_KHR: return "OUT_OF_DATE";
+    case VK_ERROR_INVALID_EXTERNAL_HANDLE: return "INVALID_EXTERNAL_HANDLE";
+    default: return "UNKNOWN";
+    }
+}
+
+static int find_memory_type(VulkanRenderer *v, uint32_t bits, VkMemoryPropertyFlags want) {
+    for (uint32_t i = 0; i < v->mem_props.memoryTypeCount; i++) {
+        if ((bits & (1u << i)) && (v->mem_props.memoryTypes[i].propertyFlags & want) == want)
+            return (int)i;
+    }
+    return -1;
+}
+
+/* ================================
+ * Section: Device selection
+ * ================================ */
+
+static bool has_extension(const VkExtensionProperties *exts, uint32_t count, const char *name) {
+    for (uint32_t i = 0; i < count; i++)
+        if (!strcmp(exts[i].extensionName, name))
+            return true;
+    return false;
+}
+
+/* Prefer real GPUs, but accept lavapipe when it's all there is */
+static int device_score(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 4;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 3;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return 1;
+    default: return 0;
+    }
+}
+
+static bool pick_device(VulkanRenderer *v) {
+    uint32_t count = 0;
+    vkEnumeratePhysicalDevices(v->instance, &count, NULL);
+    if (count == 0) return false;
+
+    VkPhysicalDevice devs[16];
+    if (count > 16) count = 16;
+    vkEnumeratePhysicalDevices(v->instance, &count, devs);
+
+    int best = -1;
+    for (uint32_t i = 0; i < count; i++) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(devs[i], &props);
+        if (props.apiVersion < VK_API_VERSION_1_1) continue;
+
+        VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcr = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES,
+        };
+        VkPhysicalDeviceFeatures2 feats = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &ycbcr,
+        };
+        vkGetPhysicalDeviceFeatures2(devs[i], &feats);
+        if (!ycbcr.samplerYcbcrConversion) {
+            LOG_DEBUG("Vulkan: %s lacks samplerYcbcrConversion", props.deviceName);
+            continue;
+        }
+
+        uint32_t qcount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(devs[i], &qcount, NULL);
+        VkQueueFamilyProperties qprops[16];
+        if (qcount > 16) qcount = 16;
+        vkGetPhysicalDeviceQueueFamilyProperties(devs[i], &qcount, qprops);
+
+        int family = -1;
+        for (uint32_t q = 0; q < qcount; q++) {
+            if ((qprops[q].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+                vkGetPhysicalDeviceWaylandPresentationSupportKHR(devs[i], q, v->display)) {
+                family = (int)q;
+                break;
+            }
+        }
+        if (family < 0) continue;
+
+        int score = device_score(props.deviceType);
+        if (best < 0 || score > best) {
+            best = score;
+            v->phys = devs[i];
+            v->queue_family = (uint32_t)family;
+            v->vendor_id = props.vendorID;
+            snprintf(v->device_name, sizeof(v->device_name), "%s", props.deviceName);
+        }
+    }
+    return best >= 0;
+}
+
+static bool create_device(VulkanRenderer *v) {
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(v->phys, NULL, &count, NULL);
+    VkExtensionProperties *exts = calloc(count ? count : 1, sizeof(*exts));
+    if (!exts) return false;
+    vkEnumerateDeviceExtensionProperties(v->phys, NULL, &count, exts);
+
+    if (!has_extension(exts, count, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+        LOG_ERROR("Vulkan: %s has no %s", v->device_name, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        free(exts);
+        return false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(v->phys, &props);
+
+    const char *enable[8];
+    uint32_t n = 0;
+    enable[n++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+
+    /* Import needs the whole set; image_format_list is core from 1.2 */
+    bool need_format_list = props.apiVersion < VK_API_VERSION_1_2;
+    v->has_import = has_extension(exts, count, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME) &&
+                    has_extension(exts, count, VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME) &&
+                    has_extension(exts, count, VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME) &&
+                    (!need_format_list ||
+                     has_extension(exts, count, VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME));
+    if (v->has_import) {
+        enable[n++] = VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME;
+        enable[n++] = VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME;
+        enable[n++] = VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME;
+        if (need_format_list)
+            enable[n++] = VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME;
+        v->has_foreign_queue = has_extension(exts, count, VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME);
+        if (v->has_foreign_queue)
+            enable[n++] = VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME;
+    }
+    free(exts);
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo qci = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueFamilyIndex = v->queue_family,
+        .queueCount = 1,
+        .pQueuePriorities = &priority,
+    };
+    VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcr = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES,
+        .samplerYcbcrConversion = VK_TRUE,
+    };
+    VkDeviceCreateInfo dci = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &ycbcr,
+        .queueCreateInfoCount = 1,
+        .pQueueCreateInfos = &qci,
+        .enabledExtensionCount = n,
+        .ppEnabledExtensionNames = enable,
+    };
+    VkResult res = vkCreateDevice(v->phys, &dci, NULL, &v->device);
+    if (res != VK_SUCCESS) {
+        LOG_ERROR("Vulkan: vkCreateDevice failed: %s", vk_result_name(res));
+        return false;
+    }
+    vkGetDeviceQueue(v->device, v->queue_family, 0, &v->queue);
+
+    if (v->has_import) {
+        v->get_memory_fd_properties = (PFN_vkGetMemoryFdPropertiesKHR)
+            vkGetDeviceProcAddr(v->device, "vkGetMemoryFdPropertiesKHR");
+        if (!v->get_memory_fd_properties)
+            v->has_import = false;
+    }
+    return true;
+}
+
+/*
+ * Linear chroma reconstruction where every NV12 image we may sample allows
+ * it: the optimal-tiling upload image and, with import, each DRM modifier a
+ * dma-buf can arrive in. The filter is baked into the conversions, so one
+ * modifier without the feature makes it nearest for all.
+ */
+static VkFilter pick_chroma_filter(VulkanRenderer *v) {
+    const VkFormatFeatureFlags linear = VK_FORMAT_FEATURE_SAMPLED_IMAGE_YCBCR_CONVERSION_LINEAR_FILTER_BIT;
+
+    VkDrmFormatModifierPropertiesListEXT mods = {
+        .sType = VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT,
+    };
+    VkFormatProperties2 fp = {
+        .sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2,
+        .pNext = v->has_import ? &mods : NULL,
+    };
+    vkGetPhysicalDeviceFormatProperties2(v->phys, NV12_FORMAT, &fp);
+    if (!(fp.formatProperties.optimalTilingFeatures & linear))
+        return VK_FILTER_NEAREST;
+    if (!v->has_import || mods.drmFormatModifierCount == 0)
+        return VK_FILTER_LINEAR;
+
+    VkDrmFormatModifierPropertiesEXT *props = calloc(mods.drmFormatModifierCount, sizeof(*props));
+    if (!props) return VK_FILTER_NEAREST;
+    mods.pDrmFormatModifierProperties = props;
+    vkGetPhysicalDeviceFormatProperties2(v->phys, NV12_FORMAT, &fp);
+
+    VkFilter filter = VK_FILTER_LINEAR;
+    for (uint32_t i = 0; i < mods.drmFormatModifierCount; i++) {
+        if (!(props[i].drmFormatModifierTilingFeatures & linear)) {
+            LOG_DEBUG("Vulkan: NV12 modifier 0x%016llx lacks linear chroma filtering",
+                      (unsigned long long)props[i].drmFormatModifier);
+            filter = VK_FILTER_NEAREST;
+        }
+    }
+    free(props);
+    return filter;
+}
+
+/* ================================
+ * Section: Pipelines
+ * ================================ */
+
+static VkShaderModule create_shader(VulkanRenderer *v, const uint32_t *code, size_t size) {
+    VkShaderModuleCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = size,
+        .pCode = code,
+    };
+    VkShaderModule mod = VK_NULL_HANDLE;
+    vkCreateShaderModule(v->device, &ci, NULL, &mod);
+    return mod;
+}
+
+static bool create_render_pass(VulkanRenderer *v) {
+    VkAttachmentDescription color = {
+        .format = v->swap_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    };
+    VkAttachmentReference ref = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &ref,
+    };
+    /* The acquire semaphore is waited at this stage; order the clear after it */
+    VkSubpassDependency dep = {
+        .srcSubpass = VK_SUBPASS_EXTERNAL,
+        .dstSubpass = 0,
+        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+    };
+    VkRenderPassCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = 1,
+        .pDependencies = &dep,
+    };
+    return vkCreateRenderPass(v->device, &ci, NULL, &v->render_pass) == VK_SUCCESS;
+}
+
+static void variant_destroy(VulkanRenderer *v, VkVariant *var) {
+    if (var->pipeline) vkDestroyPipeline(v->device, var->pipeline, NULL);
+    if (var->layout) vkDestroyPipelineLayout(v->device, var->layout, NULL);
+    if (var->set_layout) vkDestroyDescriptorSetLayout(v->device, var->set_layout, NULL);
+    if (var->sampler) vkDestroySampler(v->device, var->sampler, NULL);
+    if (var->conversion) vkDestroySamplerYcbcrConversion(v->device, var->conversion, NULL);
+    memset(var, 0, sizeof(*var));
+}
+
+static int variant_index(ColorSpace cs, ColorRange range) {
+    return (int)cs * (CR_FULL + 1) + (int)range;
+}
+
+/*
+ * Sampler conversion, immutable sampler, layouts and pipeline for one
+ * colorspace/range pair, built the first time a frame needs it. Needs the
+ * render pass, so only after the first swapchain exists.
+ */
+static VkVariant *variant_get(VulkanRenderer *v, ColorSpace cs, ColorRange range) {
+    VkVariant *var = &v->variants[variant_index(cs, range)];
+    if (var->pipeline) return var;
+    if (var->tried || !v->render_pass) return NULL;
+    var->tried = true;
+
+    VkSamplerYcbcrConversionCreateInfo cci = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO,
+        .format = NV12_FORMAT,
+        .ycbcrModel = cs == CS_BT601 ? VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601 :
+                      cs == CS_BT2020 ? VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_2020 :
+                      VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709,
+        .ycbcrRange = range == CR_FULL ? VK_SAMPLER_YCBCR_RANGE_ITU_FULL
+                                       : VK_SAMPLER_YCBCR_RANGE_ITU_NARROW,
+        .components = {
+            VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+            VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+        },
+        /* MPEG-2/H.264 default siting: left-aligned, vertically centred */
+        .xChromaOffset = VK_CHROMA_LOCATION_COSITED_EVEN,
+        .yChromaOffset = VK_CHROMA_LOCATION_MIDPOINT,
+        .chromaFilter = v->chroma_filter,
+        .forceExplicitReconstruction = VK_FALSE,
+    };
+    if (vkCreateSamplerYcbcrConversion(v->device, &cci, NULL, &var->conversion) != VK_SUCCESS)
+        goto fail;
+
+    VkSamplerYcbcrConversionInfo conv = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .conversion = var->conversion,
+    };
+    VkSamplerCreateInfo sci = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .pNext = &conv,
+        .magFilter = v->chroma_filter,
+        .minFilter = v->chroma_filter,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .maxLod = 0.0f,
+    };
+    if (vkCreateSampler(v->device, &sci, NULL, &var->sampler) != VK_SUCCESS)
+        goto fail;
+
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = &var->sampler,
+    };
+    VkDescriptorSetLayoutCreateInfo dci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    if (vkCreateDescriptorSetLayout(v->device, &dci, NULL, &var->set_layout) != VK_SUCCESS)
+        goto fail;
+
+    VkPushConstantRange push = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = 4 * sizeof(float),
+    };
+    VkPipelineLayoutCreateInfo lci = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &var->set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push,
+    };
+    if (vkCreatePipelineLayout(v->device, &lci, NULL, &var->layout) != VK_SUCCESS)
+        goto fail;
+
+    VkPipelineShaderStageCreateInfo stages[2] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = v->vert,
+            .pName = "main",
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = v->frag,
+            .pName = "main",
+        },
+    };
+    VkPipelineVertexInputStateCreateInfo vin = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    };
+    VkPipelineInputAssemblyStateCreateInfo ia = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+    };
+    VkPipelineViewportStateCreateInfo vp = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+    VkPipelineRasterizationStateCreateInfo rs = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+        .lineWidth = 1.0f,
+    };
+    VkPipelineMultisampleStateCreateInfo ms = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    VkPipelineColorBlendAttachmentState blend_att = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+    VkPipelineColorBlendStateCreateInfo blend = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &blend_att,
+    };
+    VkDynamicState dyn_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dyn = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dyn_states,
+    };
+    VkGraphicsPipelineCreateInfo pci = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = 2,
+        .pStages = stages,
+        .pVertexInputState = &vin,
+        .pInputAssemblyState = &ia,
+        .pViewportState = &vp,
+        .pRasterizationState = &rs,
+        .pMultisampleState = &ms,
+        .pColorBlendState = &blend,
+        .pDynamicState = &dyn,
+        .layout = var->layout,
+        .renderPass = v->render_pass,
+        .subpass = 0,
+    };
+    if (vkCreateGraphicsPipelines(v->device, VK_NULL_HANDLE, 1, &pci, NULL, &var->pipeline) != VK_SUCCESS)
+        goto fail;
+
+    LOG_DEBUG("Vulkan: pipeline for colorspace %d range %d built", cs, range);
+    return var;
+
+fail:
+    LOG_WARN("Vulkan: YCbCr pipeline for colorspace %d range %d failed", cs, range);
+    variant_destroy(v, var);
+    var->tried = true;
+    return NULL;
+}
+
+/* ================================
+ * Section: Image import
+ * ================================ */
+
+static void imported_reset(VulkanRenderer *v, VkImported *e) {
+    if (e->view) vkDestroyImageView(v->device, e->view, NULL);
+    if (e->image) vkDestroyImage(v->device, e->image, NULL);
+    for (int i = 0; i < e->memory_count; i++)
+        vkFreeMemory(v->device, e->memory[i], NULL);
+    memset(e, 0, sizeof(*e));
+    e->view_variant = -1;
+}
+
+static bool same_file(int a, int b) {
+    if (a == b) return true;
+    struct stat sa, sb;
+    return fstat(a, &sa) == 0 && fstat(b, &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/*
+ * Wrap an NV12 dma-buf as a VkImage with an explicit DRM format modifier
+ * layout. Planes in one buffer are bound with one (dedicated) import;
+ * planes in separate buffers make a disjoint image, one import per plane.
+ * The fds are dup'd: Vulkan owns what it imports.
+ */
+static bool import_dmabuf(VulkanRenderer *v, const DmaBuf *buf, int w, int h, VkImported *e) {
+    if (!v->has_import || buf->fourcc != DRM_FORMAT_NV12 || buf->num_planes != 2)
+        return false;
+
+    bool disjoint = buf->fd[1] >= 0 && !same_file(buf->fd[0], buf->fd[1]);
+    VkImageCreateFlags flags = disjoint ? VK_IMAGE_CREATE_DISJOINT_BIT : 0;
+
+    VkPhysicalDeviceImageDrmFormatModifierInfoEXT mod_info = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT,
+        .drmFormatModifier = buf->modifier[0],
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkPhysicalDeviceExternalImageFormatInfo ext_info = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO,
+        .pNext = &mod_info,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+    };
+    VkPhysicalDeviceImageFormatInfo2 fmt_info = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+        .pNext = &ext_info,
+        .format = NV12_FORMAT,
+        .type = VK_IMAGE_TYPE_2D,
+        .tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT,
+        .flags = flags,
+    };
+    VkExternalImageFormatProperties ext_props = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
+    };
+    VkImageFormatProperties2 fmt_props = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+        .pNext = &ext_props,
+    };
+    if (vkGetPhysicalDeviceImageFormatProperties2(v->phys, &fmt_info, &fmt_props) != VK_SUCCESS) {
+        LOG_DEBUG("Vulkan: NV12 modifier 0x%016llx not importable",
+                  (unsigned long long)buf->modifier[0]);
+        return false;
+    }
+    if (!(ext_props.externalMemoryProperties.externalMemoryFeatures &
+          VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT))
+        return false;
+
+    VkSubresourceLayout planes[2] = {
+        { .offset = buf->offset[0], .rowPitch = buf->stride[0] },
+        { .offset = buf->offset[1], .rowPitch = buf->stride[1] },
+    };
+    VkImageDrmFormatModifierExplicitCreateInfoEXT mod = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT,
+        .drmFormatModifier = buf->modifier[0],
+        .drmFormatModifierPlaneCount = 2,
+        .pPlaneLayouts = planes,
+    };
+    VkExternalMemoryImageCreateInfo ext = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+        .pNext = &mod,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+    };
+    VkImageCreateInfo ici = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = &ext,
+        .flags = flags,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = NV12_FORMAT,
+        .extent = { (uint32_t)w, (uint32_t)h, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if (vkCreateImage(v->device, &ici, NULL, &e->image) != VK_SUCCESS)
+        return false;
+
+    int count = disjoint ? 2 : 1;
+    VkBindImageMemoryInfo binds[2];
+    VkBindImagePlaneMemoryInfo plane_binds[2];
+
+    for (int i = 0; i < count; i++) {
+        VkImageAspectFlagBits aspect = i ? VK_IMAGE_ASPECT_MEMORY_PLANE_1_BIT_EXT
+                                         : VK_IMAGE_ASPECT_MEMORY_PLANE_0_BIT_EXT;
+        VkImagePlaneMemoryRequirementsInfo plane_req = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_PLANE_MEMORY_REQUIREMENTS_INFO,
+            .planeAspect = aspect,
+        };
+        VkImageMemoryRequirementsInfo2 req_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+            .pNext = disjoint ? &plane_req : NULL,
+            .image = e->image,
+        };
+        VkMemoryRequirements2 req = { .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+        vkGetImageMemoryRequirements2(v->device, &req_info, &req);
+
+        int fd = dup(buf->fd[i]);
+        if (fd < 0) goto fail;
+
+        VkMemoryFdPropertiesKHR fd_props = { .sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR };
+        if (v->get_memory_fd_properties(v->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+                                        fd, &fd_props) != VK_SUCCESS) {
+            close(fd);
+            goto fail;
+        }
+        int type = find_memory_type(v, req.memoryRequirements.memoryTypeBits & fd_props.memoryTypeBits, 0);
+        if (type < 0) {
+            close(fd);
+            goto fail;
+        }
+
+        VkMemoryDedicatedAllocateInfo dedicated = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+            .image = e->image,
+        };
+        VkImportMemoryFdInfoKHR import = {
+            .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+            .pNext = disjoint ? NULL : &dedicated,
+            .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+            .fd = fd,
+        };
+        VkMemoryAllocateInfo alloc = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = &import,
+            .allocationSize = req.memoryRequirements.size,
+            .memoryTypeIndex = (uint32_t)type,
+        };
+        /* On success the fd belongs to the allocation */
+        if (vkAllocateMemory(v->device, &alloc, NULL, &e->memory[i]) != VK_SUCCESS) {
+            close(fd);
+            goto fail;
+        }
+        e->memory_count = i + 1;
+
+        plane_binds[i] = (VkBindImagePlaneMemoryInfo){
+            .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_PLANE_MEMORY_INFO,
+            .planeAspect = aspect,
+        };
+        binds[i] = (VkBindImageMemoryInfo){
+            .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+            .pNext = disjoint ? &plane_binds[i] : NULL,
+            .image = e->image,
+            .memory = e->memory[i],
+            .memoryOffset = 0,
+        };
+    }
+
+    if (vkBindImageMemory2(v->device, (uint32_t)count, binds) != VK_SUCCESS)
+        goto fail;
+
+    v->stat_imports++;
+    return true;
+
+fail:
+    imported_reset(v, e);
+    return false;
+}
+
+/* View with the variant's conversion attached; views are per conversion */
+static VkImageView ycbcr_view(VulkanRenderer *v, VkImage image, const VkVariant *var) {
+    VkSamplerYcbcrConversionInfo conv = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO,
+        .conversion = var->conversion,
+    };
+    VkImageViewCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = &conv,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = NV12_FORMAT,
+        .components = {
+            VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+            VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+        },
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .layerCount = 1,
+        },
+    };
+    VkImageView view = VK_NULL_HANDLE;
+    vkCreateImageView(v->device, &ci, NULL, &view);
+    return view;
+}
+
+static VkImageView imported_view(VulkanRenderer *v, VkImported *e, const VkVariant *var, int idx) {
+    if (e->view && e->view_variant == idx)
+        return e->view;
+    if (e->view) vkDestroyImageView(v->device, e->view, NULL);
+    e->view = ycbcr_view(v, e->image, var);
+    e->view_variant = e->view ? idx : -1;
+    return e->view;
+}
+
+static void wait_all_outputs(VulkanRenderer *v) {
+    vkDeviceWaitIdle(v->device);
+}
+
+/*
+ * An import is idle once the newest submission that sampled it has
+ * completed. One queue: a fence also covers every earlier submission.
+ */
+static bool imported_idle(VulkanRenderer *v, VkImported *e, uint64_t timeout_ns) {
+    if (!e->fence) return true;
+    if (vkWaitForFences(v->device, 1, &e->fence, VK_TRUE, timeout_ns) != VK_SUCCESS)
+        return false;
+    e->fence = VK_NULL_HANDLE;
+    return true;
+}
+
+/* An output fence is going away; its submissions are already waited for */
+static void forget_fence(VulkanRenderer *v, VkFence fence) {
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        if (v->cache[i].fence == fence) v->cache[i].fence = VK_NULL_HANDLE;
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        if (v->ring[i].fence == fence) v->ring[i].fence = VK_NULL_HANDLE;
+    if (v->staging_fence == fence)
+        v->staging_fence = VK_NULL_HANDLE;
+}
+
+static bool imported_match(const VkImported *e, const Frame *frame) {
+    if (!e->image) return false;
+    if (frame->hw.buffer_id)
+        return e->buffer_id == frame->hw.buffer_id;
+    return !e->buffer_id && e->surface_id == frame->hw.surface_id &&
+           e->generation == frame->hw.generation;
+}
+
+/*
+ * VA surface → cached import, LRU like the EGLImage cache. A miss evicts
+ * the least recently used idle entry; if every entry is still sampled, the
+ * oldest gets VK_FENCE_TIMEOUT_NS and *busy is set when it doesn't finish.
+ */
+static VkImported *hw_image(VulkanRenderer *v, Frame *frame, bool *busy) {
+    *busy = false;
+    v->tick++;
+    VkImported *victim = NULL, *lru = NULL;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++) {
+        VkImported *e = &v->cache[i];
+        if (imported_match(e, frame)) {
+            e->last_use = v->tick;
+            v->stat_import_hits++;
+            return e;
+        }
+        if (!e->image) {
+            if (!victim || victim->image) victim = e;
+            continue;
+        }
+        if (!lru || e->last_use < lru->last_use)
+            lru = e;
+        if ((!victim || (victim->image && e->last_use < victim->last_use)) && imported_idle(v, e, 0))
+            victim = e;
+    }
+
+    if (!victim) {
+        if (!imported_idle(v, lru, VK_FENCE_TIMEOUT_NS)) {
+            *busy = true;
+            return NULL;
+        }
+        victim = lru;
+    }
+    if (victim->image)
+        imported_reset(v, victim);
+    if (!import_dmabuf(v, &frame->hw.dmabuf, frame->width, frame->height, victim))
+        return NULL;
+    victim->surface_id = frame->hw.surface_id;
+    victim->generation = frame->hw.generation;
+    victim->buffer_id = frame->hw.buffer_id;
+    victim->last_use = v->tick;
+    return victim;
+}
+
+/*
+ * SoftwareRing.slot_wait while slots are sampled in place: a slot is free
+ * once the newest submission that sampled it has completed.
+ */
+static bool ring_slot_wait(void *ctx, int slot, uint64_t timeout_ns) {
+    VulkanRenderer *v = ctx;
+    return imported_idle(v, &v->ring[slot], timeout_ns);
+}
+
+static void ring_images_release(VulkanRenderer *v) {
+    if (v->ring_hooked && v->ring_hooked->slot_wait_ctx == v) {
+        v->ring_hooked->slot_wait = NULL;
+        v->ring_hooked->slot_wait_ctx = NULL;
+    }
+    v->ring_hooked = NULL;
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        imported_reset(v, &v->ring[i]);
+}
+
+/*
+ * udmabuf ring slot → linear import, one per slot per ring allocation.
+ * The decoder may come round to a slot while a submission still samples
+ * it, so it waits on the slot's fence (ring_slot_wait) before rewriting.
+ */
+static VkImported *ring_image(VulkanRenderer *v, Frame *frame, SoftwareRing *ring) {
+    if (ring->dmabuf_fd < 0 || v->ring_import_failed) return NULL;
+
+    if (v->ring_gen != ring->generation) {
+        wait_all_outputs(v);
+        ring_images_release(v);
+        v->ring_gen = ring->generation;
+    }
+
+    int slot = frame->sw.ring_slot;
+    VkImported *e = &v->ring[slot];
+    ring->slot_wait = ring_slot_wait;
+    ring->slot_wait_ctx = v;
+    v->ring_hooked = ring;
+    if (e->image) return e;
+
+    size_t base = (size_t)slot * ring->slot_size;
+    DmaBuf d = {
+        .fd = { ring->dmabuf_fd, ring->dmabuf_fd, -1, -1 },
+        .offset = { (uint32_t)base, (uint32_t)(base + (size_t)ring->y_stride * ring->height) },
+        .stride = { (uint32_t)ring->y_stride, (uint32_t)ring->uv_stride },
+        .fourcc = DRM_FORMAT_NV12,
+        .modifier = { DRM_FORMAT_MOD_LINEAR, DRM_FORMAT_MOD_LINEAR },
+        .width = frame->width,
+        .height = frame->height,
+        .num_planes = 2,
+    };
+    if (!import_dmabuf(v, &d, frame->width, frame->height, e)) {
+        LOG_INFO("Vulkan: ring slot import failed, using staging uploads");
+        wait_all_outputs(v);
+        ring_images_release(v);
+        v->ring_import_failed = true;
+        return NULL;
+    }
+    return e;
+}
+
+/* ================================
+ * Section: Staging upload
+ * ================================ */
+
+static void upload_release(VulkanRenderer *v) {
+    if (v->upload_view) vkDestroyImageView(v->device, v->upload_view, NULL);
+    if (v->upload_image) vkDestroyImage(v->device, v->upload_image, NULL);
+    if (v->upload_memory) vkFreeMemory(v->device, v->upload_memory, NULL);
+    if (v->staging) vkDestroyBuffer(v->device, v->staging, NULL);
+    if (v->staging_memory) vkFreeMemory(v->device, v->staging_memory, NULL);
+    mem_release(MEM_CACHE, v->upload_bytes);
+    mem_release(MEM_STAGING, v->staging_size);
+
+    v->upload_view = VK_NULL_HANDLE;
+    v->upload_image = VK_NULL_HANDLE;
+    v->upload_memory = VK_NULL_HANDLE;
+    v->staging = VK_NULL_HANDLE;
+    v->staging_memory = VK_NULL_HANDLE;
+    v->staging_map = NULL;
+    v->upload_bytes = 0;
+    v->staging_size = 0;
+    v->upload_w = v->upload_h = 0;
+    v->upload_view_variant = -1;
+    v->upload_ready = false;
+    v->uploaded_seq = 0;
+    v->staging_fence = VK_NULL_HANDLE;
+}
+
+/* Device-local NV12 image plus a mapped staging buffer the size of a slot */
+static bool upload_ensure(VulkanRenderer *v, const SoftwareRing *ring, int w, int h) {
+    if (v->upload_image && v->upload_w == w && v->upload_h == h)
+        return true;
+
+    wait_all_outputs(v);
+    upload_release(v);
+
+    VkImageCreateInfo ici = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = NV12_FORMAT,
+        .extent = { (uint32_t)w, (uint32_t)h, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if (vkCreateImage(v->device, &ici, NULL, &v->upload_image) != VK_SUCCESS)
+        goto fail;
+
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(v->device, v->upload_image, &req);
+    int type = find_memory_type(v, req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (type < 0 || !mem_reserve(MEM_CACHE, req.size))
+        goto fail;
+    v->upload_bytes = req.size;
+
+    VkMemoryAllocateInfo alloc = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = req.size,
+        .memoryTypeIndex = (uint32_t)type,
+    };
+    if (vkAllocateMemory(v->device, &alloc, NULL, &v->upload_memory) != VK_SUCCESS ||
+        vkBindImageMemory(v->device, v->upload_image, v->upload_memory, 0) != VK_SUCCESS)
+        goto fail;
+
+    size_t size = (size_t)ring->y_stride * h + (size_t)ring->uv_stride * (h / 2);
+    if (!mem_reserve(MEM_STAGING, size))
+        goto fail;
+    v->staging_size = size;
+
+    VkBufferCreateInfo bci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(v->device, &bci, NULL, &v->staging) != VK_SUCCESS)
+        goto fail;
+
+    vkGetBufferMemoryRequirements(v->device, v->staging, &req);
+    type = find_memory_type(v, req.memoryTypeBits,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (type < 0) goto fail;
+    alloc.allocationSize = req.size;
+    alloc.memoryTypeIndex = (uint32_t)type;
+    if (vkAllocateMemory(v->device, &alloc, NULL, &v->staging_memory) != VK_SUCCESS ||
+        vkBindBufferMemory(v->device, v->staging, v->staging_memory, 0) != VK_SUCCESS ||
+        vkMapMemory(v->device, v->staging_memory, 0, VK_WHOLE_SIZE, 0, &v->staging_map) != VK_SUCCESS)
+        goto fail;
+
+    v->upload_w = w;
+    v->upload_h = h;
+    LOG_DEBUG("Vulkan: upload image %dx%d, %zu KiB staging", w, h, size / 1024);
+    return true;
+
+fail:
+    LOG_WARN("Vulkan: upload image allocation failed");
+    upload_release(v);
+    return false;
+}
+
+/*
+ * Get the upload image ready to take this frame, before anything is
+ * acquired. The staging buffer is only rewritten once the submission that
+ * last read it has completed; if that doesn't happen within
+ * VK_FENCE_TIMEOUT_NS the fence is kept and false returned, so the frame
+ * is skipped rather than the previous upload presented as this one.
+ */
+static bool upload_prepare(VulkanRenderer *v, Frame *frame, SoftwareRing *ring) {
+    if (!upload_ensure(v, ring, frame->width, frame->height))
+        return false;
+    if (v->uploaded_seq == frame->seq && v->upload_ready)
+        return true;
+
+    if (v->staging_fence) {
+        VkResult res = vkWaitForFences(v->device, 1, &v->staging_fence, VK_TRUE, VK_FENCE_TIMEOUT_NS);
+        if (res != VK_SUCCESS) {
+            LOG_DEBUG("Vulkan: staging buffer still in use (%s), frame skipped", vk_result_name(res));
+            return false;
+        }
+        v->staging_fence = VK_NULL_HANDLE;
+    }
+    return true;
+}
+
+/*
+ * Copy the slot into staging and record the buffer→image copy into cmd,
+ * after upload_prepare(). Later outputs of the same frame reuse the image:
+ * queue submission order plus the final barrier makes the copy visible to
+ * them.
+ */
+static void upload_record(VulkanRenderer *v, VkCommandBuffer cmd, VkFence fence,
+                          Frame *frame, SoftwareRing *ring) {
+    int w = frame->width, h = frame->height;
+    if (v->uploaded_seq == frame->seq && v->upload_ready)
+        return;
+
+    memcpy(v->staging_map, sw_ring_get_y(ring, frame->sw.ring_slot), v->staging_size);
+
+    VkImageMemoryBarrier to_dst = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = v->upload_ready ? VK_ACCESS_SHADER_READ_BIT : 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = v->upload_ready ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                     : VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = v->upload_image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &to_dst);
+
+    /* bufferRowLength is in texels: 1 byte luma, 2 byte interleaved chroma */
+    VkBufferImageCopy regions[2] = {
+        {
+            .bufferOffset = 0,
+            .bufferRowLength = (uint32_t)ring->y_stride,
+            .imageSubresource = { VK_IMAGE_ASPECT_PLANE_0_BIT, 0, 0, 1 },
+            .imageExtent = { (uint32_t)w, (uint32_t)h, 1 },
+        },
+        {
+            .bufferOffset = (VkDeviceSize)ring->y_stride * h,
+            .bufferRowLength = (uint32_t)ring->uv_stride / 2,
+            .imageSubresource = { VK_IMAGE_ASPECT_PLANE_1_BIT, 0, 0, 1 },
+            .imageExtent = { (uint32_t)w / 2, (uint32_t)h / 2, 1 },
+        },
+    };
+    vkCmdCopyBufferToImage(cmd, v->staging, v->upload_image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 2, regions);
+
+    VkImageMemoryBarrier to_read = to_dst;
+    to_read.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    to_read.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    to_read.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    to_read.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &to_read);
+
+    v->staging_fence = fence;
+    v->upload_ready = true;
+    v->uploaded_seq = frame->seq;
+    v->stat_uploads++;
+}
+
+/* ================================
+ * Section: Swapchain
+ * ================================ */
+
+static void swapchain_release(VulkanRenderer *v, struct VulkanOutput *o) {
+    for (uint32_t i = 0; i < o->image_count; i++) {
+        if (o->framebuffers[i]) vkDestroyFramebuffer(v->device, o->framebuffers[i], NULL);
+        if (o->views[i]) vkDestroyImageView(v->device, o->views[i], NULL);
+        if (o->render_done[i]) vkDestroySemaphore(v->device, o->render_done[i], NULL);
+        o->framebuffers[i] = VK_NULL_HANDLE;
+        o->views[i] = VK_NULL_HANDLE;
+        o->render_done[i] = VK_NULL_HANDLE;
+    }
+    o->image_count = 0;
+}
+
+static bool pick_surface_format(VulkanRenderer *v, VkSurfaceKHR surface) {
+    uint32_t count = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(v->phys, surface, &count, NULL);
+    VkSurfaceFormatKHR formats[32];
+    if (count > 32) count = 32;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(v->phys, surface, &count, formats);
+
+    /* Video is already gamma encoded: UNORM, never an _SRGB format */
+    for (uint32_t i = 0; i < count; i++) {
+        bool match = v->swap_format != VK_FORMAT_UNDEFINED
+            ? formats[i].format == v->swap_format
+            : formats[i].format == VK_FORMAT_B8G8R8A8_UNORM ||
+              formats[i].format == VK_FORMAT_R8G8B8A8_UNORM;
+        if (match && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            v->swap_format = formats[i].format;
+            v->swap_colorspace = formats[i].colorSpace;
+            return true;
+        }
+    }
+    return false;
+}
+
+static VkPresentModeKHR pick_present_mode(VulkanRenderer *v, VkSurfaceKHR surface) {
+    uint32_t count = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(v->phys, surface, &count, NULL);
+    VkPresentModeKHR modes[8];
+    if (count > 8) count = 8;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(v->phys, surface, &count, modes);
+
+    /* Non-blocking first: frame callbacks already pace every output */
+    bool immediate = false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) return modes[i];
+        if (modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) immediate = true;
+    }
+    return immediate ? VK_PRESENT_MODE_IMMEDIATE_KHR : VK_PRESENT_MODE_FIFO_KHR;
+}
+
+static bool swapchain_create(VulkanRenderer *v, Output *out) {
+    struct VulkanOutput *o = out->vk;
+
+    if (o->pending) {
+        vkWaitForFences(v->device, 1, &o->fence, VK_TRUE, VK_FENCE_TIMEOUT_NS);
+        o->pending = false;
+    }
+
+    VkSurfaceCapabilitiesKHR caps;
+    if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(v->phys, o->surface, &caps) != VK_SUCCESS)
+        return false;
+
+    VkFormat had_format = v->swap_format;
+    if (!pick_surface_format(v, o->surface)) {
+        LOG_ERROR("Output %s: no UNORM sRGB-nonlinear swapchain format", out->name);
+        return false;
+    }
+    if (had_format == VK_FORMAT_UNDEFINED && !create_render_pass(v))
+        return false;
+
+    /* Wayland leaves the extent to us */
+    VkExtent2D extent = caps.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        extent.width = (uint32_t)out->width;
+        extent.height = (uint32_t)out->height;
+    }
+
+    uint32_t images = VK_SWAPCHAIN_IMAGES;
+    if (images < caps.minImageCount) images = caps.minImageCount;
+    if (caps.maxImageCount && images > caps.maxImageCount) images = caps.maxImageCount;
+
+    VkCompositeAlphaFlagBitsKHR alpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(caps.supportedCompositeAlpha & alpha)) {
+        for (uint32_t bit = 1; bit <= VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR; bit <<= 1) {
+            if (caps.supportedCompositeAlpha & bit) {
+                alpha = (VkCompositeAlphaFlagBitsKHR)bit;
+                break;
+            }
+        }
+    }
+
+    VkPresentModeKHR mode = pick_present_mode(v, o->surface);
+    VkSwapchainKHR old = o->swapchain;
+    VkSwapchainCreateInfoKHR sci = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = o->surface,
+        .minImageCount = images,
+        .imageFormat = v->swap_format,
+        .imageColorSpace = v->swap_colorspace,
+        .imageExtent = extent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .preTransform = caps.currentTransform,
+        .compositeAlpha = alpha,
+        .presentMode = mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = old,
+    };
+    VkResult res = vkCreateSwapchainKHR(v->device, &sci, NULL, &o->swapchain);
+
+    /* Everything from the old chain goes, whether or not the new one exists */
+    swapchain_release(v, o);
+    if (old) vkDestroySwapchainKHR(v->device, old, NULL);
+    if (res != VK_SUCCESS) {
+        LOG_ERROR("Output %s: vkCreateSwapchainKHR failed: %s", out->name, vk_result_name(res));
+        o->swapchain = VK_NULL_HANDLE;
+        return false;
+    }
+
+    uint32_t count = 0;
+    vkGetSwapchainImagesKHR(v->device, o->swapchain, &count, NULL);
+    if (count > VK_MAX_IMAGES) count = VK_MAX_IMAGES;
+    vkGetSwapchainImagesKHR(v->device, o->swapchain, &count, o->images);
+    o->image_count = count;
+    o->extent = extent;
+    o->stale = false;
+
+    VkSemaphoreCreateInfo sem = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    for (uint32_t i = 0; i < count; i++) {
+        VkImageViewCreateInfo vci = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = o->images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = v->swap_format,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        };
+        VkFramebufferCreateInfo fci = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = v->render_pass,
+            .attachmentCount = 1,
+            .width = extent.width,
+            .height = extent.height,
+            .layers = 1,
+        };
+        if (vkCreateImageView(v->device, &vci, NULL, &o->views[i]) != VK_SUCCESS)
+            return false;
+        fci.pAttachments = &o->views[i];
+        if (vkCreateFramebuffer(v->device, &fci, NULL, &o->framebuffers[i]) != VK_SUCCESS ||
+            vkCreateSemaphore(v->device, &sem, NULL, &o->render_done[i]) != VK_SUCCESS)
+            return false;
+    }
+
+    LOG_DEBUG("Output %s: swapchain %ux%u, %u images, %s", out->name, extent.width, extent.height,
+              count, mode == VK_PRESENT_MODE_MAILBOX_KHR ? "mailbox" :
+                     mode == VK_PRESENT_MODE_IMMEDIATE_KHR ? "immediate" : "fifo");
+    if (mode == VK_PRESENT_MODE_FIFO_KHR)
+        LOG_WARN("Output %s: only FIFO presentation, presents may block", out->name);
+    return true;
+}
+
+/* ================================
+ * Section: Renderer lifecycle
+ * ================================ */
+
+VulkanRenderer *vk_renderer_create(App *app) {
+    VulkanRenderer *v = calloc(1, sizeof(VulkanRenderer));
+    if (!v) return NULL;
+    v->display = app->display;
+    v->upload_view_variant = -1;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        v->cache[i].view_variant = -1;
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        v->ring[i].view_variant = -1;
+
+    VkApplicationInfo app_info = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .pApplicationName = "wlvideo",
+        .apiVersion = VK_API_VERSION_1_1,
+    };
+    const char *inst_exts[] = {
+        VK_KHR_SURFACE_EXTENSION_NAME,
+        VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME,
+    };
+    VkInstanceCreateInfo ici = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &app_info,
+        .enabledExtensionCount = 2,
+        .ppEnabledExtensionNames = inst_exts,
+    };
+    VkResult res = vkCreateInstance(&ici, NULL, &v->instance);
+    if (res != VK_SUCCESS) {
+        LOG_ERROR("Vulkan: vkCreateInstance failed: %s", vk_result_name(res));
+        goto fail;
+    }
+
+    if (!pick_device(v)) {
+        LOG_ERROR("Vulkan: no 1.1 device with YCbCr sampling and Wayland presentation");
+        goto fail;
+    }
+    if (!create_device(v))
+        goto fail;
+    vkGetPhysicalDeviceMemoryProperties(v->phys, &v->mem_props);
+
+    v->chroma_filter = pick_chroma_filter(v);
+
+    VkCommandPoolCreateInfo pci = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = v->queue_family,
+    };
+    if (vkCreateCommandPool(v->device, &pci, NULL, &v->cmd_pool) != VK_SUCCESS)
+        goto fail;
+
+    v->vert = create_shader(v, quad_vert, sizeof(quad_vert));
+    v->frag = create_shader(v, nv12_frag, sizeof(nv12_frag));
+    if (!v->vert || !v->frag) {
+        LOG_ERROR("Vulkan: shader module creation failed");
+        goto fail;
+    }
+
+    LOG_INFO("Renderer: Vulkan on %s (DMA-BUF import: %s, chroma filter: %s)", v->device_name,
+             v->has_import ? "yes" : "no",
+             v->chroma_filter == VK_FILTER_LINEAR ? "linear" : "nearest");
+    return v;
+
+fail:
+    vk_renderer_destroy(v);
+    return NULL;
+}
+
+void vk_renderer_destroy(VulkanRenderer *v) {
+    if (!v) return;
+
+    if (v->device) {
+        vkDeviceWaitIdle(v->device);
+        for (int i = 0; i < EGL_CACHE_SIZE; i++)
+            imported_reset(v, &v->cache[i]);
+        ring_images_release(v);
+        upload_release(v);
+        for (int i = 0; i < VK_VARIANTS; i++)
+            variant_destroy(v, &v->variants[i]);
+        if (v->render_pass) vkDestroyRenderPass(v->device, v->render_pass, NULL);
+        if (v->vert) vkDestroyShaderModule(v->device, v->vert, NULL);
+        if (v->frag) vkDestroyShaderModule(v->device, v->frag, NULL);
+        if (v->cmd_pool) vkDestroyCommandPool(v->device, v->cmd_pool, NULL);
+        vkDestroyDevice(v->device, NULL);
+    }
+    if (v->instance) vkDestroyInstance(v->instance, NULL);
+    free(v);
+}
+
+GpuVendor vk_renderer_vendor(const VulkanRenderer *v) {
+    if (!v) return GPU_VENDOR_UNKNOWN;
+    switch (v->vendor_id) {
+    case 0x8086: return GPU_VENDOR_INTEL;
+    case 0x1002: return GPU_VENDOR_AMD;
+    case 0x10de: return GPU_VENDOR_NVIDIA;
+    default: return GPU_VENDOR_UNKNOWN;
+    }
+}
+
+const char *vk_renderer_name(const VulkanRenderer *v) {
+    return v ? v->device_name : NULL;
+}
+
+/* Drop every import (the decoder surface pool is being replaced) */
+void vk_clear_cache(VulkanRenderer *v) {
+    if (!v) return;
+    wait_all_outputs(v);
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        imported_reset(v, &v->cache[i]);
+    v->uploaded_seq = 0;
+}
+
+/* ================================
+ * Section: Output management
+ * ================================ */
+
+int vk_create_output(VulkanRenderer *v, Output *out) {
+    vk_destroy_output(v, out);
+
+    struct VulkanOutput *o = calloc(1, sizeof(struct VulkanOutput));
+    if (!o) return -1;
+    out->vk = o;
+    o->parent = out->surface;
+
+    VkWaylandSurfaceCreateInfoKHR wci = {
+        .sType = VK_STRUCTURE_TYPE_WAYLAND_SURFACE_CREATE_INFO_KHR,
+        .display = v->display,
+        .surface = out->surface,
+    };
+    if (vkCreateWaylandSurfaceKHR(v->instance, &wci, NULL, &o->surface) != VK_SUCCESS)
+        goto fail;
+
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(v->phys, v->queue_family, o->surface, &supported);
+    if (!supported) {
+        LOG_ERROR("Output %s: queue family can't present to this surface", out->name);
+        goto fail;
+    }
+
+    VkCommandBufferAllocateInfo cai = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = v->cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkFenceCreateInfo fci = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    VkSemaphoreCreateInfo sci = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    if (vkAllocateCommandBuffers(v->device, &cai, &o->cmd) != VK_SUCCESS ||
+        vkCreateFence(v->device, &fci, NULL, &o->fence) != VK_SUCCESS ||
+        vkCreateSemaphore(v->device, &sci, NULL, &o->acquired) != VK_SUCCESS)
+        goto fail;
+
+    /* Immutable YCbCr samplers may take several descriptors each */
+    VkDescriptorPoolSize size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = VK_VARIANTS * 3,
+    };
+    VkDescriptorPoolCreateInfo dpci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = VK_VARIANTS,
+        .poolSizeCount = 1,
+        .pPoolSizes = &size,
+    };
+    if (vkCreateDescriptorPool(v->device, &dpci, NULL, &o->pool) != VK_SUCCESS)
+        goto fail;
+
+    if (!swapchain_create(v, out))
+        goto fail;
+
+    LOG_DEBUG("Output %s: Vulkan swapchain created (%dx%d)", out->name, out->width, out->height);
+    return 0;
+
+fail:
+    vk_destroy_output(v, out);
+    return -1;
+}
+
+void vk_destroy_output(VulkanRenderer *v, Output *out) {
+    struct VulkanOutput *o = out->vk;
+    if (!o) return;
+
+    if (o->pending)
+        vkWaitForFences(v->device, 1, &o->fence, VK_TRUE, VK_FENCE_TIMEOUT_NS);
+
+    /* The swapchain's own presents must be done before it goes */
+    vkQueueWaitIdle(v->queue);
+    forget_fence(v, o->fence);
+
+    swapchain_release(v, o);
+    if (o->swapchain) vkDestroySwapchainKHR(v->device, o->swapchain, NULL);
+    if (o->surface) vkDestroySurfaceKHR(v->instance, o->surface, NULL);
+    if (o->pool) vkDestroyDescriptorPool(v->device, o->pool, NULL);
+    if (o->acquired) vkDestroySemaphore(v->device, o->acquired, NULL);
+    if (o->fence) vkDestroyFence(v->device, o->fence, NULL);
+    if (o->cmd) vkFreeCommandBuffers(v->device, v->cmd_pool, 1, &o->cmd);
+
+    free(o);
+    out->vk = NULL;
+    LOG_DEBUG("Output %s: Vulkan swapchain destroyed", out->name);
+}
+
+bool vk_output_attached(const Output *out) {
+    return out->vk && out->vk->parent == out->surface;
+}
+
+/* ================================
+ * Section: Drawing
+ * ================================ */
+
+static VkDescriptorSet output_set(VulkanRenderer *v, struct VulkanOutput *o, const VkVariant *var, int idx) {
+    if (o->sets[idx]) return o->sets[idx];
+    VkDescriptorSetAllocateInfo ai = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = o->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &var->set_layout,
+    };
+    if (vkAllocateDescriptorSets(v->device, &ai, &o->sets[idx]) != VK_SUCCESS)
+        o->sets[idx] = VK_NULL_HANDLE;
+    return o->sets[idx];
+}
+
+/* Device or surface loss: only a full reset brings the output back */
+static void vk_lost(Output *out, VkResult res) {
+    LOG_WARN("Output %s: Vulkan %s, resetting renderer", out->name, vk_result_name(res));
+    if (g_app) g_app->renderer_needs_reset = true;
+}
+
+static VkResult timed_present(VulkanRenderer *v, Output *out, uint32_t index) {
+    struct VulkanOutput *o = out->vk;
+    VkPresentInfoKHR pi = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &o->render_done[index],
+        .swapchainCount = 1,
+        .pSwapchains = &o->swapchain,
+        .pImageIndices = &index,
+    };
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    VkResult res = vkQueuePresentKHR(v->queue, &pi);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    out->swap_count++;
+    out->swap_ms_total += ms;
+    if (ms > out->swap_ms_max) out->swap_ms_max = ms;
+    if (ms > SWAP_SLOW_MS) {
+        out->swaps_slow++;
+        LOG_DEBUG("Output %s: vkQueuePresentKHR took %.2f ms", out->name, ms);
+    }
+    return res;
+}
+
+bool vk_draw(VulkanRenderer *v, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale) {
+    if (!out->surface) return false;
+
+    /* Layer surface was recreated underneath us: new VkSurfaceKHR */
+    if (!vk_output_attached(out) && vk_create_output(v, out) < 0)
+        return false;
+    struct VulkanOutput *o = out->vk;
+
+    if (o->pending) {
+        VkResult res = vkWaitForFences(v->device, 1, &o->fence, VK_TRUE, VK_FENCE_TIMEOUT_NS);
+        if (res == VK_TIMEOUT) {
+            /* GPU still busy with the last frame: skip, keep the callback alive */
+            v->stat_skipped++;
+            out->draw_skipped = true;
+            wl_surface_commit(out->surface);
+            return false;
+        }
+        if (res != VK_SUCCESS) {
+            vk_lost(out, res);
+            return false;
+        }
+        o->pending = false;
+    }
+
+    if (o->stale || o->extent.width != (uint32_t)out->width ||
+        o->extent.height != (uint32_t)out->height) {
+        if (!swapchain_create(v, out)) {
+            out->draw_skipped = true;
+            wl_surface_commit(out->surface);
+            return false;
+        }
+    }
+
+    int idx = variant_index(frame->colorspace, frame->color_range);
+    VkVariant *var = variant_get(v, frame->colorspace, frame->color_range);
+    if (!var) {
+        out->draw_skipped = true;
+        wl_surface_commit(out->surface);
+        return false;
+    }
+
+    /*
+     * Source: VA surface, udmabuf ring slot, or the staging upload. Picked
+     * before acquiring so a cache with every entry still in flight skips
+     * the frame without holding a swapchain image.
+     */
+    VkImported *src = NULL;
+    bool hw = false;
+    if (frame->type == FRAME_HW && !v->hw_failed) {
+        bool busy;
+        src = hw_image(v, frame, &busy);
+        if (busy) {
+            v->stat_skipped++;
+            out->draw_skipped = true;
+            wl_surface_commit(out->surface);
+            return false;
+        }
+        if (src) {
+            hw = true;
+        } else if (v->has_import) {
+            LOG_INFO("Vulkan: VA surface import failed, using software frames");
+            v->hw_failed = true;
+        }
+    }
+    if (!src && frame->sw.available && ring->data)
+        src = ring_image(v, frame, ring);
+
+    /*
+     * Everything the draw samples is settled before acquiring, so nothing
+     * is presented in place of this frame. With a software copy to show,
+     * a missing view or a busy staging buffer is a skip and the frame is
+     * retried; without one it is a failed draw, as for any backend.
+     */
+    VkImageView view = VK_NULL_HANDLE;
+    bool upload = false;
+    if (src) {
+        view = imported_view(v, src, var, idx);
+    } else if (frame->sw.available && ring->data && upload_prepare(v, frame, ring)) {
+        if (v->upload_view_variant != idx) {
+            if (v->upload_view) vkDestroyImageView(v->device, v->upload_view, NULL);
+            v->upload_view = ycbcr_view(v, v->upload_image, var);
+            v->upload_view_variant = v->upload_view ? idx : -1;
+        }
+        view = v->upload_view;
+        upload = true;
+    }
+
+    VkDescriptorSet set = view ? output_set(v, o, var, idx) : VK_NULL_HANDLE;
+    if (!set) {
+        if (frame->sw.available) {
+            v->stat_skipped++;
+            out->draw_skipped = true;
+        }
+        wl_surface_commit(out->surface);
+        return false;
+    }
+
+    uint32_t image;
+    VkResult res = vkAcquireNextImageKHR(v->device, o->swapchain, VK_FENCE_TIMEOUT_NS,
+                                         o->acquired, VK_NULL_HANDLE, &image);
+    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_TIMEOUT || res == VK_NOT_READY) {
+        o->stale = res == VK_ERROR_OUT_OF_DATE_KHR;
+        v->stat_skipped++;
+        out->draw_skipped = true;
+        wl_surface_commit(out->surface);
+        return false;
+    }
+    if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+        vk_lost(out, res);
+        return false;
+    }
+    if (res == VK_SUBOPTIMAL_KHR)
+        o->stale = true;
+
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkResetCommandBuffer(o->cmd, 0);
+    vkBeginCommandBuffer(o->cmd, &bi);
+
+    /*
+     * Take the dma-buf over from whoever wrote it (decoder, CPU) for this
+     * submission and hand it back afterwards. The first acquire has no
+     * earlier release to pair with: imported images start UNDEFINED.
+     */
+    VkImageMemoryBarrier acquire = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .oldLayout = src && src->acquired_once ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = v->has_foreign_queue ? VK_QUEUE_FAMILY_FOREIGN_EXT
+                                                    : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = v->has_foreign_queue ? v->queue_family
+                                                    : VK_QUEUE_FAMILY_IGNORED,
+        .image = src ? src->image : VK_NULL_HANDLE,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+
+    if (src)
+        vkCmdPipelineBarrier(o->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 0, NULL, 0, NULL, 1, &acquire);
+    else if (upload)
+        upload_record(v, o->cmd, o->fence, frame, ring);
+
+    VkDescriptorImageInfo info = {
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &info,
+    };
+    vkUpdateDescriptorSets(v->device, 1, &write, 0, NULL);
+
+    VkClearValue clear = { .color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } } };
+    VkRenderPassBeginInfo rp = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = v->render_pass,
+        .framebuffer = o->framebuffers[image],
+        .renderArea = { { 0, 0 }, o->extent },
+        .clearValueCount = 1,
+        .pClearValues = &clear,
+    };
+    vkCmdBeginRenderPass(o->cmd, &rp, VK_SUBPASS_CONTENTS_INLINE);
+
+    float t[4];
+    renderer_compute_transform(t, frame->width, frame->height, out, scale);
+
+    VkViewport vp = { 0, 0, (float)o->extent.width, (float)o->extent.height, 0, 1 };
+    VkRect2D scissor = { { 0, 0 }, o->extent };
+    vkCmdBindPipeline(o->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, var->pipeline);
+    vkCmdSetViewport(o->cmd, 0, 1, &vp);
+    vkCmdSetScissor(o->cmd, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(o->cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, var->layout,
+                            0, 1, &set, 0, NULL);
+    vkCmdPushConstants(o->cmd, var->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(t), t);
+    vkCmdDraw(o->cmd, 4, 1, 0, 0);
+
+    vkCmdEndRenderPass(o->cmd);
+
+    if (src) {
+        VkImageMemoryBarrier release = acquire;
+        release.srcAccessMask = 0;
+        release.dstAccessMask = 0;
+        release.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        release.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        release.srcQueueFamilyIndex = acquire.dstQueueFamilyIndex;
+        release.dstQueueFamilyIndex = acquire.srcQueueFamilyIndex;
+        vkCmdPipelineBarrier(o->cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, NULL, 0, NULL, 1, &release);
+    }
+    vkEndCommandBuffer(o->cmd);
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &o->acquired,
+        .pWaitDstStageMask = &wait_stage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &o->cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &o->render_done[image],
+    };
+    vkResetFences(v->device, 1, &o->fence);
+    res = vkQueueSubmit(v->queue, 1, &si, o->fence);
+    if (res != VK_SUCCESS) {
+        vk_lost(out, res);
+        return false;
+    }
+    o->pending = true;
+    if (src) {
+        src->fence = o->fence;
+        src->acquired_once = true;
+    }
+
+    res = timed_present(v, out, image);
+    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR) {
+        o->stale = true;
+    } else if (res != VK_SUCCESS) {
+        vk_lost(out, res);
+        return false;
+    }
+
+    v->stat_frames++;
+    return hw;
+}
+
+/* Imported VkImages: cached VA surfaces and ring slots */
+int vk_live_images(const VulkanRenderer *v) {
+    if (!v) return 0;
+    int n = 0;
+    for (int i = 0; i < EGL_CACHE_SIZE; i++)
+        if (v->cache[i].image) n++;
+    for (int i = 0; i < SW_RING_SIZE; i++)
+        if (v->ring[i].image) n++;
+    return n;
+}
+
+void vk_log_stats(VulkanRenderer *v) {
+    if (!v || v->stat_frames == 0) return;
+    LOG_INFO("Vulkan: %lu frames, %lu dma-buf imports (%lu reused), %lu staging uploads, %lu skipped",
+             (unsigned long)v->stat_frames,
+             (unsigned long)v->stat_imports,
+             (unsigned long)v->stat_import_hits,
+             (unsigned long)v->stat_uploads,
+             (unsigned long)v->stat_skipped);
+}
+
+#else /* !HAVE_VULKAN */
+
+/*
+ * Built without the Vulkan loader or glslangValidator: the backend can't
+ * be created, and app_init_renderer() falls back to EGL.
+ */
+VulkanRenderer *vk_renderer_create(App *app) {
+    (void)app;
+    LOG_ERROR("Vulkan backend not available in this build");
+    return NULL;
+}
+
+void vk_renderer_destroy(VulkanRenderer *v) { (void)v; }
+GpuVendor vk_renderer_vendor(const VulkanRenderer *v) { (void)v; return GPU_VENDOR_UNKNOWN; }
+const char *vk_renderer_name(const VulkanRenderer *v) { (void)v; return NULL; }
+void vk_clear_cache(VulkanRenderer *v) { (void)v; }
+int vk_create_output(VulkanRenderer *v, Output *out) { (void)v; (void)out; return -1; }
+void vk_destroy_output(VulkanRenderer *v, Output *out) { (void)v; (void)out; }
+bool vk_output_attached(const Output *out) { (void)out; return false; }
+
+bool vk_draw(VulkanRenderer *v, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale) {
+    (void)v; (void)out; (void)frame; (void)ring; (void)scale;
+    return false;
+}
+
+int vk_live_images(const VulkanRenderer *v) { (void)v; return 0; }
+void vk_log_stats(VulkanRenderer *v) { (void)v; }
+
+#endif /* HAVE_VULKAN */
@@ -11,16 +11,23 @@
  * State machine ensures clean transitions and prevents duplicate operations.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <wayland-client.h>
 #include <wayland-egl.h>
 
+#include "config.h"
 #include "wlvideo.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+#include "single-pixel-buffer-v1-client-protocol.h"
+#endif
 
 /* Human-readable state names for logging */
 const char *output_state_name(OutputState state) {
@@ -72,12 +79,29 @@ static void layer_configure(void *data, struct zwlr_layer_surface_v1 *surf,
     out->width = w;
     out->height = h;
 
-    /* Resize EGL window if it exists */
-    if (out->egl_window) {
-        wl_egl_window_resize(out->egl_window, w, h, 0, 0);
-        LOG_DEBUG("Output %s: resized EGL window to %dx%d", out->name, w, h);
+    /* Buffer contents are undefined after a resize, force a redraw */
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+
+    /*
+     * Every backend fills the whole surface with opaque pixels (video plus
+     * black bars), so let the compositor skip blending whatever is beneath
+     * the wallpaper. Applied with the next commit.
+     */
+    if (g_app && g_app->compositor) {
+        struct wl_region *region = wl_compositor_create_region(g_app->compositor);
+        if (region) {
+            wl_region_add(region, 0, 0, (int32_t)w, (int32_t)h);
+            wl_surface_set_opaque_region(out->surface, region);
+            wl_region_destroy(region);
+        }
     }
 
+    /* Resize EGL window if it exists (to the scaled size, if any) */
+    out->render_width = 0;
+    out->render_height = 0;
+    wayland_update_render_size(out);
+
     /* State transition */
     if (first_configure) {
         out->state = OUT_READY;
@@ -202,8 +226,15 @@ void wayland_request_frame(Output *out) {
 static void output_geometry(void *data, struct wl_output *o, int32_t x, int32_t y,
                             int32_t pw, int32_t ph, int32_t subpx, const char *make,
                             const char *model, int32_t transform) {
-    (void)data; (void)o; (void)x; (void)y; (void)pw; (void)ph;
+    (void)o; (void)pw; (void)ph;
     (void)subpx; (void)make; (void)model; (void)transform;
+    Output *out = data;
+
+    /* Position in compositor space, used to lay out span mode */
+    if (out->x != x || out->y != y)
+        LOG_DEBUG("Output %s: position %d,%d", out->name, x, y);
+    out->x = x;
+    out->y = y;
 }
 
 static void output_mode(void *data, struct wl_output *o, uint32_t flags, int32_t w,
@@ -274,6 +305,16 @@ static void registry_global(void *data, struct wl_registry *reg, uint32_t name,
         app->layer_shell = wl_registry_bind(reg, name, &zwlr_layer_shell_v1_interface, 1);
     } else if (!strcmp(iface, zwp_linux_dmabuf_v1_interface.name)) {
         app->dmabuf = wl_registry_bind(reg, name, &zwp_linux_dmabuf_v1_interface, ver < 3 ? ver : 3);
+    } else if (!strcmp(iface, wl_shm_interface.name)) {
+        app->shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+    } else if (!strcmp(iface, wl_subcompositor_interface.name)) {
+        app->subcompositor = wl_registry_bind(reg, name, &wl_subcompositor_interface, 1);
+    } else if (!strcmp(iface, wp_viewporter_interface.name)) {
+        app->viewporter = wl_registry_bind(reg, name, &wp_viewporter_interface, 1);
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    } else if (!strcmp(iface, wp_single_pixel_buffer_manager_v1_interface.name)) {
+        app->single_pixel = wl_registry_bind(reg, name, &wp_single_pixel_buffer_manager_v1_interface, 1);
+#endif
     } else if (!strcmp(iface, wl_output_interface.name)) {
         Output *out = calloc(1, sizeof(Output));
         if (!out) return;
@@ -308,6 +349,8 @@ static void registry_remove(void *data, struct wl_registry *reg, uint32_t name)
             }
             if (out->frame_callback) wl_callback_destroy(out->frame_callback);
             if (out->layer_surface) zwlr_layer_surface_v1_destroy(out->layer_surface);
+            wayland_destroy_letterbox(out);
+            if (out->viewport) wp_viewport_destroy(out->viewport);
             if (out->surface) wl_surface_destroy(out->surface);
             if (out->egl_window) wl_egl_window_destroy(out->egl_window);
             if (out->wl_output) wl_output_destroy(out->wl_output);
@@ -366,6 +409,8 @@ void wayland_destroy(App *app) {
 
         if (out->frame_callback) wl_callback_destroy(out->frame_callback);
         if (out->layer_surface) zwlr_layer_surface_v1_destroy(out->layer_surface);
+        wayland_destroy_letterbox(out);
+        if (out->viewport) wp_viewport_destroy(out->viewport);
         if (out->surface) wl_surface_destroy(out->surface);
         if (out->egl_window) wl_egl_window_destroy(out->egl_window);
         if (out->wl_output) wl_output_destroy(out->wl_output);
@@ -373,7 +418,14 @@ void wayland_destroy(App *app) {
         free(out);
     }
 
+    if (app->black_buffer) wl_buffer_destroy(app->black_buffer);
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    if (app->single_pixel) wp_single_pixel_buffer_manager_v1_destroy(app->single_pixel);
+#endif
     if (app->dmabuf) zwp_linux_dmabuf_v1_destroy(app->dmabuf);
+    if (app->shm) wl_shm_destroy(app->shm);
+    if (app->viewporter) wp_viewporter_destroy(app->viewporter);
+    if (app->subcompositor) wl_subcompositor_destroy(app->subcompositor);
     if (app->layer_shell) zwlr_layer_shell_v1_destroy(app->layer_shell);
     if (app->compositor) wl_compositor_destroy(app->compositor);
     if (app->registry) wl_registry_destroy(app->registry);
@@ -436,6 +488,13 @@ void wayland_destroy_surface(Output *out) {
         zwlr_layer_surface_v1_destroy(out->layer_surface);
         out->layer_surface = NULL;
     }
+    wayland_destroy_letterbox(out);
+    if (out->viewport) {
+        wp_viewport_destroy(out->viewport);
+        out->viewport = NULL;
+    }
+    out->render_width = 0;
+    out->render_height = 0;
     if (out->surface) {
         wl_surface_destroy(out->surface);
         out->surface = NULL;
@@ -452,3 +511,224 @@ void wayland_destroy_surface(Output *out) {
     /* Transition to PENDING_RECREATE so main loop knows to recreate */
     out->state = OUT_PENDING_RECREATE;
 }
+
+/* ================================
+ * Section: Letterbox
+ * ================================ */
+
+/*
+ * 1×1 opaque black buffer, created on first use and shared by every output
+ * (wl_buffers may be attached to any number of surfaces). A single-pixel
+ * buffer costs the compositor no memory at all; wl_shm is the fallback.
+ */
+struct wl_buffer *wayland_black_buffer(App *app) {
+    if (app->black_buffer) return app->black_buffer;
+
+#ifdef HAVE_SINGLE_PIXEL_BUFFER
+    if (app->single_pixel) {
+        app->black_buffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+            app->single_pixel, 0, 0, 0, UINT32_MAX);
+        return app->black_buffer;
+    }
+#endif
+    if (!app->shm) return NULL;
+
+    int fd = memfd_create("wlvideo-black", MFD_CLOEXEC);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, 4) < 0) {
+        close(fd);
+        return NULL;
+    }
+    uint32_t *px = mmap(NULL, 4, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (px == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    *px = 0xff000000u;
+    munmap(px, 4);
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(app->shm, fd, 4);
+    app->black_buffer = wl_shm_pool_create_buffer(pool, 0, 1, 1, 4, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return app->black_buffer;
+}
+
+/*
+ * Fit leaves bars the GL path would otherwise clear and swap every frame.
+ * Instead the bars become a static background and the EGL window shrinks
+ * to the video itself. Other backends lay out their own surfaces.
+ */
+bool wayland_letterbox_wanted(App *app) {
+    return app->config.scale_mode == SCALE_FIT && app->config.backend == BACKEND_EGL &&
+           app->subcompositor && app->viewporter && wayland_black_buffer(app);
+}
+
+int wayland_create_letterbox(Output *out) {
+    App *app = g_app;
+    if (!app || !out->surface) return -1;
+    wayland_destroy_letterbox(out);
+
+    struct wl_buffer *black = wayland_black_buffer(app);
+    if (!black) return -1;
+
+    out->video_surface = wl_compositor_create_surface(app->compositor);
+    if (!out->video_surface) {
+        LOG_ERROR("Output %s: failed to create video subsurface", out->name);
+        return -1;
+    }
+    /*
+     * Synchronized (the default): the video commit is applied together
+     * with the parent commit that follows each swap, so position, size and
+     * content change atomically and the frame callback on the layer
+     * surface keeps pacing the output.
+     */
+    out->video_subsurface = wl_subcompositor_get_subsurface(app->subcompositor,
+                                                            out->video_surface, out->surface);
+    out->video_viewport = wp_viewporter_get_viewport(app->viewporter, out->video_surface);
+
+    /* The video never takes input */
+    struct wl_region *empty = wl_compositor_create_region(app->compositor);
+    wl_surface_set_input_region(out->video_surface, empty);
+    wl_region_destroy(empty);
+
+    if (!out->viewport)
+        out->viewport = wp_viewporter_get_viewport(app->viewporter, out->surface);
+    wl_surface_attach(out->surface, black, 0, 0);
+    wl_surface_damage_buffer(out->surface, 0, 0, 1, 1);
+
+    /* Place the subsurface and size the background for the current layout */
+    out->render_width = 0;
+    out->render_height = 0;
+    wayland_update_render_size(out);
+    wl_surface_commit(out->surface);
+
+    LOG_DEBUG("Output %s: letterbox background with video subsurface", out->name);
+    return 0;
+}
+
+void wayland_destroy_letterbox(Output *out) {
+    if (!out->video_surface) return;
+
+    if (out->video_viewport) wp_viewport_destroy(out->video_viewport);
+    if (out->video_subsurface) wl_subsurface_destroy(out->video_subsurface);
+    wl_surface_destroy(out->video_surface);
+    out->video_viewport = NULL;
+    out->video_subsurface = NULL;
+    out->video_surface = NULL;
+    out->video_rect = (Rect){ 0 };
+
+    /*
+     * No commit: attaching NULL would unmap the layer surface. The next
+     * backend's first commit replaces the background buffer.
+     */
+    out->render_width = 0;
+    out->render_height = 0;
+    LOG_DEBUG("Output %s: letterbox surfaces destroyed", out->name);
+}
+
+/* Visible part of the video in output coordinates, at least 1×1 */
+static Rect visible_rect(const Output *out, const float *t) {
+    double W = out->width, H = out->height;
+    double rx0 = (t[2] - t[0] + 1.0) * 0.5 * W, rx1 = (t[2] + t[0] + 1.0) * 0.5 * W;
+    double ry0 = (1.0 - t[3] - t[1]) * 0.5 * H, ry1 = (1.0 - t[3] + t[1]) * 0.5 * H;
+    double cx0 = rx0 < 0 ? 0 : rx0, cx1 = rx1 > W ? W : rx1;
+    double cy0 = ry0 < 0 ? 0 : ry0, cy1 = ry1 > H ? H : ry1;
+
+    Rect r;
+    r.x = (int)(cx0 + 0.5);
+    r.y = (int)(cy0 + 0.5);
+    r.width = (int)(cx1 + 0.5) - r.x;
+    r.height = (int)(cy1 + 0.5) - r.y;
+    if (r.width < 1) r.width = 1;
+    if (r.height < 1) r.height = 1;
+    return r;
+}
+
+/* ================================
+ * Section: Render size
+ * ================================ */
+
+/*
+ * Pick the EGL window size for --render-scale and keep the wp_viewport
+ * destination on the area the window covers: the full output, or the
+ * visible video when letterboxed. In auto mode the window is shrunk until
+ * one window pixel covers one video pixel along the more detailed axis, so
+ * nothing the video contains is lost; a fixed fraction applies as given.
+ * Fill rate and swapchain memory go down with the square of the factor.
+ * Without wp_viewporter, or with a non-EGL backend (which may own the
+ * surface's viewport), the window stays at full size.
+ */
+void wayland_update_render_size(Output *out) {
+    App *app = g_app;
+    if (!out->surface || out->width <= 0 || out->height <= 0) return;
+
+    bool have_video = app && app->video_width > 0 && app->video_height > 0;
+    float t[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+    if (have_video)
+        renderer_compute_transform(t, app->video_width, app->video_height, out,
+                                   app->config.scale_mode);
+
+    Rect area = { 0, 0, out->width, out->height };
+    if (out->video_surface && have_video)
+        area = visible_rect(out, t);
+
+    float f = 1.0f;
+    if (app && app->config.render_scale != 1.0f && app->config.backend == BACKEND_EGL &&
+        app->viewporter) {
+        f = app->config.render_scale;
+        if (f == 0.0f && have_video) {
+            float fx = app->video_width / (t[0] * out->width);
+            float fy = app->video_height / (t[1] * out->height);
+            f = fx > fy ? fx : fy;
+        }
+        if (f <= 0.0f || f > 1.0f) f = 1.0f;
+    }
+
+    int w = (int)(area.width * f + 0.5f), h = (int)(area.height * f + 0.5f);
+    if (w < 1) w = 1;
+    if (h < 1) h = 1;
+    if (w == out->render_width && h == out->render_height &&
+        memcmp(&area, &out->video_rect, sizeof(area)) == 0)
+        return;
+
+    bool scaled = w != area.width || h != area.height;
+    if (out->video_surface) {
+        /* Background stretched over the output, video window over its rect */
+        wp_viewport_set_destination(out->viewport, out->width, out->height);
+        wl_subsurface_set_position(out->video_subsurface, area.x, area.y);
+        wp_viewport_set_destination(out->video_viewport, area.width, area.height);
+
+        struct wl_region *region = wl_compositor_create_region(app->compositor);
+        wl_region_add(region, 0, 0, area.width, area.height);
+        wl_surface_set_opaque_region(out->video_surface, region);
+        wl_region_destroy(region);
+    } else {
+        if (scaled && !out->viewport)
+            out->viewport = wp_viewporter_get_viewport(app->viewporter, out->surface);
+        if (out->viewport) {
+            /* -1 unsets the destination: the buffer maps 1:1 again */
+            wp_viewport_set_destination(out->viewport, scaled ? out->width : -1,
+                                        scaled ? out->height : -1);
+        }
+    }
+
+    bool moved = memcmp(&area, &out->video_rect, sizeof(area)) != 0;
+    out->video_rect = area;
+    out->render_width = w;
+    out->render_height = h;
+    out->shown_seq = 0;
+    out->shown_hash = 0;
+    out->damage_count = 0;
+
+    if (out->egl_window) {
+        wl_egl_window_resize(out->egl_window, w, h, 0, 0);
+        LOG_DEBUG("Output %s: resized EGL window to %dx%d", out->name, w, h);
+    }
+    if (out->video_surface && moved)
+        LOG_INFO("Output %s: video at %dx%d+%d+%d, letterbox bars left to the compositor",
+                 out->name, area.width, area.height, area.x, area.y);
+    if (scaled)
+        LOG_INFO("Output %s: rendering at %dx%d, scaled to %dx%d by the compositor",
+                 out->name, w, h, area.width, area.height);
+}
@@ -5,13 +5,15 @@
  *   - VA-API decode (Intel/AMD/NVIDIA via nvidia-vaapi-driver)
  *   - DMA-BUF export for zero-copy on Intel/AMD
  *   - Software fallback when DMA-BUF import fails
- *   - Fixed memory: preallocated ring buffer, no per-frame malloc
+ *   - Fixed memory: ring buffer allocated on first need, no per-frame malloc
+ *   - Optional global memory budget across ring, staging and caches
  */
 
 #ifndef WLVIDEO_H
 #define WLVIDEO_H
 
 #include <stdio.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
@@ -22,8 +24,28 @@
 /* Ring buffer slots for software decode. Two slots = double buffering. */
 #define SW_RING_SIZE 2
 
-/* EGL image cache size. VA-API typically uses 4-8 surfaces. */
+/* Frames one main loop iteration may decode to catch up with the clock */
+#define MAX_SKIP_FRAMES 5
+
+/*
+ * Damage tracking granularity in luma pixels. Each ring slot carries a map
+ * of which DAMAGE_TILE×DAMAGE_TILE tiles differ from the previous frame.
+ */
+#define DAMAGE_TILE 64
+
+/* A swap taking longer than this (ms) is counted as having blocked */
+#define SWAP_SLOW_MS 2.0
+
+/* Swaps of per-output damage remembered for EGL_EXT_buffer_age */
+#define DAMAGE_HISTORY 4
+
+/*
+ * Image cache sizes. The EGLImage cache starts at EGL_CACHE_SIZE and grows
+ * to the decoder's surface pool (HEVC/AV1 pools often exceed 8), capped at
+ * EGL_CACHE_MAX. The direct and Vulkan caches stay at EGL_CACHE_SIZE.
+ */
 #define EGL_CACHE_SIZE 8
+#define EGL_CACHE_MAX 64
 
 typedef enum {
     GPU_VENDOR_UNKNOWN,
@@ -49,6 +71,20 @@ typedef enum {
     SCALE_STRETCH,
 } ScaleMode;
 
+typedef enum {
+    BACKEND_EGL,            /* EGL + GLES, DMA-BUF zero-copy capable */
+    BACKEND_SHM,            /* CPU conversion into wl_shm buffers */
+    BACKEND_DIRECT,         /* Frames attached as linux-dmabuf wl_buffers */
+    BACKEND_VULKAN,         /* Vulkan swapchains, DMA-BUFs as VkImages */
+} RenderBackend;
+
+typedef enum {
+    BENCH_OFF,
+    BENCH_FAST,             /* Decode and draw back to back */
+    BENCH_REALTIME,         /* Paced at the source frame rate */
+    BENCH_MICRO,            /* Ring, copy and upload kernels on their own */
+} BenchmarkMode;
+
 typedef struct {
     int fd[4];
     uint32_t offset[4];
@@ -63,6 +99,8 @@ typedef struct {
     enum { FRAME_HW, FRAME_SW } type;
 
     double pts;
+    uint64_t seq;           /* Decode sequence number, unique per decoded frame */
+    uint64_t content_hash;  /* Fingerprint of sw pixels, 0 = unknown */
     int width, height;
     ColorSpace colorspace;
     ColorRange color_range;
@@ -70,6 +108,7 @@ typedef struct {
     struct {
         uintptr_t surface_id;
         uint64_t generation;
+        uint64_t buffer_id; /* dma-buf inode of plane 0, 0 = unknown */
         DmaBuf dmabuf;
     } hw;
 
@@ -80,14 +119,47 @@ typedef struct {
     } sw;
 } Frame;
 
+/*
+ * Software ring geometry is fixed by sw_ring_init(), but the slots are only
+ * allocated on first use (sw_ring_ensure) and can be released again once the
+ * zero-copy path is confirmed. data == NULL means "not allocated".
+ *
+ * Where /dev/udmabuf is usable the slots live in a sealed memfd exported as
+ * a dma-buf, which the renderer imports as EGLImages instead of uploading.
+ */
 typedef struct {
     uint8_t *data;
-    size_t slot_size;
+    size_t slot_size;       /* Page-aligned, so every slot starts on a page */
     int width, height;
     int y_stride;
     int uv_stride;
+    int dmabuf_fd;          /* udmabuf over all slots, -1 = heap memory */
+    uint64_t generation;    /* Bumped per allocation, keys renderer imports */
+
+    /*
+     * Tile change maps, one byte per tile per slot (1 = changed), relative
+     * to the frame with seq - 1. Only meaningful where tiles_valid is set.
+     */
+    uint8_t *tile_map;
+    int tiles_x, tiles_y;
+    uint64_t slot_seq[SW_RING_SIZE];
+    bool tiles_valid[SW_RING_SIZE];
+    int tiles_changed[SW_RING_SIZE];
+
+    /*
+     * Installed by a backend that reads slots in place (udmabuf imports,
+     * dma-buf wl_buffers). The decoder asks before rewriting a slot: true
+     * once nothing reads it any more, false if it is still in use after
+     * timeout_ns. NULL = slots are copied out, never read in place.
+     */
+    bool (*slot_wait)(void *ctx, int slot, uint64_t timeout_ns);
+    void *slot_wait_ctx;
 } SoftwareRing;
 
+typedef struct {
+    int x, y, width, height;
+} Rect;
+
 typedef struct {
     uintptr_t surface_id;
     EGLImage image;
@@ -135,11 +207,78 @@ typedef struct Output {
     int width, height;
     int scale;
 
+    /* Position in the global compositor space (wl_output.geometry) */
+    int x, y;
+
+    /*
+     * Span mode: this output's rectangle within the whole-desktop canvas the
+     * video is laid out on. canvas_w == 0 means the output shows the frame
+     * on its own.
+     */
+    int canvas_x, canvas_y;
+    int canvas_w, canvas_h;
+
+    /*
+     * Size of the EGL window. Smaller than width x height with a render
+     * scale, in which case wp_viewport stretches it back to the output.
+     */
+    int render_width, render_height;
+    struct wp_viewport *viewport;
+
+    /*
+     * EGL letterboxing (fit): the layer surface holds a black pixel
+     * stretched over the output and the EGL window lives on this
+     * subsurface, sized and placed to video_rect, the visible video in
+     * output coordinates. NULL when the video draws on the layer surface.
+     */
+    struct wl_surface *video_surface;
+    struct wl_subsurface *video_subsurface;
+    struct wp_viewport *video_viewport;
+    Rect video_rect;
+
     struct wl_egl_window *egl_window;
     EGLSurface egl_surface;
+    struct ShmOutput *shm;      /* wl_shm backend buffers, NULL otherwise */
+    struct DirectOutput *direct; /* Direct backend subsurface, NULL otherwise */
+    struct VulkanOutput *vk;    /* Vulkan swapchain, NULL otherwise */
+    struct RenderThread *render_thread; /* --render-threads, NULL = main thread */
+    struct GpuTimers *gpu_timers;       /* --gpu-timers query slots and stats */
 
     OutputState state;
     uint64_t frames_rendered;
+    uint64_t frames_deduped;
+
+    /* Time spent inside eglSwapBuffers, to show no output blocks another */
+    uint64_t swap_count;
+    uint64_t swaps_slow;
+    double swap_ms_total;
+    double swap_ms_max;
+
+    /*
+     * Set by a backend whose draw presented nothing for a transient reason
+     * (no idle buffer, swapchain out of date). It still commits so the
+     * frame callback fires, and the frame is retried on the next tick: not
+     * a failed draw, and no evidence either way about zero-copy.
+     */
+    bool draw_skipped;
+    uint64_t frames_skipped;
+
+    /*
+     * What is currently on screen, to skip draw/swap/commit for a frame that
+     * is already presented (same seq) or pixel-identical (same content hash).
+     * Reset to 0 whenever the surface contents become undefined.
+     */
+    uint64_t shown_seq;
+    uint64_t shown_hash;
+
+    /*
+     * Damage of the most recent swaps in output pixels, newest first, for
+     * buffer-age partial repaint. Only trusted while damage_transform still
+     * matches the current layout.
+     */
+    Rect damage[DAMAGE_HISTORY];
+    int damage_count;
+    float damage_transform[4];
 
     /* Track configured dimensions to detect actual changes */
     int configured_width, configured_height;
@@ -149,15 +288,44 @@ typedef struct Output {
     int recreation_failures;
 } Output;
 
+/* Memory accounting categories counted against --memory-budget */
+typedef enum {
+    MEM_RING,       /* SoftwareRing slots */
+    MEM_STAGING,    /* GPU->CPU transfer frames, PBO and Vulkan upload staging */
+    MEM_CACHE,      /* Renderer frame copies: shared RGB target, Vulkan upload images */
+    MEM_CATEGORY_COUNT,
+} MemCategory;
+
+typedef struct {
+    size_t limit;                       /* 0 = unlimited */
+    size_t used[MEM_CATEGORY_COUNT];
+    size_t total;
+    size_t peak;
+    uint64_t denied;                    /* Reservations refused by the budget */
+} MemoryBudget;
+
 typedef struct Decoder Decoder;
 typedef struct Renderer Renderer;
+typedef struct ShmRenderer ShmRenderer;
+typedef struct DirectRenderer DirectRenderer;
+typedef struct VulkanRenderer VulkanRenderer;
+typedef struct RenderThread RenderThread;
 
 typedef struct {
     const char *video_path;
     const char *output_name;
     const char *gpu_device;
     ScaleMode scale_mode;
+    RenderBackend backend;
+    size_t memory_budget;   /* Bytes, 0 = unlimited */
     bool loop;
+    bool span;              /* Lay one video out across all outputs */
+    bool background;        /* Idle CPU/IO class, low GPU context priority */
+    bool render_threads;    /* One EGL render thread per output */
+    bool preimport;         /* Import the whole VA surface pool up front */
+    bool gpu_timers;        /* Time GPU render stages with timer queries */
+    BenchmarkMode benchmark; /* Headless run with a JSON report on stdout */
+    float render_scale;     /* EGL window size factor, 0 = auto, 1 = full */
     bool hw_accel;
     bool verbose;
 } Config;
@@ -168,13 +336,20 @@ typedef struct App {
     struct wl_compositor *compositor;
     struct zwlr_layer_shell_v1 *layer_shell;
     struct zwp_linux_dmabuf_v1 *dmabuf;
+    struct wl_shm *shm;
+    struct wl_subcompositor *subcompositor;
+    struct wp_viewporter *viewporter;
+    struct wp_single_pixel_buffer_manager_v1 *single_pixel;
+    struct wl_buffer *black_buffer;     /* 1x1 opaque black, shared by outputs */
     struct wl_list outputs;
 
     Decoder *decoder;
     Renderer *renderer;
     SoftwareRing sw_ring;
+    MemoryBudget mem;
 
     Config config;
+    int video_width, video_height;
 
     bool renderer_needs_reset;
 
@@ -183,6 +358,7 @@ typedef struct App {
     double start_time;
     double frame_duration;
     uint64_t frame_counter;
+    uint64_t frames_deduped;
 
     bool render_path_determined;
     bool use_dmabuf_path;
@@ -194,6 +370,39 @@ typedef struct App {
 
 extern App *g_app;
 
+/* ================================
+ * Section: Clock
+ * ================================
+ * Scheduling, recreation backoff and timeouts read clock_now(), which is
+ * CLOCK_MONOTONIC unless another source is installed. WLVIDEO_TIME_SCALE
+ * installs a scaled clock so a soak run covers hours of looping, backoff
+ * and timeouts in minutes; WLVIDEO_CLOCK=virtual installs one that only
+ * moves in explicit steps (clock_advance). Work durations (stats,
+ * benchmark) keep using clock_monotonic(): they measure the machine, not
+ * the schedule.
+ */
+
+typedef double (*ClockSource)(void);
+
+extern ClockSource g_clock_source;
+
+static inline double clock_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline double clock_now(void) {
+    return g_clock_source ? g_clock_source() : clock_monotonic();
+}
+
+void clock_set_source(ClockSource source);   /* NULL restores CLOCK_MONOTONIC */
+bool clock_set_scale(double scale);          /* Virtual seconds per real second */
+int clock_timeout_ms(double seconds);        /* Clock interval to a real poll timeout */
+void clock_set_virtual(void);                /* Stepped clock, starts at CLOCK_MONOTONIC */
+bool clock_is_virtual(void);
+void clock_advance(double seconds);          /* Step the virtual clock forward */
+
 /* ================================
  * Section: Logging
  * ================================
@@ -202,9 +411,7 @@ extern App *g_app;
  */
 
 static inline double log_timestamp(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec * 1e-9;
+    return clock_now();
 }
 
 /* Start time for relative timestamps (set in main) */
@@ -236,8 +443,13 @@ extern double g_log_start_time;
 const char *fourcc_to_str(uint32_t fourcc);
 const char *output_state_name(OutputState state);
 
+/* Memory budget */
+bool mem_reserve(MemCategory cat, size_t bytes);
+void mem_release(MemCategory cat, size_t bytes);
+void mem_log_usage(bool verbose_only);
+
 /* Decoder */
-int decoder_init(Decoder **dec, const char *path, bool hw_accel, const char *gpu);
+int decoder_init(Decoder **dec, const char *path, bool hw_accel, const char *gpu, bool hold_frames);
 void decoder_destroy(Decoder *dec);
 bool decoder_get_frame(Decoder *dec, Frame *frame, SoftwareRing *ring, bool need_sw);
 int decoder_seek_start(Decoder *dec);
@@ -245,21 +457,71 @@ void decoder_get_info(Decoder *dec, int *w, int *h, double *fps, bool *hw);
 void decoder_close_dmabuf(DmaBuf *dmabuf);
 GpuVendor decoder_get_gpu_vendor(Decoder *dec);
 bool decoder_dmabuf_export_supported(Decoder *dec);
+double decoder_get_copy_ms(Decoder *dec);
 void decoder_set_dmabuf_export_result(Decoder *dec, bool works);
 void decoder_increment_generation(Decoder *dec);
+void decoder_release_staging(Decoder *dec);
+int decoder_get_pool_size(Decoder *dec);
+int decoder_export_pool(Decoder *dec, Frame *frames, int max);
 
 /* Renderer */
-int renderer_init(Renderer **r, struct wl_display *display);
+int renderer_init(Renderer **r, struct wl_display *display, bool low_priority);
+int renderer_init_shm(Renderer **r, struct wl_shm *shm, int threads);
+int renderer_init_direct(Renderer **r, App *app);
+int renderer_init_vulkan(Renderer **r, App *app);
 void renderer_destroy(Renderer *r);
 int renderer_create_output(Renderer *r, Output *out);
 void renderer_destroy_output(Renderer *r, Output *out);
 bool renderer_draw(Renderer *r, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale, bool try_dmabuf);
 void renderer_clear_cache(Renderer *r);
+void renderer_set_cache_size(Renderer *r, int entries);
+bool renderer_preimport(Renderer *r, Frame *frame);
+void renderer_log_cache_stats(Renderer *r);
+void renderer_log_gpu_timers(Renderer *r, const Output *out, bool verbose_only);
+void renderer_write_gpu_timers_json(Renderer *r, FILE *f, const Output *out);
+void renderer_finish(Renderer *r);
+void renderer_set_active_outputs(Renderer *r, int count);
+void renderer_flush(Renderer *r);
 void renderer_reset_dmabuf_state(Renderer *r);
 void renderer_reset_texture_state(Renderer *r);
 GpuVendor renderer_get_gpu_vendor(Renderer *r);
 const char *renderer_get_gl_renderer(Renderer *r);
 void renderer_log_stats(Renderer *r);
+int renderer_live_images(Renderer *r);
+bool renderer_output_attached(Renderer *r, const Output *out);
+void renderer_compute_transform(float *out, int vid_w, int vid_h, const Output *o, ScaleMode mode);
+
+/* wl_shm backend (used through the renderer_* API) */
+ShmRenderer *shm_renderer_create(struct wl_shm *shm, int threads);
+void shm_renderer_destroy(ShmRenderer *s);
+int shm_create_output(ShmRenderer *s, Output *out);
+void shm_destroy_output(ShmRenderer *s, Output *out);
+bool shm_draw(ShmRenderer *s, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale);
+int shm_live_buffers(const ShmRenderer *s);
+void shm_log_stats(ShmRenderer *s);
+
+/* Direct linux-dmabuf backend (used through the renderer_* API) */
+DirectRenderer *direct_renderer_create(App *app);
+void direct_renderer_destroy(DirectRenderer *d);
+int direct_create_output(DirectRenderer *d, Output *out);
+void direct_destroy_output(DirectRenderer *d, Output *out);
+bool direct_output_attached(const Output *out);
+bool direct_draw(DirectRenderer *d, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale);
+int direct_live_buffers(const DirectRenderer *d);
+void direct_log_stats(DirectRenderer *d);
+
+/* Vulkan backend (used through the renderer_* API) */
+VulkanRenderer *vk_renderer_create(App *app);
+void vk_renderer_destroy(VulkanRenderer *v);
+GpuVendor vk_renderer_vendor(const VulkanRenderer *v);
+const char *vk_renderer_name(const VulkanRenderer *v);
+void vk_clear_cache(VulkanRenderer *v);
+int vk_create_output(VulkanRenderer *v, Output *out);
+void vk_destroy_output(VulkanRenderer *v, Output *out);
+bool vk_output_attached(const Output *out);
+bool vk_draw(VulkanRenderer *v, Output *out, Frame *frame, SoftwareRing *ring, ScaleMode scale);
+int vk_live_images(const VulkanRenderer *v);
+void vk_log_stats(VulkanRenderer *v);
 
 /* Wayland */
 int wayland_init(App *app);
@@ -267,11 +529,26 @@ void wayland_destroy(App *app);
 int wayland_create_surface(Output *out, App *app);
 void wayland_destroy_surface(Output *out);
 void wayland_request_frame(Output *out);
+void wayland_update_render_size(Output *out);
+struct wl_buffer *wayland_black_buffer(App *app);
+bool wayland_letterbox_wanted(App *app);
+int wayland_create_letterbox(Output *out);
+void wayland_destroy_letterbox(Output *out);
 
 /* Ring buffer */
 int sw_ring_init(SoftwareRing *ring, int width, int height);
+bool sw_ring_ensure(SoftwareRing *ring);
 void sw_ring_destroy(SoftwareRing *ring);
 uint8_t *sw_ring_get_y(SoftwareRing *ring, int slot);
 uint8_t *sw_ring_get_uv(SoftwareRing *ring, int slot);
+const uint8_t *sw_ring_get_tiles(const SoftwareRing *ring, int slot);
+void sw_ring_write(SoftwareRing *ring, int slot, uint8_t *const planes[3], const int linesize[3],
+                   int w, int h);
+
+/* Renderer for config.backend; direct and vulkan fall back to egl */
+int app_init_renderer(App *app);
+
+/* Headless benchmark (--benchmark) */
+int benchmark_run(App *app, volatile sig_atomic_t *stop);
 
 #endif